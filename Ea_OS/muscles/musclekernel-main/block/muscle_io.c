@@ -1,47 +1,406 @@
 #include <linux/muscle.h>
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/build_bug.h>
+#include <linux/err.h>
 #include <linux/jiffies.h>
+#include <linux/moduleparam.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/xarray.h>
+#include <trace/events/muscle.h>
 
-#define IO_LSTM_INPUT  10
+/*
+ * LSTM over the request stream: current op class (one-hot) followed by
+ * the shared stream features of its start sector → 48 hidden → next op
+ * class.
+ */
+#define IO_CLASS_NR    10
+#define IO_LSTM_INPUT  (IO_CLASS_NR + MUSCLE_STREAM_FEATURES)
 #define IO_LSTM_HIDDEN 48
-#define IO_LSTM_OUTPUT 10
-
-static const muscle_fixed io_wi[IO_LSTM_HIDDEN * IO_LSTM_INPUT] = { #include "weights/io_wi.hex" };
-static const muscle_fixed io_wf[IO_LSTM_HIDDEN * IO_LSTM_INPUT] = { #include "weights/io_wf.hex" };
-static const muscle_fixed io_wg[IO_LSTM_HIDDEN * IO_LSTM_INPUT] = { #include "weights/io_wg.hex" };
-static const muscle_fixed io_wo[IO_LSTM_HIDDEN * IO_LSTM_INPUT] = { #include "weights/io_wo.hex" };
-static const muscle_fixed io_bi[IO_LSTM_HIDDEN] = { #include "weights/io_bi.hex" };
-static const muscle_fixed io_bf[IO_LSTM_HIDDEN] = { #include "weights/io_bf.hex" };
-static const muscle_fixed io_bg[IO_LSTM_HIDDEN] = { #include "weights/io_bg.hex" };
-static const muscle_fixed io_bo[IO_LSTM_HIDDEN] = { #include "weights/io_bo.hex" };
-
-static struct {
+#define IO_LSTM_OUTPUT IO_CLASS_NR
+
+/* Built-in weights; missing sources leave empty tables (see muscle_wset) */
+static const muscle_fixed io_wi[] = {
+#if __has_include("weights/io_wi.hex")
+    #include "weights/io_wi.hex"
+#endif
+};
+static const muscle_fixed io_wf[] = {
+#if __has_include("weights/io_wf.hex")
+    #include "weights/io_wf.hex"
+#endif
+};
+static const muscle_fixed io_wg[] = {
+#if __has_include("weights/io_wg.hex")
+    #include "weights/io_wg.hex"
+#endif
+};
+static const muscle_fixed io_wo[] = {
+#if __has_include("weights/io_wo.hex")
+    #include "weights/io_wo.hex"
+#endif
+};
+static const muscle_fixed io_bi[] = {
+#if __has_include("weights/io_bi.hex")
+    #include "weights/io_bi.hex"
+#endif
+};
+static const muscle_fixed io_bf[] = {
+#if __has_include("weights/io_bf.hex")
+    #include "weights/io_bf.hex"
+#endif
+};
+static const muscle_fixed io_bg[] = {
+#if __has_include("weights/io_bg.hex")
+    #include "weights/io_bg.hex"
+#endif
+};
+static const muscle_fixed io_bo[] = {
+#if __has_include("weights/io_bo.hex")
+    #include "weights/io_bo.hex"
+#endif
+};
+static const muscle_fixed io_outw[] = {
+#if __has_include("weights/io_outw.hex")
+    #include "weights/io_outw.hex"
+#endif
+};
+static const muscle_fixed io_outb[] = {
+#if __has_include("weights/io_outb.hex")
+    #include "weights/io_outb.hex"
+#endif
+};
+
+enum {
+    IO_WI, IO_WF, IO_WG, IO_WO,
+    IO_BI, IO_BF, IO_BG, IO_BO,
+    IO_OUTW, IO_OUTB,
+    IO_TABLES,
+};
+
+static const struct muscle_wtable io_tables[IO_TABLES] = {
+    [IO_WI]   = MUSCLE_WTABLE("wi", io_wi, IO_LSTM_HIDDEN * IO_LSTM_INPUT),
+    [IO_WF]   = MUSCLE_WTABLE("wf", io_wf, IO_LSTM_HIDDEN * IO_LSTM_INPUT),
+    [IO_WG]   = MUSCLE_WTABLE("wg", io_wg, IO_LSTM_HIDDEN * IO_LSTM_INPUT),
+    [IO_WO]   = MUSCLE_WTABLE("wo", io_wo, IO_LSTM_HIDDEN * IO_LSTM_INPUT),
+    [IO_BI]   = MUSCLE_WTABLE("bi", io_bi, IO_LSTM_HIDDEN),
+    [IO_BF]   = MUSCLE_WTABLE("bf", io_bf, IO_LSTM_HIDDEN),
+    [IO_BG]   = MUSCLE_WTABLE("bg", io_bg, IO_LSTM_HIDDEN),
+    [IO_BO]   = MUSCLE_WTABLE("bo", io_bo, IO_LSTM_HIDDEN),
+    [IO_OUTW] = MUSCLE_WTABLE("outw", io_outw, IO_LSTM_OUTPUT * IO_LSTM_HIDDEN),
+    [IO_OUTB] = MUSCLE_WTABLE("outb", io_outb, IO_LSTM_OUTPUT),
+};
+
+/* Op classes, shared by the one-hot input and the output logits */
+enum {
+    IO_CLASS_READ,
+    IO_CLASS_READ_SEQ,      /* starts where the previous read ended */
+    IO_CLASS_WRITE,
+    IO_CLASS_WRITE_SEQ,
+    IO_CLASS_WRITE_SYNC,    /* FUA or preflush */
+    IO_CLASS_FLUSH,
+    IO_CLASS_DISCARD,
+    IO_CLASS_ZEROES,        /* write-zeroes, secure erase */
+    IO_CLASS_ZONE,
+    IO_CLASS_OTHER,         /* driver private, passthrough */
+};
+static_assert(IO_CLASS_OTHER + 1 == IO_CLASS_NR);
+
+/*
+ * One predictor per request_queue, so interleaved devices don't pollute
+ * each other's history.  Looked up by q->id under RCU; created by the
+ * queue's first request and freed from muscle_io_queue_exit().  Requests
+ * are queued as events on the submitting CPU's ring, tagged with the
+ * predictor's gen: the drain drops events whose predictor is gone or was
+ * replaced, since ids are reused once a queue is released.  The lock
+ * serialises the ring drains of different CPUs feeding the same device.
+ */
+struct muscle_io_state {
+    u64 gen;
     muscle_fixed h[IO_LSTM_HIDDEN];
     muscle_fixed c[IO_LSTM_HIDDEN];
-    u64 last_ops[10];
+    sector_t next_sector[2];    /* end of the last read / write */
+    struct muscle_stream stream;
+    int pred;                   /* last published class, -1 if unsure */
     spinlock_t lock;
-} io_state ____cacheline_aligned;
+    struct rcu_head rcu;
+} ____cacheline_aligned;
+
+static DEFINE_XARRAY(io_queues);
+static atomic64_t io_state_gen = ATOMIC64_INIT(0);
+
+MUSCLE_LSTM_CELL(io_cell, IO_LSTM_INPUT, IO_LSTM_HIDDEN)
+MUSCLE_DENSE(io_head, IO_LSTM_HIDDEN, IO_LSTM_OUTPUT, 8, MUSCLE_ACT_NONE)
+
+struct io_model {
+    struct io_cell lstm;
+    struct io_head out;
+};
+
+static struct io_model __rcu *io_model;
+static struct muscle_evq io_evq;
+
+DEFINE_MUSCLE_SWITCH(muscle_io_key, "io");
+
+static bool io_hints = true;
+module_param(io_hints, bool, 0644);
+MODULE_PARM_DESC(io_hints, "Return merge/dispatch hints from MuscleIO");
+
+/*
+ * HITS and MISSES score each confident prediction against the class of
+ * the next request the device sees; LOCK_NS is the drain's wait for a
+ * queue another CPU's drain is feeding.
+ */
+DEFINE_MUSCLE_STATS(io_stats, "io",
+                    BIT(MUSCLE_STAT_CALLS) | BIT(MUSCLE_STAT_INFER) |
+                    BIT(MUSCLE_STAT_INFER_NS) | BIT(MUSCLE_STAT_LOCK_NS) |
+                    BIT(MUSCLE_STAT_ISSUED) | BIT(MUSCLE_STAT_HITS) |
+                    BIT(MUSCLE_STAT_MISSES) | BIT(MUSCLE_STAT_ABSTAIN));
+
+/* Logit lead over the runner-up needed before a hint is returned */
+static int io_hint_margin = MUSCLE_FIXED_ONE / 4;
+module_param(io_hint_margin, int, 0644);
+MODULE_PARM_DESC(io_hint_margin, "Minimum Q12 logit margin for a hint");
 
-static void io_lstm_step(u64 op)
+static int io_classify(struct muscle_io_state *s, sector_t pos,
+                       unsigned int sectors, blk_opf_t opf)
 {
-    /* identical LSTM implementation as cache, reused gates */
-    /* omitted for brevity — full code is 380 lines and ready */
-    pr_info("MuscleIO: predicted next op type %llu\n", op);
+    sector_t end = pos + sectors;
+    enum req_op op = opf & REQ_OP_MASK;
+    bool seq;
+
+    switch (op) {
+    case REQ_OP_READ:
+        seq = pos == s->next_sector[0];
+        s->next_sector[0] = end;
+        return seq ? IO_CLASS_READ_SEQ : IO_CLASS_READ;
+    case REQ_OP_WRITE:
+        seq = pos == s->next_sector[1];
+        s->next_sector[1] = end;
+        if (opf & (REQ_FUA | REQ_PREFLUSH))
+            return IO_CLASS_WRITE_SYNC;
+        return seq ? IO_CLASS_WRITE_SEQ : IO_CLASS_WRITE;
+    case REQ_OP_FLUSH:
+        return IO_CLASS_FLUSH;
+    case REQ_OP_DISCARD:
+        return IO_CLASS_DISCARD;
+    case REQ_OP_WRITE_ZEROES:
+    case REQ_OP_SECURE_ERASE:
+        return IO_CLASS_ZEROES;
+    default:
+        return op_is_zone_mgmt(op) ? IO_CLASS_ZONE : IO_CLASS_OTHER;
+    }
+}
+
+static struct muscle_io_state *io_state_get(unsigned long id)
+{
+    struct muscle_io_state *s, *old;
+
+    s = xa_load(&io_queues, id);
+    if (likely(s))
+        return s;
+
+    s = kzalloc(sizeof(*s), GFP_ATOMIC | __GFP_NOWARN);
+    if (!s)
+        return NULL;
+    spin_lock_init(&s->lock);
+    s->pred = -1;
+    s->gen = atomic64_inc_return(&io_state_gen);
+
+    old = xa_cmpxchg(&io_queues, id, NULL, s, GFP_ATOMIC | __GFP_NOWARN);
+    if (old) {
+        /* Lost the race to another CPU's first request, or out of memory */
+        kfree(s);
+        return xa_is_err(old) ? NULL : old;
+    }
+    return s;
 }
 
-void muscle_io_predict(struct request_queue *q, struct request *rq)
+/* One LSTM step for a cls request at pos; returns the predicted next class or -1 */
+static int io_lstm_step(const struct io_model *m, struct muscle_io_state *s,
+                        unsigned long id, int cls, sector_t pos)
 {
-    unsigned long flags;
-    spin_lock_irqsave(&io_state.lock, flags);
-    io_lstm_step(rq->cmd_flags);
-    spin_unlock_irqrestore(&io_state.lock, flags);
+    muscle_fixed input[IO_LSTM_INPUT] = {0};
+    muscle_fixed logits[IO_LSTM_OUTPUT];
+    u64 t0 = muscle_stat_clock();
+    int pred;
+
+    input[cls] = MUSCLE_FIXED_ONE;
+    muscle_stream_encode(&s->stream, id, pos, input + IO_CLASS_NR);
+    io_cell_step(&m->lstm, input, s->h, s->c);
+    io_head_forward(&m->out, s->h, logits);
+    pred = muscle_stream_argmax(logits, IO_LSTM_OUTPUT, READ_ONCE(io_hint_margin));
+
+    muscle_stat_time(&io_stats, MUSCLE_STAT_INFER_NS, t0);
+    muscle_stat_inc(&io_stats, MUSCLE_STAT_INFER);
+    if (pred < 0)
+        muscle_stat_inc(&io_stats, MUSCLE_STAT_ABSTAIN);
+    return pred;
 }
 
+/* Event layout: a = start sector, c = q->id, d = cmd_flags, e = sectors, id = gen */
+static void io_drain(struct muscle_evq *q, int cpu,
+                     const struct muscle_event *ev, unsigned int n)
+{
+    const struct io_model *m;
+    struct muscle_io_state *s;
+    unsigned int i;
+    int cls;
+    u64 t0;
+
+    rcu_read_lock();
+    m = rcu_dereference(io_model);
+    for (i = 0; m && i < n; i++) {
+        /* Queued before its queue was released, or out of memory */
+        s = xa_load(&io_queues, ev[i].c);
+        if (!s || s->gen != ev[i].id)
+            continue;
+        t0 = muscle_stat_clock();
+        spin_lock_bh(&s->lock);
+        muscle_stat_time(&io_stats, MUSCLE_STAT_LOCK_NS, t0);
+        cls = io_classify(s, ev[i].a, ev[i].e, ev[i].d);
+        if (s->pred >= 0)
+            muscle_stat_inc(&io_stats, s->pred == cls ? MUSCLE_STAT_HITS : MUSCLE_STAT_MISSES);
+        WRITE_ONCE(s->pred, io_lstm_step(m, s, ev[i].c, cls, ev[i].a));
+        spin_unlock_bh(&s->lock);
+    }
+    rcu_read_unlock();
+}
+
+/* Hint for a request of op, given the class predicted for it */
+static enum muscle_io_hint io_hint(int pred, enum req_op op)
+{
+    switch (pred) {
+    case IO_CLASS_READ_SEQ:
+        return op == REQ_OP_READ ? MUSCLE_IO_HINT_MERGE : MUSCLE_IO_HINT_NONE;
+    case IO_CLASS_WRITE_SEQ:
+        return op == REQ_OP_WRITE ? MUSCLE_IO_HINT_MERGE : MUSCLE_IO_HINT_NONE;
+    case IO_CLASS_WRITE_SYNC:
+    case IO_CLASS_FLUSH:
+        return MUSCLE_IO_HINT_DISPATCH;
+    default:
+        return MUSCLE_IO_HINT_NONE;
+    }
+}
+
+/*
+ * Called on request insertion.  rq is queued for the device's predictor
+ * and the hint comes from what it last published: a contiguous
+ * follow-up in the same direction is worth holding rq back for a merge,
+ * a sync write or flush means nothing will merge and rq should go out now.
+ * Captured as the queued event with b = the hint returned.
+ */
+enum muscle_io_hint __muscle_io_predict(struct request_queue *q, struct request *rq)
+{
+    struct muscle_event ev = {
+        .a = blk_rq_pos(rq),
+        .c = q->id,
+        .d = (__force u32)rq->cmd_flags,
+        .e = blk_rq_sectors(rq),
+    };
+    enum muscle_io_hint hint = MUSCLE_IO_HINT_NONE;
+    struct muscle_io_state *s;
+    int pred;
+
+    if (unlikely(!rcu_access_pointer(io_model)))
+        goto trace;
+
+    muscle_stat_inc(&io_stats, MUSCLE_STAT_CALLS);
+    rcu_read_lock();
+    s = io_state_get(q->id);
+    if (!s) {
+        rcu_read_unlock();
+        goto trace;
+    }
+    ev.id = s->gen;
+    muscle_evq_push(&io_evq, &ev);
+    if (READ_ONCE(io_hints)) {
+        pred = READ_ONCE(s->pred);
+        hint = io_hint(pred, req_op(rq));
+        trace_muscle_io_hint(q->id, ev.a, pred, hint);
+    }
+    rcu_read_unlock();
+    if (hint != MUSCLE_IO_HINT_NONE)
+        muscle_stat_inc(&io_stats, MUSCLE_STAT_ISSUED);
+trace:
+    ev.b = hint;
+    muscle_trace_event(MUSCLE_TRACE_IO, &ev);
+    return hint;
+}
+
+/*
+ * Drop q's predictor; called when the queue is released, after its last
+ * request.  Events still on the rings no longer find it and are dropped.
+ */
+void muscle_io_queue_exit(struct request_queue *q)
+{
+    struct muscle_io_state *s = xa_erase(&io_queues, q->id);
+
+    if (s)
+        kfree_rcu(s, rcu);
+}
+
+static void io_release(void *model)
+{
+    struct io_model *m = model;
+
+    io_head_free(&m->out);
+    io_cell_free(&m->lstm);
+    kfree(m);
+}
+
+static void *io_build(const muscle_fixed *const *t)
+{
+    struct io_model *m;
+    int ret;
+
+    m = kzalloc(sizeof(*m), GFP_KERNEL);
+    if (!m)
+        return ERR_PTR(-ENOMEM);
+    ret = io_cell_init(&m->lstm, &t[IO_WI], NULL, &t[IO_BI], MUSCLE_FIXED_ONE);
+    if (ret) {
+        kfree(m);
+        return ERR_PTR(ret);
+    }
+    ret = io_head_init(&m->out, t[IO_OUTW], t[IO_OUTB]);
+    if (ret) {
+        io_cell_free(&m->lstm);
+        kfree(m);
+        return ERR_PTR(ret);
+    }
+    return m;
+}
+
+static struct muscle_wset io_wset = {
+    .name      = "io",
+    .tables    = io_tables,
+    .nr_tables = IO_TABLES,
+    .build     = io_build,
+    .release   = io_release,
+    .model     = (void __rcu **)&io_model,
+};
+
 static int __init muscle_io_init(void)
 {
-    spin_lock_init(&io_state.lock);
-    pr_info("MuscleIO: LSTM block predictor active\n");
+    int ret;
+
+    muscle_switch_ready(&muscle_io_key_switch);
+    ret = muscle_evq_init(&io_evq, "io", io_drain);
+    if (ret) {
+        pr_err("MuscleIO: failed to set up event rings (%d)\n", ret);
+        return ret;
+    }
+    ret = muscle_wset_register(&io_wset);
+    if (ret) {
+        pr_err("MuscleIO: failed to build weights (%d)\n", ret);
+        return ret;
+    }
+
+    muscle_stats_register(&io_stats, &io_evq);
+    pr_info("MuscleIO: LSTM block predictor active (per-queue state, async, %s)\n",
+            muscle_lstm_impl_name());
     return 0;
 }
 late_initcall(muscle_io_init);
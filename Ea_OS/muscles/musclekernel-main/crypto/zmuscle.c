@@ -0,0 +1,150 @@
+/*
+ * Crypto API glue for the zmuscle compressor (lib/muscle/muscle_compress.c),
+ * so zram ("comp_algorithm") and zswap ("compressor") can pick it by name.
+ * Registered like lz4: a legacy compress alg for crypto_comp users and a
+ * scomp alg for acomp users.
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/crypto.h>
+#include <linux/vmalloc.h>
+#include <linux/muscle.h>
+#include <crypto/internal/scompress.h>
+
+struct zmuscle_ctx {
+    void *wrkmem;
+};
+
+static void *zmuscle_alloc_ctx(struct crypto_scomp *tfm)
+{
+    void *ctx = vmalloc(MUSCLE_COMPRESS_WRKMEM);
+
+    return ctx ? ctx : ERR_PTR(-ENOMEM);
+}
+
+static void zmuscle_free_ctx(struct crypto_scomp *tfm, void *ctx)
+{
+    vfree(ctx);
+}
+
+static int zmuscle_init(struct crypto_tfm *tfm)
+{
+    struct zmuscle_ctx *ctx = crypto_tfm_ctx(tfm);
+
+    ctx->wrkmem = zmuscle_alloc_ctx(NULL);
+    return IS_ERR(ctx->wrkmem) ? PTR_ERR(ctx->wrkmem) : 0;
+}
+
+static void zmuscle_exit(struct crypto_tfm *tfm)
+{
+    struct zmuscle_ctx *ctx = crypto_tfm_ctx(tfm);
+
+    zmuscle_free_ctx(NULL, ctx->wrkmem);
+}
+
+static int __zmuscle_compress(const u8 *src, unsigned int slen, u8 *dst,
+                              unsigned int *dlen, void *wrkmem)
+{
+    size_t len = *dlen;
+    int ret = muscle_compress(dst, &len, src, slen, wrkmem);
+
+    if (ret)
+        return ret;
+    *dlen = len;
+    return 0;
+}
+
+static int __zmuscle_decompress(const u8 *src, unsigned int slen, u8 *dst,
+                                unsigned int *dlen)
+{
+    size_t len = *dlen;
+    int ret = muscle_decompress(dst, &len, src, slen);
+
+    if (ret)
+        return ret;
+    *dlen = len;
+    return 0;
+}
+
+static int zmuscle_scompress(struct crypto_scomp *tfm, const u8 *src,
+                             unsigned int slen, u8 *dst, unsigned int *dlen,
+                             void *ctx)
+{
+    return __zmuscle_compress(src, slen, dst, dlen, ctx);
+}
+
+static int zmuscle_sdecompress(struct crypto_scomp *tfm, const u8 *src,
+                               unsigned int slen, u8 *dst, unsigned int *dlen,
+                               void *ctx)
+{
+    return __zmuscle_decompress(src, slen, dst, dlen);
+}
+
+static int zmuscle_compress_crypto(struct crypto_tfm *tfm, const u8 *src,
+                                   unsigned int slen, u8 *dst, unsigned int *dlen)
+{
+    struct zmuscle_ctx *ctx = crypto_tfm_ctx(tfm);
+
+    return __zmuscle_compress(src, slen, dst, dlen, ctx->wrkmem);
+}
+
+static int zmuscle_decompress_crypto(struct crypto_tfm *tfm, const u8 *src,
+                                     unsigned int slen, u8 *dst, unsigned int *dlen)
+{
+    return __zmuscle_decompress(src, slen, dst, dlen);
+}
+
+static struct crypto_alg alg_zmuscle = {
+    .cra_name        = "zmuscle",
+    .cra_driver_name = "zmuscle-generic",
+    .cra_flags       = CRYPTO_ALG_TYPE_COMPRESS,
+    .cra_ctxsize     = sizeof(struct zmuscle_ctx),
+    .cra_module      = THIS_MODULE,
+    .cra_init        = zmuscle_init,
+    .cra_exit        = zmuscle_exit,
+    .cra_u           = { .compress = {
+    .coa_compress    = zmuscle_compress_crypto,
+    .coa_decompress  = zmuscle_decompress_crypto } }
+};
+
+static struct scomp_alg scomp = {
+    .alloc_ctx  = zmuscle_alloc_ctx,
+    .free_ctx   = zmuscle_free_ctx,
+    .compress   = zmuscle_scompress,
+    .decompress = zmuscle_sdecompress,
+    .base       = {
+        .cra_name        = "zmuscle",
+        .cra_driver_name = "zmuscle-scomp",
+        .cra_module      = THIS_MODULE,
+    }
+};
+
+static int __init zmuscle_mod_init(void)
+{
+    int ret;
+
+    ret = crypto_register_alg(&alg_zmuscle);
+    if (ret)
+        return ret;
+
+    ret = crypto_register_scomp(&scomp);
+    if (ret) {
+        crypto_unregister_alg(&alg_zmuscle);
+        return ret;
+    }
+    pr_info("zmuscle: compressor registered (learned transform + LZ)\n");
+    return 0;
+}
+
+static void __exit zmuscle_mod_fini(void)
+{
+    crypto_unregister_alg(&alg_zmuscle);
+    crypto_unregister_scomp(&scomp);
+}
+
+subsys_initcall(zmuscle_mod_init);
+module_exit(zmuscle_mod_fini);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("zmuscle compression algorithm");
+MODULE_ALIAS_CRYPTO("zmuscle");
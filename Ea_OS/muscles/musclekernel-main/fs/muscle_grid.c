@@ -0,0 +1,323 @@
+#include <linux/muscle.h>
+#include <linux/atomic.h>
+#include <linux/cred.h>
+#include <linux/dcache.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/moduleparam.h>
+#include <linux/mount.h>
+#include <linux/namei.h>
+#include <linux/path.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/stringhash.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <trace/events/muscle.h>
+
+/*
+ * MuscleGrid: a path-lookup prefetcher.  Build systems and CI jobs walk
+ * the same trees in the same order run after run, so the component looked
+ * up after "foo.c" in a directory is very likely the one looked up after
+ * it last time.  Each (directory, name) pair owns a slot in a
+ * direct-mapped successor table; the slot learns online, with a
+ * saturating confidence that is raised when its prediction comes true
+ * and lowered (then replaced) when it does not.
+ *
+ * muscle_grid_walk() is called with every resolved path.  It trains the
+ * slot of the previous lookup made by the same task and, if the slot for
+ * this one is confident, queues a prefetch that looks up the next
+ * grid_depth predicted siblings.  That warms the dcache and icache, or
+ * leaves negative dentries for names that do not exist, which build
+ * systems probe just as often.  The hook itself never sleeps, blocks or
+ * touches the filesystem.
+ */
+#define GRID_NAME_MAX   39      /* longer names are not learned */
+#define GRID_CONF_MAX   3
+#define GRID_DEPTH_MAX  8
+
+struct grid_slot {
+    spinlock_t lock;
+    u8 conf;
+    u8 len;
+    char next[GRID_NAME_MAX];   /* predicted next component, same directory */
+    u64 tag;                    /* key of the (directory, name) owning the slot */
+};
+
+/* The last lookup seen on this CPU, to learn the transition to the next */
+struct grid_last {
+    pid_t pid;
+    const struct dentry *parent;
+    u64 key;
+};
+
+/* What became of queued prefetches; the predictions are in grid_mstats */
+struct grid_stats {
+    unsigned long cached, warmed, dropped;
+};
+
+/* cred is the walking task's, so a prefetch can see no more than it could */
+struct grid_prefetch {
+    struct work_struct work;
+    struct path dir;
+    const struct cred *cred;
+    unsigned int depth;
+    u8 len;
+    char name[GRID_NAME_MAX];
+};
+
+static unsigned int grid_bits = 12;
+module_param(grid_bits, uint, 0444);
+MODULE_PARM_DESC(grid_bits, "log2 of the successor table size (set at boot)");
+
+static bool grid_prefetch = true;
+module_param(grid_prefetch, bool, 0644);
+MODULE_PARM_DESC(grid_prefetch, "Prefetch predicted path components");
+
+static unsigned int grid_depth = 4;
+module_param(grid_depth, uint, 0644);
+MODULE_PARM_DESC(grid_depth, "Predicted siblings to look up ahead (max 8)");
+
+static unsigned int grid_confidence = 2;
+module_param(grid_confidence, uint, 0644);
+MODULE_PARM_DESC(grid_confidence, "Slot confidence (1-3) needed to prefetch");
+
+static unsigned int grid_max_inflight = 64;
+module_param(grid_max_inflight, uint, 0644);
+MODULE_PARM_DESC(grid_max_inflight, "Queued prefetches before new ones are dropped");
+
+static struct grid_slot *grid_table;
+static unsigned int grid_mask;
+static atomic_t grid_inflight = ATOMIC_INIT(0);
+static struct workqueue_struct *grid_wq;
+
+DEFINE_MUSCLE_SWITCH(muscle_grid_key, "grid");
+
+static DEFINE_PER_CPU(struct grid_last, grid_last);
+static DEFINE_PER_CPU(struct grid_stats, grid_stats);
+
+/* INFER is a slot lookup; HITS and MISSES score confident slots' successors */
+DEFINE_MUSCLE_STATS(grid_mstats, "grid",
+                    BIT(MUSCLE_STAT_CALLS) | BIT(MUSCLE_STAT_INFER) |
+                    BIT(MUSCLE_STAT_INFER_NS) | BIT(MUSCLE_STAT_ISSUED) |
+                    BIT(MUSCLE_STAT_HITS) | BIT(MUSCLE_STAT_MISSES));
+
+/* Name hashes are salted with the parent, the pointer keeps keys apart */
+static inline u64 grid_key(const struct dentry *parent, u32 hash)
+{
+    return hash_64((unsigned long)parent ^ ((u64)hash << 32 | hash), 64);
+}
+
+static inline struct grid_slot *grid_slot(u64 key)
+{
+    return &grid_table[key & grid_mask];
+}
+
+static inline unsigned int grid_min_conf(void)
+{
+    return max(READ_ONCE(grid_confidence), 1U);
+}
+
+/* Teach the previous lookup's slot that name came next */
+static void grid_learn(u64 key, const char *name, unsigned int len)
+{
+    struct grid_slot *s = grid_slot(key);
+
+    if (!spin_trylock(&s->lock))
+        return;
+    if (s->tag == key && s->len == len && !memcmp(s->next, name, len)) {
+        muscle_stat_inc(&grid_mstats, MUSCLE_STAT_HITS);
+        if (s->conf < GRID_CONF_MAX)
+            s->conf++;
+    } else {
+        if (s->tag == key)
+            muscle_stat_inc(&grid_mstats, MUSCLE_STAT_MISSES);
+        if (s->tag != key || !s->conf || !--s->conf) {
+            s->tag = key;
+            s->len = len;
+            memcpy(s->next, name, len);
+            s->conf = 1;
+        }
+    }
+    spin_unlock(&s->lock);
+}
+
+/* Copy out key's prediction if it is confident enough; returns its length */
+static unsigned int grid_predict(u64 key, char *name, unsigned int conf)
+{
+    struct grid_slot *s = grid_slot(key);
+    unsigned int len = 0;
+
+    if (!spin_trylock(&s->lock))
+        return 0;
+    if (s->tag == key && s->conf >= conf) {
+        len = s->len;
+        memcpy(name, s->next, len);
+    }
+    spin_unlock(&s->lock);
+    return len;
+}
+
+static void grid_prefetch_fn(struct work_struct *work)
+{
+    struct grid_prefetch *pf = container_of(work, struct grid_prefetch, work);
+    struct dentry *dir = pf->dir.dentry;
+    unsigned int i, len = pf->len;
+    const struct cred *old;
+    char name[GRID_NAME_MAX];
+
+    memcpy(name, pf->name, len);
+    old = override_creds(pf->cred);
+    for (i = 0; i < pf->depth && len; i++) {
+        struct qstr q = QSTR_INIT(name, len);
+        struct dentry *d;
+
+        q.hash = full_name_hash(dir, name, len);
+        d = d_hash_and_lookup(dir, &q);
+        if (!d) {
+            d = lookup_one_unlocked(mnt_idmap(pf->dir.mnt), name, dir, len);
+            if (!IS_ERR(d))
+                this_cpu_inc(grid_stats.warmed);
+        } else if (!IS_ERR(d)) {
+            this_cpu_inc(grid_stats.cached);
+        }
+        if (!IS_ERR_OR_NULL(d))
+            dput(d);
+
+        len = grid_predict(grid_key(dir, q.hash), name, grid_min_conf());
+    }
+    revert_creds(old);
+
+    put_cred(pf->cred);
+    path_put(&pf->dir);
+    kfree(pf);
+    atomic_dec(&grid_inflight);
+}
+
+static void grid_queue(const struct path *path, u64 key, const char *name,
+                       unsigned int len)
+{
+    struct grid_prefetch *pf;
+
+    if (atomic_inc_return(&grid_inflight) > READ_ONCE(grid_max_inflight))
+        goto drop;
+    pf = kmalloc(sizeof(*pf), GFP_NOWAIT | __GFP_NOWARN);
+    if (!pf)
+        goto drop;
+
+    INIT_WORK(&pf->work, grid_prefetch_fn);
+    pf->dir.mnt = mntget(path->mnt);
+    pf->dir.dentry = dget_parent(path->dentry);
+    pf->cred = get_current_cred();
+    pf->depth = min(READ_ONCE(grid_depth), GRID_DEPTH_MAX);
+    pf->len = len;
+    memcpy(pf->name, name, len);
+    queue_work(grid_wq, &pf->work);
+    trace_muscle_grid_prefetch(key, len, pf->depth, true);
+    muscle_stat_inc(&grid_mstats, MUSCLE_STAT_ISSUED);
+    return;
+drop:
+    atomic_dec(&grid_inflight);
+    trace_muscle_grid_prefetch(key, len, 0, false);
+    this_cpu_inc(grid_stats.dropped);
+}
+
+/*
+ * Path-walk hook: path is a successfully resolved lookup, held by the
+ * caller for the duration of the call.
+ */
+void __muscle_grid_walk(struct path *path)
+{
+    struct dentry *dentry = path->dentry;
+    const struct dentry *parent;
+    struct name_snapshot snap;
+    struct grid_last *last;
+    char next[GRID_NAME_MAX];
+    unsigned int len, n = 0;
+    u64 key, t0;
+
+    /* Pairs with the release in muscle_grid_init() */
+    if (!smp_load_acquire(&grid_table) || IS_ROOT(dentry))
+        return;
+
+    take_dentry_name_snapshot(&snap, dentry);
+    len = snap.name.len;
+    parent = READ_ONCE(dentry->d_parent);
+    key = grid_key(parent, snap.name.hash);
+
+    last = get_cpu_ptr(&grid_last);
+    muscle_stat_inc(&grid_mstats, MUSCLE_STAT_CALLS);
+    if (last->pid == current->pid && last->parent == parent && last->key != key &&
+        len <= GRID_NAME_MAX)
+        grid_learn(last->key, (const char *)snap.name.name, len);
+    last->pid = current->pid;
+    last->parent = parent;
+    last->key = key;
+    if (READ_ONCE(grid_prefetch)) {
+        t0 = muscle_stat_clock();
+        n = grid_predict(key, next, grid_min_conf());
+        muscle_stat_time(&grid_mstats, MUSCLE_STAT_INFER_NS, t0);
+        muscle_stat_inc(&grid_mstats, MUSCLE_STAT_INFER);
+    }
+    put_cpu_ptr(&grid_last);
+    release_dentry_name_snapshot(&snap);
+
+    if (n)
+        grid_queue(path, key, next, n);
+}
+
+static int grid_stats_get(char *buf, const struct kernel_param *kp)
+{
+    struct grid_stats sum = {};
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        const struct grid_stats *st = per_cpu_ptr(&grid_stats, cpu);
+
+        sum.cached  += data_race(st->cached);
+        sum.warmed  += data_race(st->warmed);
+        sum.dropped += data_race(st->dropped);
+    }
+    return sysfs_emit(buf, "hits %llu misses %llu issued %llu cached %lu warmed %lu dropped %lu\n",
+                      muscle_stat_read(&grid_mstats, MUSCLE_STAT_HITS),
+                      muscle_stat_read(&grid_mstats, MUSCLE_STAT_MISSES),
+                      muscle_stat_read(&grid_mstats, MUSCLE_STAT_ISSUED),
+                      sum.cached, sum.warmed, sum.dropped);
+}
+
+static const struct kernel_param_ops grid_stats_ops = {
+    .get = grid_stats_get,
+};
+module_param_cb(grid_stats, &grid_stats_ops, NULL, 0444);
+MODULE_PARM_DESC(grid_stats, "Predictions hit/missed, prefetches issued, already cached, warmed, dropped");
+
+static int __init muscle_grid_init(void)
+{
+    struct grid_slot *table;
+    unsigned int i, nr;
+
+    muscle_switch_ready(&muscle_grid_key_switch);
+    grid_bits = clamp(grid_bits, 8U, 20U);
+    nr = 1U << grid_bits;
+
+    grid_wq = alloc_workqueue("muscle_grid", WQ_UNBOUND | WQ_FREEZABLE, 0);
+    if (!grid_wq)
+        return -ENOMEM;
+    table = vzalloc(array_size(nr, sizeof(*table)));
+    if (!table) {
+        destroy_workqueue(grid_wq);
+        return -ENOMEM;
+    }
+    for (i = 0; i < nr; i++)
+        spin_lock_init(&table[i].lock);
+    grid_mask = nr - 1;
+    smp_store_release(&grid_table, table);
+    muscle_stats_register(&grid_mstats, NULL);
+
+    pr_info("MuscleGrid: path-lookup prefetcher initialized (%u slots)\n", nr);
+    return 0;
+}
+
+late_initcall(muscle_grid_init);
@@ -2,15 +2,27 @@
 #define _LINUX_MUSCLE_H
 
 #include <linux/types.h>
+#include <linux/build_bug.h>
+#include <linux/jump_label.h>
+#include <linux/kobject.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
 #include <linux/spinlock.h>
 #include <linux/sched.h>
+#include <linux/sched/clock.h>
+#include <linux/workqueue.h>
 
 #define MUSCLE_FIXED_SHIFT 12
 #define MUSCLE_FIXED_ONE (1 << MUSCLE_FIXED_SHIFT)
 
 typedef s32 muscle_fixed;
 
-/* Tiny fixed-point neural net utilities */
+/*
+ * Float conversions are for tools/ only: kernel code would have to
+ * bracket each one with kernel_fpu_begin/end(), so it gets none.
+ */
+#ifndef __KERNEL__
 static inline muscle_fixed muscle_float_to_fixed(float x)
 {
 	return (muscle_fixed)(x * MUSCLE_FIXED_ONE);
@@ -20,18 +32,956 @@ static inline float muscle_fixed_to_float(muscle_fixed x)
 {
 	return (float)x / MUSCLE_FIXED_ONE;
 }
+#endif
+
+/* Tiny ReLU for fixed-point */
+static inline muscle_fixed muscle_relu(muscle_fixed x)
+{
+	return x > 0 ? x : 0;
+}
+
+/*
+ * Fixed-point arithmetic.  Products of two muscle_fixed values are formed
+ * in s64 and shifted back by MUSCLE_FIXED_SHIFT; anything that can leave
+ * the s32 range saturates instead of wrapping.
+ */
+static inline muscle_fixed muscle_fx_sat(s64 x)
+{
+	return x > S32_MAX ? S32_MAX : x < S32_MIN ? S32_MIN : (muscle_fixed)x;
+}
+
+static inline muscle_fixed muscle_fx_mul(muscle_fixed a, muscle_fixed b)
+{
+	return muscle_fx_sat(((s64)a * b) >> MUSCLE_FIXED_SHIFT);
+}
+
+static inline muscle_fixed muscle_fx_add_sat(muscle_fixed a, muscle_fixed b)
+{
+	return muscle_fx_sat((s64)a + b);
+}
+
+/*
+ * Feature normalisation without a divide: x / d in Q12, for d a build
+ * time constant, is one 64×64→128 multiply by 2^63 / d and a shift.  The
+ * reciprocal keeps at least 64 - ilog2(d) significant bits, plenty for
+ * Q12 at any d we use.  Saturates at S32_MAX.
+ */
+#define MUSCLE_RECIP_SHIFT	63
+#define MUSCLE_RECIP(d)		((u64)(((1ULL << MUSCLE_RECIP_SHIFT) + (d) / 2) / (d)))
+
+static __always_inline muscle_fixed __muscle_fx_div(u64 x, u64 limit, u64 recip)
+{
+	u64 q;
+
+	if (x >= limit)
+		return S32_MAX;
+	q = mul_u64_u64_shr(x, recip, MUSCLE_RECIP_SHIFT - MUSCLE_FIXED_SHIFT);
+	return q > S32_MAX ? S32_MAX : (muscle_fixed)q;
+}
+
+/* x / d in Q12; d must be a constant below 2^44 */
+#define muscle_fx_div_const(x, d)						\
+	__muscle_fx_div((x), (u64)(d) << (31 - MUSCLE_FIXED_SHIFT), MUSCLE_RECIP(d))
+
+/* a·b + c·d with a single rounding step */
+static inline muscle_fixed muscle_fx_mul2(muscle_fixed a, muscle_fixed b,
+					  muscle_fixed c, muscle_fixed d)
+{
+	return muscle_fx_sat(((s64)a * b + (s64)c * d) >> MUSCLE_FIXED_SHIFT);
+}
+
+/*
+ * Table-driven sigmoid and tanh: 257-entry s16 tables over [0, 8] in
+ * 1/32 steps (lib/muscle/tables/, generated by tools/muscle/gen_act_lut.py),
+ * mirrored for negative inputs and linearly interpolated.  Both tables
+ * (1 KB) stay L1-resident; error stays under 1.5 LSB of Q12.
+ */
+#define MUSCLE_LUT_SHIFT	7
+#define MUSCLE_LUT_SIZE		((8 * MUSCLE_FIXED_ONE >> MUSCLE_LUT_SHIFT) + 1)
+
+extern const s16 muscle_sigmoid_lut[MUSCLE_LUT_SIZE];
+extern const s16 muscle_tanh_lut[MUSCLE_LUT_SIZE];
+
+static inline muscle_fixed muscle_lut_interp(const s16 *lut, u32 ax)
+{
+	u32 idx = ax >> MUSCLE_LUT_SHIFT;
+	s32 frac = ax & ((1 << MUSCLE_LUT_SHIFT) - 1);
+
+	if (idx >= MUSCLE_LUT_SIZE - 1)
+		return lut[MUSCLE_LUT_SIZE - 1];
+	return lut[idx] + (((lut[idx + 1] - lut[idx]) * frac +
+			   (1 << (MUSCLE_LUT_SHIFT - 1))) >> MUSCLE_LUT_SHIFT);
+}
+
+static inline muscle_fixed muscle_sigmoid(muscle_fixed x)
+{
+	u32 ax = x < 0 ? -(u32)x : (u32)x;
+	muscle_fixed y = muscle_lut_interp(muscle_sigmoid_lut, ax);
+
+	return x < 0 ? MUSCLE_FIXED_ONE - y : y;
+}
+
+static inline muscle_fixed muscle_tanh(muscle_fixed x)
+{
+	u32 ax = x < 0 ? -(u32)x : (u32)x;
+	muscle_fixed y = muscle_lut_interp(muscle_tanh_lut, ax);
+
+	return x < 0 ? -y : y;
+}
+
+/*
+ * Quantized weights.  Each row is stored as int8 or int16 with its own
+ * scale, w[r][c] ≈ (q[r][c] * scale[r]) >> MUSCLE_QSCALE_SHIFT, so a
+ * 64×64 matrix drops from 16 KB to 4 KB at int8.  Activations are
+ * saturated to s16 and products accumulate in s32 (int8) or s64 (int16).
+ * Tables are quantized when a weight set is built (see struct
+ * muscle_wset), with the same rounding as tools/muscle/quantize.py which
+ * reports the accuracy cost.
+ */
+#define MUSCLE_QSCALE_SHIFT	16
+#define MUSCLE_QMAT_MAX_COLS	80
+
+struct muscle_qmat {
+	unsigned int rows;
+	unsigned int cols;
+	unsigned int bits;			/* 8 or 16 */
+	void *q;				/* s8 / s16, [rows][cols] */
+	s32 *scale;				/* [rows] */
+	const muscle_fixed *bias;		/* [rows], NULL for none */
+};
+
+static inline s16 muscle_act16(muscle_fixed x)
+{
+	return x > S16_MAX ? S16_MAX : x < S16_MIN ? S16_MIN : (s16)x;
+}
+
+/* acc is Σ q·x in Q(scale)·Q12; bring it back to muscle_fixed */
+static inline muscle_fixed muscle_dequant(s64 acc, s32 scale)
+{
+	return muscle_fx_sat((acc * scale) >> (MUSCLE_QSCALE_SHIFT + MUSCLE_FIXED_SHIFT));
+}
+
+/*
+ * Weight arena (lib/muscle/muscle_arena.c): the quantized tables of every
+ * muscle share cacheline-aligned chunks, carved in build order so each
+ * model's layers are contiguous.  Process context only.
+ */
+void *muscle_arena_alloc(size_t size);
+void muscle_arena_free(const void *p);
+
+int muscle_quantize_row(const muscle_fixed *w, unsigned int n, unsigned int bits,
+			void *q, s32 *scale);
+int muscle_qmat_init(struct muscle_qmat *m, const muscle_fixed *w,
+		     const muscle_fixed *bias, unsigned int rows,
+		     unsigned int cols, unsigned int bits);
+void muscle_qmat_free(struct muscle_qmat *m);
+void muscle_qmat_gemv(const struct muscle_qmat *m, const muscle_fixed *x,
+		      muscle_fixed *y);
+/* Y[b] = bias + W·X[b] for b < batch; X is [batch][cols], Y [batch][rows] */
+void muscle_qmat_gemm(const struct muscle_qmat *m, const muscle_fixed *x,
+		      muscle_fixed *y, unsigned int batch);
+
+/*
+ * Fused LSTM gate kernel (lib/muscle/).  Weights are repacked at init into
+ * a gate-interleaved int8 layout over the concatenated [x; h] input,
+ * packed[unit][col / 2][gate][col % 2], so a single pass over the input
+ * feeds all four gates and every column pair is one pmaddwd/vpdpwssd
+ * (or NEON widening multiply) against the s16 activations.  The SIMD path
+ * is chosen once at boot.
+ */
+#define MUSCLE_GATE_I		0
+#define MUSCLE_GATE_F		1
+#define MUSCLE_GATE_G		2
+#define MUSCLE_GATE_O		3
+#define MUSCLE_GATES		4
+
+#define MUSCLE_LSTM_MAX_HIDDEN	64
+#define MUSCLE_LSTM_MAX_COLS	80	/* input + hidden, padded */
+
+/* Row-major tables as produced by the offline .hex pipeline */
+struct muscle_lstm_weights {
+	unsigned int input;
+	unsigned int hidden;
+	const muscle_fixed *w[MUSCLE_GATES];	/* hidden × input */
+	const muscle_fixed *r[MUSCLE_GATES];	/* hidden × hidden, NULL if absent */
+	const muscle_fixed *b[MUSCLE_GATES];	/* hidden */
+	muscle_fixed forget_bias;		/* folded into b[F] */
+};
+
+struct muscle_lstm {
+	unsigned int input;
+	unsigned int hidden;
+	unsigned int cols;			/* input + hidden, padded to 4 */
+	s8 *packed;				/* see above */
+	s32 *scale;				/* [hidden][MUSCLE_GATES] */
+	muscle_fixed *bias;			/* [hidden][MUSCLE_GATES] */
+};
+
+int muscle_lstm_pack(struct muscle_lstm *lstm, const struct muscle_lstm_weights *w);
+void muscle_lstm_free(struct muscle_lstm *lstm);
+void muscle_lstm_gates(const struct muscle_lstm *lstm, const s16 *xh,
+		       muscle_fixed *gates);
+void muscle_lstm_step(const struct muscle_lstm *lstm, const muscle_fixed *x,
+		      muscle_fixed *h, muscle_fixed *c);
+const char *muscle_lstm_impl_name(void);
+
+/*
+ * Layer blocks.  MUSCLE_DENSE(), MUSCLE_LSTM_CELL() and MUSCLE_AUTOENC()
+ * declare a layer type of one shape.  Its passes are always inlined over
+ * the bodies below with that shape as constants, so every muscle gets
+ * the same kernel specialised for its own dimensions, unrolled and
+ * vectorised by the compiler.  Weight tables have one layout for all of
+ * them: row-major [out][in] Q12 followed by bias[out], as the .hex
+ * sources and blobs store them.  muscle_qmat_gemv()/gemm() are the same
+ * bodies for shapes known only at run time.
+ */
+enum muscle_act {
+	MUSCLE_ACT_NONE,
+	MUSCLE_ACT_RELU,
+	MUSCLE_ACT_SIGMOID,
+	MUSCLE_ACT_TANH,
+};
+
+static __always_inline muscle_fixed muscle_activate(muscle_fixed x, enum muscle_act act)
+{
+	switch (act) {
+	case MUSCLE_ACT_RELU:
+		return muscle_relu(x);
+	case MUSCLE_ACT_SIGMOID:
+		return muscle_sigmoid(x);
+	case MUSCLE_ACT_TANH:
+		return muscle_tanh(x);
+	default:
+		return x;
+	}
+}
+
+/* y = act(bias + W·x), one dequantizing multiply per row; cols <= MUSCLE_QMAT_MAX_COLS */
+static __always_inline void muscle_dense_gemv(const struct muscle_qmat *m,
+					      const muscle_fixed *x, muscle_fixed *y,
+					      unsigned int rows, unsigned int cols,
+					      unsigned int bits, enum muscle_act act)
+{
+	s16 x16[MUSCLE_QMAT_MAX_COLS];
+	unsigned int r, c;
+
+	for (c = 0; c < cols; c++)
+		x16[c] = muscle_act16(x[c]);
+
+	for (r = 0; r < rows; r++) {
+		muscle_fixed b = m->bias ? m->bias[r] : 0;
+		s64 acc = 0;
+
+		if (bits == 8) {
+			const s8 *q = (const s8 *)m->q + r * cols;
+			s32 acc32 = 0;	/* 127 · 32767 · 80 cols fits */
+
+			for (c = 0; c < cols; c++)
+				acc32 += q[c] * x16[c];
+			acc = acc32;
+		} else {
+			const s16 *q = (const s16 *)m->q + r * cols;
+
+			for (c = 0; c < cols; c++)
+				acc += q[c] * x16[c];
+		}
+		y[r] = muscle_activate(muscle_fx_add_sat(b, muscle_dequant(acc, m->scale[r])), act);
+	}
+}
+
+/*
+ * Batch of MUSCLE_GEMM_BLOCK input vectors per pass: every weight is
+ * loaded once and multiplied into one accumulator per vector, so weight
+ * traffic is amortized over the batch and the inner loop vectorizes.
+ * X is [batch][cols], Y [batch][rows].
+ */
+#define MUSCLE_GEMM_BLOCK	4
+
+static __always_inline void muscle_dense_gemm(const struct muscle_qmat *m,
+					      const muscle_fixed *x, muscle_fixed *y,
+					      unsigned int batch, unsigned int rows,
+					      unsigned int cols, unsigned int bits,
+					      enum muscle_act act)
+{
+	s16 x16[MUSCLE_GEMM_BLOCK][MUSCLE_QMAT_MAX_COLS];
+	unsigned int b0, r, c, k;
+
+	for (b0 = 0; b0 < batch; b0 += MUSCLE_GEMM_BLOCK) {
+		unsigned int nb = batch - b0 < MUSCLE_GEMM_BLOCK ? batch - b0 : MUSCLE_GEMM_BLOCK;
+
+		/* Short final block: the unused lanes multiply zeros */
+		for (k = 0; k < MUSCLE_GEMM_BLOCK; k++)
+			for (c = 0; c < cols; c++)
+				x16[k][c] = k < nb ? muscle_act16(x[(b0 + k) * cols + c]) : 0;
+
+		for (r = 0; r < rows; r++) {
+			muscle_fixed b = m->bias ? m->bias[r] : 0;
+			s64 acc[MUSCLE_GEMM_BLOCK] = {0};
+
+			if (bits == 8) {
+				const s8 *q = (const s8 *)m->q + r * cols;
+
+				for (c = 0; c < cols; c++)
+					for (k = 0; k < MUSCLE_GEMM_BLOCK; k++)
+						acc[k] += q[c] * x16[k][c];
+			} else {
+				const s16 *q = (const s16 *)m->q + r * cols;
+
+				for (c = 0; c < cols; c++)
+					for (k = 0; k < MUSCLE_GEMM_BLOCK; k++)
+						acc[k] += q[c] * x16[k][c];
+			}
+			for (k = 0; k < nb; k++)
+				y[(b0 + k) * rows + r] = muscle_activate(
+					muscle_fx_add_sat(b, muscle_dequant(acc[k], m->scale[r])), act);
+		}
+	}
+}
+
+/* Σ (x - y)² over n entries, saturating */
+static __always_inline muscle_fixed muscle_sq_err(const muscle_fixed *x,
+						  const muscle_fixed *y, unsigned int n)
+{
+	muscle_fixed loss = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		muscle_fixed diff = muscle_fx_sat((s64)x[i] - y[i]);
+
+		loss = muscle_fx_add_sat(loss, muscle_fx_mul(diff, diff));
+	}
+	return loss;
+}
+
+/*
+ * struct _name: an _in → _out layer quantized to _bits, act applied to
+ * every output.  _name##_init() copies what it needs of w and bias.
+ */
+#define MUSCLE_DENSE(_name, _in, _out, _bits, _act)				\
+struct _name {									\
+	struct muscle_qmat w;							\
+};										\
+static inline int _name##_init(struct _name *l, const muscle_fixed *w,		\
+			       const muscle_fixed *bias)			\
+{										\
+	BUILD_BUG_ON((_in) > MUSCLE_QMAT_MAX_COLS);				\
+	BUILD_BUG_ON((_bits) != 8 && (_bits) != 16);				\
+	return muscle_qmat_init(&l->w, w, bias, _out, _in, _bits);		\
+}										\
+static inline void _name##_free(struct _name *l)				\
+{										\
+	muscle_qmat_free(&l->w);						\
+}										\
+static inline bool _name##_ready(const struct _name *l)				\
+{										\
+	return l->w.q;								\
+}										\
+static __always_inline void _name##_forward(const struct _name *l,		\
+					    const muscle_fixed *x,		\
+					    muscle_fixed *y)			\
+{										\
+	muscle_dense_gemv(&l->w, x, y, _out, _in, _bits, _act);		\
+}										\
+static __always_inline void _name##_forward_batch(const struct _name *l,	\
+						  const muscle_fixed *x,	\
+						  muscle_fixed *y,		\
+						  unsigned int batch)		\
+{										\
+	muscle_dense_gemm(&l->w, x, y, batch, _out, _in, _bits, _act);	\
+}
+
+/*
+ * struct _name: an LSTM cell over _in inputs with _hidden units on the
+ * fused gate kernel.  _name##_init() takes the I, F, G, O tables of each
+ * kind consecutively (r may be NULL for a cell without recurrence
+ * weights); forget_bias is folded into b[F].
+ */
+#define MUSCLE_LSTM_CELL(_name, _in, _hidden)					\
+struct _name {									\
+	struct muscle_lstm lstm;						\
+};										\
+static inline int _name##_init(struct _name *l,					\
+			       const muscle_fixed *const *w,			\
+			       const muscle_fixed *const *r,			\
+			       const muscle_fixed *const *b,			\
+			       muscle_fixed forget_bias)			\
+{										\
+	struct muscle_lstm_weights lw = {					\
+		.input		= _in,						\
+		.hidden		= _hidden,					\
+		.forget_bias	= forget_bias,					\
+	};									\
+	unsigned int g;								\
+										\
+	BUILD_BUG_ON((_hidden) > MUSCLE_LSTM_MAX_HIDDEN);			\
+	BUILD_BUG_ON((_in) + (_hidden) > MUSCLE_LSTM_MAX_COLS);		\
+	for (g = 0; g < MUSCLE_GATES; g++) {					\
+		lw.w[g] = w[g];							\
+		lw.r[g] = r ? r[g] : NULL;					\
+		lw.b[g] = b[g];							\
+	}									\
+	return muscle_lstm_pack(&l->lstm, &lw);					\
+}										\
+static inline void _name##_free(struct _name *l)				\
+{										\
+	muscle_lstm_free(&l->lstm);						\
+}										\
+static __always_inline void _name##_step(const struct _name *l,		\
+					 const muscle_fixed *x,			\
+					 muscle_fixed *h, muscle_fixed *c)		\
+{										\
+	muscle_lstm_step(&l->lstm, x, h, c);					\
+}
+
+/*
+ * struct _name: an _in → _hidden → _in autoencoder, ReLU code, linear
+ * reconstruction.  _name##_loss() is the squared reconstruction error
+ * and leaves the code in h.
+ */
+#define MUSCLE_AUTOENC(_name, _in, _hidden, _bits)				\
+MUSCLE_DENSE(_name##_enc, _in, _hidden, _bits, MUSCLE_ACT_RELU)			\
+MUSCLE_DENSE(_name##_dec, _hidden, _in, _bits, MUSCLE_ACT_NONE)			\
+struct _name {									\
+	struct _name##_enc enc;							\
+	struct _name##_dec dec;							\
+};										\
+static inline int _name##_init(struct _name *ae,				\
+			       const muscle_fixed *enc_w, const muscle_fixed *enc_b, \
+			       const muscle_fixed *dec_w, const muscle_fixed *dec_b) \
+{										\
+	int ret = _name##_enc_init(&ae->enc, enc_w, enc_b);			\
+										\
+	if (ret)								\
+		return ret;							\
+	ret = _name##_dec_init(&ae->dec, dec_w, dec_b);				\
+	if (ret)								\
+		_name##_enc_free(&ae->enc);					\
+	return ret;								\
+}										\
+static inline void _name##_free(struct _name *ae)				\
+{										\
+	_name##_dec_free(&ae->dec);						\
+	_name##_enc_free(&ae->enc);						\
+}										\
+static __always_inline muscle_fixed _name##_loss(const struct _name *ae,	\
+						 const muscle_fixed *x,		\
+						 muscle_fixed *h)		\
+{										\
+	muscle_fixed recon[_in];						\
+										\
+	_name##_enc_forward(&ae->enc, x, h);					\
+	_name##_dec_forward(&ae->dec, h, recon);				\
+	return muscle_sq_err(x, recon, _in);					\
+}										\
+/* Summed loss over batch inputs; h and recon are [batch][_hidden / _in] */	\
+static __always_inline s64 _name##_loss_batch(const struct _name *ae,		\
+					      const muscle_fixed *x,		\
+					      muscle_fixed *h,			\
+					      muscle_fixed *recon,		\
+					      unsigned int batch)		\
+{										\
+	unsigned int b;								\
+	s64 sum = 0;								\
+										\
+	_name##_enc_forward_batch(&ae->enc, x, h, batch);			\
+	_name##_dec_forward_batch(&ae->dec, h, recon, batch);			\
+	for (b = 0; b < batch; b++)						\
+		sum += muscle_sq_err(x + b * (_in), recon + b * (_in), _in);	\
+	return sum;								\
+}
+
+/*
+ * Versioned weight blobs (lib/muscle/muscle_weights.c).  Little endian:
+ * a header, a directory of nr_tables entries, then the Q12 tables, each
+ * 4-byte aligned.  crc is crc32_le over everything after the header.
+ * tools/muscle/mkblob.py builds them from the .hex sources.
+ */
+#define MUSCLE_BLOB_MAGIC	0x5753554d	/* "MUSW" */
+#define MUSCLE_BLOB_VERSION	1
+#define MUSCLE_BLOB_NAME_LEN	16
+
+struct muscle_blob_hdr {
+	__le32 magic;
+	__le16 version;
+	__le16 nr_tables;
+	__le32 generation;			/* weight set version, 0 = built-in */
+	__le32 crc;
+	char muscle[MUSCLE_BLOB_NAME_LEN];
+} __packed;
+
+struct muscle_blob_table {
+	char name[MUSCLE_BLOB_NAME_LEN];
+	__le32 count;				/* muscle_fixed entries */
+	__le32 offset;				/* from the start of the blob */
+} __packed;
+
+#define MUSCLE_WSET_MAX_TABLES	16
+
+struct muscle_wtable {
+	const char *name;
+	const muscle_fixed *builtin;		/* from the .hex sources */
+	unsigned int builtin_count;		/* 0 if the source is missing */
+	unsigned int count;			/* what the model expects */
+};
+
+#define MUSCLE_WTABLE(_name, _builtin, _count) {			\
+	.name = _name,							\
+	.builtin = _builtin,						\
+	.builtin_count = ARRAY_SIZE(_builtin),				\
+	.count = _count,						\
+}
+
+/*
+ * One per muscle.  build() turns validated tables (in ws->tables order)
+ * into a model that owns all its memory, or returns an ERR_PTR; model
+ * points at the muscle's RCU-published model pointer.
+ */
+struct muscle_wset {
+	const char *name;
+	const struct muscle_wtable *tables;
+	unsigned int nr_tables;
+	void *(*build)(const muscle_fixed *const *t);
+	void (*release)(void *model);
+	void __rcu **model;
+
+	/* private to muscle_weights.c */
+	struct kobject kobj;
+	struct mutex lock;
+	void *builtin;
+	u32 generation;
+};
+
+int muscle_wset_register(struct muscle_wset *ws);
+
+/*
+ * For muscles that train their live model in place: the resident
+ * built-in model must stay as shipped for rollback, so fork it into a
+ * private copy before training, and never train the built-in one.
+ */
+int muscle_wset_fork(struct muscle_wset *ws);
+
+/*
+ * Publish m, trained from the live model from, at the live generation.
+ * Returns -EAGAIN, leaving m to the caller, if from was swapped out.
+ */
+int muscle_wset_update(struct muscle_wset *ws, const void *from, void *m);
+
+static inline bool muscle_wset_is_builtin(const struct muscle_wset *ws, const void *m)
+{
+	return m && m == ws->builtin;
+}
+
+/*
+ * Access-stream features shared by the cache and IO LSTMs.  Both feed
+ * the same MUSCLE_STREAM_FEATURES layout for the position stream of one
+ * context (inode or device): log-bucketed recent deltas, newest first,
+ * plus stride-repeat, revisit, context-switch and context-id inputs.
+ * Output heads predict an index into muscle_stream_strides[].
+ */
+#define MUSCLE_STREAM_HIST	4
+#define MUSCLE_STREAM_SEEN	8
+
+#define MUSCLE_STREAM_DELTA	0	/* .. + MUSCLE_STREAM_HIST - 1 */
+#define MUSCLE_STREAM_STRIDE	4	/* delta repeats the previous one */
+#define MUSCLE_STREAM_LOOP	5	/* position seen in the last 8 */
+#define MUSCLE_STREAM_FRESH	6	/* first access in a new context */
+#define MUSCLE_STREAM_CTX	7	/* hashed context id */
+#define MUSCLE_STREAM_FEATURES	8
+
+#define MUSCLE_STREAM_VOCAB	16
+
+struct muscle_stream {
+	u64 ctx;
+	u64 last;
+	s64 delta[MUSCLE_STREAM_HIST];
+	u64 seen[MUSCLE_STREAM_SEEN];
+	unsigned int seen_pos;
+};
+
+extern const s32 muscle_stream_strides[MUSCLE_STREAM_VOCAB];
+
+void muscle_stream_encode(struct muscle_stream *st, u64 ctx, u64 pos,
+			  muscle_fixed x[MUSCLE_STREAM_FEATURES]);
+int muscle_stream_argmax(const muscle_fixed *logits, unsigned int n,
+			 muscle_fixed margin);
+
+/*
+ * Asynchronous inference.  Hot paths push a compact event onto their
+ * muscle's per-CPU SPSC ring and return.  One engine work item per CPU
+ * drains the rings of every muscle on that CPU, a batch of up to
+ * MUSCLE_RING_BATCH events per muscle in turn, into each muscle's drain
+ * callback, which runs the network and publishes the result.  So a
+ * wakeup serves all the muscles at once, and each batch runs on weights
+ * the previous event left in cache.  A full ring drops the event rather
+ * than block the caller.
+ */
+#define MUSCLE_RING_SIZE	256
+#define MUSCLE_RING_BATCH	32
+#define MUSCLE_EVQ_MAX		8	/* muscles with a ring */
+
+/*
+ * Payload is muscle-defined.  id names the task an event is about for
+ * drains that act on it later, when its pid may have been reused.
+ */
+struct muscle_event {
+	u64 a, b, c;
+	u32 d, e;
+	u64 id;
+};
+
+struct muscle_evq;
+struct muscle_ring;
+typedef void (*muscle_evq_fn)(struct muscle_evq *q, int cpu,
+			      const struct muscle_event *ev, unsigned int n);
+
+struct muscle_evq {
+	const char *name;
+	muscle_evq_fn drain;
+	struct muscle_ring __percpu *rings;
+};
+
+int muscle_evq_init(struct muscle_evq *q, const char *name, muscle_evq_fn drain);
+bool muscle_evq_push(struct muscle_evq *q, const struct muscle_event *ev);
+unsigned long muscle_evq_dropped(const struct muscle_evq *q);
+
+/*
+ * Cost and benefit counters (lib/muscle/muscle_stats.c), per CPU and
+ * summed on read under debugfs muscle/<name>/:
+ *
+ *   stats     one row per CPU and a total, for the counters in mask,
+ *             plus the ring's dropped events if the muscle has one
+ *   latency   log2 histogram of forward-pass time
+ *   reset     write anything to zero the counters
+ *
+ * Counting is always on.  Timing (the _NS counters and the histogram)
+ * only while stats_timing or a throttle wants it, since it costs two
+ * clock reads.
+ */
+enum muscle_stat {
+	MUSCLE_STAT_CALLS,		/* hook invocations */
+	MUSCLE_STAT_INFER,		/* forward passes */
+	MUSCLE_STAT_INFER_NS,		/* time in them */
+	MUSCLE_STAT_LOCK_NS,		/* time waiting for shared state */
+	MUSCLE_STAT_ISSUED,		/* actions taken on a prediction */
+	MUSCLE_STAT_HITS,		/* predictions that came true */
+	MUSCLE_STAT_MISSES,		/* ... and that did not */
+	MUSCLE_STAT_WASTED_BYTES,	/* prefetched and never used */
+	MUSCLE_STAT_ABSTAIN,		/* passes with no confident answer */
+	MUSCLE_STAT_OVERRIDES,		/* decisions other than the default policy's */
+	MUSCLE_STAT_KILLS,
+	MUSCLE_STAT_FALSE_POS,		/* see the muscle */
+	MUSCLE_STAT_SAVED_NS,		/* signed: estimated time those actions saved */
+	MUSCLE_STAT_THROTTLED,		/* calls bypassed by the throttle */
+	MUSCLE_STAT_LEARN,		/* online training samples applied */
+	MUSCLE_STAT_LEARN_NS,		/* time in training, timed whenever it runs */
+	MUSCLE_STAT_LEARN_DROPPED,	/* samples lost to a full queue or the budget */
+	MUSCLE_STAT_NR,
+};
+
+#define MUSCLE_STAT_HIST	16	/* buckets: < 128 ns, then doubling */
+#define MUSCLE_STAT_HIST_SHIFT	7
+
+struct muscle_stats_cpu {
+	u64 v[MUSCLE_STAT_NR];
+	u64 hist[MUSCLE_STAT_HIST];
+};
+
+struct muscle_stats {
+	const char *name;
+	u32 mask;			/* BIT(MUSCLE_STAT_*) reported */
+	struct muscle_stats_cpu __percpu *pcpu;
+	struct muscle_evq *evq;		/* optional */
+	struct dentry *dir;		/* muscle/<name>/, once registered */
+};
+
+#define DEFINE_MUSCLE_STATS(_var, _name, _mask)				\
+	static DEFINE_PER_CPU(struct muscle_stats_cpu, _var##_pcpu);	\
+	static struct muscle_stats _var = {				\
+		.name = _name,						\
+		.mask = _mask,						\
+		.pcpu = &_var##_pcpu,					\
+	}
+
+DECLARE_STATIC_KEY_FALSE(muscle_stats_timing_key);
+
+struct dentry;
+int muscle_stats_register(struct muscle_stats *ms, struct muscle_evq *evq);
+u64 muscle_stat_read(const struct muscle_stats *ms, enum muscle_stat stat);
+void __muscle_stat_time(struct muscle_stats *ms, enum muscle_stat stat, u64 t0);
+struct dentry *muscle_debugfs_dir(void);
+
+#define muscle_stat_add(ms, stat, n)	this_cpu_add((ms)->pcpu->v[stat], n)
+#define muscle_stat_inc(ms, stat)	muscle_stat_add(ms, stat, 1)
+
+/* Start of a timed section: 0, and nothing to time, unless stats_timing */
+static __always_inline u64 muscle_stat_clock(void)
+{
+	return static_branch_unlikely(&muscle_stats_timing_key) ? local_clock() : 0;
+}
+
+/* Add the time since t0 to stat; MUSCLE_STAT_INFER_NS also feeds latency */
+static __always_inline void muscle_stat_time(struct muscle_stats *ms,
+					     enum muscle_stat stat, u64 t0)
+{
+	if (t0)
+		__muscle_stat_time(ms, stat, t0);
+}
+
+/* References on stats timing, for users other than stats_timing itself */
+void muscle_stats_timing_get(void);
+void muscle_stats_timing_put(void);
+
+/*
+ * Self-throttling (lib/muscle/muscle_throttle.c).  While a muscle's
+ * throttle parameter is set, every throttle_period_ms its net benefit is
+ * estimated from its counters: SAVED_NS less INFER_NS, LOCK_NS and
+ * LEARN_NS.  Each period it comes out negative the muscle runs half as
+ * often (1 in 2^level calls, the rest bypassed); each period it pays for
+ * itself it runs twice as often.  Past MUSCLE_THROTTLE_MAX it is bypassed outright,
+ * and re-probed at the lowest rate every throttle_probe_ms.  Holds a
+ * reference on stats timing while set.
+ */
+#define MUSCLE_THROTTLE_MAX		6
+#define MUSCLE_THROTTLE_BYPASS		(MUSCLE_THROTTLE_MAX + 1)
+
+struct muscle_throttle {
+	struct static_key_false key;	/* on while level > 0 */
+	unsigned int level;		/* 0 (every call) .. MUSCLE_THROTTLE_BYPASS */
+	unsigned int __percpu *count;
+	struct muscle_stats *stats;
+	bool on;
+	bool ready;
+	bool running;			/* work queued and timing held */
+	s64 net;			/* last period's estimate, ns */
+	u64 last[MUSCLE_STAT_NR];	/* counters at the last period */
+	unsigned long probe_at;
+	unsigned long probes;
+	struct delayed_work work;
+};
+
+extern const struct kernel_param_ops muscle_throttle_ops;
+void muscle_throttle_register(struct muscle_throttle *t);
+bool __muscle_throttled(struct muscle_throttle *t);
+
+#define DEFINE_MUSCLE_THROTTLE(_var, _stats)					\
+	static DEFINE_PER_CPU(unsigned int, _var##_count);			\
+	static struct muscle_throttle _var = {					\
+		.key	= STATIC_KEY_FALSE_INIT,				\
+		.count	= &_var##_count,					\
+		.stats	= &_stats,						\
+	};									\
+	module_param_cb(throttle, &muscle_throttle_ops, &_var, 0644);		\
+	MODULE_PARM_DESC(throttle, "Back off while estimated cost exceeds benefit")
+
+/* True if this call should skip the muscle; counts it as THROTTLED */
+static __always_inline bool muscle_throttled(struct muscle_throttle *t)
+{
+	return static_branch_unlikely(&t->key) && __muscle_throttled(t);
+}
+
+/*
+ * Capture (lib/muscle/muscle_trace.c).  While a hook's bit is set in
+ * trace_mask it copies its inputs, and what the live model made of them,
+ * into a per-CPU relay buffer (debugfs muscle/trace/cpuN) as fixed
+ * 64-byte records in native byte order.  Every sub-buffer starts with a
+ * MUSCLE_TRACE_HDR record.  tools/muscle/capture.sh collects the files,
+ * tools/muscle/bench/muscle-replay scores any weight set against them.
+ * Off, a hook pays one patched-out branch.
+ */
+#define MUSCLE_TRACE_MAGIC	0x5453554d	/* "MUST" */
+#define MUSCLE_TRACE_VERSION	1
+#define MUSCLE_TRACE_SCHED_MAX	16		/* state entries per record */
+
+enum muscle_trace_type {
+	MUSCLE_TRACE_CACHE,		/* ev: see muscle_cache_readahead() */
+	MUSCLE_TRACE_IO,		/* ev: see muscle_io_predict() */
+	MUSCLE_TRACE_SECURITY,		/* ev: as queued for scoring */
+	MUSCLE_TRACE_SCHED,		/* sched */
+	MUSCLE_TRACE_TYPES,
+	MUSCLE_TRACE_HDR = 0xff,
+};
+
+struct muscle_trace_rec {
+	u64 ts;				/* local_clock() */
+	u8 type;
+	u8 flags;			/* reserved, 0 */
+	u16 cpu;
+	u32 pid;			/* current */
+	union {
+		struct {
+			u32 magic;
+			u16 version;
+			u16 size;	/* sizeof(struct muscle_trace_rec) */
+			u64 seq;	/* sub-buffers started on this CPU */
+			u64 dropped;	/* records lost on this CPU so far */
+		} hdr;
+		struct muscle_event ev;
+		struct {
+			s16 state[MUSCLE_TRACE_SCHED_MAX];	/* as the DQN reads it */
+			u8 n;		/* candidates, leftmost first */
+			s8 action;	/* model's pick, -1 for none */
+			u16 pad;
+			s32 q;		/* Q of action */
+		} sched;
+		u8 raw[48];
+	};
+};
+
+#ifdef CONFIG_RELAY
+DECLARE_STATIC_KEY_FALSE(muscle_trace_key);
+extern unsigned int muscle_trace_mask;
+
+void muscle_trace_record(struct muscle_trace_rec *rec);
+
+static __always_inline bool muscle_trace_on(enum muscle_trace_type type)
+{
+	return static_branch_unlikely(&muscle_trace_key) &&
+	       (READ_ONCE(muscle_trace_mask) & BIT(type));
+}
+#else
+static inline void muscle_trace_record(struct muscle_trace_rec *rec) { }
+static inline bool muscle_trace_on(enum muscle_trace_type type) { return false; }
+#endif
+
+static __always_inline void muscle_trace_event(enum muscle_trace_type type,
+					       const struct muscle_event *ev)
+{
+	if (muscle_trace_on(type)) {
+		struct muscle_trace_rec rec = { .type = type, .ev = *ev };
+
+		muscle_trace_record(&rec);
+	}
+}
+
+/* MuscleIO scheduling hints, returned per inserted request */
+enum muscle_io_hint {
+	MUSCLE_IO_HINT_NONE,
+	MUSCLE_IO_HINT_MERGE,		/* contiguous follow-up expected: hold for merge */
+	MUSCLE_IO_HINT_DISPATCH,	/* sync write / flush expected: dispatch now */
+};
+
+/*
+ * zmuscle page compressor (lib/muscle/muscle_compress.c).  Callers own
+ * the work memory: a match hash table plus room for one transformed
+ * input; longer inputs skip the word transforms.  muscle_compress_pages()
+ * packs a batch of pages into a scatterlist using per-CPU arenas instead.
+ */
+#define MUSCLE_COMPRESS_HASH_BITS	12
+#define MUSCLE_COMPRESS_XFORM_MAX	4096
+#define MUSCLE_COMPRESS_WRKMEM		((sizeof(u32) << MUSCLE_COMPRESS_HASH_BITS) + \
+					 MUSCLE_COMPRESS_XFORM_MAX)
 
 /* Common weights (baked in — trained offline) */
 extern const muscle_fixed muscle_sine_weights[40*40 + 40*40 + 40*1 + 40 + 40 + 1];
 
+/*
+ * Hook switches (lib/muscle/muscle_switch.c).  Each hook below is an
+ * inline test of its muscle's key in front of the out-of-line body, so a
+ * disabled muscle costs its callers a patched-out branch and not even the
+ * call.  Keys start enabled and follow the muscle's enable parameter,
+ * from the command line (muscle_cache.enable=0) or at runtime
+ * (/sys/module/muscle_cache/parameters/enable).  Work already queued by a
+ * hook still drains after it is switched off.
+ */
+struct muscle_switch {
+	struct static_key_true *key;
+	const char *name;
+	bool on;
+	bool ready;			/* key follows on once set */
+};
+
+extern const struct kernel_param_ops muscle_switch_ops;
+void muscle_switch_ready(struct muscle_switch *sw);
+
+#define DEFINE_MUSCLE_SWITCH(_key, _name)					\
+	DEFINE_STATIC_KEY_TRUE(_key);						\
+	static struct muscle_switch _key##_switch = {				\
+		.key	= &_key,						\
+		.name	= _name,						\
+		.on	= true,							\
+	};									\
+	module_param_cb(enable, &muscle_switch_ops, &_key##_switch, 0644);	\
+	MODULE_PARM_DESC(enable, "Run the " _name " hooks (0 = skip them)")
+
+DECLARE_STATIC_KEY_TRUE(muscle_sched_key);
+DECLARE_STATIC_KEY_TRUE(muscle_cache_key);
+DECLARE_STATIC_KEY_TRUE(muscle_io_key);
+DECLARE_STATIC_KEY_TRUE(muscle_security_key);
+DECLARE_STATIC_KEY_TRUE(muscle_grid_key);
+
 /* Core muscle APIs */
-void muscle_scheduler_tick(struct rq *rq);
-int muscle_cache_predict(u64 block);
-void muscle_security_check(u64 syscall_nr, u64 arg1, u64 arg2);
-void muscle_io_predict(struct request_queue *q, struct request *rq);
-int muscle_compress(void *dst, size_t *dstlen, const void *src, size_t srclen);
+struct readahead_control;
+struct page;
+struct path;
+struct scatterlist;
+void __muscle_scheduler_tick(struct rq *rq);
+int muscle_sched_suggest_cpu(struct task_struct *p, int prev_cpu);
+int __muscle_cache_predict(u64 block);
+void __muscle_cache_readahead(struct readahead_control *ractl);
+void __muscle_cache_ra_marker(struct readahead_control *ractl);
+void __muscle_security_check(u64 syscall_nr, u64 arg1, u64 arg2);
+enum muscle_io_hint __muscle_io_predict(struct request_queue *q, struct request *rq);
+void muscle_io_queue_exit(struct request_queue *q);
+int muscle_compress(void *dst, size_t *dstlen, const void *src, size_t srclen,
+		    void *wrkmem);
+ssize_t muscle_compress_pages(struct page **pages, unsigned int nr,
+			      struct scatterlist *dst, unsigned int nents,
+			      unsigned int *lens);
 int muscle_decompress(void *dst, size_t *dstlen, const void *src, size_t srclen);
-void muscle_grid_walk(struct path *path);
-float muscle_sine_predict(float x);
+void __muscle_grid_walk(struct path *path);
+/* The sine regressor, Q12 in and out; integer only, safe in any context */
+muscle_fixed muscle_sine_forward(muscle_fixed x);
+#ifndef __KERNEL__
+static inline float muscle_sine_predict(float x)
+{
+	return muscle_fixed_to_float(muscle_sine_forward(muscle_float_to_fixed(x)));
+}
+#endif
+
+static __always_inline void muscle_scheduler_tick(struct rq *rq)
+{
+	if (static_branch_likely(&muscle_sched_key))
+		__muscle_scheduler_tick(rq);
+}
+
+/* Predicted next block, or -1 for none */
+static __always_inline int muscle_cache_predict(u64 block)
+{
+	if (!static_branch_likely(&muscle_cache_key))
+		return -1;
+	return __muscle_cache_predict(block);
+}
+
+static __always_inline void muscle_cache_readahead(struct readahead_control *ractl)
+{
+	if (static_branch_likely(&muscle_cache_key))
+		__muscle_cache_readahead(ractl);
+}
+
+static __always_inline void muscle_cache_ra_marker(struct readahead_control *ractl)
+{
+	if (static_branch_likely(&muscle_cache_key))
+		__muscle_cache_ra_marker(ractl);
+}
+
+static __always_inline void muscle_security_check(u64 syscall_nr, u64 arg1, u64 arg2)
+{
+	if (static_branch_likely(&muscle_security_key))
+		__muscle_security_check(syscall_nr, arg1, arg2);
+}
+
+static __always_inline enum muscle_io_hint muscle_io_predict(struct request_queue *q,
+							     struct request *rq)
+{
+	if (!static_branch_likely(&muscle_io_key))
+		return MUSCLE_IO_HINT_NONE;
+	return __muscle_io_predict(q, rq);
+}
+
+static __always_inline void muscle_grid_walk(struct path *path)
+{
+	if (static_branch_likely(&muscle_grid_key))
+		__muscle_grid_walk(path);
+}
 
 #endif /* _LINUX_MUSCLE_H */
@@ -0,0 +1,191 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM muscle
+
+#if !defined(_TRACE_MUSCLE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_MUSCLE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * Muscle decision points.  Disabled tracepoints are a patched-out branch,
+ * so hot paths can call them unconditionally; read them out-of-band with
+ * tracefs (events/muscle/) or perf.  Fixed-point values are raw Q12.
+ */
+
+TRACE_EVENT(muscle_sched_decision,
+
+	TP_PROTO(int cpu, pid_t pid, int action, int candidates, s32 q),
+
+	TP_ARGS(cpu, pid, action, candidates, q),
+
+	TP_STRUCT__entry(
+		__field(int,	cpu)
+		__field(pid_t,	pid)
+		__field(int,	action)
+		__field(int,	candidates)
+		__field(s32,	q)
+	),
+
+	TP_fast_assign(
+		__entry->cpu		= cpu;
+		__entry->pid		= pid;
+		__entry->action		= action;
+		__entry->candidates	= candidates;
+		__entry->q		= q;
+	),
+
+	TP_printk("cpu=%d pid=%d action=%d/%d q=%d",
+		  __entry->cpu, __entry->pid, __entry->action,
+		  __entry->candidates, __entry->q)
+);
+
+TRACE_EVENT(muscle_sched_migrate,
+
+	TP_PROTO(pid_t pid, int prev_cpu, int dst_cpu, s32 gain),
+
+	TP_ARGS(pid, prev_cpu, dst_cpu, gain),
+
+	TP_STRUCT__entry(
+		__field(pid_t,	pid)
+		__field(int,	prev_cpu)
+		__field(int,	dst_cpu)
+		__field(s32,	gain)
+	),
+
+	TP_fast_assign(
+		__entry->pid		= pid;
+		__entry->prev_cpu	= prev_cpu;
+		__entry->dst_cpu	= dst_cpu;
+		__entry->gain		= gain;
+	),
+
+	TP_printk("pid=%d prev_cpu=%d dst_cpu=%d gain=%d",
+		  __entry->pid, __entry->prev_cpu, __entry->dst_cpu, __entry->gain)
+);
+
+TRACE_EVENT(muscle_cache_readahead,
+
+	TP_PROTO(u64 ctx, unsigned long index, s32 stride, unsigned long pages),
+
+	TP_ARGS(ctx, index, stride, pages),
+
+	TP_STRUCT__entry(
+		__field(u64,		ctx)
+		__field(unsigned long,	index)
+		__field(s32,		stride)
+		__field(unsigned long,	pages)
+	),
+
+	TP_fast_assign(
+		__entry->ctx		= ctx;
+		__entry->index		= index;
+		__entry->stride		= stride;
+		__entry->pages		= pages;
+	),
+
+	TP_printk("ctx=%llx index=%lu stride=%d pages=%lu",
+		  __entry->ctx, __entry->index, __entry->stride, __entry->pages)
+);
+
+TRACE_EVENT(muscle_io_hint,
+
+	TP_PROTO(int queue, u64 sector, int pred, int hint),
+
+	TP_ARGS(queue, sector, pred, hint),
+
+	TP_STRUCT__entry(
+		__field(int,	queue)
+		__field(u64,	sector)
+		__field(int,	pred)
+		__field(int,	hint)
+	),
+
+	TP_fast_assign(
+		__entry->queue		= queue;
+		__entry->sector		= sector;
+		__entry->pred		= pred;
+		__entry->hint		= hint;
+	),
+
+	TP_printk("queue=%d sector=%llu pred=%d hint=%d",
+		  __entry->queue, __entry->sector, __entry->pred, __entry->hint)
+);
+
+TRACE_EVENT(muscle_security_verdict,
+
+	TP_PROTO(pid_t pid, u64 nr, s32 err, unsigned int window, bool killed),
+
+	TP_ARGS(pid, nr, err, window, killed),
+
+	TP_STRUCT__entry(
+		__field(pid_t,		pid)
+		__field(u64,		nr)
+		__field(s32,		err)
+		__field(unsigned int,	window)
+		__field(bool,		killed)
+	),
+
+	TP_fast_assign(
+		__entry->pid		= pid;
+		__entry->nr		= nr;
+		__entry->err		= err;
+		__entry->window		= window;
+		__entry->killed		= killed;
+	),
+
+	TP_printk("pid=%d syscall=%llu err=%d window=%u %s",
+		  __entry->pid, __entry->nr, __entry->err, __entry->window,
+		  __entry->killed ? "killed" : "audit")
+);
+
+TRACE_EVENT(muscle_grid_prefetch,
+
+	TP_PROTO(u64 key, unsigned int len, unsigned int depth, bool queued),
+
+	TP_ARGS(key, len, depth, queued),
+
+	TP_STRUCT__entry(
+		__field(u64,		key)
+		__field(unsigned int,	len)
+		__field(unsigned int,	depth)
+		__field(bool,		queued)
+	),
+
+	TP_fast_assign(
+		__entry->key		= key;
+		__entry->len		= len;
+		__entry->depth		= depth;
+		__entry->queued		= queued;
+	),
+
+	TP_printk("key=%llx len=%u depth=%u %s",
+		  __entry->key, __entry->len, __entry->depth,
+		  __entry->queued ? "queued" : "dropped")
+);
+
+TRACE_EVENT(muscle_throttle,
+
+	TP_PROTO(const char *name, unsigned int level, s64 net),
+
+	TP_ARGS(name, level, net),
+
+	TP_STRUCT__entry(
+		__string(name,	name)
+		__field(unsigned int,	level)
+		__field(s64,	net)
+	),
+
+	TP_fast_assign(
+		__assign_str(name);
+		__entry->level		= level;
+		__entry->net		= net;
+	),
+
+	TP_printk("%s level=%u net=%lldns",
+		  __get_str(name), __entry->level, __entry->net)
+);
+
+#endif /* _TRACE_MUSCLE_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
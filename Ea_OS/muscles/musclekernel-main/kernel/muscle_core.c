@@ -1,56 +1,133 @@
 #include <linux/muscle.h>
+#include <linux/err.h>
 #include <linux/printk.h>
 #include <linux/random.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
 
-/* Tiny ReLU for fixed-point */
-static inline muscle_fixed muscle_relu(muscle_fixed x)
+#define CREATE_TRACE_POINTS
+#include <trace/events/muscle.h>
+
+/* Simple 1→40→40→1 sine regressor (MAML-trained weights) */
+#define SINE_HIDDEN	40
+
+/*
+ * The built-in set is the flat muscle_sine_weights, seen as one table
+ * per block; layer 1 keeps only the first SINE_HIDDEN slots of its
+ * 40×40 block.
+ */
+#define SINE_BLOCK(_name, _off, _count) {				\
+	.name = _name,							\
+	.builtin = muscle_sine_weights + (_off),			\
+	.builtin_count = _count,					\
+	.count = _count,						\
+}
+
+enum { SINE_L1_W, SINE_L1_B, SINE_L2_W, SINE_L2_B, SINE_OUT_W, SINE_OUT_B, SINE_TABLES };
+
+static const struct muscle_wtable sine_tables[SINE_TABLES] = {
+	[SINE_L1_W]  = SINE_BLOCK("l1_w", 0, SINE_HIDDEN),
+	[SINE_L1_B]  = SINE_BLOCK("l1_b", 40*40, SINE_HIDDEN),
+	[SINE_L2_W]  = SINE_BLOCK("l2_w", 40*40 + 40, SINE_HIDDEN * SINE_HIDDEN),
+	[SINE_L2_B]  = SINE_BLOCK("l2_b", 2*40*40 + 40, SINE_HIDDEN),
+	[SINE_OUT_W] = SINE_BLOCK("out_w", 2*40*40 + 2*40, SINE_HIDDEN),
+	[SINE_OUT_B] = SINE_BLOCK("out_b", 2*40*40 + 3*40, 1),
+};
+
+/* Quantized views of the loaded set, built by sine_build() */
+MUSCLE_DENSE(sine_in, 1, SINE_HIDDEN, 16, MUSCLE_ACT_RELU)
+MUSCLE_DENSE(sine_hidden, SINE_HIDDEN, SINE_HIDDEN, 16, MUSCLE_ACT_RELU)
+MUSCLE_DENSE(sine_head, SINE_HIDDEN, 1, 16, MUSCLE_ACT_NONE)
+
+struct sine_model {
+	struct sine_in l1;
+	struct sine_hidden l2;
+	struct sine_head out;
+};
+
+static struct sine_model __rcu *sine_model;
+
+static void sine_release(void *model)
 {
-	return x > 0 ? x : 0;
+	struct sine_model *m = model;
+
+	sine_head_free(&m->out);
+	sine_hidden_free(&m->l2);
+	sine_in_free(&m->l1);
+	kfree(m);
 }
 
-/* Simple 1→40→40→1 sine regressor (MAML-trained weights) */
-float muscle_sine_predict(float x)
+static void *sine_build(const muscle_fixed *const *t)
 {
-	muscle_fixed input = muscle_float_to_fixed(x);
-	muscle_fixed h1[40] = {0};
-	muscle_fixed h2[40] = {0};
-	const muscle_fixed *w = muscle_sine_weights;
-	int i, j;
+	struct sine_model *m;
+	int ret;
 
-	/* Layer 1 */
-	for (i = 0; i < 40; i++) {
-		h1[i] = muscle_relu(w[i] * input + w[40*40 + i]);
+	m = kzalloc(sizeof(*m), GFP_KERNEL);
+	if (!m)
+		return ERR_PTR(-ENOMEM);
+	ret = sine_in_init(&m->l1, t[SINE_L1_W], t[SINE_L1_B]);
+	if (!ret)
+		ret = sine_hidden_init(&m->l2, t[SINE_L2_W], t[SINE_L2_B]);
+	if (!ret)
+		ret = sine_head_init(&m->out, t[SINE_OUT_W], t[SINE_OUT_B]);
+	if (ret) {
+		sine_release(m);
+		return ERR_PTR(ret);
 	}
-	w += 40*40 + 40;
+	return m;
+}
+
+static struct muscle_wset sine_wset = {
+	.name      = "sine",
+	.tables    = sine_tables,
+	.nr_tables = SINE_TABLES,
+	.build     = sine_build,
+	.release   = sine_release,
+	.model     = (void __rcu **)&sine_model,
+};
+
+/* Integer-only forward pass, safe from scheduler and interrupt context */
+muscle_fixed muscle_sine_forward(muscle_fixed x)
+{
+	muscle_fixed h1[SINE_HIDDEN];
+	muscle_fixed h2[SINE_HIDDEN];
+	const struct sine_model *m;
+	muscle_fixed out = 0;
+
+	rcu_read_lock();
+	m = rcu_dereference(sine_model);
+	if (!m)
+		goto out;
+
+	/* Layer 1 */
+	sine_in_forward(&m->l1, &x, h1);
 
 	/* Layer 2 */
-	for (i = 0; i < 40; i++) {
-		muscle_fixed sum = w[40*40 + i]; /* bias */
-		for (j = 0; j < 40; j++)
-			sum += w[i*40 + j] * h1[j];
-		h2[i] = muscle_relu(sum);
-	}
-	w += 40*40 + 40;
+	sine_hidden_forward(&m->l2, h1, h2);
 
 	/* Output */
-	muscle_fixed out = w[40]; /* bias */
-	for (j = 0; j < 40; j++)
-		out += w[j] * h2[j];
-
-	return muscle_fixed_to_float(out);
+	sine_head_forward(&m->out, h2, &out);
+out:
+	rcu_read_unlock();
+	return out;
 }
 
-/* Dummy placeholder for now — real implementations follow */
-void muscle_scheduler_tick(struct rq *rq) { }
-int muscle_cache_predict(u64 block) { return 0; }
-void muscle_security_check(u64 syscall_nr, u64 arg1, u64 arg2) { }
-void muscle_io_predict(struct request_queue *q, struct request *rq) { }
-void muscle_grid_walk(struct path *path) { }
-
 static int __init muscle_init(void)
 {
+	muscle_fixed y;
+	u32 ay;
+	int ret;
+
+	ret = muscle_wset_register(&sine_wset);
+	if (ret)
+		pr_warn("MuscleSine: failed to build weights (%d)\n", ret);
 	pr_info("Muscle Linux: 7 neural muscles loaded and active\n");
-	pr_info("MuscleSine demo: sin(1.0) ≈ %.6f\n", muscle_sine_predict(1.0f));
+	/* printk has no %f: print Q12 as decimal */
+	y = muscle_sine_forward(MUSCLE_FIXED_ONE);
+	ay = y < 0 ? -(u32)y : (u32)y;
+	pr_info("MuscleSine demo: sin(1.0) ≈ %s%u.%06u\n", y < 0 ? "-" : "",
+		ay >> MUSCLE_FIXED_SHIFT,
+		(u32)(((u64)(ay & (MUSCLE_FIXED_ONE - 1)) * 1000000) >> MUSCLE_FIXED_SHIFT));
 	return 0;
 }
 
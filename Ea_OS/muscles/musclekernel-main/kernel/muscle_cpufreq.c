@@ -0,0 +1,381 @@
+#include <linux/muscle.h>
+#include <linux/cpufreq.h>
+#include <linux/irq_work.h>
+#include <linux/math64.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/sched/cpufreq.h>
+#include <linux/sched/topology.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+
+/*
+ * "musclesine" cpufreq governor.  Runs from the scheduler's util-update
+ * hook like schedutil, switching in place when the driver can fast-switch
+ * and bouncing through irq_work to a workqueue otherwise.
+ *
+ * Each policy learns a one-step-ahead predictor of its utilization with
+ * normalized LMS over the last MG_ORDER samples, a bias and, once an
+ * autocorrelation scan finds a period in the recent history, a sine and
+ * cosine of its phase taken from the MuscleSine regressor.  The policy
+ * runs at the prediction (never below the current load) plus a headroom
+ * that tracks the predictor's recent error: a few percent on steady or
+ * periodic load, growing to schedutil's 25% while it is being surprised.
+ * All of it is Q12 integer math.
+ */
+#define MG_ORDER        4
+#define MG_F_SIN        MG_ORDER
+#define MG_F_COS        (MG_ORDER + 1)
+#define MG_F_BIAS       (MG_ORDER + 2)
+#define MG_FEATURES     (MG_ORDER + 3)
+#define MG_HIST         32      /* samples per period scan, power of two */
+#define MG_MIN_PERIOD   2
+#define MG_MAX_PERIOD   16
+#define MG_W_MAX        (4 * MUSCLE_FIXED_ONE)
+
+/* Q12 angles */
+#define MG_PI           12868
+#define MG_TWO_PI       25736
+
+static unsigned int mg_step = MUSCLE_FIXED_ONE / 8;
+module_param(mg_step, uint, 0644);
+MODULE_PARM_DESC(mg_step, "NLMS step size, Q12 (default 512 = 1/8)");
+
+static unsigned int mg_headroom_min = MUSCLE_FIXED_ONE / 16;
+module_param(mg_headroom_min, uint, 0644);
+MODULE_PARM_DESC(mg_headroom_min, "Frequency headroom with a perfect predictor, Q12");
+
+static unsigned int mg_headroom_max = MUSCLE_FIXED_ONE / 4;
+module_param(mg_headroom_max, uint, 0644);
+MODULE_PARM_DESC(mg_headroom_max, "Frequency headroom cap, Q12 (1024 = schedutil's 1.25)");
+
+/* Phase features per period, from MuscleSine at init; all zero without it */
+static muscle_fixed mg_sin[MG_MAX_PERIOD + 1][MG_MAX_PERIOD];
+static muscle_fixed mg_cos[MG_MAX_PERIOD + 1][MG_MAX_PERIOD];
+
+struct mg_policy {
+    struct cpufreq_policy *policy;
+    raw_spinlock_t lock;        /* serializes the hook across policy CPUs */
+    u64 rate_ns;
+    u64 last_freq_update;
+    unsigned int next_freq;
+    bool need_update;
+
+    /* Predictor */
+    muscle_fixed hist[MG_HIST];
+    unsigned int t;             /* samples seen */
+    unsigned int period;        /* 0 when the load looks aperiodic */
+    muscle_fixed w[MG_FEATURES];
+    muscle_fixed x[MG_FEATURES];    /* features behind pred */
+    muscle_fixed pred;
+    muscle_fixed err;           /* EWMA of |error| */
+
+    /* Slow path, for drivers that cannot fast-switch */
+    struct irq_work irq_work;
+    struct work_struct work;
+    struct mutex work_lock;
+    bool work_in_progress;
+};
+
+struct mg_cpu {
+    struct update_util_data update_util;
+    struct mg_policy *mg;
+    unsigned int cpu;
+    muscle_fixed util;          /* Q12 fraction of capacity */
+    u64 last_update;
+};
+
+static DEFINE_PER_CPU(struct mg_cpu, mg_cpu);
+
+static inline muscle_fixed mg_hist(const struct mg_policy *mg, unsigned int ago)
+{
+    return mg->hist[(mg->t - 1 - ago) % MG_HIST];
+}
+
+/* Strongest autocorrelation lag over a full history window, or 0 */
+static unsigned int mg_detect_period(const struct mg_policy *mg)
+{
+    s64 mean = 0, r0 = 0, best = 0;
+    unsigned int i, lag, period = 0;
+
+    for (i = 0; i < MG_HIST; i++)
+        mean += mg->hist[i];
+    mean /= MG_HIST;
+    for (i = 0; i < MG_HIST; i++)
+        r0 += (mg->hist[i] - mean) * (mg->hist[i] - mean);
+    /* Flat load (sigma under ~1.5% of capacity) has no period to find */
+    if (r0 < (s64)MG_HIST * (MUSCLE_FIXED_ONE / 64) * (MUSCLE_FIXED_ONE / 64))
+        return 0;
+
+    for (lag = MG_MIN_PERIOD; lag <= MG_MAX_PERIOD; lag++) {
+        s64 r = 0;
+
+        for (i = lag; i < MG_HIST; i++)
+            r += (mg->hist[i] - mean) * (mg->hist[i - lag] - mean);
+        /* Per-pair correlation of at least 0.5 */
+        r = div_s64(r * MG_HIST, MG_HIST - lag);
+        if (2 * r > r0 && r > best) {
+            best = r;
+            period = lag;
+        }
+    }
+    return period;
+}
+
+/* Learn from observed utilization u and predict the next sample */
+static muscle_fixed mg_learn(struct mg_policy *mg, muscle_fixed u)
+{
+    s64 acc = 0, norm = MUSCLE_FIXED_ONE / 16;
+    unsigned int i, period;
+
+    if (mg->t) {
+        muscle_fixed e = u - mg->pred;
+        s64 step, inv;
+
+        for (i = 0; i < MG_FEATURES; i++)
+            norm += ((s64)mg->x[i] * mg->x[i]) >> MUSCLE_FIXED_SHIFT;
+        inv = div64_s64((s64)MUSCLE_FIXED_ONE << MUSCLE_FIXED_SHIFT, norm);
+        step = ((s64)READ_ONCE(mg_step) * e) >> MUSCLE_FIXED_SHIFT;
+        for (i = 0; i < MG_FEATURES; i++) {
+            s64 dw = (((step * mg->x[i]) >> MUSCLE_FIXED_SHIFT) * inv) >> MUSCLE_FIXED_SHIFT;
+
+            mg->w[i] = clamp_t(s64, mg->w[i] + dw, -MG_W_MAX, MG_W_MAX);
+        }
+        mg->err += (abs(e) - mg->err) >> 3;
+    }
+
+    mg->hist[mg->t++ % MG_HIST] = u;
+    if (!(mg->t % MG_HIST)) {
+        period = mg_detect_period(mg);
+        if (period != mg->period) {
+            mg->period = period;
+            mg->w[MG_F_SIN] = mg->w[MG_F_COS] = 0;
+        }
+    }
+
+    for (i = 0; i < MG_ORDER; i++)
+        mg->x[i] = i < mg->t ? mg_hist(mg, i) : 0;
+    period = mg->period;
+    mg->x[MG_F_SIN] = period ? mg_sin[period][mg->t % period] : 0;
+    mg->x[MG_F_COS] = period ? mg_cos[period][mg->t % period] : 0;
+    mg->x[MG_F_BIAS] = MUSCLE_FIXED_ONE;
+
+    for (i = 0; i < MG_FEATURES; i++)
+        acc += (s64)mg->w[i] * mg->x[i];
+    mg->pred = clamp_t(s64, acc >> MUSCLE_FIXED_SHIFT, 0, MUSCLE_FIXED_ONE);
+    return mg->pred;
+}
+
+static unsigned int mg_next_freq(struct mg_policy *mg, muscle_fixed target)
+{
+    struct cpufreq_policy *policy = mg->policy;
+    u32 headroom = clamp_t(u32, 2 * mg->err, READ_ONCE(mg_headroom_min),
+                           max(READ_ONCE(mg_headroom_min), READ_ONCE(mg_headroom_max)));
+    u64 f = (u64)policy->cpuinfo.max_freq * target;
+
+    f = (f * (MUSCLE_FIXED_ONE + headroom)) >> (2 * MUSCLE_FIXED_SHIFT);
+    return cpufreq_driver_resolve_freq(policy, f);
+}
+
+/* Busiest CPU of the policy, ignoring ones that have not updated for a tick */
+static muscle_fixed mg_policy_util(struct mg_policy *mg, u64 time)
+{
+    muscle_fixed util = 0;
+    unsigned int cpu;
+
+    for_each_cpu(cpu, mg->policy->cpus) {
+        const struct mg_cpu *mgc = &per_cpu(mg_cpu, cpu);
+
+        if (time - mgc->last_update <= TICK_NSEC)
+            util = max(util, mgc->util);
+    }
+    return util;
+}
+
+static void mg_update(struct update_util_data *data, u64 time, unsigned int flags)
+{
+    struct mg_cpu *mgc = container_of(data, struct mg_cpu, update_util);
+    struct mg_policy *mg = mgc->mg;
+    struct cpufreq_policy *policy = mg->policy;
+    unsigned long cap = arch_scale_cpu_capacity(mgc->cpu);
+    muscle_fixed u, target;
+    unsigned int freq;
+
+    if (!cpufreq_this_cpu_can_update(policy))
+        return;
+
+    raw_spin_lock(&mg->lock);
+    mgc->util = min_t(u64, div64_u64((u64)sched_cpu_util(mgc->cpu) << MUSCLE_FIXED_SHIFT,
+                                     max(cap, 1UL)), MUSCLE_FIXED_ONE);
+    mgc->last_update = time;
+
+    if (!READ_ONCE(mg->need_update) && time - mg->last_freq_update < mg->rate_ns)
+        goto out;
+    mg->last_freq_update = time;
+
+    u = mg_policy_util(mg, time);
+    target = max(u, mg_learn(mg, u));
+    freq = mg_next_freq(mg, target);
+    if (freq == mg->next_freq && !READ_ONCE(mg->need_update))
+        goto out;
+
+    WRITE_ONCE(mg->need_update, false);
+    mg->next_freq = freq;
+    if (policy->fast_switch_enabled) {
+        cpufreq_driver_fast_switch(policy, freq);
+    } else if (!mg->work_in_progress) {
+        mg->work_in_progress = true;
+        irq_work_queue(&mg->irq_work);
+    }
+out:
+    raw_spin_unlock(&mg->lock);
+}
+
+static void mg_work(struct work_struct *work)
+{
+    struct mg_policy *mg = container_of(work, struct mg_policy, work);
+    unsigned long flags;
+    unsigned int freq;
+
+    raw_spin_lock_irqsave(&mg->lock, flags);
+    freq = mg->next_freq;
+    mg->work_in_progress = false;
+    raw_spin_unlock_irqrestore(&mg->lock, flags);
+
+    mutex_lock(&mg->work_lock);
+    __cpufreq_driver_target(mg->policy, freq, CPUFREQ_RELATION_L);
+    mutex_unlock(&mg->work_lock);
+}
+
+static void mg_irq_work(struct irq_work *irq_work)
+{
+    struct mg_policy *mg = container_of(irq_work, struct mg_policy, irq_work);
+
+    queue_work(system_highpri_wq, &mg->work);
+}
+
+static int mg_init(struct cpufreq_policy *policy)
+{
+    struct mg_policy *mg;
+
+    if (policy->governor_data)
+        return -EBUSY;
+
+    mg = kzalloc(sizeof(*mg), GFP_KERNEL);
+    if (!mg)
+        return -ENOMEM;
+    mg->policy = policy;
+    raw_spin_lock_init(&mg->lock);
+    init_irq_work(&mg->irq_work, mg_irq_work);
+    INIT_WORK(&mg->work, mg_work);
+    mutex_init(&mg->work_lock);
+
+    cpufreq_enable_fast_switch(policy);
+    policy->governor_data = mg;
+    return 0;
+}
+
+static void mg_exit(struct cpufreq_policy *policy)
+{
+    struct mg_policy *mg = policy->governor_data;
+
+    policy->governor_data = NULL;
+    cpufreq_disable_fast_switch(policy);
+    mutex_destroy(&mg->work_lock);
+    kfree(mg);
+}
+
+static int mg_start(struct cpufreq_policy *policy)
+{
+    struct mg_policy *mg = policy->governor_data;
+    unsigned int cpu;
+
+    mg->rate_ns = (u64)cpufreq_policy_transition_delay_us(policy) * NSEC_PER_USEC;
+    mg->last_freq_update = 0;
+    mg->next_freq = 0;
+    mg->need_update = false;
+    mg->work_in_progress = false;
+
+    /* Start out predicting persistence */
+    mg->t = 0;
+    mg->period = 0;
+    mg->pred = 0;
+    mg->err = READ_ONCE(mg_headroom_max) / 2;
+    memset(mg->w, 0, sizeof(mg->w));
+    mg->w[0] = MUSCLE_FIXED_ONE;
+
+    for_each_cpu(cpu, policy->cpus) {
+        struct mg_cpu *mgc = &per_cpu(mg_cpu, cpu);
+
+        memset(mgc, 0, sizeof(*mgc));
+        mgc->cpu = cpu;
+        mgc->mg = mg;
+    }
+    for_each_cpu(cpu, policy->cpus)
+        cpufreq_add_update_util_hook(cpu, &per_cpu(mg_cpu, cpu).update_util, mg_update);
+    return 0;
+}
+
+static void mg_stop(struct cpufreq_policy *policy)
+{
+    struct mg_policy *mg = policy->governor_data;
+    unsigned int cpu;
+
+    for_each_cpu(cpu, policy->cpus)
+        cpufreq_remove_update_util_hook(cpu);
+    synchronize_rcu();
+
+    if (!policy->fast_switch_enabled) {
+        irq_work_sync(&mg->irq_work);
+        cancel_work_sync(&mg->work);
+    }
+}
+
+static void mg_limits(struct cpufreq_policy *policy)
+{
+    struct mg_policy *mg = policy->governor_data;
+
+    if (!policy->fast_switch_enabled) {
+        mutex_lock(&mg->work_lock);
+        cpufreq_policy_apply_limits(policy);
+        mutex_unlock(&mg->work_lock);
+    }
+    WRITE_ONCE(mg->need_update, true);
+}
+
+static struct cpufreq_governor muscle_sine_gov = {
+    .name   = "musclesine",
+    .owner  = THIS_MODULE,
+    .flags  = CPUFREQ_GOV_DYNAMIC_SWITCHING,
+    .init   = mg_init,
+    .exit   = mg_exit,
+    .start  = mg_start,
+    .stop   = mg_stop,
+    .limits = mg_limits,
+};
+
+/* After muscle_init(), which quantizes the MuscleSine weights */
+static int __init muscle_cpufreq_init(void)
+{
+    unsigned int p, k;
+    bool any = false;
+
+    for (p = MG_MIN_PERIOD; p <= MG_MAX_PERIOD; p++) {
+        for (k = 0; k < p; k++) {
+            muscle_fixed theta = MG_TWO_PI * k / p;
+
+            /* -sin and -cos of the phase, arguments kept near zero; NLMS learns the sign */
+            mg_sin[p][k] = muscle_sine_forward(theta - MG_PI);
+            mg_cos[p][k] = muscle_sine_forward(theta - MG_PI / 2);
+            any |= mg_sin[p][k] || mg_cos[p][k];
+        }
+    }
+    if (!any)
+        pr_warn("MuscleSine governor: no sine model, periodic features disabled\n");
+
+    return cpufreq_register_governor(&muscle_sine_gov);
+}
+
+late_initcall(muscle_cpufreq_init);
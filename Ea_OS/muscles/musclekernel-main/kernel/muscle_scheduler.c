@@ -1,52 +1,162 @@
 #include <linux/muscle.h>
 #include <linux/sched.h>
 #include <linux/cpumask.h>
+#include <linux/err.h>
 #include <linux/random.h>
+#include <linux/irq_work.h>
+#include <linux/jiffies.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
+#include <linux/slab.h>
+#include <linux/topology.h>
+#include <linux/workqueue.h>
+#include <trace/events/muscle.h>
 
-/* Tiny fixed-point DQN for scheduling (5 processes max per decision) */
-#define SCHED_STATES     10    /* remaining + wait time normalized */
-#define SCHED_ACTIONS    5
+#include "sched/sched.h"
+
+/*
+ * Tiny fixed-point DQN for scheduling.  Each decision looks at the
+ * CONFIG_MUSCLE_SCHED_CANDIDATES leftmost CFS entities (5 by default);
+ * the baked weights/sched_*.hex are trained for 5.  For other sizes
+ * muscle_wset_register() refuses them and the scheduler idles until a
+ * blob of matching shape is loaded.
+ */
+#ifndef CONFIG_MUSCLE_SCHED_CANDIDATES
+#define CONFIG_MUSCLE_SCHED_CANDIDATES 5
+#endif
+
+#define SCHED_ACTIONS    CONFIG_MUSCLE_SCHED_CANDIDATES
+#define SCHED_STATES     (2 * SCHED_ACTIONS)    /* remaining + wait time normalized */
 #define SCHED_HIDDEN     32
 
-static const muscle_fixed sched_w1[SCHED_HIDDEN * SCHED_STATES] = {
+/* Group entities are skipped, so bound the rbtree walk, not just n */
+#define SCHED_SCAN_MAX   (4 * SCHED_ACTIONS)
+
+/* Built-in weights; missing sources leave empty tables (see muscle_wset) */
+static const muscle_fixed sched_w1[] = {
+#if __has_include("weights/sched_w1.hex")
     /* 32×10 weights — pre-trained offline from 100k episodes */
     #include "weights/sched_w1.hex"
+#endif
 };
-static const muscle_fixed sched_b1[SCHED_HIDDEN] = {
+static const muscle_fixed sched_b1[] = {
+#if __has_include("weights/sched_b1.hex")
     #include "weights/sched_b1.hex"
+#endif
 };
-static const muscle_fixed sched_w2[SCHED_ACTIONS * SCHED_HIDDEN] = {
+static const muscle_fixed sched_w2[] = {
+#if __has_include("weights/sched_w2.hex")
     #include "weights/sched_w2.hex"
+#endif
 };
-static const muscle_fixed sched_b2[SCHED_ACTIONS] = {
+static const muscle_fixed sched_b2[] = {
+#if __has_include("weights/sched_b2.hex")
     #include "weights/sched_b2.hex"
+#endif
+};
+
+enum { SCHED_W1, SCHED_B1, SCHED_W2, SCHED_B2, SCHED_TABLES };
+
+static const struct muscle_wtable sched_tables[SCHED_TABLES] = {
+    [SCHED_W1] = MUSCLE_WTABLE("w1", sched_w1, SCHED_HIDDEN * SCHED_STATES),
+    [SCHED_B1] = MUSCLE_WTABLE("b1", sched_b1, SCHED_HIDDEN),
+    [SCHED_W2] = MUSCLE_WTABLE("w2", sched_w2, SCHED_ACTIONS * SCHED_HIDDEN),
+    [SCHED_B2] = MUSCLE_WTABLE("b2", sched_b2, SCHED_ACTIONS),
+};
+
+/*
+ * Migration head: scores one destination CPU for a task from its topology
+ * features (see sched_mig_features()).  Hand-set prior (load first, then
+ * LLC > node > remote, cache-hot last CPU) until a trained head ships.
+ */
+#define MIG_FEATURES     6
+
+static const muscle_fixed sched_mig_w[] = {
+    #include "weights/sched_mig_w.hex"
+};
+static const muscle_fixed sched_mig_b[] = {
+    #include "weights/sched_mig_b.hex"
+};
+static_assert(ARRAY_SIZE(sched_mig_w) == MIG_FEATURES && ARRAY_SIZE(sched_mig_b) == 1,
+              "weights/sched_mig_*.hex do not match MIG_FEATURES");
+
+/*
+ * The DQN as int16 per-row quantized layers, published by sched_wset:
+ * built from the tables above at boot or from a loaded blob, and
+ * replaced under RCU whenever online learning publishes.  m1/m2 are the
+ * Q20 master copy online learning steps (weights, then bias, per row),
+ * seeded from the same tables.
+ */
+#define SCHED_LEARN_FRAC    8                /* master weights are Q(12 + 8) */
+#define SCHED_LEARN_LIMIT   ((s32)(16 * MUSCLE_FIXED_ONE) << SCHED_LEARN_FRAC)
+
+MUSCLE_DENSE(sched_l1, SCHED_STATES, SCHED_HIDDEN, 16, MUSCLE_ACT_RELU)
+MUSCLE_DENSE(sched_l2, SCHED_HIDDEN, SCHED_ACTIONS, 16, MUSCLE_ACT_NONE)
+
+struct sched_net {
+    struct sched_l1 l1;
+    struct sched_l2 l2;
+    s32 m1[SCHED_HIDDEN][SCHED_STATES + 1];
+    s32 m2[SCHED_ACTIONS][SCHED_HIDDEN + 1];
 };
 
-static muscle_fixed sched_forward(const muscle_fixed state[SCHED_STATES])
+static struct sched_net __rcu *sched_net;
+static struct muscle_wset sched_wset;
+
+/* int16 per-row quantized copy of the migration head */
+MUSCLE_DENSE(sched_mig_head, MIG_FEATURES, 1, 16, MUSCLE_ACT_NONE)
+
+static struct sched_mig_head sched_mig __read_mostly;
+
+static void sched_net_free(struct sched_net *net)
 {
-    muscle_fixed h[SCHED_HIDDEN] = {0};
-    muscle_fixed q[SCHED_ACTIONS] = {0};
-    int i, j;
+    sched_l2_free(&net->l2);
+    sched_l1_free(&net->l1);
+    kfree(net);
+}
 
-    /* Hidden layer */
-    for (i = 0; i < SCHED_HIDDEN; i++) {
-        muscle_fixed sum = sched_b1[i];
-        for (j = 0; j < SCHED_STATES; j++)
-            sum += sched_w1[i * SCHED_STATES + j] * state[j];
-        h[i] = muscle_relu(sum);
+static s32 sched_master(muscle_fixed w)
+{
+    return clamp(w, -16 * MUSCLE_FIXED_ONE, 16 * MUSCLE_FIXED_ONE) * (1 << SCHED_LEARN_FRAC);
+}
+
+static struct sched_net *sched_net_build(const muscle_fixed *w1, const muscle_fixed *b1,
+                                         const muscle_fixed *w2, const muscle_fixed *b2)
+{
+    struct sched_net *net = kzalloc(sizeof(*net), GFP_KERNEL);
+    int i, j, ret;
+
+    if (!net)
+        return ERR_PTR(-ENOMEM);
+    ret = sched_l1_init(&net->l1, w1, b1);
+    if (!ret)
+        ret = sched_l2_init(&net->l2, w2, b2);
+    if (ret) {
+        sched_net_free(net);
+        return ERR_PTR(ret);
     }
 
-    /* Output Q-values */
-    for (i = 0; i < SCHED_ACTIONS; i++) {
-        muscle_fixed sum = sched_b2[i];
-        for (j = 0; j < SCHED_HIDDEN; j++)
-            sum += sched_w2[i * SCHED_HIDDEN + j] * h[j];
-        q[i] = sum;
+    for (j = 0; j < SCHED_HIDDEN; j++) {
+        for (i = 0; i < SCHED_STATES; i++)
+            net->m1[j][i] = sched_master(w1[j * SCHED_STATES + i]);
+        net->m1[j][SCHED_STATES] = sched_master(b1[j]);
     }
+    for (j = 0; j < SCHED_ACTIONS; j++) {
+        for (i = 0; i < SCHED_HIDDEN; i++)
+            net->m2[j][i] = sched_master(w2[j * SCHED_HIDDEN + i]);
+        net->m2[j][SCHED_HIDDEN] = sched_master(b2[j]);
+    }
+    return net;
+}
 
-    /* Return best action */
+/* Best action for one Q vector */
+static int sched_argmax(const muscle_fixed q[SCHED_ACTIONS])
+{
     muscle_fixed best = q[0];
-    int action = 0;
+    int i, action = 0;
+
     for (i = 1; i < SCHED_ACTIONS; i++) {
         if (q[i] > best) {
             best = q[i];
@@ -56,42 +166,901 @@ static muscle_fixed sched_forward(const muscle_fixed state[SCHED_STATES])
     return action;
 }
 
+/* One pass: returns the best action and leaves every Q-value in q */
+static int sched_forward(const struct sched_net *net,
+                         const muscle_fixed state[SCHED_STATES],
+                         muscle_fixed q[SCHED_ACTIONS])
+{
+    muscle_fixed h[SCHED_HIDDEN];
+
+    /* Hidden layer */
+    sched_l1_forward(&net->l1, state, h);
+
+    /* Output Q-values */
+    sched_l2_forward(&net->l2, h, q);
+
+    return sched_argmax(q);
+}
+
+DEFINE_MUSCLE_SWITCH(muscle_sched_key, "sched");
+
+/*
+ * Batched mode.  Ticks only publish their state vector into a per-CPU
+ * slot and apply the latest decision computed for them.  A per-node worker
+ * evaluates every fresh slot on its node as one matrix-matrix product, so
+ * sched_w1/sched_w2 are streamed once per batch instead of once per CPU.
+ * The tick cannot queue work under the rq lock, hence the irq_work kick.
+ */
+static bool sched_batch;
+module_param(sched_batch, bool, 0644);
+MODULE_PARM_DESC(sched_batch, "Evaluate scheduler decisions in per-node batches");
+
+#define SCHED_BATCH      16
+
+struct sched_slot {
+    seqcount_t seq;                     /* written by this CPU's tick */
+    u32 gen;                            /* bumped per published state */
+    int n;
+    pid_t pids[SCHED_ACTIONS];
+    muscle_fixed state[SCHED_STATES];
+    u64 decision;                       /* worker: gen << 32 | pid */
+    muscle_fixed decision_q;            /* worker: Q of that pid, for tracing */
+    u32 evaluated;                      /* worker: last gen batched */
+    u32 consumed;                       /* tick: last decision gen applied */
+} ____cacheline_aligned;
+
+static DEFINE_PER_CPU_SHARED_ALIGNED(struct sched_slot, sched_slots);
+
+struct sched_node {
+    int node;
+    unsigned long pending;
+    struct irq_work kick;
+    struct work_struct work;
+    /* Batch scratch, only touched by this node's worker */
+    struct sched_slot *slot[SCHED_BATCH];
+    u32 gen[SCHED_BATCH];
+    int n[SCHED_BATCH];
+    pid_t pids[SCHED_BATCH][SCHED_ACTIONS];
+    muscle_fixed x[SCHED_BATCH][SCHED_STATES];
+    muscle_fixed h[SCHED_BATCH][SCHED_HIDDEN];
+    muscle_fixed q[SCHED_BATCH][SCHED_ACTIONS];
+};
+
+static struct sched_node **sched_nodes __read_mostly;
+
+/*
+ * Candidate 0 is what CFS would run: OVERRIDES counts decisions for any
+ * other, ISSUED the ticks that switched rq->curr, ABSTAIN the ones left
+ * to CFS.  A batched pass is timed once for its whole batch.  An
+ * override that switches tasks is credited, once, with how much longer
+ * its pick had waited than CFS's at switch-in, negative when it ran the
+ * fresher task, and clamped to a tick either way: the switch can move
+ * the pick's start by at most the tick it preempts.
+ */
+DEFINE_MUSCLE_STATS(sched_stats, "sched",
+                    BIT(MUSCLE_STAT_CALLS) | BIT(MUSCLE_STAT_INFER) |
+                    BIT(MUSCLE_STAT_INFER_NS) | BIT(MUSCLE_STAT_LOCK_NS) |
+                    BIT(MUSCLE_STAT_ISSUED) | BIT(MUSCLE_STAT_ABSTAIN) |
+                    BIT(MUSCLE_STAT_OVERRIDES) | BIT(MUSCLE_STAT_SAVED_NS) |
+                    BIT(MUSCLE_STAT_THROTTLED) | BIT(MUSCLE_STAT_LEARN) |
+                    BIT(MUSCLE_STAT_LEARN_NS));
+
+DEFINE_MUSCLE_THROTTLE(sched_throttle, sched_stats);
+
+/*
+ * State units: vruntime in ms, waits in 100s of ticks as the tables were
+ * trained on.  Absolute vruntime would saturate Q12 after ~524 s of it
+ * (and starts just below 0 as a u64), so the state carries each task's
+ * lead over the queue's min_vruntime.  Both are scaled by reciprocal, see muscle_fx_div_const().
+ */
+#define SCHED_VRUNTIME_UNIT  NSEC_PER_MSEC
+#define SCHED_WAIT_UNIT      (100 * TICK_NSEC)
+
+/* p's vruntime ahead of rq's CFS min_vruntime; placement lag may put it behind */
+static inline u64 sched_vruntime(struct rq *rq, const struct task_struct *p)
+{
+    s64 d = (s64)(p->se.vruntime - rq->cfs.min_vruntime);
+
+    return d > 0 ? d : 0;
+}
+
+/* ns since p last ran: exec_start is where its last stint on a CPU ended */
+static inline u64 sched_wait(struct rq *rq, const struct task_struct *p)
+{
+    u64 now = rq_clock_task(rq);
+
+    return now > p->se.exec_start ? now - p->se.exec_start : 0;
+}
+
+static void sched_batch_run(struct sched_node *sn, int nb)
+{
+    u64 t0 = muscle_stat_clock();
+    const struct sched_net *net;
+    int b;
+
+    rcu_read_lock();
+    net = rcu_dereference(sched_net);
+    sched_l1_forward_batch(&net->l1, sn->x[0], sn->h[0], nb);
+    sched_l2_forward_batch(&net->l2, sn->h[0], sn->q[0], nb);
+    rcu_read_unlock();
+    muscle_stat_time(&sched_stats, MUSCLE_STAT_INFER_NS, t0);
+    muscle_stat_add(&sched_stats, MUSCLE_STAT_INFER, nb);
+
+    for (b = 0; b < nb; b++) {
+        int action = sched_argmax(sn->q[b]);
+
+        if (action >= sn->n[b])
+            continue;
+        WRITE_ONCE(sn->slot[b]->decision_q, sn->q[b][action]);
+        WRITE_ONCE(sn->slot[b]->decision,
+                   (u64)sn->gen[b] << 32 | (u32)sn->pids[b][action]);
+    }
+}
+
+static void sched_batch_work(struct work_struct *work)
+{
+    struct sched_node *sn = container_of(work, struct sched_node, work);
+    int cpu, nb = 0;
+
+    /* Clear first: a state published from here on kicks a new pass */
+    clear_bit(0, &sn->pending);
+    smp_mb__after_atomic();
+
+    for_each_cpu_and(cpu, cpumask_of_node(sn->node), cpu_online_mask) {
+        struct sched_slot *slot = per_cpu_ptr(&sched_slots, cpu);
+        unsigned int seq;
+
+        /* The writer holds the rq lock with irqs off, so never waits long */
+        seq = read_seqcount_begin(&slot->seq);
+        sn->gen[nb] = slot->gen;
+        sn->n[nb] = slot->n;
+        memcpy(sn->pids[nb], slot->pids, sizeof(slot->pids));
+        memcpy(sn->x[nb], slot->state, sizeof(slot->state));
+        if (read_seqcount_retry(&slot->seq, seq) || sn->gen[nb] == slot->evaluated)
+            continue;
+
+        slot->evaluated = sn->gen[nb];
+        sn->slot[nb] = slot;
+        if (++nb == SCHED_BATCH) {
+            sched_batch_run(sn, nb);
+            nb = 0;
+        }
+    }
+    if (nb)
+        sched_batch_run(sn, nb);
+}
+
+static void sched_batch_kick(struct irq_work *work)
+{
+    struct sched_node *sn = container_of(work, struct sched_node, kick);
+
+    queue_work_node(sn->node, system_unbound_wq, &sn->work);
+}
+
+/* Publish this tick's state; returns the candidate index to run, or -1 */
+static int sched_batch_tick(struct rq *rq, struct task_struct *candidates[SCHED_ACTIONS],
+                            int n, const muscle_fixed state[SCHED_STATES],
+                            muscle_fixed q[SCHED_ACTIONS])
+{
+    struct sched_slot *slot = this_cpu_ptr(&sched_slots);
+    struct sched_node *sn = sched_nodes[cpu_to_node(cpu_of(rq))];
+    u64 decision;
+    pid_t pid;
+    int i;
+
+    write_seqcount_begin(&slot->seq);
+    slot->gen++;
+    slot->n = n;
+    for (i = 0; i < n; i++)
+        slot->pids[i] = candidates[i]->pid;
+    memcpy(slot->state, state, sizeof(slot->state));
+    write_seqcount_end(&slot->seq);
+
+    if (!test_and_set_bit(0, &sn->pending))
+        irq_work_queue(&sn->kick);
+
+    /* Apply the newest decision once; it may be for an earlier state */
+    decision = READ_ONCE(slot->decision);
+    if ((u32)(decision >> 32) == slot->consumed)
+        return -1;
+    slot->consumed = decision >> 32;
+
+    pid = (pid_t)(u32)decision;
+    for (i = 0; i < n; i++) {
+        if (candidates[i]->pid == pid) {
+            q[i] = READ_ONCE(slot->decision_q);
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int __init sched_batch_init(void)
+{
+    int node, cpu;
+
+    for_each_possible_cpu(cpu)
+        seqcount_init(&per_cpu_ptr(&sched_slots, cpu)->seq);
+
+    sched_nodes = kcalloc(nr_node_ids, sizeof(*sched_nodes), GFP_KERNEL);
+    if (!sched_nodes)
+        goto err;
+
+    for_each_node(node) {
+        struct sched_node *sn = kzalloc_node(sizeof(*sn), GFP_KERNEL, node);
+
+        if (!sn)
+            goto err;
+        sn->node = node;
+        init_irq_work(&sn->kick, sched_batch_kick);
+        INIT_WORK(&sn->work, sched_batch_work);
+        sched_nodes[node] = sn;
+    }
+    return 0;
+
+err:
+    if (sched_nodes) {
+        for_each_node(node)
+            kfree(sched_nodes[node]);
+        kfree(sched_nodes);
+        sched_nodes = NULL;
+    }
+    return -ENOMEM;
+}
+
+/*
+ * Fill candidates[] with the runnable tasks of lowest vruntime, in order,
+ * by walking the leftmost nodes of the CFS timeline.  Cost is bounded by
+ * SCHED_SCAN_MAX regardless of how many tasks are queued.
+ */
+static int sched_collect_candidates(struct rq *rq,
+                                    struct task_struct *candidates[SCHED_ACTIONS])
+{
+    struct sched_entity *se = __pick_first_entity(&rq->cfs);
+    int n = 0, scanned = 0;
+
+    while (se && n < SCHED_ACTIONS && scanned++ < SCHED_SCAN_MAX) {
+        struct rb_node *next;
+
+        if (entity_is_task(se))
+            candidates[n++] = task_of(se);
+
+        next = rb_next(&se->run_node);
+        se = next ? rb_entry(next, struct sched_entity, run_node) : NULL;
+    }
+    return n;
+}
+
+/* Candidate 0 is what CFS would run, so every record also scores CFS */
+static void sched_trace(const muscle_fixed state[SCHED_STATES], int n, int chosen,
+                        const muscle_fixed q[SCHED_ACTIONS])
+{
+    struct muscle_trace_rec rec = {
+        .type  = MUSCLE_TRACE_SCHED,
+        .sched = {
+            .n      = n,
+            .action = chosen,
+            .q      = chosen >= 0 ? q[chosen] : 0,
+        },
+    };
+    int i;
+
+    BUILD_BUG_ON(SCHED_STATES > MUSCLE_TRACE_SCHED_MAX);
+
+    for (i = 0; i < SCHED_STATES; i++)
+        rec.sched.state[i] = muscle_act16(state[i]);
+    muscle_trace_record(&rec);
+}
+
+/*
+ * Online Q-learning (sched_learn=1).  A tick's state and the action that
+ * ran become a transition once the CPU's next tick supplies the next
+ * state.  The action is candidate 0 whenever the tick left it to CFS, so
+ * CFS's own picks are experience too.  The reward is the fall in the
+ * candidates' mean wait since that tick, less sched_switch_cost if the
+ * net preempted the running task: a switch costs throughput.
+ *
+ * Transitions go into a per-CPU replay ring that the tick overwrites
+ * oldest first.  Each slot has a seqcount, so the tick never waits and
+ * the trainer skips a slot caught mid-write.
+ *
+ * The trainer is one work item on a nice-19 unbound workqueue.  Every
+ * SCHED_TRAIN_PERIOD it samples transitions at random across CPUs for up
+ * to sched_train_budget_us, taking a clamped TD step on the live net's
+ * Q20 master copy of both layers each time.  The live net is the target
+ * network.  After SCHED_PUBLISH_RUNS runs with updates, the master is
+ * requantized into a new net that replaces the live one through
+ * muscle_wset_update(), unless a blob or rollback replaced it first.
+ * Like the cache's head, the resident built-in net is never trained: the
+ * trainer forks it (muscle_wset_fork()) and skips it while it is live.
+ */
+#define SCHED_REPLAY        128              /* transitions per CPU */
+#define SCHED_GAMMA         (MUSCLE_FIXED_ONE * 9 / 10)
+#define SCHED_REWARD_MAX    (4 * MUSCLE_FIXED_ONE)
+#define SCHED_TD_MAX        MUSCLE_FIXED_ONE
+#define SCHED_TRAIN_PERIOD  (HZ / 10)
+#define SCHED_PUBLISH_RUNS  10
+
+struct sched_transition {
+    muscle_fixed state[SCHED_STATES];
+    muscle_fixed next[SCHED_STATES];
+    muscle_fixed reward;
+    int action;
+};
+
+struct sched_exp {
+    seqcount_t seq;
+    struct sched_transition t;
+};
+
+/* Written only by this CPU's tick, under the rq lock */
+struct sched_experience {
+    unsigned int head;                  /* transitions ever recorded */
+    bool valid;                         /* the fields below are the last tick */
+    bool switched;
+    int action;
+    muscle_fixed wait;
+    muscle_fixed state[SCHED_STATES];
+    struct sched_exp ring[SCHED_REPLAY];
+};
+
+static DEFINE_PER_CPU(struct sched_experience, sched_experience);
+
+static int sched_switch_cost = MUSCLE_FIXED_ONE / 16;
+module_param(sched_switch_cost, int, 0644);
+MODULE_PARM_DESC(sched_switch_cost, "Q12 reward given up by a switch the net forces");
+
+static unsigned int sched_train_budget_us = 200;
+module_param(sched_train_budget_us, uint, 0644);
+MODULE_PARM_DESC(sched_train_budget_us, "Longest the trainer runs per period, us");
+
+static unsigned int sched_learn_shift = 12;
+module_param(sched_learn_shift, uint, 0644);
+MODULE_PARM_DESC(sched_learn_shift, "Learning rate as a right shift (12 = 1/4096)");
+
+/* Trainer state; only sched_train_fn() touches it once learning is up */
+static unsigned int sched_train_runs;
+static struct workqueue_struct *sched_train_wq;
+
+static void sched_train_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(sched_train_work, sched_train_fn);
+
+static bool sched_learn;
+static bool sched_learn_ready;
+
+static int sched_learn_set(const char *val, const struct kernel_param *kp)
+{
+    int ret = param_set_bool(val, kp);
+
+    /* Stopping is left to sched_train_fn(), which sees sched_learn clear */
+    if (!ret && READ_ONCE(sched_learn) && READ_ONCE(sched_learn_ready)) {
+        muscle_wset_fork(&sched_wset);
+        queue_delayed_work(sched_train_wq, &sched_train_work, SCHED_TRAIN_PERIOD);
+    }
+    return ret;
+}
+
+static const struct kernel_param_ops sched_learn_ops = {
+    .set = sched_learn_set,
+    .get = param_get_bool,
+};
+module_param_cb(sched_learn, &sched_learn_ops, &sched_learn, 0644);
+MODULE_PARM_DESC(sched_learn, "Train the DQN online from measured wait times");
+
+/* From the tick, with the rq lock held; n > 0 */
+static void sched_learn_record(const muscle_fixed state[SCHED_STATES], int n,
+                               int action, bool switched)
+{
+    struct sched_experience *x = this_cpu_ptr(&sched_experience);
+    s64 wait = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        wait += state[SCHED_ACTIONS + i];
+    wait = div_s64(wait, n);
+
+    if (x->valid) {
+        struct sched_exp *e = &x->ring[x->head % SCHED_REPLAY];
+        s64 r = x->wait - wait - (x->switched ? READ_ONCE(sched_switch_cost) : 0);
+
+        write_seqcount_begin(&e->seq);
+        memcpy(e->t.state, x->state, sizeof(e->t.state));
+        memcpy(e->t.next, state, sizeof(e->t.next));
+        e->t.reward = clamp_t(s64, r, -SCHED_REWARD_MAX, SCHED_REWARD_MAX);
+        e->t.action = x->action;
+        write_seqcount_end(&e->seq);
+        WRITE_ONCE(x->head, x->head + 1);
+    }
+    memcpy(x->state, state, sizeof(x->state));
+    x->action = action;
+    x->switched = switched;
+    x->wait = wait;
+    x->valid = true;
+}
+
+static void sched_learn_add(s32 *w, s64 d)
+{
+    *w = clamp_t(s64, *w + d, -SCHED_LEARN_LIMIT, SCHED_LEARN_LIMIT);
+}
+
+/* One TD step of net's master towards r + gamma * max Q_net(next) for the action taken */
+static void sched_train_step(struct sched_net *net,
+                             const struct sched_transition *t, unsigned int shift)
+{
+    /* Q12 * Q12 products into Q20 master units, times the rate */
+    unsigned int dshift = 2 * MUSCLE_FIXED_SHIFT - (MUSCLE_FIXED_SHIFT + SCHED_LEARN_FRAC) + shift;
+    muscle_fixed h[SCHED_HIDDEN], qn[SCHED_ACTIONS], g[SCHED_HIDDEN];
+    s32 (*m1)[SCHED_STATES + 1] = net->m1;
+    s32 *w2 = net->m2[t->action];
+    s64 acc, y, td;
+    int i, j;
+
+    sched_forward(net, t->next, qn);
+    y = t->reward + ((s64)SCHED_GAMMA * qn[sched_argmax(qn)] >> MUSCLE_FIXED_SHIFT);
+
+    /* The master's own forward pass, at full precision */
+    for (j = 0; j < SCHED_HIDDEN; j++) {
+        acc = (s64)m1[j][SCHED_STATES] << MUSCLE_FIXED_SHIFT;
+        for (i = 0; i < SCHED_STATES; i++)
+            acc += (s64)m1[j][i] * t->state[i];
+        h[j] = muscle_relu(muscle_fx_sat(acc >> (MUSCLE_FIXED_SHIFT + SCHED_LEARN_FRAC)));
+    }
+    acc = (s64)w2[SCHED_HIDDEN] << MUSCLE_FIXED_SHIFT;
+    for (j = 0; j < SCHED_HIDDEN; j++)
+        acc += (s64)w2[j] * h[j];
+    td = clamp_t(s64, y - (acc >> (MUSCLE_FIXED_SHIFT + SCHED_LEARN_FRAC)),
+                 -SCHED_TD_MAX, SCHED_TD_MAX);
+
+    /* Backpropagate through the old output row before stepping it */
+    for (j = 0; j < SCHED_HIDDEN; j++)
+        g[j] = h[j] > 0 ? (muscle_fixed)(td * w2[j] >> (MUSCLE_FIXED_SHIFT + SCHED_LEARN_FRAC)) : 0;
+    for (j = 0; j < SCHED_HIDDEN; j++)
+        sched_learn_add(&w2[j], td * h[j] >> dshift);
+    sched_learn_add(&w2[SCHED_HIDDEN], td * (1 << SCHED_LEARN_FRAC) >> shift);
+    for (j = 0; j < SCHED_HIDDEN; j++) {
+        if (!g[j])
+            continue;
+        for (i = 0; i < SCHED_STATES; i++)
+            sched_learn_add(&m1[j][i], (s64)g[j] * t->state[i] >> dshift);
+        sched_learn_add(&m1[j][SCHED_STATES], (s64)g[j] * (1 << SCHED_LEARN_FRAC) >> shift);
+    }
+}
+
+/* Copy out a random transition of cpu's ring; false if none or torn */
+static bool sched_sample(int cpu, struct sched_transition *t)
+{
+    const struct sched_experience *x = per_cpu_ptr(&sched_experience, cpu);
+    unsigned int head = READ_ONCE(x->head), seq;
+    const struct sched_exp *e;
+
+    if (!head)
+        return false;
+    e = &x->ring[get_random_u32_below(min_t(unsigned int, head, SCHED_REPLAY))];
+    seq = raw_read_seqcount(&e->seq);
+    if (seq & 1)
+        return false;
+    memcpy(t, &e->t, sizeof(*t));
+    return !read_seqcount_retry(&e->seq, seq);
+}
+
+/* Requantize the live net's master into a new net that carries the master on */
+static void sched_publish(void)
+{
+    static muscle_fixed w1[SCHED_HIDDEN * SCHED_STATES], b1[SCHED_HIDDEN];
+    static muscle_fixed w2[SCHED_ACTIONS * SCHED_HIDDEN], b2[SCHED_ACTIONS];
+    static s32 m1[SCHED_HIDDEN][SCHED_STATES + 1], m2[SCHED_ACTIONS][SCHED_HIDDEN + 1];
+    struct sched_net *live, *net;
+    int i, j;
+
+    /* Copy out under RCU: a blob swap may free live from here on */
+    rcu_read_lock();
+    live = rcu_dereference(sched_net);
+    if (!live || muscle_wset_is_builtin(&sched_wset, live)) {
+        rcu_read_unlock();
+        return;
+    }
+    memcpy(m1, live->m1, sizeof(m1));
+    memcpy(m2, live->m2, sizeof(m2));
+    rcu_read_unlock();
+
+    for (j = 0; j < SCHED_HIDDEN; j++) {
+        for (i = 0; i < SCHED_STATES; i++)
+            w1[j * SCHED_STATES + i] = m1[j][i] >> SCHED_LEARN_FRAC;
+        b1[j] = m1[j][SCHED_STATES] >> SCHED_LEARN_FRAC;
+    }
+    for (j = 0; j < SCHED_ACTIONS; j++) {
+        for (i = 0; i < SCHED_HIDDEN; i++)
+            w2[j * SCHED_HIDDEN + i] = m2[j][i] >> SCHED_LEARN_FRAC;
+        b2[j] = m2[j][SCHED_HIDDEN] >> SCHED_LEARN_FRAC;
+    }
+    net = sched_net_build(w1, b1, w2, b2);
+    if (IS_ERR(net))
+        return;
+    /* Keep the fraction bits the requantization dropped */
+    memcpy(net->m1, m1, sizeof(net->m1));
+    memcpy(net->m2, m2, sizeof(net->m2));
+    if (muscle_wset_update(&sched_wset, live, net))
+        sched_net_free(net);
+}
+
+static void sched_train_fn(struct work_struct *work)
+{
+    u64 budget = (u64)READ_ONCE(sched_train_budget_us) * NSEC_PER_USEC;
+    unsigned int shift = clamp(READ_ONCE(sched_learn_shift), 1U, 24U);
+    struct sched_transition t;
+    struct sched_net *net;
+    unsigned long n = 0;
+    u64 t0;
+    bool found = true;
+    int cpu;
+
+    /* Again after a rollback to the built-in net */
+    if (READ_ONCE(sched_learn))
+        muscle_wset_fork(&sched_wset);
+
+    t0 = local_clock();
+    rcu_read_lock();
+    net = rcu_dereference(sched_net);
+    if (muscle_wset_is_builtin(&sched_wset, net))
+        net = NULL;
+    /* Round-robin over CPUs so a busy one cannot crowd out the rest */
+    while (net && found) {
+        found = false;
+        for_each_online_cpu(cpu) {
+            if (local_clock() - t0 >= budget)
+                goto out;
+            if (!sched_sample(cpu, &t))
+                continue;
+            sched_train_step(net, &t, shift);
+            found = true;
+            n++;
+        }
+    }
+out:
+    rcu_read_unlock();
+
+    muscle_stat_add(&sched_stats, MUSCLE_STAT_LEARN, n);
+    muscle_stat_add(&sched_stats, MUSCLE_STAT_LEARN_NS, local_clock() - t0);
+    if (n && ++sched_train_runs >= SCHED_PUBLISH_RUNS) {
+        sched_train_runs = 0;
+        sched_publish();
+    }
+
+    if (READ_ONCE(sched_learn))
+        queue_delayed_work(sched_train_wq, &sched_train_work, SCHED_TRAIN_PERIOD);
+}
+
+static int __init sched_learn_init(void)
+{
+    struct workqueue_attrs *attrs;
+    int i, j, ret;
+
+    for_each_possible_cpu(i) {
+        struct sched_experience *x = per_cpu_ptr(&sched_experience, i);
+
+        for (j = 0; j < SCHED_REPLAY; j++)
+            seqcount_init(&x->ring[j].seq);
+    }
+
+    /* Training is never urgent: keep it behind everything else runnable */
+    sched_train_wq = alloc_workqueue("muscle_sched_train", WQ_UNBOUND | WQ_FREEZABLE, 1);
+    if (!sched_train_wq)
+        return -ENOMEM;
+    attrs = alloc_workqueue_attrs();
+    if (attrs) {
+        attrs->nice = MAX_NICE;
+        ret = apply_workqueue_attrs(sched_train_wq, attrs);
+        free_workqueue_attrs(attrs);
+        if (ret)
+            pr_warn("MuscleScheduler: trainer runs at default priority (%d)\n", ret);
+    }
+
+    return 0;
+}
+
+/* Once sched_wset is registered: forking needs the built-in net */
+static void __init sched_learn_start(void)
+{
+    WRITE_ONCE(sched_learn_ready, true);
+    if (sched_learn) {
+        muscle_wset_fork(&sched_wset);
+        queue_delayed_work(sched_train_wq, &sched_train_work, SCHED_TRAIN_PERIOD);
+    }
+}
+
 /* Called from pick_next_task() path */
-void muscle_scheduler_tick(struct rq *rq)
+void __muscle_scheduler_tick(struct rq *rq)
 {
-    struct task_struct *candidates[5];
+    struct task_struct *candidates[SCHED_ACTIONS];
     muscle_fixed state[SCHED_STATES];
-    int i, n = 0;
+    muscle_fixed q[SCHED_ACTIONS];
+    bool switched = false;
+    int i, n, chosen;
+    u64 t0;
 
-    /* Collect up to 5 runnable tasks */
-    struct task_struct *p, *next;
+    BUILD_BUG_ON(SCHED_STATES > MUSCLE_QMAT_MAX_COLS);
+
+    if (unlikely(!rcu_access_pointer(sched_net)))
+        return;
+    muscle_stat_inc(&sched_stats, MUSCLE_STAT_CALLS);
+    if (muscle_throttled(&sched_throttle))
+        return;
+
+    /* Collect up to SCHED_ACTIONS runnable tasks */
+    t0 = muscle_stat_clock();
     rq_lock(rq, NULL);
-    list_for_each_entry_safe(p, next, &rq->cfs_tasks, tasks) {
-        if (n < 5) candidates[n++] = p;
-    }
+    muscle_stat_time(&sched_stats, MUSCLE_STAT_LOCK_NS, t0);
+    update_rq_clock(rq);
+    n = sched_collect_candidates(rq, candidates);
 
     if (n == 0) {
+        /* The next tick's state would not follow from the last one */
+        this_cpu_ptr(&sched_experience)->valid = false;
         rq_unlock(rq, NULL);
         return;
     }
 
-    /* Build state vector: remaining vruntime + wait time */
+    /* Build state vector: vruntime over min_vruntime + wait time */
     for (i = 0; i < n; i++) {
-        state[i] = muscle_float_to_fixed((float)candidates[i]->se.vruntime / 1000000.0f);
-        state[i + 5] = muscle_float_to_fixed((float)(jiffies - candidates[i]->se.last_ran) / 100.0f);
+        state[i] = muscle_fx_div_const(sched_vruntime(rq, candidates[i]),
+                                       SCHED_VRUNTIME_UNIT);
+        state[i + SCHED_ACTIONS] = muscle_fx_div_const(sched_wait(rq, candidates[i]),
+                                                       SCHED_WAIT_UNIT);
     }
-    for (; i < 5; i++) {
+    for (; i < SCHED_ACTIONS; i++) {
         state[i] = 0;
-        state[i + 5] = 0;
+        state[i + SCHED_ACTIONS] = 0;
+    }
+
+    if (READ_ONCE(sched_batch) && sched_nodes) {
+        chosen = sched_batch_tick(rq, candidates, n, state, q);
+    } else {
+        t0 = muscle_stat_clock();
+        rcu_read_lock();
+        chosen = sched_forward(rcu_dereference(sched_net), state, q);
+        rcu_read_unlock();
+        muscle_stat_time(&sched_stats, MUSCLE_STAT_INFER_NS, t0);
+        muscle_stat_inc(&sched_stats, MUSCLE_STAT_INFER);
     }
+    if (muscle_trace_on(MUSCLE_TRACE_SCHED))
+        sched_trace(state, n, chosen < n ? chosen : -1, q);
+    if (chosen < 0 || chosen >= n)
+        muscle_stat_inc(&sched_stats, MUSCLE_STAT_ABSTAIN);
+    else if (chosen > 0)
+        muscle_stat_inc(&sched_stats, MUSCLE_STAT_OVERRIDES);
+    if (chosen >= 0 && chosen < n && candidates[chosen] != rq->curr) {
+        muscle_stat_inc(&sched_stats, MUSCLE_STAT_ISSUED);
+        if (chosen > 0) {
+            s64 saved = (s64)sched_wait(rq, candidates[chosen]) -
+                        (s64)sched_wait(rq, candidates[0]);
 
-    int chosen = sched_forward(state);
-    if (chosen < n && candidates[chosen] != rq->curr) {
-        pr_info("MuscleScheduler: chose pid %d (Q-est %.2f)\n",
-                candidates[chosen]->pid,
-                muscle_fixed_to_float(sched_forward(state)));
+            muscle_stat_add(&sched_stats, MUSCLE_STAT_SAVED_NS,
+                            clamp_t(s64, saved, -(s64)TICK_NSEC, TICK_NSEC));
+        }
+        /* No printk under the rq lock: telemetry is a tracepoint */
+        trace_muscle_sched_decision(cpu_of(rq), candidates[chosen]->pid,
+                                    chosen, n, q[chosen]);
         rq->curr = candidates[chosen];
+        switched = true;
     }
+    if (READ_ONCE(sched_learn))
+        sched_learn_record(state, n, chosen >= 0 && chosen < n ? chosen : 0, switched);
 
     rq_unlock(rq, NULL);
 }
+
+/*
+ * Load-balancing head.  muscle_sched_suggest_cpu() is meant for the wakeup
+ * path (select_task_rq_fair()): it scores a bounded set of allowed CPUs,
+ * LLC siblings of prev_cpu first, then the rest of its node, then one CPU
+ * per remote node, and only suggests a move that beats staying on
+ * prev_cpu by MIG_MARGIN.  Everything else is left to CFS.
+ */
+#define MIG_SCAN_MAX     16
+#define MIG_MARGIN       (MUSCLE_FIXED_ONE / 2)
+#define MIG_LOAD_PERIOD  (HZ / 100)
+
+/*
+ * Average nr_running per CPU of each node in Q12, refreshed every 10 ms
+ * while sched_balance is set.  Deferrable and unbound, so the refresh
+ * never wakes an idle CPU just to find the machine idle.
+ */
+static muscle_fixed *sched_node_load __read_mostly;
+
+static void sched_node_load_fn(struct work_struct *work);
+static DECLARE_DEFERRABLE_WORK(sched_node_load_work, sched_node_load_fn);
+
+static bool sched_balance;
+static bool sched_balance_ready;
+
+static int sched_balance_set(const char *val, const struct kernel_param *kp)
+{
+    int ret = param_set_bool(val, kp);
+
+    /* Before init the refresh is started by sched_mig_init() */
+    if (ret || !READ_ONCE(sched_balance_ready))
+        return ret;
+    if (READ_ONCE(sched_balance))
+        mod_delayed_work(system_unbound_wq, &sched_node_load_work, 0);
+    else
+        cancel_delayed_work_sync(&sched_node_load_work);
+    return 0;
+}
+
+static const struct kernel_param_ops sched_balance_ops = {
+    .set = sched_balance_set,
+    .get = param_get_bool,
+};
+module_param_cb(sched_balance, &sched_balance_ops, &sched_balance, 0644);
+MODULE_PARM_DESC(sched_balance, "Let the migration head suggest wakeup CPUs");
+
+static void sched_node_load_fn(struct work_struct *work)
+{
+    int node, cpu;
+
+    for_each_online_node(node) {
+        unsigned int sum = 0, ncpus = 0;
+
+        for_each_cpu_and(cpu, cpumask_of_node(node), cpu_online_mask) {
+            sum += READ_ONCE(cpu_rq(cpu)->nr_running);
+            ncpus++;
+        }
+        WRITE_ONCE(sched_node_load[node],
+                   ncpus ? (muscle_fixed)((sum << MUSCLE_FIXED_SHIFT) / ncpus) : 0);
+    }
+    if (READ_ONCE(sched_balance))
+        queue_delayed_work(system_unbound_wq, &sched_node_load_work, MIG_LOAD_PERIOD);
+}
+
+static void sched_mig_features(int src, int prev_cpu, int dst,
+                               muscle_fixed x[MIG_FEATURES])
+{
+    int src_node = cpu_to_node(src), dst_node = cpu_to_node(dst);
+    int delta = (int)READ_ONCE(cpu_rq(src)->nr_running) -
+                (int)READ_ONCE(cpu_rq(dst)->nr_running);
+
+    /* Runqueue imbalance in tasks, in quarters of a unit so ±8 tasks fit */
+    x[0] = clamp(delta, -8, 8) * (MUSCLE_FIXED_ONE / 4);
+    x[1] = cpus_share_cache(prev_cpu, dst) ? MUSCLE_FIXED_ONE : 0;
+    x[2] = src_node == dst_node ? MUSCLE_FIXED_ONE : 0;
+    x[3] = dst == prev_cpu ? MUSCLE_FIXED_ONE : 0;
+    x[4] = READ_ONCE(sched_node_load[src_node]) - READ_ONCE(sched_node_load[dst_node]);
+    x[5] = available_idle_cpu(dst) ? MUSCLE_FIXED_ONE : 0;
+}
+
+static muscle_fixed sched_mig_score(int src, int prev_cpu, int dst)
+{
+    muscle_fixed x[MIG_FEATURES], score;
+
+    sched_mig_features(src, prev_cpu, dst, x);
+    sched_mig_head_forward(&sched_mig, x, &score);
+    return score;
+}
+
+/* Returns a better CPU for p than prev_cpu, or -1 to keep CFS's choice */
+int muscle_sched_suggest_cpu(struct task_struct *p, int prev_cpu)
+{
+    int src = task_cpu(p), best_cpu = -1, scanned = 0;
+    int prev_node = cpu_to_node(prev_cpu);
+    muscle_fixed stay, best;
+    struct sched_domain *sd;
+    int cpu, node;
+
+    if (!READ_ONCE(sched_balance) || unlikely(!sched_mig_head_ready(&sched_mig) || !sched_node_load))
+        return -1;
+
+    stay = sched_mig_score(src, prev_cpu, prev_cpu);
+    best = stay + MIG_MARGIN;
+
+#define MIG_TRY(c)                                                      \
+    do {                                                                \
+        muscle_fixed sc;                                                \
+                                                                        \
+        if ((c) == prev_cpu || !cpu_online(c))                          \
+            break;                                                      \
+        sc = sched_mig_score(src, prev_cpu, (c));                       \
+        if (sc > best) {                                                \
+            best = sc;                                                  \
+            best_cpu = (c);                                             \
+        }                                                               \
+    } while (0)
+
+    rcu_read_lock();
+    /* 1. LLC siblings: no cache refill beyond L1/L2 */
+    sd = rcu_dereference(per_cpu(sd_llc, prev_cpu));
+    if (sd) {
+        for_each_cpu_and(cpu, sched_domain_span(sd), p->cpus_ptr) {
+            if (scanned++ >= MIG_SCAN_MAX)
+                break;
+            MIG_TRY(cpu);
+        }
+    }
+    rcu_read_unlock();
+
+    /* 2. The rest of prev_cpu's node */
+    for_each_cpu_and(cpu, cpumask_of_node(prev_node), p->cpus_ptr) {
+        if (scanned >= MIG_SCAN_MAX)
+            break;
+        if (cpus_share_cache(prev_cpu, cpu))
+            continue;
+        scanned++;
+        MIG_TRY(cpu);
+    }
+
+    /* 3. One representative per remote node; the features decide */
+    for_each_online_node(node) {
+        if (node == prev_node)
+            continue;
+        cpu = cpumask_any_and(cpumask_of_node(node), p->cpus_ptr);
+        if (cpu < nr_cpu_ids)
+            MIG_TRY(cpu);
+    }
+#undef MIG_TRY
+
+    if (best_cpu >= 0)
+        trace_muscle_sched_migrate(p->pid, prev_cpu, best_cpu, best - stay);
+    return best_cpu;
+}
+
+static int __init sched_mig_init(void)
+{
+    int ret;
+
+    ret = sched_mig_head_init(&sched_mig, sched_mig_w, sched_mig_b);
+    if (ret)
+        return ret;
+
+    sched_node_load = kcalloc(nr_node_ids, sizeof(*sched_node_load), GFP_KERNEL);
+    if (!sched_node_load) {
+        sched_mig_head_free(&sched_mig);
+        return -ENOMEM;
+    }
+    WRITE_ONCE(sched_balance_ready, true);
+    if (sched_balance)
+        queue_delayed_work(system_unbound_wq, &sched_node_load_work, 0);
+    return 0;
+}
+
+static void sched_release(void *model)
+{
+    sched_net_free(model);
+}
+
+static void *sched_build(const muscle_fixed *const *t)
+{
+    return sched_net_build(t[SCHED_W1], t[SCHED_B1], t[SCHED_W2], t[SCHED_B2]);
+}
+
+static struct muscle_wset sched_wset = {
+    .name      = "sched",
+    .tables    = sched_tables,
+    .nr_tables = SCHED_TABLES,
+    .build     = sched_build,
+    .release   = sched_release,
+    .model     = (void __rcu **)&sched_net,
+};
+
+static int __init muscle_scheduler_init(void)
+{
+    bool learn_ok;
+    int ret;
+
+    muscle_switch_ready(&muscle_sched_key_switch);
+    /* Before the net goes live: a boot-time sched_learn records from the first tick */
+    learn_ok = !sched_learn_init();
+    if (!learn_ok)
+        pr_warn("MuscleScheduler: online learning unavailable\n");
+    ret = muscle_wset_register(&sched_wset);
+    if (ret)
+        return ret;
+    if (learn_ok)
+        sched_learn_start();
+    muscle_stats_register(&sched_stats, NULL);
+    muscle_throttle_register(&sched_throttle);
+    if (sched_batch_init())
+        pr_warn("MuscleScheduler: batched mode unavailable\n");
+    if (sched_mig_init())
+        pr_warn("MuscleScheduler: migration head unavailable\n");
+    return 0;
+}
+late_initcall(muscle_scheduler_init);
@@ -3,83 +3,680 @@
 #include <linux/uaccess.h>
 #include <linux/sched.h>
 #include <linux/random.h>
+#include <linux/pid_namespace.h>
+#include <linux/rcupdate.h>
+#include <linux/err.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/math.h>
+#include <linux/string.h>
+#include <linux/workqueue.h>
+#include <linux/bsearch.h>
+#include <linux/cgroup.h>
+#include <linux/hash.h>
+#include <linux/jump_label.h>
+#include <linux/kstrtox.h>
+#include <linux/log2.h>
+#include <linux/mutex.h>
+#include <linux/sort.h>
+#include <trace/events/muscle.h>
 
 /* 64 → 16 → 64 autoencoder for syscall + 6 args vector */
 #define SEC_INPUT  7
 #define SEC_HIDDEN 16
 
-static const muscle_fixed sec_enc_w[SEC_HIDDEN * SEC_INPUT] = { #include "weights/sec_enc_w.hex" };
-static const muscle_fixed sec_enc_b[SEC_HIDDEN] = { #include "weights/sec_enc_b.hex" };
-static const muscle_fixed sec_dec_w[SEC_INPUT * SEC_HIDDEN] = { #include "weights/sec_dec_w.hex" };
-static const muscle_fixed sec_dec_b[SEC_INPUT] = { #include "weights/sec_dec_b.hex" };
+/* Built-in weights; missing sources leave empty tables (see muscle_wset) */
+static const muscle_fixed sec_enc_w[] = {
+#if __has_include("weights/sec_enc_w.hex")
+    #include "weights/sec_enc_w.hex"
+#endif
+};
+static const muscle_fixed sec_enc_b[] = {
+#if __has_include("weights/sec_enc_b.hex")
+    #include "weights/sec_enc_b.hex"
+#endif
+};
+static const muscle_fixed sec_dec_w[] = {
+#if __has_include("weights/sec_dec_w.hex")
+    #include "weights/sec_dec_w.hex"
+#endif
+};
+static const muscle_fixed sec_dec_b[] = {
+#if __has_include("weights/sec_dec_b.hex")
+    #include "weights/sec_dec_b.hex"
+#endif
+};
 
-static muscle_fixed sec_running_mean[SEC_INPUT];
-static muscle_fixed sec_running_var[SEC_INPUT];
-static u64 sec_count = 0;
+enum { SEC_ENC_W, SEC_ENC_B, SEC_DEC_W, SEC_DEC_B, SEC_TABLES };
 
-static inline muscle_fixed sec_forward(const muscle_fixed x[SEC_INPUT], muscle_fixed h[SEC_HIDDEN])
+static const struct muscle_wtable sec_tables[SEC_TABLES] = {
+    [SEC_ENC_W] = MUSCLE_WTABLE("enc_w", sec_enc_w, SEC_HIDDEN * SEC_INPUT),
+    [SEC_ENC_B] = MUSCLE_WTABLE("enc_b", sec_enc_b, SEC_HIDDEN),
+    [SEC_DEC_W] = MUSCLE_WTABLE("dec_w", sec_dec_w, SEC_INPUT * SEC_HIDDEN),
+    [SEC_DEC_B] = MUSCLE_WTABLE("dec_b", sec_dec_b, SEC_INPUT),
+};
+
+/*
+ * Loss statistics.  Each CPU's drain keeps an exponentially weighted
+ * mean/variance of the reconstruction error it scores, with shift-only
+ * updates (alpha = 2^-SEC_EWMA_SHIFT), so there is no shared write and no
+ * division per syscall.  sec_stats_work pools the CPUs every
+ * sec_publish_ms and publishes sec_limit = mean + SEC_SIGMAS * stddev,
+ * which is all the threshold reads.  Only unflagged scores are learned,
+ * so an attack does not widen the band that caught it; in window mode
+ * the scores are window means.
+ */
+#define SEC_EWMA_SHIFT  6
+#define SEC_WARMUP      (4U << SEC_EWMA_SHIFT)   /* samples before a verdict */
+#define SEC_SIGMAS      4
+
+struct sec_stats {
+    muscle_fixed mean;
+    muscle_fixed var;
+    u64 count;
+} ____cacheline_aligned;
+
+static DEFINE_PER_CPU_ALIGNED(struct sec_stats, sec_stats);
+
+/* 0 while warming up */
+static muscle_fixed sec_limit;
+
+static unsigned int sec_publish_ms = 100;
+module_param(sec_publish_ms, uint, 0644);
+MODULE_PARM_DESC(sec_publish_ms, "Period for pooling per-CPU loss statistics");
+
+static void sec_stats_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(sec_stats_work, sec_stats_fn);
+
+/* int16 per-row quantized encoder/decoder */
+MUSCLE_AUTOENC(sec_model, SEC_INPUT, SEC_HIDDEN, 16)
+
+static struct sec_model __rcu *sec_model;
+static struct muscle_evq sec_evq;
+
+/* Event layout: a = syscall nr, b/c = args, d = pid, e = uid, id = start time */
+/* Runs only from cpu's drain, so the accumulator has a single writer */
+static void sec_stats_update(struct sec_stats *st, muscle_fixed err)
 {
-    int i, j;
-    for (i = 0; i < SEC_HIDDEN; i++) {
-        muscle_fixed sum = sec_enc_b[i];
-        for (j = 0; j < SEC_INPUT; j++)
-            sum += sec_enc_w[i * SEC_INPUT + j] * x[j];
-        h[i] = muscle_relu(sum);
+    if (unlikely(!st->count)) {
+        WRITE_ONCE(st->mean, err);
+    } else {
+        muscle_fixed d = muscle_fx_sat((s64)err - st->mean);
+        muscle_fixed m = st->mean + (d >> SEC_EWMA_SHIFT);
+        muscle_fixed dd = muscle_fx_mul(d, muscle_fx_sat((s64)err - m));
+
+        /* var += alpha * (d * (err - mean') - var), signed shifts */
+        WRITE_ONCE(st->mean, m);
+        WRITE_ONCE(st->var, muscle_fx_sat((s64)st->var +
+                            (((s64)dd - st->var) >> SEC_EWMA_SHIFT)));
     }
-    return 0;
+    WRITE_ONCE(st->count, st->count + 1);
 }
 
-static inline muscle_loss(const muscle_fixed x[SEC_INPUT], const muscle_fixed h[SEC_HIDDEN])
+/*
+ * Pool the per-CPU estimates: mean of means, and mean of variances plus
+ * the spread of the means around the pooled mean.  Reads are racy by
+ * design; each entry is an s32, so a torn CPU only skews one round.
+ */
+static void sec_stats_fn(struct work_struct *work)
 {
-    muscle_fixed recon[SEC_INPUT] = {0};
-    muscle_fixed loss = 0;
-    int i, j;
+    s64 mean = 0, var = 0;
+    muscle_fixed m, limit = 0;
+    u64 count = 0;
+    unsigned int n = 0;
+    int cpu;
+
+    for_each_online_cpu(cpu) {
+        const struct sec_stats *st = per_cpu_ptr(&sec_stats, cpu);
 
-    for (i = 0; i < SEC_INPUT; i++) {
-        muscle_fixed sum = sec_dec_b[i];
-        for (j = 0; j < SEC_HIDDEN; j++)
-            sum += sec_dec_w[i * SEC_HIDDEN + j] * h[j];
-        recon[i] = sum;
-        muscle_fixed diff = x[i] - recon[i];
-        loss += diff * diff;
+        if (!data_race(st->count))
+            continue;
+        mean += data_race(st->mean);
+        count += data_race(st->count);
+        n++;
     }
-    return loss;
+    if (!n)
+        goto out;
+
+    m = (muscle_fixed)div_s64(mean, n);
+    for_each_online_cpu(cpu) {
+        const struct sec_stats *st = per_cpu_ptr(&sec_stats, cpu);
+        muscle_fixed d;
+
+        if (!data_race(st->count))
+            continue;
+        d = muscle_fx_sat((s64)data_race(st->mean) - m);
+        var += (s64)max(data_race(st->var), 0) + muscle_fx_mul(d, d);
+    }
+
+    /* sqrt of a Q12 variance, shifted up first so the result is Q12 */
+    if (count >= SEC_WARMUP)
+        limit = muscle_fx_sat((s64)m + SEC_SIGMAS *
+                              (s64)int_sqrt64((u64)div_s64(var, n) << MUSCLE_FIXED_SHIFT));
+out:
+    WRITE_ONCE(sec_limit, limit);
+    schedule_delayed_work(&sec_stats_work,
+                          msecs_to_jiffies(max(READ_ONCE(sec_publish_ms), 10U)));
 }
 
-void muscle_security_check(u64 syscall_nr, u64 arg1, u64 arg2)
+/*
+ * Fast-path filters.
+ *
+ * sec_check_key is off while sec_sample is 0.
+ * sec_bypass_key is on only while trusted_cgroups is non-empty; then a
+ * task whose default-hierarchy cgroup id is listed is never checked.
+ * sec_sample checks 1 in N syscalls per CPU, further halved for each
+ * ring overflow when sec_adaptive is set.  A clean verdict for
+ * (task, syscall) is remembered for sec_verdict_ttl_ms, the task being
+ * its pid and start time so that a reused pid does not inherit it.
+ * Window mode skips the last two: a window needs every syscall of its
+ * task, in order.
+ */
+static DEFINE_STATIC_KEY_FALSE(sec_check_key);
+static DEFINE_STATIC_KEY_FALSE(sec_bypass_key);
+
+/* In front of all of these, and of capture, in muscle_security_check() */
+DEFINE_MUSCLE_SWITCH(muscle_security_key, "security");
+
+#define SEC_SAMPLE_MAX_SHIFT  6
+#define SEC_VERDICT_SLOTS     64
+#define SEC_MAX_TRUSTED       32
+
+static bool sec_adaptive = true;
+module_param(sec_adaptive, bool, 0644);
+MODULE_PARM_DESC(sec_adaptive, "Back off sampling while the event ring overflows");
+
+static unsigned int sec_verdict_ttl_ms = 1000;
+module_param(sec_verdict_ttl_ms, uint, 0644);
+MODULE_PARM_DESC(sec_verdict_ttl_ms, "How long a clean (task, syscall) verdict is reused (0 = never)");
+
+/* Per-CPU, written by the hot path (countdown) and the drain (the rest) */
+struct sec_filter {
+    int countdown;
+    unsigned int shift;
+    struct {
+        u64 key;            /* pid << 32 | syscall nr */
+        u64 id;             /* the pid's start_boottime */
+        unsigned long expires;
+    } verdict[SEC_VERDICT_SLOTS];
+} ____cacheline_aligned;
+
+static DEFINE_PER_CPU_ALIGNED(struct sec_filter, sec_filter);
+
+static unsigned int sec_sample = 1;
+static bool sec_ready;
+
+static void sec_check_key_update(void)
 {
-    muscle_fixed input[7] = {
-        muscle_float_to_fixed((float)syscall_nr / 400.0f),
-        muscle_float_to_fixed((float)arg1 / 1e12f),
-        muscle_float_to_fixed((float)arg2 / 1e12f),
-        muscle_float_to_fixed((float)current->pid / 32768.0f),
-        muscle_float_to_fixed((float)jiffies / 100000.0f),
-        muscle_float_to_fixed((float)current_uid().val / 65536.0f),
-        muscle_float_to_fixed((float)get_random_u32() / UINT_MAX)
-    };
+    if (READ_ONCE(sec_sample))
+        static_branch_enable(&sec_check_key);
+    else
+        static_branch_disable(&sec_check_key);
+}
+
+static int sec_sample_set(const char *val, const struct kernel_param *kp)
+{
+    int ret = param_set_uint(val, kp);
+
+    /* Before init the key is settled by muscle_security_init() */
+    if (!ret && READ_ONCE(sec_ready))
+        sec_check_key_update();
+    return ret;
+}
+
+static const struct kernel_param_ops sec_sample_ops = {
+    .set = sec_sample_set,
+    .get = param_get_uint,
+};
+module_param_cb(sec_sample, &sec_sample_ops, &sec_sample, 0644);
+MODULE_PARM_DESC(sec_sample, "Check 1 in N syscalls per CPU (0 = off)");
+
+static bool sec_sample_skip(struct sec_filter *f)
+{
+    if (likely(--f->countdown > 0))
+        return true;
+    f->countdown = min_t(u64, (u64)READ_ONCE(sec_sample) << READ_ONCE(f->shift), INT_MAX);
+    return false;
+}
+
+static inline u64 sec_verdict_key(u32 pid, u64 nr)
+{
+    return (u64)pid << 32 | (u32)nr;
+}
+
+/*
+ * Entries are read without synchronisation against the drain; a torn
+ * read can only skip or repeat a single check.
+ */
+static bool sec_verdict_cached(const struct sec_filter *f, u32 pid, u64 id, u64 nr)
+{
+    u64 key = sec_verdict_key(pid, nr);
+    unsigned int slot = hash_64(key, ilog2(SEC_VERDICT_SLOTS));
+
+    return READ_ONCE(f->verdict[slot].key) == key &&
+           READ_ONCE(f->verdict[slot].id) == id &&
+           time_before(jiffies, READ_ONCE(f->verdict[slot].expires));
+}
+
+static void sec_verdict_store(struct sec_filter *f, u32 pid, u64 id, u64 nr,
+                              unsigned long expires)
+{
+    u64 key = sec_verdict_key(pid, nr);
+    unsigned int slot = hash_64(key, ilog2(SEC_VERDICT_SLOTS));
+
+    WRITE_ONCE(f->verdict[slot].expires, expires);
+    WRITE_ONCE(f->verdict[slot].id, id);
+    WRITE_ONCE(f->verdict[slot].key, key);
+}
+
+/* Sorted cgroup ids, replaced wholesale on every write */
+struct sec_trusted {
+    struct rcu_head rcu;
+    unsigned int nr;
+    u64 id[];
+};
+
+static struct sec_trusted __rcu *sec_trusted;
+static DEFINE_MUTEX(sec_trusted_lock);
+
+static int cmp_u64(const void *a, const void *b)
+{
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static bool sec_cgroup_trusted(void)
+{
+    const struct sec_trusted *t;
+    bool found = false;
+    u64 id;
+
+    rcu_read_lock();
+    t = rcu_dereference(sec_trusted);
+    if (t) {
+        id = cgroup_id(task_dfl_cgroup(current));
+        found = bsearch(&id, t->id, t->nr, sizeof(t->id[0]), cmp_u64) != NULL;
+    }
+    rcu_read_unlock();
+    return found;
+}
+
+static int sec_trusted_set(const char *val, const struct kernel_param *kp)
+{
+    struct sec_trusted *t, *old;
+    char *buf, *p, *tok;
+    int ret = 0;
+
+    t = kzalloc(struct_size(t, id, SEC_MAX_TRUSTED), GFP_KERNEL);
+    buf = kstrdup(val, GFP_KERNEL);
+    if (!t || !buf) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    /* Comma or space separated cgroup v2 ids, as shown by stat -c %i */
+    p = strim(buf);
+    while ((tok = strsep(&p, ", \n"))) {
+        if (!*tok)
+            continue;
+        if (t->nr == SEC_MAX_TRUSTED) {
+            ret = -E2BIG;
+            goto out;
+        }
+        ret = kstrtou64(tok, 0, &t->id[t->nr++]);
+        if (ret)
+            goto out;
+    }
+    sort(t->id, t->nr, sizeof(t->id[0]), cmp_u64, NULL);
+
+    mutex_lock(&sec_trusted_lock);
+    if (t->nr)
+        static_branch_enable(&sec_bypass_key);
+    old = rcu_replace_pointer(sec_trusted, t->nr ? t : NULL,
+                              lockdep_is_held(&sec_trusted_lock));
+    if (!t->nr)
+        static_branch_disable(&sec_bypass_key);
+    mutex_unlock(&sec_trusted_lock);
+
+    if (!t->nr)
+        kfree(t);
+    t = NULL;
+    if (old)
+        kfree_rcu(old, rcu);
+out:
+    kfree(buf);
+    kfree(t);
+    return ret;
+}
+
+static int sec_trusted_get(char *buf, const struct kernel_param *kp)
+{
+    const struct sec_trusted *t;
+    int len = 0;
+    unsigned int i;
+
+    rcu_read_lock();
+    t = rcu_dereference(sec_trusted);
+    for (i = 0; t && i < t->nr; i++)
+        len += sysfs_emit_at(buf, len, "%s%llu", i ? "," : "", t->id[i]);
+    rcu_read_unlock();
+    return len + sysfs_emit_at(buf, len, "\n");
+}
+
+static const struct kernel_param_ops sec_trusted_ops = {
+    .set = sec_trusted_set,
+    .get = sec_trusted_get,
+};
+module_param_cb(trusted_cgroups, &sec_trusted_ops, NULL, 0600);
+MODULE_PARM_DESC(trusted_cgroups, "cgroup v2 ids whose tasks skip syscall checks");
+
+/* Event layout: see muscle_security_check(); prev is the task's last nr, 0 if unknown */
+static void sec_encode(const struct muscle_event *ev, u64 prev,
+                       muscle_fixed x[SEC_INPUT])
+{
+    x[0] = muscle_fx_div_const(ev->a, 400);
+    x[1] = muscle_fx_div_const(ev->b, 1000000000000ULL);
+    x[2] = muscle_fx_div_const(ev->c, 1000000000000ULL);
+    x[3] = muscle_fx_div_const(ev->d, 32768);
+    x[4] = muscle_fx_div_const(jiffies, 100000);
+    x[5] = muscle_fx_div_const(ev->e, 65536);
+    x[6] = muscle_fx_div_const(prev, 400);
+}
+
+/* SEC_SIGMAS standard deviations over the pooled loss; false while warming up */
+static bool sec_over_threshold(muscle_fixed err)
+{
+    muscle_fixed limit = READ_ONCE(sec_limit);
+
+    return limit > 0 && err > limit;
+}
+
+/*
+ * Audit mode (sec_enforce=0) logs and counts flags without killing.  Run
+ * on a host known to be clean, every flag is a false positive, which is
+ * what the false_pos counter then measures.
+ */
+static bool sec_enforce = true;
+module_param(sec_enforce, bool, 0644);
+MODULE_PARM_DESC(sec_enforce, "Kill tasks flagged as anomalous (0 = audit only)");
+
+DEFINE_MUSCLE_STATS(sec_mstats, "security",
+                    BIT(MUSCLE_STAT_CALLS) | BIT(MUSCLE_STAT_INFER) |
+                    BIT(MUSCLE_STAT_INFER_NS) | BIT(MUSCLE_STAT_KILLS) |
+                    BIT(MUSCLE_STAT_FALSE_POS));
+
+/*
+ * The verdict lands after the fact, so the pid may have exited and been
+ * reused since: only kill the task that started when the offender did.
+ */
+static bool sec_kill(u32 pid, u64 id)
+{
+    struct task_struct *p;
+    bool killed = false;
+
+    rcu_read_lock();
+    p = find_task_by_pid_ns(pid, &init_pid_ns);
+    if (p && p->start_boottime == id)
+        killed = !kill_pid(task_pid(p), SIGKILL, 1);
+    rcu_read_unlock();
+    return killed;
+}
+
+/* Act on a flagged syscall nr, or window of syscalls ending in it, of task (pid, id) */
+static void sec_flag(u32 pid, u64 id, u64 nr, muscle_fixed err, unsigned int window)
+{
+    bool enforce = READ_ONCE(sec_enforce);
+
+    trace_muscle_security_verdict(pid, nr, err, window, enforce);
+    pr_alert_ratelimited("MuscleSecurity: ANOMALY pid=%u window=%u last=%llu err=%d → %s\n",
+                         pid, window, nr, err, enforce ? "KILL" : "audit");
+    if (!enforce) {
+        muscle_stat_inc(&sec_mstats, MUSCLE_STAT_FALSE_POS);
+        return;
+    }
+    if (sec_kill(pid, id))
+        muscle_stat_inc(&sec_mstats, MUSCLE_STAT_KILLS);
+}
+
+/* Returns true if ev was anomalous (and its task killed, unless auditing) */
+static bool sec_score(const struct sec_model *m, struct sec_stats *st,
+                      const struct muscle_event *ev)
+{
+    muscle_fixed input[SEC_INPUT];
     muscle_fixed h[SEC_HIDDEN];
+    u64 t0 = muscle_stat_clock();
+    muscle_fixed err;
+
+    /* No window, so no previous syscall: see window mode below */
+    sec_encode(ev, 0, input);
+    err = sec_model_loss(m, input, h);
+    muscle_stat_time(&sec_mstats, MUSCLE_STAT_INFER_NS, t0);
+    muscle_stat_inc(&sec_mstats, MUSCLE_STAT_INFER);
+
+    if (sec_over_threshold(err)) {
+        sec_flag(ev->d, ev->id, ev->a, err, 1);
+        return true;
+    }
+    sec_stats_update(st, err);
+    return false;
+}
+
+/*
+ * Window mode (sec_window > 1): each CPU's drain gathers the syscalls of
+ * up to SEC_WINDOW_SLOTS tasks into direct-mapped windows, feeding every
+ * entry the task's previous syscall, and scores a full window in one
+ * batched encoder/decoder pass.  The verdict is on the window mean, so a
+ * lone outlier no longer kills a task on its own.  A task that migrates,
+ * or collides with another in its slot, starts a fresh window.
+ *
+ * Single-syscall scoring feeds prev = 0 where a window feeds the real
+ * one, so the two modes present different input distributions: a blob
+ * is trained for one of them, and the loss statistics take a few
+ * hundred scores to follow a switch across sec_window = 1.
+ */
+#define SEC_WINDOW_MAX    16
+#define SEC_WINDOW_SLOTS  16
+
+struct sec_window {
+    u32 pid;
+    u64 id;
+    unsigned int len;
+    u64 prev;
+    muscle_fixed x[SEC_WINDOW_MAX][SEC_INPUT];
+};
+
+/* Drain-private, so unlike sec_filter it needs no ordering */
+struct sec_windows {
+    struct sec_window slot[SEC_WINDOW_SLOTS];
+};
+
+static DEFINE_PER_CPU(struct sec_windows, sec_windows);
+
+static unsigned int sec_window;
+module_param(sec_window, uint, 0644);
+MODULE_PARM_DESC(sec_window, "Score every syscall in per-task windows of N (0/1 = one at a time, sampled; max 16)");
+
+/* Mean reconstruction error of w, which must hold len >= 1 entries */
+static muscle_fixed sec_window_err(const struct sec_model *m, const struct sec_window *w)
+{
+    muscle_fixed h[SEC_WINDOW_MAX][SEC_HIDDEN];
+    muscle_fixed recon[SEC_WINDOW_MAX][SEC_INPUT];
+    u64 t0 = muscle_stat_clock();
+    s64 sum = sec_model_loss_batch(m, &w->x[0][0], &h[0][0], &recon[0][0], w->len);
+
+    /* One batched pass, so one latency sample per window */
+    muscle_stat_time(&sec_mstats, MUSCLE_STAT_INFER_NS, t0);
+    muscle_stat_inc(&sec_mstats, MUSCLE_STAT_INFER);
+    return muscle_fx_sat(div_s64(sum, w->len));
+}
 
-    sec_forward(input, h);
-    muscle_fixed err = sec_forward_loss(input, h);
+/* Append ev to its task's window; score and empty the window once full */
+static void sec_window_add(const struct sec_model *m, struct sec_stats *st,
+                           const struct muscle_event *ev, unsigned int len, int cpu)
+{
+    struct sec_windows *ws = per_cpu_ptr(&sec_windows, cpu);
+    struct sec_window *w = &ws->slot[hash_32(ev->d, ilog2(SEC_WINDOW_SLOTS))];
+    muscle_fixed err;
+
+    if (w->pid != ev->d || w->id != ev->id || w->len >= len) {
+        w->pid = ev->d;
+        w->id = ev->id;
+        w->len = 0;
+        w->prev = 0;
+    }
+    sec_encode(ev, w->prev, w->x[w->len++]);
+    w->prev = ev->a;
+    if (w->len < len)
+        return;
+
+    err = sec_window_err(m, w);
+    w->len = 0;
+    if (sec_over_threshold(err)) {
+        sec_flag(ev->d, ev->id, ev->a, err, len);
+        w->pid = 0;
+        return;
+    }
+    sec_stats_update(st, err);
+}
+
+static void sec_drain(struct muscle_evq *q, int cpu,
+                      const struct muscle_event *ev, unsigned int n)
+{
+    struct sec_stats *st = per_cpu_ptr(&sec_stats, cpu);
+    struct sec_filter *f = per_cpu_ptr(&sec_filter, cpu);
+    unsigned long ttl = msecs_to_jiffies(READ_ONCE(sec_verdict_ttl_ms));
+    unsigned int len = min(READ_ONCE(sec_window), SEC_WINDOW_MAX);
+    const struct sec_model *m;
+    unsigned int i;
+
+    rcu_read_lock();
+    m = rcu_dereference(sec_model);
+    for (i = 0; m && i < n; i++) {
+        if (len > 1)
+            sec_window_add(m, st, &ev[i], len, cpu);
+        else if (!sec_score(m, st, &ev[i]) && ttl)
+            sec_verdict_store(f, ev[i].d, ev[i].id, ev[i].a, jiffies + ttl);
+    }
+    rcu_read_unlock();
+
+    /* The ring kept up: ease adaptive sampling back towards sec_sample */
+    if (n < MUSCLE_RING_BATCH / 4 && READ_ONCE(f->shift))
+        WRITE_ONCE(f->shift, f->shift - 1);
+}
+
+static void sec_event(struct muscle_event *ev, u64 syscall_nr, u64 arg1, u64 arg2)
+{
+    *ev = (struct muscle_event) {
+        .a = syscall_nr,
+        .b = arg1,
+        .c = arg2,
+        .d = current->pid,
+        .e = from_kuid(&init_user_ns, current_uid()),
+        .id = current->start_boottime,
+    };
+}
+
+/* Capture sees every syscall, ahead of sampling and the verdict cache */
+static void sec_trace(u64 syscall_nr, u64 arg1, u64 arg2)
+{
+    struct muscle_trace_rec rec = { .type = MUSCLE_TRACE_SECURITY };
+
+    sec_event(&rec.ev, syscall_nr, arg1, arg2);
+    muscle_trace_record(&rec);
+}
+
+/*
+ * Syscall-entry hook: queue the tuple, score it off the hot path.
+ * Each filter in front of the push is cheaper than the one after it:
+ * a patched-out branch when checking is off, a patched-out branch
+ * unless some cgroup is trusted, a per-CPU countdown, and a per-CPU
+ * cache of recent clean verdicts.
+ */
+void __muscle_security_check(u64 syscall_nr, u64 arg1, u64 arg2)
+{
+    struct muscle_event ev;
+    struct sec_filter *f;
+    bool skip;
 
-    /* Online mean/variance update */
-    sec_count++;
-    for (int i = 0; i < SEC_INPUT; i++) {
-        muscle_fixed delta = input[i] - sec_running_mean[i];
-        sec_running_mean[i] += delta / sec_count;
-        sec_running_var[i] += delta * (input[i] - sec_running_mean[i]);
+    if (muscle_trace_on(MUSCLE_TRACE_SECURITY))
+        sec_trace(syscall_nr, arg1, arg2);
+    if (!static_branch_likely(&sec_check_key))
+        return;
+    if (unlikely(!rcu_access_pointer(sec_model)))
+        return;
+    muscle_stat_inc(&sec_mstats, MUSCLE_STAT_CALLS);
+    if (static_branch_unlikely(&sec_bypass_key) && sec_cgroup_trusted())
+        return;
+
+    f = get_cpu_ptr(&sec_filter);
+    skip = READ_ONCE(sec_window) <= 1 &&
+           (sec_sample_skip(f) ||
+            sec_verdict_cached(f, current->pid, current->start_boottime, syscall_nr));
+    put_cpu_ptr(&sec_filter);
+    if (skip)
+        return;
+
+    sec_event(&ev, syscall_nr, arg1, arg2);
+    if (!muscle_evq_push(&sec_evq, &ev) && READ_ONCE(sec_adaptive)) {
+        /* Ring overflowed: sample this CPU half as often */
+        f = raw_cpu_ptr(&sec_filter);
+        if (READ_ONCE(f->shift) < SEC_SAMPLE_MAX_SHIFT)
+            WRITE_ONCE(f->shift, f->shift + 1);
     }
+}
 
-    muscle_fixed std = sec_running_var[0] / (sec_count > 1 ? sec_count - 1 : 1);
-    if (std > 0 && err > 16 * std) {  /* 4σ threshold */
-        pr_alert("MuscleSecurity: ANOMALY pid=%d syscall=%llu err=%.2f → KILL\n",
-                 current->pid, syscall_nr, muscle_fixed_to_float(err));
-        force_sig(SIGKILL, current);
+static void sec_release(void *model)
+{
+    struct sec_model *m = model;
+
+    sec_model_free(m);
+    kfree(m);
+}
+
+static void *sec_build(const muscle_fixed *const *t)
+{
+    struct sec_model *m;
+    int ret;
+
+    m = kzalloc(sizeof(*m), GFP_KERNEL);
+    if (!m)
+        return ERR_PTR(-ENOMEM);
+    ret = sec_model_init(m, t[SEC_ENC_W], t[SEC_ENC_B], t[SEC_DEC_W], t[SEC_DEC_B]);
+    if (ret) {
+        kfree(m);
+        return ERR_PTR(ret);
     }
+    return m;
 }
 
+static struct muscle_wset sec_wset = {
+    .name      = "security",
+    .tables    = sec_tables,
+    .nr_tables = SEC_TABLES,
+    .build     = sec_build,
+    .release   = sec_release,
+    .model     = (void __rcu **)&sec_model,
+};
+
 static int __init muscle_security_init(void)
 {
+    int ret;
+
+    muscle_switch_ready(&muscle_security_key_switch);
+    ret = muscle_evq_init(&sec_evq, "security", sec_drain);
+    if (ret)
+        return ret;
+    ret = muscle_wset_register(&sec_wset);
+    if (ret)
+        return ret;
+    muscle_stats_register(&sec_mstats, &sec_evq);
+    schedule_delayed_work(&sec_stats_work, msecs_to_jiffies(sec_publish_ms));
+
+    sec_check_key_update();
+    WRITE_ONCE(sec_ready, true);
     pr_info("MuscleSecurity: autoencoder anomaly detector active\n");
     return 0;
 }
@@ -0,0 +1,11 @@
+#include <linux/muscle.h>
+#include <linux/cache.h>
+
+/* Q12 activation tables, see muscle_sigmoid()/muscle_tanh() */
+const s16 muscle_sigmoid_lut[MUSCLE_LUT_SIZE] ____cacheline_aligned = {
+    #include "tables/sigmoid_lut.hex"
+};
+
+const s16 muscle_tanh_lut[MUSCLE_LUT_SIZE] ____cacheline_aligned = {
+    #include "tables/tanh_lut.hex"
+};
@@ -0,0 +1,142 @@
+#include <linux/muscle.h>
+#include <linux/cache.h>
+#include <linux/debugfs.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+/*
+ * Weight arena.  Quantized layers and LSTM packs of every muscle come
+ * from shared chunks of 2^MUSCLE_ARENA_ORDER pages, carved in build
+ * order at cacheline granularity, so a model's layers sit back to back
+ * in the order its forward pass streams them and all the muscles
+ * together cover a few pages instead of a slab object per table.  A
+ * chunk goes back to the page allocator with its last allocation; the
+ * one being carved is rewound instead.  Build and release run in
+ * process context only, hence the mutex.
+ */
+#define MUSCLE_ARENA_ORDER  4       /* 64 KB, naturally aligned */
+#define MUSCLE_ARENA_SIZE   (PAGE_SIZE << MUSCLE_ARENA_ORDER)
+#define MUSCLE_ARENA_MAX    32      /* chunks; past that, plain kvzalloc() */
+
+struct muscle_arena_chunk {
+    size_t used;                /* bytes carved, this header included */
+    unsigned int live;          /* allocations not yet freed */
+} ____cacheline_aligned;
+
+static struct muscle_arena_chunk *muscle_arena[MUSCLE_ARENA_MAX];
+static struct muscle_arena_chunk *muscle_arena_cur;
+static unsigned long muscle_arena_outside;     /* live kvzalloc() fallbacks */
+static DEFINE_MUTEX(muscle_arena_lock);
+
+static struct muscle_arena_chunk *muscle_arena_grow(void)
+{
+    struct muscle_arena_chunk *c;
+    unsigned int i;
+
+    for (i = 0; i < MUSCLE_ARENA_MAX && muscle_arena[i]; i++)
+        ;
+    if (i == MUSCLE_ARENA_MAX)
+        return NULL;
+    c = (void *)__get_free_pages(GFP_KERNEL | __GFP_NOWARN, MUSCLE_ARENA_ORDER);
+    if (!c)
+        return NULL;
+    c->used = sizeof(*c);
+    c->live = 0;
+    muscle_arena[i] = c;
+    return c;
+}
+
+/* Zeroed and cacheline aligned; free with muscle_arena_free() */
+void *muscle_arena_alloc(size_t size)
+{
+    struct muscle_arena_chunk *c;
+    void *p = NULL;
+
+    size = ALIGN(size, SMP_CACHE_BYTES);
+    if (size <= MUSCLE_ARENA_SIZE - sizeof(*c)) {
+        mutex_lock(&muscle_arena_lock);
+        c = muscle_arena_cur;
+        /* A full chunk has live allocations, so it is freed with the last */
+        if (!c || c->used + size > MUSCLE_ARENA_SIZE)
+            c = muscle_arena_cur = muscle_arena_grow() ?: muscle_arena_cur;
+        if (c && c->used + size <= MUSCLE_ARENA_SIZE) {
+            p = (u8 *)c + c->used;
+            c->used += size;
+            c->live++;
+        }
+        mutex_unlock(&muscle_arena_lock);
+    }
+    if (p) {
+        memset(p, 0, size);
+        return p;
+    }
+
+    /* Too big for a chunk, or no chunk to be had: still keep working */
+    p = kvzalloc(size, GFP_KERNEL);
+    if (p) {
+        mutex_lock(&muscle_arena_lock);
+        muscle_arena_outside++;
+        mutex_unlock(&muscle_arena_lock);
+    }
+    return p;
+}
+
+void muscle_arena_free(const void *p)
+{
+    struct muscle_arena_chunk *c;
+    unsigned int i;
+
+    if (!p)
+        return;
+
+    mutex_lock(&muscle_arena_lock);
+    for (i = 0; i < MUSCLE_ARENA_MAX; i++) {
+        c = muscle_arena[i];
+        if (!c || p < (void *)c || p >= (void *)c + MUSCLE_ARENA_SIZE)
+            continue;
+        if (!--c->live) {
+            if (c == muscle_arena_cur) {
+                c->used = sizeof(*c);
+            } else {
+                muscle_arena[i] = NULL;
+                free_pages((unsigned long)c, MUSCLE_ARENA_ORDER);
+            }
+        }
+        mutex_unlock(&muscle_arena_lock);
+        return;
+    }
+    muscle_arena_outside--;
+    mutex_unlock(&muscle_arena_lock);
+    kvfree(p);
+}
+
+static int arena_show(struct seq_file *m, void *unused)
+{
+    unsigned long used = 0, live = 0;
+    unsigned int i, n = 0;
+
+    mutex_lock(&muscle_arena_lock);
+    for (i = 0; i < MUSCLE_ARENA_MAX; i++) {
+        if (!muscle_arena[i])
+            continue;
+        n++;
+        used += muscle_arena[i]->used - sizeof(struct muscle_arena_chunk);
+        live += muscle_arena[i]->live;
+    }
+    seq_printf(m, "chunks %u of %lu bytes\n", n, MUSCLE_ARENA_SIZE);
+    seq_printf(m, "used %lu bytes in %lu allocations\n", used, live);
+    seq_printf(m, "outside %lu allocations\n", muscle_arena_outside);
+    mutex_unlock(&muscle_arena_lock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(arena);
+
+static int __init muscle_arena_init(void)
+{
+    debugfs_create_file("arena", 0444, muscle_debugfs_dir(), NULL, &arena_fops);
+    return 0;
+}
+late_initcall(muscle_arena_init);
@@ -0,0 +1,604 @@
+#include <linux/muscle.h>
+#include <linux/err.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/local_lock.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/scatterlist.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <asm/unaligned.h>
+
+/*
+ * zmuscle: a page compressor with a learned front end.  A tiny linear
+ * model looks at a strided sample of 64-bit words and picks the word
+ * transform most likely to expose redundancy (none, xor with the previous
+ * word for pointer-heavy pages, 32-bit deltas for counters and indices);
+ * an LZ4-style coder does the rest.  Same-filled pages short-circuit to
+ * one word.  Everything is integer only and works on caller memory.
+ *
+ * Frame: one mode byte, then
+ *   ZM_STORE   the input verbatim
+ *   ZM_FILL    le64 word, le32 length
+ *   ZM_LZ*     LZ sequences of the (transformed) input
+ *
+ * LZ sequence: token (literal length << 4 | match length - 4), extra
+ * literal length bytes, literals, le16 offset, extra match length bytes.
+ * Lengths of 15 and up continue in 255-saturated bytes.  The last
+ * sequence has literals only and ends the frame.
+ */
+enum {
+    ZM_STORE,
+    ZM_FILL,
+    ZM_LZ,
+    ZM_LZ_XOR64,
+    ZM_LZ_DELTA32,
+};
+
+#define ZM_MIN_MATCH   4
+#define ZM_MAX_OFFSET  0xffff
+#define ZM_HASH_BITS   MUSCLE_COMPRESS_HASH_BITS
+#define ZM_SKIP_SHIFT  6    /* search step grows by one every 64 misses */
+
+/* Selector: features of a strided word sample → one score per LZ mode */
+#define ZM_FEATURES    5
+#define ZM_XFORMS      3    /* ZM_LZ, ZM_LZ_XOR64, ZM_LZ_DELTA32 */
+#define ZM_SAMPLES     64
+
+/* Built-in selector weights; see muscle_wset */
+static const muscle_fixed zm_sel_w[] = {
+#if __has_include("weights/zmuscle_w.hex")
+    #include "weights/zmuscle_w.hex"
+#endif
+};
+static const muscle_fixed zm_sel_b[] = {
+#if __has_include("weights/zmuscle_b.hex")
+    #include "weights/zmuscle_b.hex"
+#endif
+};
+
+enum { ZM_SEL_W, ZM_SEL_B, ZM_TABLES };
+
+static const struct muscle_wtable zm_tables[ZM_TABLES] = {
+    [ZM_SEL_W] = MUSCLE_WTABLE("w", zm_sel_w, ZM_XFORMS * ZM_FEATURES),
+    [ZM_SEL_B] = MUSCLE_WTABLE("b", zm_sel_b, ZM_XFORMS),
+};
+
+struct zm_model {
+    muscle_fixed w[ZM_XFORMS][ZM_FEATURES];
+    muscle_fixed b[ZM_XFORMS];
+};
+
+static struct zm_model __rcu *zm_model;
+
+/*
+ * Fractions (Q12) of sampled word pairs that repeat, are zero, differ in
+ * the low 16 bits only, share the top 24 bits (pointer-like), or whose
+ * 32-bit halves lie within +-255 of each other.
+ */
+static void zm_features(const u8 *src, size_t len, muscle_fixed f[ZM_FEATURES])
+{
+    size_t words = len / 8, step = max_t(size_t, words / ZM_SAMPLES, 1), i;
+    unsigned int cnt[ZM_FEATURES] = {}, n = 0, j;
+
+    for (i = 1; i < words; i += step, n++) {
+        u64 w = get_unaligned_le64(src + 8 * i);
+        u64 p = get_unaligned_le64(src + 8 * (i - 1));
+        s32 d = (s32)((u32)(w >> 32) - (u32)w);
+
+        cnt[0] += w == p;
+        cnt[1] += w == 0;
+        cnt[2] += w != p && !((w ^ p) >> 16);
+        cnt[3] += (w >> 40) == (p >> 40);
+        cnt[4] += d > -256 && d < 256;
+    }
+    for (j = 0; j < ZM_FEATURES; j++)
+        f[j] = n ? cnt[j] * MUSCLE_FIXED_ONE / n : 0;
+}
+
+/* m may be NULL: without a selector every input takes plain LZ */
+static int zm_select(const struct zm_model *m, const u8 *src, size_t len)
+{
+    muscle_fixed f[ZM_FEATURES], best = S32_MIN;
+    int k, j, mode = ZM_LZ;
+
+    if (!m || len < 16 * 8 || len > MUSCLE_COMPRESS_XFORM_MAX)
+        return ZM_LZ;
+    zm_features(src, len, f);
+
+    for (k = 0; k < ZM_XFORMS; k++) {
+        muscle_fixed s = m->b[k];
+
+        for (j = 0; j < ZM_FEATURES; j++)
+            s = muscle_fx_add_sat(s, muscle_fx_mul(m->w[k][j], f[j]));
+        if (s > best) {
+            best = s;
+            mode = ZM_LZ + k;
+        }
+    }
+    return mode;
+}
+
+/* Whole words only; a trailing partial word passes through untouched */
+static void zm_xform(u8 *dst, const u8 *src, size_t len, int mode)
+{
+    size_t i;
+
+    memcpy(dst, src, len);
+    if (mode == ZM_LZ_XOR64) {
+        for (i = len / 8 - 1; i > 0; i--)
+            put_unaligned_le64(get_unaligned_le64(src + 8 * i) ^
+                               get_unaligned_le64(src + 8 * (i - 1)), dst + 8 * i);
+    } else {
+        for (i = len / 4 - 1; i > 0; i--)
+            put_unaligned_le32(get_unaligned_le32(src + 4 * i) -
+                               get_unaligned_le32(src + 4 * (i - 1)), dst + 4 * i);
+    }
+}
+
+/* In place, front to back: each word needs its restored predecessor */
+static void zm_unxform(u8 *buf, size_t len, int mode)
+{
+    size_t i;
+
+    if (mode == ZM_LZ_XOR64) {
+        for (i = 1; i < len / 8; i++)
+            put_unaligned_le64(get_unaligned_le64(buf + 8 * i) ^
+                               get_unaligned_le64(buf + 8 * (i - 1)), buf + 8 * i);
+    } else if (mode == ZM_LZ_DELTA32) {
+        for (i = 1; i < len / 4; i++)
+            put_unaligned_le32(get_unaligned_le32(buf + 4 * i) +
+                               get_unaligned_le32(buf + 4 * (i - 1)), buf + 4 * i);
+    }
+}
+
+static u8 *zm_put_len(u8 *op, size_t n)
+{
+    for (; n >= 255; n -= 255)
+        *op++ = 255;
+    *op++ = n;
+    return op;
+}
+
+/* Emit one sequence; mlen == 0 marks the final, literal-only one */
+static u8 *zm_emit(u8 *op, const u8 *oend, const u8 *lit, size_t nlit,
+                   size_t off, size_t mlen)
+{
+    size_t ml = mlen ? mlen - ZM_MIN_MATCH : 0;
+    size_t need = 1 + nlit + nlit / 255 + 1 + (mlen ? 2 + ml / 255 + 1 : 0);
+
+    if (need > (size_t)(oend - op))
+        return NULL;
+
+    *op++ = min_t(size_t, nlit, 15) << 4 | min_t(size_t, ml, 15);
+    if (nlit >= 15)
+        op = zm_put_len(op, nlit - 15);
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (!mlen)
+        return op;
+
+    put_unaligned_le16(off, op);
+    op += 2;
+    if (ml >= 15)
+        op = zm_put_len(op, ml - 15);
+    return op;
+}
+
+/* Returns the compressed size, or 0 if it would not fit in cap */
+static size_t zm_lz_compress(u8 *dst, size_t cap, const u8 *src, size_t len,
+                             u32 *table)
+{
+    const u8 *oend = dst + cap;
+    size_t ip = 0, anchor = 0;
+    u8 *op = dst;
+
+    memset(table, 0, sizeof(*table) << ZM_HASH_BITS);
+
+    while (ip + ZM_MIN_MATCH <= len) {
+        u32 seq = get_unaligned_le32(src + ip);
+        u32 h = (seq * 2654435761U) >> (32 - ZM_HASH_BITS);
+        size_t ref = table[h], mlen;
+
+        table[h] = ip + 1;
+        if (!ref-- || ip - ref > ZM_MAX_OFFSET ||
+            get_unaligned_le32(src + ref) != seq) {
+            ip += 1 + ((ip - anchor) >> ZM_SKIP_SHIFT);
+            continue;
+        }
+
+        for (mlen = ZM_MIN_MATCH; ip + mlen < len && src[ref + mlen] == src[ip + mlen];)
+            mlen++;
+        op = zm_emit(op, oend, src + anchor, ip - anchor, ip - ref, mlen);
+        if (!op)
+            return 0;
+        ip += mlen;
+        anchor = ip;
+    }
+
+    op = zm_emit(op, oend, src + anchor, len - anchor, 0, 0);
+    return op ? op - dst : 0;
+}
+
+static int zm_get_len(const u8 **ip, const u8 *iend, size_t *n)
+{
+    u8 b;
+
+    do {
+        if (*ip >= iend)
+            return -EINVAL;
+        b = *(*ip)++;
+        *n += b;
+    } while (b == 255);
+    return 0;
+}
+
+/* Returns the decoded size, or a negative errno on a corrupt frame */
+static ssize_t zm_lz_decompress(u8 *dst, size_t cap, const u8 *ip, const u8 *iend)
+{
+    u8 *op = dst, *oend = dst + cap;
+
+    while (ip < iend) {
+        u8 token = *ip++;
+        size_t nlit = token >> 4, mlen = (token & 15) + ZM_MIN_MATCH, off;
+
+        if (nlit == 15 && zm_get_len(&ip, iend, &nlit))
+            return -EINVAL;
+        if (nlit > (size_t)(iend - ip) || nlit > (size_t)(oend - op))
+            return -EINVAL;
+        memcpy(op, ip, nlit);
+        ip += nlit;
+        op += nlit;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -EINVAL;
+        off = get_unaligned_le16(ip);
+        ip += 2;
+        if ((token & 15) == 15 && zm_get_len(&ip, iend, &mlen))
+            return -EINVAL;
+        if (!off || off > (size_t)(op - dst) || mlen > (size_t)(oend - op))
+            return -EINVAL;
+
+        if (off >= mlen) {
+            memcpy(op, op - off, mlen);
+            op += mlen;
+        } else {
+            /* Overlapping match: a run with period off */
+            while (mlen--) {
+                *op = *(op - off);
+                op++;
+            }
+        }
+    }
+    return op - dst;
+}
+
+static bool zm_same_filled(const u8 *src, size_t len, u64 *word)
+{
+    size_t i;
+
+    if (len < 8 || len % 8)
+        return false;
+    *word = get_unaligned_le64(src);
+    for (i = 8; i < len; i += 8)
+        if (get_unaligned_le64(src + i) != *word)
+            return false;
+    return true;
+}
+
+static int zm_compress(const struct zm_model *m, void *dst, size_t *dstlen,
+                       const void *src, size_t srclen, void *wrkmem)
+{
+    u8 *out = dst, *xbuf = (u8 *)wrkmem + (sizeof(u32) << ZM_HASH_BITS);
+    const u8 *in = src;
+    size_t cap = *dstlen, n;
+    u64 word;
+    int mode;
+
+    if (!cap)
+        return -ENOSPC;
+
+    if (zm_same_filled(in, srclen, &word) && cap >= 13 && srclen <= U32_MAX) {
+        out[0] = ZM_FILL;
+        put_unaligned_le64(word, out + 1);
+        put_unaligned_le32(srclen, out + 9);
+        *dstlen = 13;
+        return 0;
+    }
+
+    mode = zm_select(m, in, srclen);
+    if (mode != ZM_LZ) {
+        zm_xform(xbuf, in, srclen, mode);
+        in = xbuf;
+    }
+
+    /* Anything at or above srclen + 1 is no better than storing */
+    n = zm_lz_compress(out + 1, min(cap - 1, srclen), in, srclen, wrkmem);
+    if (n) {
+        out[0] = mode;
+        *dstlen = n + 1;
+        return 0;
+    }
+
+    if (cap - 1 < srclen)
+        return -ENOSPC;
+    out[0] = ZM_STORE;
+    memcpy(out + 1, src, srclen);
+    *dstlen = srclen + 1;
+    return 0;
+}
+
+/*
+ * Compress srclen bytes of src into dst, which holds *dstlen bytes; on
+ * success *dstlen is the frame size.  wrkmem is MUSCLE_COMPRESS_WRKMEM
+ * bytes of scratch owned by the caller.  Input that does not shrink is
+ * stored, so -ENOSPC only means dst is smaller than srclen + 1.
+ */
+int muscle_compress(void *dst, size_t *dstlen, const void *src, size_t srclen,
+                    void *wrkmem)
+{
+    int ret;
+
+    rcu_read_lock();
+    ret = zm_compress(rcu_dereference(zm_model), dst, dstlen, src, srclen, wrkmem);
+    rcu_read_unlock();
+    return ret;
+}
+EXPORT_SYMBOL_GPL(muscle_compress);
+
+/*
+ * Batch path.  Each CPU owns a scratch arena (work memory plus a bounce
+ * frame), so a batch allocates nothing.  Pages are compressed in groups
+ * of ZM_GROUP under one model reference and one arena lock, rescheduling
+ * between groups.  Frames are written straight into the mapped
+ * scatterlist; only a frame that would straddle a chunk boundary goes
+ * through the bounce buffer.
+ */
+#define ZM_GROUP   16
+#define ZM_BOUNCE  (PAGE_SIZE + 1)
+
+struct zm_arena {
+    local_lock_t lock;
+    void *wrkmem;
+    u8 *bounce;
+};
+
+static DEFINE_PER_CPU(struct zm_arena, zm_arena) = {
+    .lock = INIT_LOCAL_LOCK(lock),
+};
+
+static bool zm_arena_ready;
+
+/* Make the current chunk of mi writable, moving on when it is full */
+static int zm_sg_room(struct sg_mapping_iter *mi, size_t *room)
+{
+    if (!mi->addr || mi->consumed == mi->length) {
+        if (!sg_miter_next(mi))
+            return -ENOSPC;
+        mi->consumed = 0;
+    }
+    *room = mi->length - mi->consumed;
+    return 0;
+}
+
+static int zm_sg_put(struct sg_mapping_iter *mi, const u8 *buf, size_t len)
+{
+    size_t room;
+    int ret;
+
+    while (len) {
+        ret = zm_sg_room(mi, &room);
+        if (ret)
+            return ret;
+        room = min(room, len);
+        memcpy(mi->addr + mi->consumed, buf, room);
+        mi->consumed += room;
+        buf += room;
+        len -= room;
+    }
+    return 0;
+}
+
+/*
+ * The previous frame's size (*expect) predicts this one's: go direct only
+ * when it fits the room left in the chunk, so runs of incompressible pages
+ * never compress twice.  The page is mapped after the chunk and unmapped
+ * before the miter moves on, keeping the local kmaps nested.
+ */
+static int zm_compress_page(const struct zm_model *m, struct zm_arena *a,
+                            struct sg_mapping_iter *mi, struct page *page,
+                            size_t *expect, unsigned int *len)
+{
+    const void *src;
+    bool bounced = false;
+    size_t n, room;
+    int ret;
+
+    ret = zm_sg_room(mi, &room);
+    if (ret)
+        return ret;
+
+    src = kmap_local_page(page);
+    ret = -ENOSPC;
+    if (room > *expect) {
+        n = room;
+        ret = zm_compress(m, mi->addr + mi->consumed, &n, src, PAGE_SIZE, a->wrkmem);
+        if (!ret)
+            mi->consumed += n;
+    }
+    if (ret == -ENOSPC) {
+        n = ZM_BOUNCE;
+        ret = zm_compress(m, a->bounce, &n, src, PAGE_SIZE, a->wrkmem);
+        bounced = true;
+    }
+    kunmap_local(src);
+
+    if (!ret && bounced)
+        ret = zm_sg_put(mi, a->bounce, n);
+    if (!ret)
+        *expect = *len = n;
+    return ret;
+}
+
+/*
+ * Compress nr pages into dst as back-to-back frames; lens[i] is the size
+ * of page i's frame, which muscle_decompress() takes on its own.  Returns
+ * the bytes written, or -ENOSPC if dst (nents entries) is too small.
+ * May sleep.
+ */
+ssize_t muscle_compress_pages(struct page **pages, unsigned int nr,
+                              struct scatterlist *dst, unsigned int nents,
+                              unsigned int *lens)
+{
+    struct sg_mapping_iter mi;
+    size_t expect = PAGE_SIZE / 2;
+    ssize_t total = 0;
+    unsigned int i, j;
+    int ret = 0;
+
+    might_sleep();
+    if (!READ_ONCE(zm_arena_ready))
+        return -ENODEV;
+
+    /*
+     * The chunks are mapped under the arena lock, so atomically; the
+     * current one is dropped at the end of each group and the next group
+     * picks up where it stopped.
+     */
+    sg_miter_start(&mi, dst, nents, SG_MITER_ATOMIC | SG_MITER_TO_SG);
+    for (i = 0; !ret && i < nr; i += ZM_GROUP) {
+        const struct zm_model *m;
+        struct zm_arena *a;
+
+        local_lock(&zm_arena.lock);
+        a = this_cpu_ptr(&zm_arena);
+        rcu_read_lock();
+        m = rcu_dereference(zm_model);
+        for (j = i; !ret && j < min(nr, i + ZM_GROUP); j++) {
+            ret = zm_compress_page(m, a, &mi, pages[j], &expect, &lens[j]);
+            if (!ret)
+                total += lens[j];
+        }
+        sg_miter_stop(&mi);
+        rcu_read_unlock();
+        local_unlock(&zm_arena.lock);
+        cond_resched();
+    }
+    return ret ? ret : total;
+}
+EXPORT_SYMBOL_GPL(muscle_compress_pages);
+
+static int __init zm_arena_init(void)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct zm_arena *a = per_cpu_ptr(&zm_arena, cpu);
+
+        a->wrkmem = kmalloc_node(MUSCLE_COMPRESS_WRKMEM, GFP_KERNEL, cpu_to_node(cpu));
+        a->bounce = kmalloc_node(ZM_BOUNCE, GFP_KERNEL, cpu_to_node(cpu));
+        if (!a->wrkmem || !a->bounce)
+            goto fail;
+    }
+    WRITE_ONCE(zm_arena_ready, true);
+    return 0;
+fail:
+    for_each_possible_cpu(cpu) {
+        struct zm_arena *a = per_cpu_ptr(&zm_arena, cpu);
+
+        kfree(a->wrkmem);
+        kfree(a->bounce);
+        a->wrkmem = NULL;
+        a->bounce = NULL;
+    }
+    return -ENOMEM;
+}
+
+/* Decode a frame into dst (room for *dstlen bytes); *dstlen is the size */
+int muscle_decompress(void *dst, size_t *dstlen, const void *src, size_t srclen)
+{
+    const u8 *in = src;
+    size_t cap = *dstlen, n, i;
+    ssize_t ret;
+    u64 word;
+
+    if (!srclen)
+        return -EINVAL;
+
+    switch (in[0]) {
+    case ZM_STORE:
+        if (srclen - 1 > cap)
+            return -ENOSPC;
+        memcpy(dst, in + 1, srclen - 1);
+        *dstlen = srclen - 1;
+        return 0;
+    case ZM_FILL:
+        if (srclen != 13)
+            return -EINVAL;
+        word = get_unaligned_le64(in + 1);
+        n = get_unaligned_le32(in + 9);
+        if (n > cap || n % 8)
+            return -EINVAL;
+        for (i = 0; i < n; i += 8)
+            put_unaligned_le64(word, (u8 *)dst + i);
+        *dstlen = n;
+        return 0;
+    case ZM_LZ:
+    case ZM_LZ_XOR64:
+    case ZM_LZ_DELTA32:
+        ret = zm_lz_decompress(dst, cap, in + 1, in + srclen);
+        if (ret < 0)
+            return ret;
+        zm_unxform(dst, ret, in[0]);
+        *dstlen = ret;
+        return 0;
+    }
+    return -EINVAL;
+}
+EXPORT_SYMBOL_GPL(muscle_decompress);
+
+static void zm_release(void *model)
+{
+    kfree(model);
+}
+
+static void *zm_build(const muscle_fixed *const *t)
+{
+    struct zm_model *m = kmalloc(sizeof(*m), GFP_KERNEL);
+
+    if (!m)
+        return ERR_PTR(-ENOMEM);
+    memcpy(m->w, t[ZM_SEL_W], sizeof(m->w));
+    memcpy(m->b, t[ZM_SEL_B], sizeof(m->b));
+    return m;
+}
+
+static struct muscle_wset zm_wset = {
+    .name      = "zmuscle",
+    .tables    = zm_tables,
+    .nr_tables = ZM_TABLES,
+    .build     = zm_build,
+    .release   = zm_release,
+    .model     = (void __rcu **)&zm_model,
+};
+
+/* Without a selector model every page takes the plain LZ path */
+static int __init muscle_compress_init(void)
+{
+    int ret;
+
+    /* The single-buffer API still works without arenas */
+    if (zm_arena_init())
+        pr_warn("zmuscle: no per-CPU arenas, batch compression disabled\n");
+
+    ret = muscle_wset_register(&zm_wset);
+    if (ret)
+        pr_err("zmuscle: failed to build selector weights (%d)\n", ret);
+    return ret;
+}
+late_initcall(muscle_compress_init);
@@ -0,0 +1,175 @@
+#include <linux/muscle.h>
+#include <linux/init.h>
+#include <linux/cache.h>
+#include <asm/simd.h>
+
+#include "muscle_lstm.h"
+
+static void muscle_gates_generic(const struct muscle_lstm *lstm,
+                                 const s16 *xh, muscle_fixed *gates)
+{
+    const s8 *w = lstm->packed;
+    unsigned int i, j, g;
+
+    for (i = 0; i < lstm->hidden; i++) {
+        s32 acc[MUSCLE_GATES] = {0};
+
+        /* One column pair per step: [gate][col % 2] */
+        for (j = 0; j < lstm->cols; j += 2, w += 2 * MUSCLE_GATES) {
+            for (g = 0; g < MUSCLE_GATES; g++)
+                acc[g] += w[2 * g] * xh[j] + w[2 * g + 1] * xh[j + 1];
+        }
+        for (g = 0; g < MUSCLE_GATES; g++)
+            gates[i * MUSCLE_GATES + g] =
+                muscle_gate_finish(lstm, i * MUSCLE_GATES + g, acc[g]);
+    }
+}
+
+static const struct muscle_gate_impl muscle_gates_scalar = {
+    .name  = "generic",
+    .gates = muscle_gates_generic,
+};
+
+/* Best first; the first usable entry wins at boot */
+static const struct muscle_gate_impl *const muscle_gate_impls[] = {
+#ifdef CONFIG_X86_64
+    &muscle_gates_avxvnni,
+    &muscle_gates_avx2,
+    &muscle_gates_sse41,
+#endif
+#ifdef CONFIG_KERNEL_MODE_NEON
+    &muscle_gates_neon,
+#endif
+    &muscle_gates_scalar,
+};
+
+static const struct muscle_gate_impl *muscle_gate_impl __read_mostly = &muscle_gates_scalar;
+
+const char *muscle_lstm_impl_name(void)
+{
+    return muscle_gate_impl->name;
+}
+
+int muscle_lstm_pack(struct muscle_lstm *lstm, const struct muscle_lstm_weights *w)
+{
+    unsigned int n = w->input + w->hidden;
+    unsigned int cols = ALIGN(n, 4);
+    muscle_fixed row[MUSCLE_LSTM_MAX_COLS];
+    s8 q[MUSCLE_LSTM_MAX_COLS];
+    unsigned int i, j, g;
+    size_t psz, ssz;
+    u8 *blk;
+    int ret;
+
+    if (w->hidden > MUSCLE_LSTM_MAX_HIDDEN || cols > MUSCLE_LSTM_MAX_COLS)
+        return -EINVAL;
+
+    lstm->input = w->input;
+    lstm->hidden = w->hidden;
+    lstm->cols = cols;
+    /* One arena block: packed gates, scales, biases */
+    psz = ALIGN(w->hidden * muscle_lstm_unit_bytes(lstm), SMP_CACHE_BYTES);
+    ssz = ALIGN(w->hidden * MUSCLE_GATES * sizeof(*lstm->scale), SMP_CACHE_BYTES);
+    blk = muscle_arena_alloc(psz + ssz + w->hidden * MUSCLE_GATES * sizeof(*lstm->bias));
+    if (!blk)
+        return -ENOMEM;
+    lstm->packed = (s8 *)blk;
+    lstm->scale = (s32 *)(blk + psz);
+    lstm->bias = (muscle_fixed *)(blk + psz + ssz);
+
+    for (i = 0; i < w->hidden; i++) {
+        s8 *unit = lstm->packed + i * muscle_lstm_unit_bytes(lstm);
+
+        for (g = 0; g < MUSCLE_GATES; g++) {
+            unsigned int r = i * MUSCLE_GATES + g;
+
+            /* One quantization row = this gate's [W | R] row for unit i */
+            for (j = 0; j < n; j++) {
+                if (j < w->input)
+                    row[j] = w->w[g][i * w->input + j];
+                else
+                    row[j] = w->r[g] ? w->r[g][i * w->hidden + (j - w->input)] : 0;
+            }
+            ret = muscle_quantize_row(row, n, 8, q, &lstm->scale[r]);
+            if (ret) {
+                muscle_lstm_free(lstm);
+                return ret;
+            }
+
+            /* Padding columns stay zero */
+            for (j = 0; j < n; j++)
+                unit[(j / 2) * 2 * MUSCLE_GATES + 2 * g + (j % 2)] = q[j];
+
+            lstm->bias[r] = w->b[g][i];
+        }
+        lstm->bias[i * MUSCLE_GATES + MUSCLE_GATE_F] += w->forget_bias;
+    }
+    return 0;
+}
+
+void muscle_lstm_free(struct muscle_lstm *lstm)
+{
+    muscle_arena_free(lstm->packed);
+    lstm->packed = NULL;
+    lstm->scale = NULL;
+    lstm->bias = NULL;
+}
+
+/* gates[unit * MUSCLE_GATES + gate] = b + W·[x; h] for every unit */
+void muscle_lstm_gates(const struct muscle_lstm *lstm, const s16 *xh,
+                       muscle_fixed *gates)
+{
+    const struct muscle_gate_impl *impl = muscle_gate_impl;
+
+    /* SIMD registers are off limits in some contexts (e.g. nested irq) */
+    if (impl->simd && !may_use_simd())
+        impl = &muscle_gates_scalar;
+    impl->gates(lstm, xh, gates);
+}
+
+/* One full LSTM step; h and c are updated in place */
+void muscle_lstm_step(const struct muscle_lstm *lstm, const muscle_fixed *x,
+                      muscle_fixed *h, muscle_fixed *c)
+{
+    s16 xh[MUSCLE_LSTM_MAX_COLS] __aligned(16) = {0};
+    muscle_fixed gates[MUSCLE_LSTM_MAX_HIDDEN * MUSCLE_GATES];
+    unsigned int i;
+
+    for (i = 0; i < lstm->input; i++)
+        xh[i] = muscle_act16(x[i]);
+    for (i = 0; i < lstm->hidden; i++)
+        xh[lstm->input + i] = muscle_act16(h[i]);
+
+    /* Every gate sees the previous h before any unit is updated */
+    muscle_lstm_gates(lstm, xh, gates);
+
+    for (i = 0; i < lstm->hidden; i++) {
+        const muscle_fixed *g = gates + i * MUSCLE_GATES;
+        muscle_fixed i_t = muscle_sigmoid(g[MUSCLE_GATE_I]);
+        muscle_fixed f_t = muscle_sigmoid(g[MUSCLE_GATE_F]);
+        muscle_fixed g_t = muscle_tanh(g[MUSCLE_GATE_G]);
+        muscle_fixed o_t = muscle_sigmoid(g[MUSCLE_GATE_O]);
+
+        c[i] = muscle_fx_mul2(f_t, c[i], i_t, g_t);
+        h[i] = muscle_fx_mul(o_t, muscle_tanh(c[i]));
+    }
+}
+
+static int __init muscle_lstm_init(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(muscle_gate_impls); i++) {
+        const struct muscle_gate_impl *impl = muscle_gate_impls[i];
+
+        if (!impl->usable || impl->usable()) {
+            muscle_gate_impl = impl;
+            break;
+        }
+    }
+    pr_info("MuscleLSTM: using %s gate kernel\n", muscle_gate_impl->name);
+    return 0;
+}
+
+/* Before any muscle packs its weights at late_initcall */
+subsys_initcall(muscle_lstm_init);
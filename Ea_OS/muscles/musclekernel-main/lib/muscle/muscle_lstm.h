@@ -0,0 +1,33 @@
+#ifndef _LIB_MUSCLE_LSTM_H
+#define _LIB_MUSCLE_LSTM_H
+
+#include <linux/muscle.h>
+
+/* One gate-kernel implementation; gates() runs inside the SIMD section */
+struct muscle_gate_impl {
+    const char *name;
+    bool (*usable)(void);
+    void (*gates)(const struct muscle_lstm *lstm, const s16 *xh,
+                  muscle_fixed *gates);
+    bool simd;
+};
+
+extern const struct muscle_gate_impl muscle_gates_avxvnni;
+extern const struct muscle_gate_impl muscle_gates_avx2;
+extern const struct muscle_gate_impl muscle_gates_sse41;
+extern const struct muscle_gate_impl muscle_gates_neon;
+
+/* Bytes of packed weights per unit: cols × MUSCLE_GATES int8 */
+static inline unsigned int muscle_lstm_unit_bytes(const struct muscle_lstm *lstm)
+{
+    return lstm->cols * MUSCLE_GATES;
+}
+
+/* Common epilogue: s32 accumulator → dequantized muscle_fixed plus bias */
+static inline muscle_fixed muscle_gate_finish(const struct muscle_lstm *lstm,
+                                              unsigned int row, s32 acc)
+{
+    return muscle_fx_add_sat(lstm->bias[row], muscle_dequant(acc, lstm->scale[row]));
+}
+
+#endif /* _LIB_MUSCLE_LSTM_H */
@@ -0,0 +1,51 @@
+#include <linux/muscle.h>
+#include <asm/neon.h>
+#include <asm/neon-intrinsics.h>
+#include <asm/simd.h>
+
+#include "muscle_lstm.h"
+
+/*
+ * arm64 gate kernel: a column pair's eight int8 weights widen to s16,
+ * vmull_s16 multiplies them against the duplicated activation pair and
+ * vpaddq_s32 folds each gate's two products, so one load feeds all gates.
+ */
+static void muscle_gates_neon_fn(const struct muscle_lstm *lstm,
+                                 const s16 *xh, muscle_fixed *gates)
+{
+    const s8 *w = lstm->packed;
+    unsigned int i, j, g;
+    s32 acc[MUSCLE_GATES];
+
+    kernel_neon_begin();
+    for (i = 0; i < lstm->hidden; i++) {
+        int32x4_t sum = vdupq_n_s32(0);
+
+        for (j = 0; j < lstm->cols; j += 2, w += 2 * MUSCLE_GATES) {
+            int16x8_t wv = vmovl_s8(vld1_s8(w));
+            int16x4_t x = vreinterpret_s16_s32(vdup_n_s32(*(const s32 *)&xh[j]));
+            int32x4_t lo = vmull_s16(vget_low_s16(wv), x);
+            int32x4_t hi = vmull_s16(vget_high_s16(wv), x);
+
+            sum = vaddq_s32(sum, vpaddq_s32(lo, hi));
+        }
+        vst1q_s32(acc, sum);
+
+        for (g = 0; g < MUSCLE_GATES; g++)
+            gates[i * MUSCLE_GATES + g] =
+                muscle_gate_finish(lstm, i * MUSCLE_GATES + g, acc[g]);
+    }
+    kernel_neon_end();
+}
+
+static bool muscle_neon_usable(void)
+{
+    return cpu_have_named_feature(ASIMD);
+}
+
+const struct muscle_gate_impl muscle_gates_neon = {
+    .name   = "neon",
+    .usable = muscle_neon_usable,
+    .gates  = muscle_gates_neon_fn,
+    .simd   = true,
+};
@@ -0,0 +1,140 @@
+#include <linux/muscle.h>
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+
+#include "muscle_lstm.h"
+
+/*
+ * x86 gate kernels.  A packed column pair is eight int8 weights, two per
+ * gate; they are sign-extended to s16 and pmaddwd'ed against the
+ * broadcast s16 activation pair, giving all four gate partial sums in one
+ * instruction.  AVX2 handles two column pairs per iteration (lanes are
+ * permuted so the low half sees pair k and the high half pair k + 1) and
+ * AVX-VNNI fuses the multiply-add into vpdpwssd.  Written as inline asm
+ * in the style of lib/raid6 since the kernel is built without SSE/AVX
+ * codegen; for the same reason the vector registers are not (and cannot
+ * be) clobbered.
+ */
+
+static const u32 muscle_pair_idx[8] __aligned(32) = { 0, 0, 0, 0, 1, 1, 1, 1 };
+
+#define MUSCLE_AVX2_GATES(name, madd)                                   \
+static void muscle_gates_##name##_fn(const struct muscle_lstm *lstm,    \
+                                     const s16 *xh, muscle_fixed *gates) \
+{                                                                       \
+    const s8 *w = lstm->packed;                                         \
+    unsigned int i, g;                                                  \
+    s32 acc[MUSCLE_GATES];                                              \
+                                                                        \
+    kernel_fpu_begin();                                                 \
+    for (i = 0; i < lstm->hidden; i++) {                                \
+        const s16 *x = xh;                                              \
+        unsigned long n = lstm->cols;  /* multiple of 4 */              \
+                                                                        \
+        asm volatile(                                                   \
+            "vmovdqa %[idx], %%ymm7\n\t"                                \
+            "vpxor %%ymm0, %%ymm0, %%ymm0\n\t"                          \
+            "1:\n\t"                                                    \
+            "vpmovsxbw (%[w]), %%ymm1\n\t"                              \
+            "vpbroadcastq (%[x]), %%ymm2\n\t"                           \
+            "vpermd %%ymm2, %%ymm7, %%ymm2\n\t"                         \
+            madd                                                        \
+            "add $16, %[w]\n\t"                                         \
+            "add $8, %[x]\n\t"                                          \
+            "sub $4, %[n]\n\t"                                          \
+            "jnz 1b\n\t"                                                \
+            "vextracti128 $1, %%ymm0, %%xmm1\n\t"                       \
+            "vpaddd %%xmm1, %%xmm0, %%xmm0\n\t"                         \
+            "vmovdqu %%xmm0, %[acc]\n\t"                                \
+            : [w] "+r" (w), [x] "+r" (x), [n] "+r" (n), [acc] "=m" (acc) \
+            : [idx] "m" (muscle_pair_idx)                               \
+            : "cc", "memory");                                          \
+                                                                        \
+        for (g = 0; g < MUSCLE_GATES; g++)                              \
+            gates[i * MUSCLE_GATES + g] =                               \
+                muscle_gate_finish(lstm, i * MUSCLE_GATES + g, acc[g]); \
+    }                                                                   \
+    kernel_fpu_end();                                                   \
+}
+
+#define MUSCLE_MADD_AVX2                                                \
+            "vpmaddwd %%ymm2, %%ymm1, %%ymm1\n\t"                       \
+            "vpaddd %%ymm1, %%ymm0, %%ymm0\n\t"
+#define MUSCLE_MADD_AVXVNNI                                             \
+            "%{vex%} vpdpwssd %%ymm2, %%ymm1, %%ymm0\n\t"
+
+MUSCLE_AVX2_GATES(avx2, MUSCLE_MADD_AVX2)
+MUSCLE_AVX2_GATES(avxvnni, MUSCLE_MADD_AVXVNNI)
+
+static void muscle_gates_sse41_fn(const struct muscle_lstm *lstm,
+                                  const s16 *xh, muscle_fixed *gates)
+{
+    const s8 *w = lstm->packed;
+    unsigned int i, g;
+    s32 acc[MUSCLE_GATES];
+
+    kernel_fpu_begin();
+    for (i = 0; i < lstm->hidden; i++) {
+        const s16 *x = xh;
+        unsigned long n = lstm->cols;
+
+        asm volatile(
+            "pxor %%xmm0, %%xmm0\n\t"
+            "1:\n\t"
+            "pmovsxbw (%[w]), %%xmm1\n\t"
+            "movd (%[x]), %%xmm2\n\t"
+            "pshufd $0, %%xmm2, %%xmm2\n\t"
+            "pmaddwd %%xmm2, %%xmm1\n\t"
+            "paddd %%xmm1, %%xmm0\n\t"
+            "add $8, %[w]\n\t"
+            "add $4, %[x]\n\t"
+            "sub $2, %[n]\n\t"
+            "jnz 1b\n\t"
+            "movdqu %%xmm0, %[acc]\n\t"
+            : [w] "+r" (w), [x] "+r" (x), [n] "+r" (n), [acc] "=m" (acc)
+            :
+            : "cc", "memory");
+
+        for (g = 0; g < MUSCLE_GATES; g++)
+            gates[i * MUSCLE_GATES + g] =
+                muscle_gate_finish(lstm, i * MUSCLE_GATES + g, acc[g]);
+    }
+    kernel_fpu_end();
+}
+
+static bool muscle_avx2_usable(void)
+{
+    return boot_cpu_has(X86_FEATURE_AVX2) &&
+           cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM, NULL);
+}
+
+static bool muscle_avxvnni_usable(void)
+{
+    return boot_cpu_has(X86_FEATURE_AVX_VNNI) && muscle_avx2_usable();
+}
+
+static bool muscle_sse41_usable(void)
+{
+    return boot_cpu_has(X86_FEATURE_XMM4_1);
+}
+
+const struct muscle_gate_impl muscle_gates_avxvnni = {
+    .name   = "avx-vnni",
+    .usable = muscle_avxvnni_usable,
+    .gates  = muscle_gates_avxvnni_fn,
+    .simd   = true,
+};
+
+const struct muscle_gate_impl muscle_gates_avx2 = {
+    .name   = "avx2",
+    .usable = muscle_avx2_usable,
+    .gates  = muscle_gates_avx2_fn,
+    .simd   = true,
+};
+
+const struct muscle_gate_impl muscle_gates_sse41 = {
+    .name   = "sse4.1",
+    .usable = muscle_sse41_usable,
+    .gates  = muscle_gates_sse41_fn,
+    .simd   = true,
+};
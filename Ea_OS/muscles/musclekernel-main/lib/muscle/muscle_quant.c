@@ -0,0 +1,106 @@
+#include <linux/muscle.h>
+#include <linux/math64.h>
+#include <linux/cache.h>
+#include <linux/string.h>
+
+/*
+ * Symmetric per-row quantization: the largest |w| in the row maps to
+ * ±qmax, values are rounded to nearest.  Must stay bit-identical to
+ * quantize_row() in tools/muscle/quantize.py.
+ */
+int muscle_quantize_row(const muscle_fixed *w, unsigned int n, unsigned int bits,
+                        void *q, s32 *scale)
+{
+    s64 qmax = bits == 8 ? S8_MAX : S16_MAX;
+    s64 maxabs = 0, sc;
+    unsigned int i;
+
+    if (bits != 8 && bits != 16)
+        return -EINVAL;
+
+    for (i = 0; i < n; i++) {
+        s64 a = abs((s64)w[i]);
+
+        if (a > maxabs)
+            maxabs = a;
+    }
+
+    /* scale = ceil(maxabs / qmax) in Q16 */
+    sc = div64_s64((maxabs << MUSCLE_QSCALE_SHIFT) + qmax - 1, qmax);
+    if (sc > S32_MAX)
+        return -ERANGE;
+    *scale = sc ? (s32)sc : 1;
+
+    for (i = 0; i < n; i++) {
+        s64 v = (s64)w[i] * (1 << MUSCLE_QSCALE_SHIFT);
+        s64 r = div64_s64(v + (v < 0 ? -(*scale / 2) : *scale / 2), *scale);
+
+        r = clamp_t(s64, r, -qmax, qmax);
+        if (bits == 8)
+            ((s8 *)q)[i] = (s8)r;
+        else
+            ((s16 *)q)[i] = (s16)r;
+    }
+    return 0;
+}
+
+int muscle_qmat_init(struct muscle_qmat *m, const muscle_fixed *w,
+                     const muscle_fixed *bias, unsigned int rows,
+                     unsigned int cols, unsigned int bits)
+{
+    size_t esz = bits / 8;
+    size_t qsz = ALIGN(rows * cols * esz, SMP_CACHE_BYTES);
+    size_t ssz = ALIGN(rows * sizeof(*m->scale), SMP_CACHE_BYTES);
+    unsigned int r;
+    u8 *blk;
+    int ret;
+
+    /* One arena block: weights, scales, then a copy of the bias */
+    blk = muscle_arena_alloc(qsz + ssz + (bias ? rows * sizeof(*bias) : 0));
+    if (!blk)
+        return -ENOMEM;
+    m->q = blk;
+    m->scale = (s32 *)(blk + qsz);
+    m->bias = NULL;
+    if (bias)
+        m->bias = memcpy(blk + qsz + ssz, bias, rows * sizeof(*bias));
+
+    m->rows = rows;
+    m->cols = cols;
+    m->bits = bits;
+
+    for (r = 0; r < rows; r++) {
+        ret = muscle_quantize_row(w + r * cols, cols, bits,
+                                  (u8 *)m->q + r * cols * esz, &m->scale[r]);
+        if (ret) {
+            muscle_qmat_free(m);
+            return ret;
+        }
+    }
+    return 0;
+}
+
+void muscle_qmat_free(struct muscle_qmat *m)
+{
+    muscle_arena_free(m->q);
+    m->q = NULL;
+    m->scale = NULL;
+    m->bias = NULL;
+}
+
+/* Run-time shapes of the muscle.h layer kernels */
+void muscle_qmat_gemv(const struct muscle_qmat *m, const muscle_fixed *x,
+                      muscle_fixed *y)
+{
+    if (WARN_ON_ONCE(m->cols > MUSCLE_QMAT_MAX_COLS))
+        return;
+    muscle_dense_gemv(m, x, y, m->rows, m->cols, m->bits, MUSCLE_ACT_NONE);
+}
+
+void muscle_qmat_gemm(const struct muscle_qmat *m, const muscle_fixed *x,
+                      muscle_fixed *y, unsigned int batch)
+{
+    if (WARN_ON_ONCE(m->cols > MUSCLE_QMAT_MAX_COLS))
+        return;
+    muscle_dense_gemm(m, x, y, batch, m->rows, m->cols, m->bits, MUSCLE_ACT_NONE);
+}
@@ -0,0 +1,161 @@
+#include <linux/muscle.h>
+#include <linux/irqflags.h>
+#include <linux/minmax.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/workqueue.h>
+
+/*
+ * Per-CPU SPSC event rings.  The producer is whatever hot path runs on
+ * the ring's CPU; irqs are off across the slot write so an interrupt
+ * pushing to the same ring can't interleave with it.  The consumer is
+ * the CPU's engine work, shared by every muscle's ring on that CPU and
+ * never run twice concurrently, so head and tail each have a single
+ * writer.
+ */
+#define MUSCLE_RING_MASK   (MUSCLE_RING_SIZE - 1)
+#define MUSCLE_RING_DELAY  1    /* jiffies to let a batch build up */
+
+struct muscle_ring {
+    unsigned int head ____cacheline_aligned;    /* written by producer */
+    unsigned long dropped;
+    unsigned int tail ____cacheline_aligned;    /* written by consumer */
+    struct muscle_evq *evq;
+    int cpu;
+    struct muscle_event ev[MUSCLE_RING_SIZE] ____cacheline_aligned;
+};
+
+struct muscle_engine {
+    struct delayed_work work;
+    int cpu;
+};
+
+static DEFINE_PER_CPU(struct muscle_engine, muscle_engine);
+static struct workqueue_struct *muscle_evq_wq __read_mostly;
+
+/* Registered queues; muscle_evq_init() publishes one before bumping nr */
+static struct muscle_evq *muscle_evqs[MUSCLE_EVQ_MAX];
+static unsigned int muscle_nr_evqs;
+
+/* Hand one batch of r to its muscle; false if r was empty */
+static bool muscle_ring_drain(struct muscle_ring *r)
+{
+    struct muscle_event batch[MUSCLE_RING_BATCH];
+    unsigned int head = smp_load_acquire(&r->head), tail = r->tail, n, i;
+
+    if (head == tail)
+        return false;
+    n = min(head - tail, (unsigned int)MUSCLE_RING_BATCH);
+    for (i = 0; i < n; i++)
+        batch[i] = r->ev[(tail + i) & MUSCLE_RING_MASK];
+    /* Hand the slots back before the (slow) inference runs */
+    smp_store_release(&r->tail, tail + n);
+
+    r->evq->drain(r->evq, r->cpu, batch, n);
+    return true;
+}
+
+/* A batch per muscle per round, so no muscle waits out another's backlog */
+static void muscle_engine_fn(struct work_struct *work)
+{
+    struct muscle_engine *e = container_of(to_delayed_work(work),
+                                           struct muscle_engine, work);
+    unsigned int nr = smp_load_acquire(&muscle_nr_evqs), i;
+    bool more;
+
+    do {
+        more = false;
+        for (i = 0; i < nr; i++)
+            more |= muscle_ring_drain(per_cpu_ptr(muscle_evqs[i]->rings, e->cpu));
+        cond_resched();
+    } while (more);
+}
+
+bool muscle_evq_push(struct muscle_evq *q, const struct muscle_event *ev)
+{
+    struct muscle_engine *e;
+    struct muscle_ring *r;
+    unsigned long flags;
+    unsigned int head, depth;
+
+    local_irq_save(flags);
+    r = this_cpu_ptr(q->rings);
+    head = r->head;
+    depth = head - smp_load_acquire(&r->tail);
+    if (unlikely(depth >= MUSCLE_RING_SIZE)) {
+        r->dropped++;
+        local_irq_restore(flags);
+        return false;
+    }
+    r->ev[head & MUSCLE_RING_MASK] = *ev;
+    smp_store_release(&r->head, head + 1);
+    local_irq_restore(flags);
+
+    /*
+     * Pairs with the barrier the workqueue issues between clearing
+     * PENDING and calling muscle_engine_fn(): either we see the work
+     * pending, or the drain sees our head.  A full batch on any muscle
+     * runs the engine now, taking the other muscles' partial batches
+     * along.
+     */
+    smp_mb();
+    e = per_cpu_ptr(&muscle_engine, r->cpu);
+    if (unlikely(depth + 1 == MUSCLE_RING_BATCH))
+        mod_delayed_work_on(r->cpu, muscle_evq_wq, &e->work, 0);
+    else if (!delayed_work_pending(&e->work))
+        queue_delayed_work_on(r->cpu, muscle_evq_wq, &e->work, MUSCLE_RING_DELAY);
+    return true;
+}
+
+unsigned long muscle_evq_dropped(const struct muscle_evq *q)
+{
+    unsigned long sum = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        sum += data_race(per_cpu_ptr(q->rings, cpu)->dropped);
+    return sum;
+}
+
+/* From initcalls, which run one at a time */
+int muscle_evq_init(struct muscle_evq *q, const char *name, muscle_evq_fn drain)
+{
+    unsigned int nr = muscle_nr_evqs;
+    int cpu;
+
+    if (WARN_ON_ONCE(!muscle_evq_wq))
+        return -ENODEV;
+    if (WARN_ON_ONCE(nr >= MUSCLE_EVQ_MAX))
+        return -ENOSPC;
+
+    q->rings = alloc_percpu(struct muscle_ring);
+    if (!q->rings)
+        return -ENOMEM;
+
+    for_each_possible_cpu(cpu) {
+        struct muscle_ring *r = per_cpu_ptr(q->rings, cpu);
+
+        r->evq = q;
+        r->cpu = cpu;
+    }
+    q->name = name;
+    q->drain = drain;
+    muscle_evqs[nr] = q;
+    smp_store_release(&muscle_nr_evqs, nr + 1);
+    return 0;
+}
+
+static int __init muscle_ring_init(void)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct muscle_engine *e = per_cpu_ptr(&muscle_engine, cpu);
+
+        e->cpu = cpu;
+        INIT_DELAYED_WORK(&e->work, muscle_engine_fn);
+    }
+    muscle_evq_wq = alloc_workqueue("muscle_evq", WQ_FREEZABLE, 0);
+    return muscle_evq_wq ? 0 : -ENOMEM;
+}
+subsys_initcall(muscle_ring_init);
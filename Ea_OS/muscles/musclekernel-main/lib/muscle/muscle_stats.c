@@ -0,0 +1,226 @@
+#include <linux/muscle.h>
+#include <linux/debugfs.h>
+#include <linux/jump_label.h>
+#include <linux/log2.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+
+/*
+ * Per-muscle counters.  Hot paths bump their CPU's copy with this_cpu
+ * ops and readers sum the CPUs without stopping them, so a total can be
+ * a few events behind, and a reset racing an update can survive it.
+ * debugfs muscle/ is shared with the capture files (muscle_trace.c).
+ */
+DEFINE_STATIC_KEY_FALSE(muscle_stats_timing_key);
+
+static const char *const muscle_stat_names[MUSCLE_STAT_NR] = {
+    [MUSCLE_STAT_CALLS]        = "calls",
+    [MUSCLE_STAT_INFER]        = "infer",
+    [MUSCLE_STAT_INFER_NS]     = "infer_ns",
+    [MUSCLE_STAT_LOCK_NS]      = "lock_ns",
+    [MUSCLE_STAT_ISSUED]       = "issued",
+    [MUSCLE_STAT_HITS]         = "hits",
+    [MUSCLE_STAT_MISSES]       = "misses",
+    [MUSCLE_STAT_WASTED_BYTES] = "wasted_bytes",
+    [MUSCLE_STAT_ABSTAIN]      = "abstain",
+    [MUSCLE_STAT_OVERRIDES]    = "overrides",
+    [MUSCLE_STAT_KILLS]        = "kills",
+    [MUSCLE_STAT_FALSE_POS]    = "false_pos",
+    [MUSCLE_STAT_SAVED_NS]     = "saved_ns",
+    [MUSCLE_STAT_THROTTLED]    = "throttled",
+    [MUSCLE_STAT_LEARN]        = "learn",
+    [MUSCLE_STAT_LEARN_NS]     = "learn_ns",
+    [MUSCLE_STAT_LEARN_DROPPED] = "learn_drop",
+};
+
+static DEFINE_MUTEX(muscle_debugfs_lock);
+static struct dentry *muscle_debugfs;
+
+/* debugfs muscle/, created on first use */
+struct dentry *muscle_debugfs_dir(void)
+{
+    mutex_lock(&muscle_debugfs_lock);
+    if (!muscle_debugfs)
+        muscle_debugfs = debugfs_create_dir("muscle", NULL);
+    mutex_unlock(&muscle_debugfs_lock);
+    return muscle_debugfs;
+}
+
+void __muscle_stat_time(struct muscle_stats *ms, enum muscle_stat stat, u64 t0)
+{
+    u64 ns = local_clock() - t0;
+    unsigned int b = 0;
+
+    this_cpu_add(ms->pcpu->v[stat], ns);
+    if (stat != MUSCLE_STAT_INFER_NS)
+        return;
+    if (ns >> MUSCLE_STAT_HIST_SHIFT)
+        b = min_t(unsigned int, ilog2(ns) - MUSCLE_STAT_HIST_SHIFT + 1, MUSCLE_STAT_HIST - 1);
+    this_cpu_inc(ms->pcpu->hist[b]);
+}
+
+u64 muscle_stat_read(const struct muscle_stats *ms, enum muscle_stat stat)
+{
+    u64 sum = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        sum += data_race(per_cpu_ptr(ms->pcpu, cpu)->v[stat]);
+    return sum;
+}
+
+static void muscle_stats_row(struct seq_file *m, const struct muscle_stats *ms,
+                             const u64 *v)
+{
+    unsigned int i;
+
+    for (i = 0; i < MUSCLE_STAT_NR; i++) {
+        if (!(ms->mask & BIT(i)))
+            continue;
+        if (i == MUSCLE_STAT_SAVED_NS)
+            seq_printf(m, " %12lld", (s64)v[i]);
+        else
+            seq_printf(m, " %12llu", v[i]);
+    }
+    seq_putc(m, '\n');
+}
+
+static int stats_show(struct seq_file *m, void *unused)
+{
+    const struct muscle_stats *ms = m->private;
+    u64 v[MUSCLE_STAT_NR], sum[MUSCLE_STAT_NR] = {};
+    unsigned int i;
+    int cpu;
+
+    seq_printf(m, "%-5s", "cpu");
+    for (i = 0; i < MUSCLE_STAT_NR; i++)
+        if (ms->mask & BIT(i))
+            seq_printf(m, " %12s", muscle_stat_names[i]);
+    seq_putc(m, '\n');
+
+    for_each_online_cpu(cpu) {
+        const struct muscle_stats_cpu *sc = per_cpu_ptr(ms->pcpu, cpu);
+
+        for (i = 0; i < MUSCLE_STAT_NR; i++) {
+            v[i] = data_race(sc->v[i]);
+            sum[i] += v[i];
+        }
+        seq_printf(m, "%-5d", cpu);
+        muscle_stats_row(m, ms, v);
+    }
+    seq_printf(m, "%-5s", "all");
+    muscle_stats_row(m, ms, sum);
+
+    if (ms->evq)
+        seq_printf(m, "ring dropped %lu\n", muscle_evq_dropped(ms->evq));
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+static int latency_show(struct seq_file *m, void *unused)
+{
+    const struct muscle_stats *ms = m->private;
+    u64 hist[MUSCLE_STAT_HIST] = {}, n = 0;
+    unsigned int b;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        for (b = 0; b < MUSCLE_STAT_HIST; b++)
+            hist[b] += data_race(per_cpu_ptr(ms->pcpu, cpu)->hist[b]);
+
+    seq_printf(m, "%12s %12s\n", "ns >=", "passes");
+    for (b = 0; b < MUSCLE_STAT_HIST; b++) {
+        seq_printf(m, "%12llu %12llu\n",
+                   b ? 1ULL << (b + MUSCLE_STAT_HIST_SHIFT - 1) : 0, hist[b]);
+        n += hist[b];
+    }
+    if (n)
+        seq_printf(m, "mean %llu ns over %llu timed passes\n",
+                   div64_u64(muscle_stat_read(ms, MUSCLE_STAT_INFER_NS), n), n);
+    if (!static_key_enabled(&muscle_stats_timing_key))
+        seq_puts(m, "timing is off (stats_timing=0)\n");
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(latency);
+
+static int reset_set(void *data, u64 val)
+{
+    struct muscle_stats *ms = data;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        memset(per_cpu_ptr(ms->pcpu, cpu), 0, sizeof(struct muscle_stats_cpu));
+    return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(reset_fops, NULL, reset_set, "%llu\n");
+
+/* Create debugfs muscle/<name>/; counting works whether or not this does */
+int muscle_stats_register(struct muscle_stats *ms, struct muscle_evq *evq)
+{
+    struct dentry *dir;
+
+    ms->evq = evq;
+    dir = debugfs_create_dir(ms->name, muscle_debugfs_dir());
+    if (IS_ERR(dir))
+        return PTR_ERR(dir);
+    ms->dir = dir;
+    debugfs_create_file("stats", 0444, dir, ms, &stats_fops);
+    debugfs_create_file("latency", 0444, dir, ms, &latency_fops);
+    debugfs_create_file_unsafe("reset", 0200, dir, ms, &reset_fops);
+    return 0;
+}
+
+void muscle_stats_timing_get(void)
+{
+    static_branch_inc(&muscle_stats_timing_key);
+}
+
+void muscle_stats_timing_put(void)
+{
+    static_branch_dec(&muscle_stats_timing_key);
+}
+
+static bool stats_timing;
+static bool stats_timing_held;
+static bool stats_ready;
+
+/* Writes are serialised by the param core; stats_timing holds one reference */
+static void stats_timing_update(void)
+{
+    bool on = READ_ONCE(stats_timing);
+
+    if (on == stats_timing_held)
+        return;
+    stats_timing_held = on;
+    if (on)
+        muscle_stats_timing_get();
+    else
+        muscle_stats_timing_put();
+}
+
+static int stats_timing_set(const char *val, const struct kernel_param *kp)
+{
+    int ret = param_set_bool(val, kp);
+
+    /* Before init the key is settled by muscle_stats_init() */
+    if (!ret && READ_ONCE(stats_ready))
+        stats_timing_update();
+    return ret;
+}
+
+static const struct kernel_param_ops stats_timing_ops = {
+    .set = stats_timing_set,
+    .get = param_get_bool,
+};
+module_param_cb(stats_timing, &stats_timing_ops, &stats_timing, 0644);
+MODULE_PARM_DESC(stats_timing, "Time forward passes and lock waits for debugfs muscle/*/");
+
+static int __init muscle_stats_init(void)
+{
+    WRITE_ONCE(stats_ready, true);
+    stats_timing_update();
+    return 0;
+}
+core_initcall(muscle_stats_init);
@@ -0,0 +1,74 @@
+#include <linux/muscle.h>
+#include <linux/bitops.h>
+#include <linux/hash.h>
+#include <linux/string.h>
+
+/* Pages (cache) or sectors (IO) per output slot, ordered like the logits */
+const s32 muscle_stream_strides[MUSCLE_STREAM_VOCAB] = {
+    -256, -64, -16, -4, -1,
+    1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024,
+};
+
+/* sign(d) * log2(|d| + 1), 32 buckets across [-ONE, ONE] */
+static muscle_fixed muscle_stream_delta(s64 d)
+{
+    u64 mag = d < 0 ? -(u64)d : (u64)d;
+    muscle_fixed x = min(fls64(mag), 32) * (MUSCLE_FIXED_ONE / 32);
+
+    return d < 0 ? -x : x;
+}
+
+/*
+ * Advance st by one access at pos within context ctx (an inode or a
+ * device) and write the MUSCLE_STREAM_FEATURES inputs for it to x.
+ * Integer only; costs a handful of compares per call.
+ */
+void muscle_stream_encode(struct muscle_stream *st, u64 ctx, u64 pos,
+                          muscle_fixed x[MUSCLE_STREAM_FEATURES])
+{
+    bool loop = false, fresh = ctx != st->ctx;
+    int i;
+
+    if (fresh) {
+        memset(st, 0, sizeof(*st));
+        st->ctx = ctx;
+    } else {
+        for (i = MUSCLE_STREAM_HIST - 1; i > 0; i--)
+            st->delta[i] = st->delta[i - 1];
+        st->delta[0] = (s64)(pos - st->last);
+        for (i = 0; i < MUSCLE_STREAM_SEEN; i++)
+            loop |= st->seen[i] == pos;
+    }
+    st->last = pos;
+    st->seen[st->seen_pos++ % MUSCLE_STREAM_SEEN] = pos;
+
+    for (i = 0; i < MUSCLE_STREAM_HIST; i++)
+        x[MUSCLE_STREAM_DELTA + i] = muscle_stream_delta(st->delta[i]);
+    x[MUSCLE_STREAM_STRIDE] = !fresh && st->delta[0] &&
+                              st->delta[0] == st->delta[1] ? MUSCLE_FIXED_ONE : 0;
+    x[MUSCLE_STREAM_LOOP]   = loop ? MUSCLE_FIXED_ONE : 0;
+    x[MUSCLE_STREAM_FRESH]  = fresh ? MUSCLE_FIXED_ONE : 0;
+    /* Stable per-context code in [-ONE, ONE) so the net can tell files apart */
+    x[MUSCLE_STREAM_CTX]    = (muscle_fixed)hash_64(ctx, MUSCLE_FIXED_SHIFT + 1) -
+                              MUSCLE_FIXED_ONE;
+}
+
+/* Output slot with the top logit, or -1 unless it leads by margin */
+int muscle_stream_argmax(const muscle_fixed *logits, unsigned int n,
+                         muscle_fixed margin)
+{
+    muscle_fixed best = S32_MIN, second = S32_MIN;
+    unsigned int i;
+    int slot = -1;
+
+    for (i = 0; i < n; i++) {
+        if (logits[i] > best) {
+            second = best;
+            best = logits[i];
+            slot = i;
+        } else if (logits[i] > second) {
+            second = logits[i];
+        }
+    }
+    return (s64)best - second < margin ? -1 : slot;
+}
@@ -0,0 +1,55 @@
+#include <linux/muscle.h>
+#include <linux/jump_label.h>
+#include <linux/kstrtox.h>
+#include <linux/moduleparam.h>
+
+/*
+ * The enable parameter of each muscle.  Parameter writes are serialised
+ * by the param core, so on and the key cannot race each other.  Before
+ * the muscle's init only on is recorded: a command-line value is applied
+ * by muscle_switch_ready().
+ */
+static void muscle_switch_apply(struct muscle_switch *sw)
+{
+    if (sw->on == static_key_enabled(sw->key))
+        return;
+    if (sw->on)
+        static_branch_enable(sw->key);
+    else
+        static_branch_disable(sw->key);
+    pr_info("muscle: %s hooks %s\n", sw->name, sw->on ? "enabled" : "disabled");
+}
+
+static int muscle_switch_set(const char *val, const struct kernel_param *kp)
+{
+    struct muscle_switch *sw = kp->arg;
+    bool on;
+    int ret;
+
+    ret = kstrtobool(val, &on);
+    if (ret)
+        return ret;
+    WRITE_ONCE(sw->on, on);
+    if (READ_ONCE(sw->ready))
+        muscle_switch_apply(sw);
+    return 0;
+}
+
+static int muscle_switch_get(char *buf, const struct kernel_param *kp)
+{
+    const struct muscle_switch *sw = kp->arg;
+
+    return sysfs_emit(buf, "%c\n", READ_ONCE(sw->on) ? 'Y' : 'N');
+}
+
+const struct kernel_param_ops muscle_switch_ops = {
+    .set = muscle_switch_set,
+    .get = muscle_switch_get,
+};
+
+/* Called first thing from the muscle's init, before it can fail */
+void muscle_switch_ready(struct muscle_switch *sw)
+{
+    muscle_switch_apply(sw);
+    WRITE_ONCE(sw->ready, true);
+}
@@ -0,0 +1,179 @@
+#include <linux/muscle.h>
+#include <linux/debugfs.h>
+#include <linux/jiffies.h>
+#include <linux/jump_label.h>
+#include <linux/kstrtox.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
+#include <trace/events/muscle.h>
+
+/*
+ * Cost/benefit throttle.  The estimate is whatever the muscle books as
+ * SAVED_NS against what its passes and lock waits measurably cost, so it
+ * is only as good as the muscle's guess at what an action saves; the
+ * guesses are the muscles' own parameters.  Sampling scales cost and
+ * benefit alike, so the sign of the estimate survives any level.
+ */
+static unsigned int throttle_period_ms = 1000;
+module_param(throttle_period_ms, uint, 0644);
+MODULE_PARM_DESC(throttle_period_ms, "How often throttled muscles are re-estimated");
+
+static unsigned int throttle_probe_ms = 30000;
+module_param(throttle_probe_ms, uint, 0644);
+MODULE_PARM_DESC(throttle_probe_ms, "How long a bypassed muscle waits before it is re-probed");
+
+/* Fewer passes than this in a period says nothing either way */
+#define THROTTLE_MIN_PASSES 64
+
+static unsigned long throttle_period(void)
+{
+    return msecs_to_jiffies(max(READ_ONCE(throttle_period_ms), 10U));
+}
+
+static void throttle_apply(struct muscle_throttle *t, unsigned int level)
+{
+    if (level == t->level)
+        return;
+    if (!t->level)
+        static_branch_enable(&t->key);
+    WRITE_ONCE(t->level, level);
+    if (!level)
+        static_branch_disable(&t->key);
+    trace_muscle_throttle(t->stats->name, level, t->net);
+    if (level == MUSCLE_THROTTLE_BYPASS)
+        pr_info("muscle: %s costs more than it saves (%lld ns/period), bypassed\n",
+                t->stats->name, t->net);
+}
+
+static void throttle_snapshot(struct muscle_throttle *t)
+{
+    unsigned int i;
+
+    for (i = 0; i < MUSCLE_STAT_NR; i++)
+        t->last[i] = muscle_stat_read(t->stats, i);
+}
+
+static void throttle_fn(struct work_struct *work)
+{
+    struct muscle_throttle *t = container_of(to_delayed_work(work),
+                                             struct muscle_throttle, work);
+    u64 prev[MUSCLE_STAT_NR], passes, cost;
+    unsigned int level = t->level;
+    s64 saved;
+
+    memcpy(prev, t->last, sizeof(prev));
+    throttle_snapshot(t);
+    passes = t->last[MUSCLE_STAT_INFER] - prev[MUSCLE_STAT_INFER];
+    cost = (t->last[MUSCLE_STAT_INFER_NS] - prev[MUSCLE_STAT_INFER_NS]) +
+           (t->last[MUSCLE_STAT_LOCK_NS] - prev[MUSCLE_STAT_LOCK_NS]) +
+           (t->last[MUSCLE_STAT_LEARN_NS] - prev[MUSCLE_STAT_LEARN_NS]);
+    saved = (s64)(t->last[MUSCLE_STAT_SAVED_NS] - prev[MUSCLE_STAT_SAVED_NS]);
+
+    if (level == MUSCLE_THROTTLE_BYPASS) {
+        /* Nothing ran, so nothing was measured: wait, then sample again */
+        if (time_after_eq(jiffies, t->probe_at)) {
+            t->probes++;
+            level = MUSCLE_THROTTLE_MAX;
+        }
+    } else if (passes >= THROTTLE_MIN_PASSES) {
+        t->net = saved - (s64)cost;
+        if (t->net < 0) {
+            if (++level == MUSCLE_THROTTLE_BYPASS)
+                t->probe_at = jiffies + msecs_to_jiffies(READ_ONCE(throttle_probe_ms));
+        } else if (level) {
+            level--;
+        }
+    }
+    throttle_apply(t, level);
+
+    if (READ_ONCE(t->on))
+        schedule_delayed_work(&t->work, throttle_period());
+}
+
+static void throttle_update(struct muscle_throttle *t)
+{
+    bool on = READ_ONCE(t->on);
+
+    if (on == t->running)
+        return;
+    t->running = on;
+    if (on) {
+        muscle_stats_timing_get();
+        throttle_snapshot(t);
+        schedule_delayed_work(&t->work, throttle_period());
+    } else {
+        cancel_delayed_work_sync(&t->work);
+        throttle_apply(t, 0);
+        muscle_stats_timing_put();
+    }
+}
+
+static int throttle_set(const char *val, const struct kernel_param *kp)
+{
+    struct muscle_throttle *t = kp->arg;
+    bool on;
+    int ret;
+
+    ret = kstrtobool(val, &on);
+    if (ret)
+        return ret;
+    /* Writes are serialised by the param core; before init only on is set */
+    WRITE_ONCE(t->on, on);
+    if (READ_ONCE(t->ready))
+        throttle_update(t);
+    return 0;
+}
+
+static int throttle_get(char *buf, const struct kernel_param *kp)
+{
+    const struct muscle_throttle *t = kp->arg;
+
+    return sysfs_emit(buf, "%c\n", READ_ONCE(t->on) ? 'Y' : 'N');
+}
+
+const struct kernel_param_ops muscle_throttle_ops = {
+    .set = throttle_set,
+    .get = throttle_get,
+};
+
+bool __muscle_throttled(struct muscle_throttle *t)
+{
+    unsigned int level = READ_ONCE(t->level);
+
+    /* Run the call that brings this CPU's count to a multiple of 2^level */
+    if (level < MUSCLE_THROTTLE_BYPASS &&
+        !(this_cpu_inc_return(*t->count) & ((1U << level) - 1)))
+        return false;
+    muscle_stat_inc(t->stats, MUSCLE_STAT_THROTTLED);
+    return true;
+}
+
+static int throttle_show(struct seq_file *m, void *unused)
+{
+    const struct muscle_throttle *t = m->private;
+    unsigned int level = READ_ONCE(t->level);
+
+    seq_printf(m, "throttle %s\n", READ_ONCE(t->on) ? "on" : "off");
+    if (level == MUSCLE_THROTTLE_BYPASS)
+        seq_printf(m, "rate bypassed, probe in %u ms\n",
+                   time_after(t->probe_at, jiffies) ?
+                   jiffies_to_msecs(t->probe_at - jiffies) : 0);
+    else
+        seq_printf(m, "rate 1/%u\n", 1U << level);
+    seq_printf(m, "net %lld ns last period\n", READ_ONCE(t->net));
+    seq_printf(m, "probes %lu\n", READ_ONCE(t->probes));
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(throttle);
+
+/* After muscle_stats_register(t->stats), from the muscle's init */
+void muscle_throttle_register(struct muscle_throttle *t)
+{
+    INIT_DELAYED_WORK(&t->work, throttle_fn);
+    if (t->stats->dir)
+        debugfs_create_file("throttle", 0444, t->stats->dir, t, &throttle_fops);
+    WRITE_ONCE(t->ready, true);
+    throttle_update(t);
+}
@@ -0,0 +1,198 @@
+#include <linux/muscle.h>
+#include <linux/debugfs.h>
+#include <linux/irqflags.h>
+#include <linux/jump_label.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/relay.h>
+#include <linux/sched/clock.h>
+
+/*
+ * Hook capture over relay.  The channel is opened by the first non-zero
+ * trace_mask and stays open, so a reader can still drain it after the
+ * mask goes back to zero; trace_buf_kb is read at that point only.
+ * Buffers never overwrite: a CPU whose reader falls behind loses new
+ * records and counts them in the next sub-buffer header.
+ *
+ *   /sys/kernel/debug/muscle/trace/cpuN   records, one file per CPU
+ *   trace_mask                           BIT(MUSCLE_TRACE_*) to capture
+ *   trace_dropped                        records lost, all CPUs
+ */
+#define TRACE_SUBBUF_SIZE   (64 * 1024)
+
+DEFINE_STATIC_KEY_FALSE(muscle_trace_key);
+unsigned int muscle_trace_mask;
+
+static struct rchan *trace_chan;
+static struct dentry *trace_dir;
+static DEFINE_MUTEX(trace_lock);
+static bool trace_ready;
+
+/* Only touched from the owning CPU's writes, or by relay_flush() once quiet */
+struct trace_cpu {
+    u64 seq;
+    u64 dropped;
+};
+
+static DEFINE_PER_CPU(struct trace_cpu, trace_cpu);
+
+static unsigned int trace_buf_kb = 1024;
+module_param(trace_buf_kb, uint, 0644);
+MODULE_PARM_DESC(trace_buf_kb, "Per-CPU capture buffer size, fixed once capture first starts");
+
+static int trace_subbuf_start(struct rchan_buf *buf, void *subbuf,
+                              void *prev_subbuf, size_t prev_padding)
+{
+    struct trace_cpu *tc = per_cpu_ptr(&trace_cpu, buf->cpu);
+    struct muscle_trace_rec *hdr = subbuf;
+
+    if (relay_buf_full(buf)) {
+        tc->dropped++;
+        return 0;
+    }
+    *hdr = (struct muscle_trace_rec) {
+        .ts   = local_clock(),
+        .type = MUSCLE_TRACE_HDR,
+        .cpu  = buf->cpu,
+        .hdr  = {
+            .magic   = MUSCLE_TRACE_MAGIC,
+            .version = MUSCLE_TRACE_VERSION,
+            .size    = sizeof(*hdr),
+            .seq     = tc->seq++,
+            .dropped = tc->dropped,
+        },
+    };
+    subbuf_start_reserve(buf, sizeof(*hdr));
+    return 1;
+}
+
+static struct dentry *trace_create_buf_file(const char *filename, struct dentry *parent,
+                                            umode_t mode, struct rchan_buf *buf,
+                                            int *is_global)
+{
+    return debugfs_create_file(filename, mode, parent, buf, &relay_file_operations);
+}
+
+static int trace_remove_buf_file(struct dentry *dentry)
+{
+    debugfs_remove(dentry);
+    return 0;
+}
+
+static const struct rchan_callbacks trace_callbacks = {
+    .subbuf_start    = trace_subbuf_start,
+    .create_buf_file = trace_create_buf_file,
+    .remove_buf_file = trace_remove_buf_file,
+};
+
+/*
+ * Hooks run in every context from syscall entry to the scheduler tick
+ * under the rq lock; with irqs off the slot write can't interleave with
+ * an interrupt's, and relay defers reader wakeups to irq_work.
+ */
+void muscle_trace_record(struct muscle_trace_rec *rec)
+{
+    unsigned long flags;
+
+    local_irq_save(flags);
+    rec->ts = local_clock();
+    rec->cpu = smp_processor_id();
+    rec->pid = current->pid;
+    __relay_write(trace_chan, rec, sizeof(*rec));
+    local_irq_restore(flags);
+}
+
+static int trace_start(void)
+{
+    size_t n = max_t(size_t, 2, ((size_t)READ_ONCE(trace_buf_kb) << 10) / TRACE_SUBBUF_SIZE);
+
+    lockdep_assert_held(&trace_lock);
+
+    if (trace_chan)
+        return 0;
+    if (!trace_dir)
+        trace_dir = debugfs_create_dir("trace", muscle_debugfs_dir());
+    trace_chan = relay_open("cpu", trace_dir, TRACE_SUBBUF_SIZE, n, &trace_callbacks, NULL);
+    return trace_chan ? 0 : -ENOMEM;
+}
+
+static int trace_mask_apply(unsigned int mask)
+{
+    int ret = 0;
+
+    mutex_lock(&trace_lock);
+    if (mask) {
+        ret = trace_start();
+        if (!ret) {
+            WRITE_ONCE(muscle_trace_mask, mask);
+            static_branch_enable(&muscle_trace_key);
+        }
+    } else if (static_key_enabled(&muscle_trace_key)) {
+        static_branch_disable(&muscle_trace_key);
+        WRITE_ONCE(muscle_trace_mask, 0);
+        /* Writers run with irqs off: after a grace period none is left */
+        synchronize_rcu();
+        relay_flush(trace_chan);
+    }
+    mutex_unlock(&trace_lock);
+    return ret;
+}
+
+static unsigned int trace_mask;
+
+static int trace_mask_set(const char *val, const struct kernel_param *kp)
+{
+    unsigned int mask;
+    int ret = kstrtouint(val, 0, &mask);
+
+    if (ret)
+        return ret;
+    if (mask & ~(BIT(MUSCLE_TRACE_TYPES) - 1))
+        return -EINVAL;
+    /* Before init the mask is applied by muscle_trace_init() */
+    if (READ_ONCE(trace_ready)) {
+        ret = trace_mask_apply(mask);
+        if (ret)
+            return ret;
+    }
+    WRITE_ONCE(trace_mask, mask);
+    return 0;
+}
+
+static const struct kernel_param_ops trace_mask_ops = {
+    .set = trace_mask_set,
+    .get = param_get_uint,
+};
+module_param_cb(trace_mask, &trace_mask_ops, &trace_mask, 0600);
+MODULE_PARM_DESC(trace_mask, "Hooks to capture: 1 cache, 2 io, 4 security, 8 sched (0 = off)");
+
+static int trace_dropped_get(char *buf, const struct kernel_param *kp)
+{
+    u64 sum = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        sum += data_race(per_cpu_ptr(&trace_cpu, cpu)->dropped);
+    return sysfs_emit(buf, "%llu\n", sum);
+}
+
+static const struct kernel_param_ops trace_dropped_ops = {
+    .get = trace_dropped_get,
+};
+module_param_cb(trace_dropped, &trace_dropped_ops, NULL, 0444);
+MODULE_PARM_DESC(trace_dropped, "Captured records lost to full buffers");
+
+static int __init muscle_trace_init(void)
+{
+    int ret = 0;
+
+    WRITE_ONCE(trace_ready, true);
+    if (trace_mask)
+        ret = trace_mask_apply(trace_mask);
+    if (ret)
+        pr_warn("muscle: trace: capture unavailable (%d)\n", ret);
+    return 0;
+}
+late_initcall(muscle_trace_init);
@@ -0,0 +1,295 @@
+#include <linux/muscle.h>
+#include <linux/crc32.h>
+#include <linux/err.h>
+#include <linux/firmware.h>
+#include <linux/kobject.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/sysfs.h>
+
+/*
+ * Hot-swappable weight sets.  Every muscle registers its tables with the
+ * counts its model expects; the built-in copy (if the .hex sources were
+ * complete) and any blob loaded later go through the same validation and
+ * the muscle's build(), and the resulting model is published with
+ * rcu_assign_pointer().  Readers only ever rcu_dereference() it, so a
+ * swap never blocks a forward pass; the old model is released after a
+ * grace period.  The built-in model stays resident for rollback.
+ *
+ *   /sys/kernel/muscle/<name>/load        firmware name, or "builtin"
+ *   /sys/kernel/muscle/<name>/generation  0 for the built-in set
+ */
+static struct kobject *muscle_kobj;
+
+#define to_wset(k) container_of(k, struct muscle_wset, kobj)
+
+/* Publish m at generation gen, release whatever it replaces */
+static void muscle_wset_publish(struct muscle_wset *ws, void *m, u32 gen)
+{
+    void *old;
+
+    lockdep_assert_held(&ws->lock);
+
+    old = rcu_replace_pointer(*ws->model, m, lockdep_is_held(&ws->lock));
+    ws->generation = gen;
+    if (old && old != ws->builtin) {
+        synchronize_rcu();
+        ws->release(old);
+    }
+}
+
+static void *muscle_wset_build_builtin(struct muscle_wset *ws)
+{
+    const muscle_fixed *t[MUSCLE_WSET_MAX_TABLES];
+    unsigned int i;
+
+    for (i = 0; i < ws->nr_tables; i++) {
+        const struct muscle_wtable *wt = &ws->tables[i];
+
+        if (wt->builtin_count != wt->count) {
+            pr_warn("muscle: %s: built-in %s has %u entries, expected %u\n",
+                    ws->name, wt->name, wt->builtin_count, wt->count);
+            return ERR_PTR(-ENOENT);
+        }
+        t[i] = wt->builtin;
+    }
+    return ws->build(t);
+}
+
+/*
+ * If the built-in model is live, publish a fresh build of the same
+ * tables in its place, still as generation 0.  Rolling back to
+ * "builtin" later brings back the untouched one.
+ */
+int muscle_wset_fork(struct muscle_wset *ws)
+{
+    void *m;
+    int ret = 0;
+
+    mutex_lock(&ws->lock);
+    if (ws->builtin && rcu_access_pointer(*ws->model) == ws->builtin) {
+        m = muscle_wset_build_builtin(ws);
+        if (IS_ERR(m))
+            ret = PTR_ERR(m);
+        else
+            muscle_wset_publish(ws, m, 0);
+    }
+    mutex_unlock(&ws->lock);
+    return ret;
+}
+
+int muscle_wset_update(struct muscle_wset *ws, const void *from, void *m)
+{
+    int ret = 0;
+
+    mutex_lock(&ws->lock);
+    if (rcu_access_pointer(*ws->model) == from)
+        muscle_wset_publish(ws, m, ws->generation);
+    else
+        ret = -EAGAIN;
+    mutex_unlock(&ws->lock);
+    return ret;
+}
+
+/*
+ * Check a blob against ws and convert its tables to host order in one
+ * kvmalloc()ed buffer; t[i] points at ws->tables[i] inside it.
+ */
+static muscle_fixed *muscle_blob_parse(const struct muscle_wset *ws,
+                                       const u8 *data, size_t size, u32 *gen,
+                                       const muscle_fixed **t)
+{
+    const struct muscle_blob_hdr *hdr = (const void *)data;
+    const struct muscle_blob_table *dir;
+    size_t dir_end, total = 0, pos = 0;
+    unsigned int i, j, nr;
+    muscle_fixed *buf;
+
+    if (size < sizeof(*hdr) || le32_to_cpu(hdr->magic) != MUSCLE_BLOB_MAGIC)
+        return ERR_PTR(-EBADMSG);
+    if (le16_to_cpu(hdr->version) != MUSCLE_BLOB_VERSION)
+        return ERR_PTR(-EOPNOTSUPP);
+    if (strncmp(hdr->muscle, ws->name, sizeof(hdr->muscle)))
+        return ERR_PTR(-EINVAL);
+
+    nr = le16_to_cpu(hdr->nr_tables);
+    dir = (const void *)(hdr + 1);
+    dir_end = sizeof(*hdr) + (size_t)nr * sizeof(*dir);
+    if (nr != ws->nr_tables || dir_end > size)
+        return ERR_PTR(-EINVAL);
+    if ((crc32_le(~0, data + sizeof(*hdr), size - sizeof(*hdr)) ^ ~0) !=
+        le32_to_cpu(hdr->crc))
+        return ERR_PTR(-EBADMSG);
+
+    for (i = 0; i < ws->nr_tables; i++)
+        total += ws->tables[i].count;
+    buf = kvmalloc_array(total, sizeof(*buf), GFP_KERNEL);
+    if (!buf)
+        return ERR_PTR(-ENOMEM);
+
+    for (i = 0; i < ws->nr_tables; i++) {
+        const struct muscle_wtable *wt = &ws->tables[i];
+        const __le32 *src = NULL;
+
+        for (j = 0; j < nr; j++) {
+            if (strncmp(dir[j].name, wt->name, sizeof(dir[j].name)))
+                continue;
+            if (src || le32_to_cpu(dir[j].count) != wt->count)
+                goto bad;
+            src = (const void *)(data + le32_to_cpu(dir[j].offset));
+            if (le32_to_cpu(dir[j].offset) < dir_end ||
+                !IS_ALIGNED(le32_to_cpu(dir[j].offset), sizeof(*src)) ||
+                le32_to_cpu(dir[j].offset) > size ||
+                (size - le32_to_cpu(dir[j].offset)) / sizeof(*src) < wt->count)
+                goto bad;
+        }
+        if (!src)
+            goto bad;
+
+        t[i] = buf + pos;
+        for (j = 0; j < wt->count; j++)
+            buf[pos++] = (s32)le32_to_cpu(src[j]);
+    }
+
+    *gen = le32_to_cpu(hdr->generation);
+    return buf;
+bad:
+    kvfree(buf);
+    return ERR_PTR(-EINVAL);
+}
+
+static int muscle_wset_load(struct muscle_wset *ws, const char *fw_name)
+{
+    const muscle_fixed *t[MUSCLE_WSET_MAX_TABLES];
+    const struct firmware *fw;
+    muscle_fixed *buf;
+    void *m;
+    u32 gen;
+    int ret;
+
+    ret = request_firmware(&fw, fw_name, NULL);
+    if (ret)
+        return ret;
+
+    buf = muscle_blob_parse(ws, fw->data, fw->size, &gen, t);
+    release_firmware(fw);
+    if (IS_ERR(buf))
+        return PTR_ERR(buf);
+
+    /* Built models own their memory, the converted tables can go */
+    m = ws->build(t);
+    kvfree(buf);
+    if (IS_ERR(m))
+        return PTR_ERR(m);
+
+    mutex_lock(&ws->lock);
+    muscle_wset_publish(ws, m, gen);
+    mutex_unlock(&ws->lock);
+    pr_info("muscle: %s: loaded %s, generation %u\n", ws->name, fw_name, gen);
+    return 0;
+}
+
+static ssize_t load_store(struct kobject *kobj, struct kobj_attribute *attr,
+                          const char *buf, size_t count)
+{
+    struct muscle_wset *ws = to_wset(kobj);
+    char tmp[NAME_MAX + 1], *name;
+    int ret;
+
+    if (count > NAME_MAX)
+        return -ENAMETOOLONG;
+    memcpy(tmp, buf, count);
+    tmp[count] = '\0';
+    name = strim(tmp);
+    if (!*name)
+        return -EINVAL;
+
+    if (!strcmp(name, "builtin")) {
+        if (!ws->builtin)
+            return -ENOENT;
+        mutex_lock(&ws->lock);
+        muscle_wset_publish(ws, ws->builtin, 0);
+        mutex_unlock(&ws->lock);
+        pr_info("muscle: %s: rolled back to built-in weights\n", ws->name);
+        return count;
+    }
+
+    ret = muscle_wset_load(ws, name);
+    return ret ? ret : count;
+}
+
+static ssize_t generation_show(struct kobject *kobj, struct kobj_attribute *attr,
+                               char *buf)
+{
+    struct muscle_wset *ws = to_wset(kobj);
+
+    if (!rcu_access_pointer(*ws->model))
+        return sysfs_emit(buf, "none\n");
+    return sysfs_emit(buf, "%u\n", READ_ONCE(ws->generation));
+}
+
+static struct kobj_attribute load_attr = __ATTR_WO(load);
+static struct kobj_attribute generation_attr = __ATTR_RO(generation);
+
+static struct attribute *muscle_wset_attrs[] = {
+    &load_attr.attr,
+    &generation_attr.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(muscle_wset);
+
+/* Weight sets are static and never unregistered */
+static void muscle_wset_kobj_release(struct kobject *kobj)
+{
+}
+
+static const struct kobj_type muscle_wset_ktype = {
+    .release        = muscle_wset_kobj_release,
+    .sysfs_ops      = &kobj_sysfs_ops,
+    .default_groups = muscle_wset_groups,
+};
+
+/*
+ * Build and publish the built-in model and create the sysfs directory.
+ * A muscle whose built-in tables are incomplete still registers, with
+ * no model published until a blob is loaded.
+ */
+int muscle_wset_register(struct muscle_wset *ws)
+{
+    void *m;
+    int ret;
+
+    if (WARN_ON(ws->nr_tables > MUSCLE_WSET_MAX_TABLES))
+        return -E2BIG;
+
+    mutex_init(&ws->lock);
+    m = muscle_wset_build_builtin(ws);
+    if (!IS_ERR(m)) {
+        ws->builtin = m;
+        mutex_lock(&ws->lock);
+        muscle_wset_publish(ws, m, 0);
+        mutex_unlock(&ws->lock);
+    } else if (PTR_ERR(m) != -ENOENT) {
+        return PTR_ERR(m);
+    } else {
+        pr_warn("muscle: %s: no built-in weights, waiting for a blob\n", ws->name);
+    }
+
+    if (!muscle_kobj)
+        return 0;
+    ret = kobject_init_and_add(&ws->kobj, &muscle_wset_ktype, muscle_kobj,
+                               "%s", ws->name);
+    if (ret)
+        kobject_put(&ws->kobj);
+    return ret;
+}
+
+static int __init muscle_weights_init(void)
+{
+    muscle_kobj = kobject_create_and_add("muscle", kernel_kobj);
+    return muscle_kobj ? 0 : -ENOMEM;
+}
+subsys_initcall(muscle_weights_init);
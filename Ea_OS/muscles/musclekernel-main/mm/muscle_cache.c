@@ -3,166 +3,901 @@
 #include <linux/bio.h>
 #include <linux/mm.h>
 #include <linux/jiffies.h>
+#include <linux/percpu.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
+#include <linux/moduleparam.h>
+#include <linux/math64.h>
+#include <linux/pagemap.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/err.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <trace/events/muscle.h>
 
-/* Tiny LSTM: 8 previous blocks → 64 hidden → 8 next-block probabilities */
-/* Fixed-point 12.4 format, hand-rolled gates (no libm, no float in hot path) */
+/* Tiny LSTM: stream features → 64 hidden → next-stride logits */
+/* Q12 fixed point throughout, hand-rolled gates (no libm, no FPU) */
 
-#define CACHE_LSTM_INPUT   8
+#define CACHE_LSTM_INPUT   MUSCLE_STREAM_FEATURES
 #define CACHE_LSTM_HIDDEN  64
-#define CACHE_LSTM_OUTPUT  8
+#define CACHE_LSTM_OUTPUT  MUSCLE_STREAM_VOCAB
+#define CACHE_STREAMS      4    /* per-CPU stream histories, by context hash */
 
-/* Pre-trained weights (from 10M block traces on real workloads) */
-static const muscle_fixed lstm_wi[CACHE_LSTM_HIDDEN * CACHE_LSTM_INPUT] = {
+/*
+ * Built-in weights (from 10M block traces on real workloads).  A missing
+ * source leaves an empty table; muscle_wset_register() then refuses the
+ * built-in set and the muscle idles until a blob is loaded.
+ */
+static const muscle_fixed lstm_wi[] = {
+#if __has_include("weights/cache_wi.hex")
     #include "weights/cache_wi.hex"
+#endif
 };
-static const muscle_fixed lstm_wf[CACHE_LSTM_HIDDEN * CACHE_LSTM_INPUT] = {
+static const muscle_fixed lstm_wf[] = {
+#if __has_include("weights/cache_wf.hex")
     #include "weights/cache_wf.hex"
+#endif
 };
-static const muscle_fixed lstm_wg[CACHE_LSTM_HIDDEN * CACHE_LSTM_INPUT] = {
+static const muscle_fixed lstm_wg[] = {
+#if __has_include("weights/cache_wg.hex")
     #include "weights/cache_wg.hex"
+#endif
 };
-static const muscle_fixed lstm_wo[CACHE_LSTM_HIDDEN * CACHE_LSTM_INPUT] = {
+static const muscle_fixed lstm_wo[] = {
+#if __has_include("weights/cache_wo.hex")
     #include "weights/cache_wo.hex"
+#endif
 };
-static const muscle_fixed lstm_ri[CACHE_LSTM_HIDDEN * CACHE_LSTM_HIDDEN] = {
+static const muscle_fixed lstm_ri[] = {
+#if __has_include("weights/cache_ri.hex")
     #include "weights/cache_ri.hex"
+#endif
 };
-static const muscle_fixed lstm_rf[CACHE_LSTM_HIDDEN * CACHE_LSTM_HIDDEN] = {
+static const muscle_fixed lstm_rf[] = {
+#if __has_include("weights/cache_rf.hex")
     #include "weights/cache_rf.hex"
+#endif
 };
-static const muscle_fixed lstm_rg[CACHE_LSTM_HIDDEN * CACHE_LSTM_HIDDEN] = {
+static const muscle_fixed lstm_rg[] = {
+#if __has_include("weights/cache_rg.hex")
     #include "weights/cache_rg.hex"
+#endif
 };
-static const muscle_fixed lstm_ro[CACHE_LSTM_HIDDEN * CACHE_LSTM_HIDDEN] = {
+static const muscle_fixed lstm_ro[] = {
+#if __has_include("weights/cache_ro.hex")
     #include "weights/cache_ro.hex"
+#endif
 };
-static const muscle_fixed lstm_outw[CACHE_LSTM_OUTPUT * CACHE_LSTM_HIDDEN] = {
+
+/* Bias vectors */
+static const muscle_fixed lstm_bi[] = {
+#if __has_include("weights/cache_bi.hex")
+    #include "weights/cache_bi.hex"
+#endif
+};
+static const muscle_fixed lstm_bf[] = {
+#if __has_include("weights/cache_bf.hex")
+    #include "weights/cache_bf.hex"
+#endif
+};
+static const muscle_fixed lstm_bg[] = {
+#if __has_include("weights/cache_bg.hex")
+    #include "weights/cache_bg.hex"
+#endif
+};
+static const muscle_fixed lstm_bo[] = {
+#if __has_include("weights/cache_bo.hex")
+    #include "weights/cache_bo.hex"
+#endif
+};
+
+/* Output layer */
+static const muscle_fixed lstm_outw[] = {
+#if __has_include("weights/cache_outw.hex")
     #include "weights/cache_outw.hex"
+#endif
+};
+static const muscle_fixed lstm_outb[] = {
+#if __has_include("weights/cache_outb.hex")
+    #include "weights/cache_outb.hex"
+#endif
 };
 
-/* Bias vectors */
-static const muscle_fixed lstm_bi[CACHE_LSTM_HIDDEN] = { #include "weights/cache_bi.hex" };
-static const muscle_fixed lstm_bf[CACHE_LSTM_HIDDEN] = { #include "weights/cache_bf.hex" };
-static const muscle_fixed lstm_bg[CACHE_LSTM_HIDDEN] = { #include "weights/cache_bg.hex" };
-static const muscle_fixed lstm_bo[CACHE_LSTM_HIDDEN] = { #include "weights/cache_bo.hex" };
-static const muscle_fixed lstm_outb[CACHE_LSTM_OUTPUT] = { #include "weights/cache_outb.hex" };
+enum {
+    CACHE_WI, CACHE_WF, CACHE_WG, CACHE_WO,
+    CACHE_RI, CACHE_RF, CACHE_RG, CACHE_RO,
+    CACHE_BI, CACHE_BF, CACHE_BG, CACHE_BO,
+    CACHE_OUTW, CACHE_OUTB,
+    CACHE_TABLES,
+};
+
+#define CACHE_GATE_W  (CACHE_LSTM_HIDDEN * CACHE_LSTM_INPUT)
+#define CACHE_GATE_R  (CACHE_LSTM_HIDDEN * CACHE_LSTM_HIDDEN)
 
+static const struct muscle_wtable cache_tables[CACHE_TABLES] = {
+    [CACHE_WI]   = MUSCLE_WTABLE("wi", lstm_wi, CACHE_GATE_W),
+    [CACHE_WF]   = MUSCLE_WTABLE("wf", lstm_wf, CACHE_GATE_W),
+    [CACHE_WG]   = MUSCLE_WTABLE("wg", lstm_wg, CACHE_GATE_W),
+    [CACHE_WO]   = MUSCLE_WTABLE("wo", lstm_wo, CACHE_GATE_W),
+    [CACHE_RI]   = MUSCLE_WTABLE("ri", lstm_ri, CACHE_GATE_R),
+    [CACHE_RF]   = MUSCLE_WTABLE("rf", lstm_rf, CACHE_GATE_R),
+    [CACHE_RG]   = MUSCLE_WTABLE("rg", lstm_rg, CACHE_GATE_R),
+    [CACHE_RO]   = MUSCLE_WTABLE("ro", lstm_ro, CACHE_GATE_R),
+    [CACHE_BI]   = MUSCLE_WTABLE("bi", lstm_bi, CACHE_LSTM_HIDDEN),
+    [CACHE_BF]   = MUSCLE_WTABLE("bf", lstm_bf, CACHE_LSTM_HIDDEN),
+    [CACHE_BG]   = MUSCLE_WTABLE("bg", lstm_bg, CACHE_LSTM_HIDDEN),
+    [CACHE_BO]   = MUSCLE_WTABLE("bo", lstm_bo, CACHE_LSTM_HIDDEN),
+    [CACHE_OUTW] = MUSCLE_WTABLE("outw", lstm_outw, CACHE_LSTM_OUTPUT * CACHE_LSTM_HIDDEN),
+    [CACHE_OUTB] = MUSCLE_WTABLE("outb", lstm_outb, CACHE_LSTM_OUTPUT),
+};
+
+/* What a stream's last step predicted, kept until its next access scores it */
+struct cache_pend {
+    s16 h[CACHE_LSTM_HIDDEN];
+    s8 top, second;            /* top -1 if nothing is pending */
+    bool confident;
+};
+
+/*
+ * Predictor state is per-CPU: each CPU's block stream is queued on its
+ * own event ring and only that ring's drain advances the history and
+ * hidden/cell vectors, so nothing on the predict path is shared.
+ * cache_merge_work optionally averages the recurrent state across CPUs
+ * and publishes it in cache_merged; each CPU blends it in lazily.
+ */
 struct muscle_cache_state {
     muscle_fixed h[CACHE_LSTM_HIDDEN];
     muscle_fixed c[CACHE_LSTM_HIDDEN];
-    u64 last_blocks[8];
-    spinlock_t lock;
+    struct muscle_stream stream[CACHE_STREAMS];
+    struct cache_pend pend[CACHE_STREAMS];    /* only while learn is set */
+    unsigned int merge_seq;    /* last cache_merged generation blended in */
+    int pred_slot;             /* last confident stride slot, -1 if none */
+    u64 pred_ctx;              /* context pred_slot was predicted for */
 } ____cacheline_aligned;
 
-static struct muscle_cache_state cache_state;
+static DEFINE_PER_CPU_ALIGNED(struct muscle_cache_state, cache_state);
 
-/* Tiny sigmoid and tanh for fixed-point */
-static inline muscle_fixed muscle_sigmoid(muscle_fixed x)
+static struct {
+    seqcount_t seq;
+    unsigned int gen;
+    muscle_fixed h[CACHE_LSTM_HIDDEN];
+    muscle_fixed c[CACHE_LSTM_HIDDEN];
+} cache_merged ____cacheline_aligned;
+
+static void cache_merge_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(cache_merge_work, cache_merge_fn);
+
+/* Merge period in ms; 0 keeps every CPU's state fully independent */
+static unsigned int merge_interval_ms = 100;
+static bool merge_ready;
+
+static int merge_interval_set(const char *val, const struct kernel_param *kp)
 {
-    if (x < -8 * MUSCLE_FIXED_ONE) return 0;
-    if (x >  8 * MUSCLE_FIXED_ONE) return MUSCLE_FIXED_ONE;
-    /* Approximation: 0.5 + 0.25 * x * (1 - |x|/16) */
-    muscle_fixed abs_x = x < 0 ? -x : x;
-    muscle_fixed approx = (abs_x >> 2) * (MUSCLE_FIXED_ONE - (abs_x >> 4));
-    return x < 0 ? (MUSCLE_FIXED_ONE >> 1) - (approx >> 1) : (MUSCLE_FIXED_ONE >> 1) + (approx >> 1);
+    int ret = param_set_uint(val, kp);
+
+    /* Before init the work is started by muscle_cache_init() */
+    if (ret || !READ_ONCE(merge_ready))
+        return ret;
+    if (READ_ONCE(merge_interval_ms))
+        mod_delayed_work(system_wq, &cache_merge_work,
+                         msecs_to_jiffies(READ_ONCE(merge_interval_ms)));
+    else
+        cancel_delayed_work_sync(&cache_merge_work);
+    return 0;
 }
 
-static inline muscle_fixed muscle_tanh(muscle_fixed x)
+static const struct kernel_param_ops merge_interval_ops = {
+    .set = merge_interval_set,
+    .get = param_get_uint,
+};
+module_param_cb(merge_interval_ms, &merge_interval_ops, &merge_interval_ms, 0644);
+MODULE_PARM_DESC(merge_interval_ms, "Cross-CPU LSTM state merge period (0 = off)");
+
+/*
+ * Online learning of the output head (learn=1).  Each stream's next access
+ * scores the prediction its last step made: if it landed on one of the
+ * strides, that step's hidden vector, the slot that would have hit and
+ * the slots predicted make a sample, unless the prediction was a
+ * confident hit already.  Samples queue per CPU for cache_learn_fn(),
+ * which nudges a Q20 master copy of the head towards the right slot and
+ * away from the wrong one (a margin perceptron), for at most
+ * learn_budget_us per run.  CPUs update the master without locking;
+ * a lost nudge costs nothing but the nudge.  cache_publish_fn()
+ * requantizes it into the head no reader can still be using and flips
+ * to it.  The LSTM itself stays frozen: backpropagating through it
+ * would not fit the budget.  Training never touches the resident
+ * built-in model: turning learn on forks it first (muscle_wset_fork()),
+ * and samples taken while it is live, e.g. just after a rollback to
+ * "builtin", are dropped until cache_publish_fn() forks it again.
+ */
+#define CACHE_LEARN_FRAC   8     /* master weights are Q(12 + 8) */
+#define CACHE_LEARN_LIMIT  ((s32)(16 * MUSCLE_FIXED_ONE) << CACHE_LEARN_FRAC)
+#define CACHE_LEARN_RING   32
+#define CACHE_LEARN_BATCH  8     /* queued samples that wake the learner */
+#define CACHE_LEARN_ROW    (CACHE_LSTM_HIDDEN + 1)    /* weights, then bias */
+
+struct cache_sample {
+    s16 h[CACHE_LSTM_HIDDEN];
+    s8 label, top, second;
+    bool confident;
+};
+
+/* SPSC like the event rings: cache_drain() produces, cache_learn_fn() consumes */
+struct cache_learn {
+    unsigned int head ____cacheline_aligned;
+    unsigned int tail ____cacheline_aligned;
+    struct work_struct work;
+    struct cache_sample s[CACHE_LEARN_RING];
+};
+
+static DEFINE_PER_CPU(struct cache_learn, cache_learn);
+
+/*
+ * Gate-interleaved int8 LSTM and int8 output head, see cache_build().
+ * head[] double-buffers the output head for learning: out is the live
+ * one, and the other is only rewritten once the grace period started by
+ * the last flip (flip_gp) is over.
+ */
+MUSCLE_LSTM_CELL(cache_cell, CACHE_LSTM_INPUT, CACHE_LSTM_HIDDEN)
+MUSCLE_DENSE(cache_head, CACHE_LSTM_HIDDEN, CACHE_LSTM_OUTPUT, 8, MUSCLE_ACT_NONE)
+
+struct cache_model {
+    struct cache_cell lstm;
+    struct cache_head head[2];
+    struct cache_head __rcu *out;
+    s32 *master;               /* [OUTPUT][CACHE_LEARN_ROW], Q20 */
+    unsigned long learned;     /* samples applied, bumped racily */
+    unsigned long published;   /* learned at the last flip */
+    unsigned long flip_gp;
+};
+
+static struct cache_model __rcu *cache_model;
+static struct muscle_evq cache_evq;
+
+DEFINE_MUSCLE_SWITCH(muscle_cache_key, "cache");
+
+/*
+ * Readahead.  Output slot k says the next access lands
+ * muscle_stream_strides[k] pages from the current one; forward strides
+ * inside one window are left to the kernel's own readahead.
+ */
+#define CACHE_RA_MAX_PAGES 256
+
+static unsigned int ra_window = 32;
+module_param(ra_window, uint, 0644);
+MODULE_PARM_DESC(ra_window, "Pages per predicted readahead window (max 256)");
+
+/* Logit lead over the runner-up needed before a slot is acted on */
+static int ra_confidence = MUSCLE_FIXED_ONE / 2;
+module_param(ra_confidence, int, 0644);
+MODULE_PARM_DESC(ra_confidence, "Minimum Q12 logit margin to issue readahead");
+
+/*
+ * The last range this CPU read ahead.  mapping is only compared, never
+ * dereferenced, so a stale pointer can at worst mis-score one range.
+ */
+struct cache_ra_last {
+    const struct address_space *mapping;
+    pgoff_t start, end;
+    bool hit;
+};
+
+static DEFINE_PER_CPU(struct cache_ra_last, cache_ra_last);
+
+/* A range is a hit once a read reaches its readahead marker, wasted otherwise */
+DEFINE_MUSCLE_STATS(cache_stats, "cache",
+                    BIT(MUSCLE_STAT_CALLS) | BIT(MUSCLE_STAT_INFER) |
+                    BIT(MUSCLE_STAT_INFER_NS) | BIT(MUSCLE_STAT_ISSUED) |
+                    BIT(MUSCLE_STAT_HITS) | BIT(MUSCLE_STAT_MISSES) |
+                    BIT(MUSCLE_STAT_WASTED_BYTES) | BIT(MUSCLE_STAT_ABSTAIN) |
+                    BIT(MUSCLE_STAT_SAVED_NS) | BIT(MUSCLE_STAT_THROTTLED) |
+                    BIT(MUSCLE_STAT_LEARN) | BIT(MUSCLE_STAT_LEARN_NS) |
+                    BIT(MUSCLE_STAT_LEARN_DROPPED));
+
+DEFINE_MUSCLE_THROTTLE(cache_throttle, cache_stats);
+
+/*
+ * What the throttle credits a range with: a hit saves roughly one
+ * synchronous read, a wasted range costs the I/O and the page cache it
+ * displaced.  Both depend on the device; these suit an SSD.
+ */
+static unsigned int ra_hit_us = 100;
+module_param(ra_hit_us, uint, 0644);
+MODULE_PARM_DESC(ra_hit_us, "Estimated time a readahead hit saves, us");
+
+static unsigned int ra_waste_ns = 2000;
+module_param(ra_waste_ns, uint, 0644);
+MODULE_PARM_DESC(ra_waste_ns, "Estimated cost of each wasted readahead page, ns");
+
+static unsigned int learn_budget_us = 50;
+module_param(learn_budget_us, uint, 0644);
+MODULE_PARM_DESC(learn_budget_us, "Longest one CPU trains per run, us; the rest is dropped");
+
+static unsigned int learn_shift = 10;
+module_param(learn_shift, uint, 0644);
+MODULE_PARM_DESC(learn_shift, "Learning rate as a right shift (10 = 1/1024)");
+
+static unsigned int learn_publish_ms = 1000;
+module_param(learn_publish_ms, uint, 0644);
+MODULE_PARM_DESC(learn_publish_ms, "How often trained weights are swapped in");
+
+static void cache_publish_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(cache_publish_work, cache_publish_fn);
+static struct muscle_wset cache_wset;
+
+static bool learn;
+static bool learn_ready;
+
+static void cache_publish_kick(void)
+{
+    schedule_delayed_work(&cache_publish_work,
+                          msecs_to_jiffies(max(READ_ONCE(learn_publish_ms), 10U)));
+}
+
+static void cache_learn_start(void)
+{
+    int ret = muscle_wset_fork(&cache_wset);
+
+    /* cache_publish_fn() retries; until then nothing is trained */
+    if (ret)
+        pr_warn("MuscleCache: cannot copy built-in weights to train (%d)\n", ret);
+    cache_publish_kick();
+}
+
+static int learn_set(const char *val, const struct kernel_param *kp)
 {
-    if (x > 5 * MUSCLE_FIXED_ONE) return MUSCLE_FIXED_ONE;
-    if (x < -5 * MUSCLE_FIXED_ONE) return -MUSCLE_FIXED_ONE;
-    /* Simple approximation */
-    return x - (x * x * x) / (3 * MUSCLE_FIXED_ONE * MUSCLE_FIXED_ONE);
+    int ret = param_set_bool(val, kp);
+
+    /* Stopping is left to cache_publish_fn(), which sees learn clear */
+    if (!ret && READ_ONCE(learn) && READ_ONCE(learn_ready))
+        cache_learn_start();
+    return ret;
 }
 
-/* One LSTM step — runs in < 800 ns on modern CPU */
-static void lstm_step(const muscle_fixed x[8])
+static const struct kernel_param_ops learn_ops = {
+    .set = learn_set,
+    .get = param_get_bool,
+};
+module_param_cb(learn, &learn_ops, &learn, 0644);
+MODULE_PARM_DESC(learn, "Fine-tune the output head online from stride hits and misses");
+
+/* Pull the latest cross-CPU average into this CPU's state, if one is newer */
+static void cache_blend_merged(struct muscle_cache_state *s)
 {
-    muscle_fixed i_t[CACHE_LSTM_HIDDEN] = {0};
-    muscle_fixed f_t[CACHE_LSTM_HIDDEN] = {0};
-    muscle_fixed g_t[CACHE_LSTM_HIDDEN] = {0};
-    muscle_fixed o_t[CACHE_LSTM_HIDDEN] = {0};
-    int i, j;
+    muscle_fixed h[CACHE_LSTM_HIDDEN], c[CACHE_LSTM_HIDDEN];
+    unsigned int seq, gen;
+    int i;
+
+    gen = READ_ONCE(cache_merged.gen);
+    if (likely(gen == s->merge_seq))
+        return;
 
+    /* Never spin here: if the merge worker is mid-publish, try next time */
+    seq = raw_read_seqcount(&cache_merged.seq);
+    if (seq & 1)
+        return;
+    memcpy(h, cache_merged.h, sizeof(h));
+    memcpy(c, cache_merged.c, sizeof(c));
+    if (read_seqcount_retry(&cache_merged.seq, seq))
+        return;
+
+    /* gen was read first, so a newer average only makes this blend again */
     for (i = 0; i < CACHE_LSTM_HIDDEN; i++) {
-        muscle_fixed sum_i = lstm_bi[i];
-        muscle_fixed sum_f = lstm_bf[i];
-        muscle_fixed sum_g = lstm_bg[i];
-        muscle_fixed sum_o = lstm_bo[i];
-
-        for (j = 0; j < CACHE_LSTM_INPUT; j++)
-            sum_i += lstm_wi[i * CACHE_LSTM_INPUT + j] * x[j];
-        for (j = 0; j < CACHE_LSTM_HIDDEN; j++) {
-            sum_i += lstm_ri[i * CACHE_LSTM_HIDDEN + j] * cache_state.h[j];
-            sum_f += lstm_rf[i * CACHE_LSTM_HIDDEN + j] * cache_state.h[j];
-            sum_g += lstm_rg[i * CACHE_LSTM_HIDDEN + j] * cache_state.h[j];
-            sum_o += lstm_ro[i * CACHE_LSTM_HIDDEN + j] * cache_state.h[j];
+        s->h[i] = (s->h[i] >> 1) + (h[i] >> 1);
+        s->c[i] = (s->c[i] >> 1) + (c[i] >> 1);
+    }
+    s->merge_seq = gen;
+}
+
+static void cache_merge_fn(struct work_struct *work)
+{
+    s64 h[CACHE_LSTM_HIDDEN] = {0};
+    s64 c[CACHE_LSTM_HIDDEN] = {0};
+    unsigned int n = 0;
+    int cpu, i;
+
+    /*
+     * Lockless snapshot of the other CPUs' state.  Entries are s32 so they
+     * never tear; a vector caught mid-step only skews one merge round.
+     */
+    for_each_online_cpu(cpu) {
+        const struct muscle_cache_state *s = per_cpu_ptr(&cache_state, cpu);
+
+        for (i = 0; i < CACHE_LSTM_HIDDEN; i++) {
+            h[i] += data_race(s->h[i]);
+            c[i] += data_race(s->c[i]);
+        }
+        n++;
+    }
+
+    if (n > 1) {
+        preempt_disable();
+        raw_write_seqcount_begin(&cache_merged.seq);
+        for (i = 0; i < CACHE_LSTM_HIDDEN; i++) {
+            cache_merged.h[i] = (muscle_fixed)div_s64(h[i], n);
+            cache_merged.c[i] = (muscle_fixed)div_s64(c[i], n);
+        }
+        raw_write_seqcount_end(&cache_merged.seq);
+        WRITE_ONCE(cache_merged.gen, cache_merged.gen + 1);
+        preempt_enable();
+    }
+
+    if (READ_ONCE(merge_interval_ms))
+        schedule_delayed_work(&cache_merge_work,
+                              msecs_to_jiffies(READ_ONCE(merge_interval_ms)));
+}
+
+/* Output slot of stride d, or -1 if it has none */
+static int cache_stride_slot(s64 d)
+{
+    int i;
+
+    for (i = 0; i < CACHE_LSTM_OUTPUT; i++)
+        if (muscle_stream_strides[i] == d)
+            return i;
+    return -1;
+}
+
+/* Score pd against the stride its stream has just taken, queueing a sample */
+static void cache_learn_score(struct cache_pend *pd, struct cache_learn *l, s64 d)
+{
+    unsigned int head = l->head;
+    struct cache_sample *cs;
+    int label;
+
+    if (pd->top < 0)
+        return;
+    label = cache_stride_slot(d);
+    if (label < 0 || (label == pd->top && pd->confident))
+        goto out;
+    if (head - smp_load_acquire(&l->tail) >= CACHE_LEARN_RING) {
+        muscle_stat_inc(&cache_stats, MUSCLE_STAT_LEARN_DROPPED);
+        goto out;
+    }
+    cs = &l->s[head % CACHE_LEARN_RING];
+    memcpy(cs->h, pd->h, sizeof(cs->h));
+    cs->label = label;
+    cs->top = pd->top;
+    cs->second = pd->second;
+    cs->confident = pd->confident;
+    smp_store_release(&l->head, head + 1);
+out:
+    pd->top = -1;
+}
+
+/* Remember what this step predicted from h, for the stream's next access */
+static void cache_learn_pend(struct cache_pend *pd, const muscle_fixed *h,
+                             const muscle_fixed *logits)
+{
+    int i, top = 0, second = 1;
+
+    if (logits[second] > logits[top])
+        swap(top, second);
+    for (i = 2; i < CACHE_LSTM_OUTPUT; i++) {
+        if (logits[i] > logits[top]) {
+            second = top;
+            top = i;
+        } else if (logits[i] > logits[second]) {
+            second = i;
         }
+    }
+    for (i = 0; i < CACHE_LSTM_HIDDEN; i++)
+        pd->h[i] = muscle_act16(h[i]);
+    pd->top = top;
+    pd->second = second;
+    pd->confident = (s64)logits[top] - logits[second] >= READ_ONCE(ra_confidence);
+}
 
-        i_t[i] = muscle_sigmoid(sum_i);
-        f_t[i] = muscle_sigmoid(sum_f + MUSCLE_FIXED_ONE); /* forget bias +1 */
-        g_t[i] = muscle_tanh(sum_g);
-        o_t[i] = muscle_sigmoid(sum_o);
+static void cache_learn_nudge(s32 *row, const s16 *h, unsigned int shift, int sign)
+{
+    int i;
+
+    for (i = 0; i < CACHE_LSTM_HIDDEN; i++) {
+        s32 d = ((s32)h[i] * (1 << CACHE_LEARN_FRAC)) >> shift;
 
-        cache_state.c[i] = f_t[i] * cache_state.c[i] + i_t[i] * g_t[i];
-        cache_state.h[i] = o_t[i] * muscle_tanh(cache_state.c[i]);
+        WRITE_ONCE(row[i], clamp(READ_ONCE(row[i]) + sign * d,
+                                 -CACHE_LEARN_LIMIT, CACHE_LEARN_LIMIT));
     }
+    i = CACHE_LSTM_HIDDEN;    /* the bias */
+    WRITE_ONCE(row[i], clamp(READ_ONCE(row[i]) +
+                             sign * ((MUSCLE_FIXED_ONE << CACHE_LEARN_FRAC) >> shift),
+                             -CACHE_LEARN_LIMIT, CACHE_LEARN_LIMIT));
+}
+
+/* Up the slot that would have hit; down the miss, or the runner-up it barely beat */
+static void cache_learn_apply(struct cache_model *m, const struct cache_sample *cs,
+                              unsigned int shift)
+{
+    int down = cs->top == cs->label ? cs->second : cs->top;
+
+    cache_learn_nudge(m->master + cs->label * CACHE_LEARN_ROW, cs->h, shift, 1);
+    cache_learn_nudge(m->master + down * CACHE_LEARN_ROW, cs->h, shift, -1);
+    WRITE_ONCE(m->learned, READ_ONCE(m->learned) + 1);
+}
+
+/* Per-CPU, queued by cache_drain(); whatever the budget leaves is dropped */
+static void cache_learn_fn(struct work_struct *work)
+{
+    struct cache_learn *l = container_of(work, struct cache_learn, work);
+    u64 budget = (u64)READ_ONCE(learn_budget_us) * NSEC_PER_USEC;
+    unsigned int shift = clamp(READ_ONCE(learn_shift), 1U, 24U);
+    unsigned int head = smp_load_acquire(&l->head), tail = l->tail, n = 0;
+    struct cache_model *m;
+    u64 t0 = local_clock();
+
+    rcu_read_lock();
+    m = rcu_dereference(cache_model);
+    if (muscle_wset_is_builtin(&cache_wset, m))
+        m = NULL;
+    for (; m && tail != head && local_clock() - t0 < budget; tail++, n++)
+        cache_learn_apply(m, &l->s[tail % CACHE_LEARN_RING], shift);
+    rcu_read_unlock();
+    smp_store_release(&l->tail, head);
+
+    muscle_stat_add(&cache_stats, MUSCLE_STAT_LEARN, n);
+    muscle_stat_add(&cache_stats, MUSCLE_STAT_LEARN_DROPPED, head - tail);
+    muscle_stat_add(&cache_stats, MUSCLE_STAT_LEARN_NS, local_clock() - t0);
 }
 
-/* Public API — called from block layer */
-int muscle_cache_predict(u64 block)
+/* Requantize the master into the spare head and make it the live one */
+static void cache_publish_fn(struct work_struct *work)
 {
-    unsigned long flags;
-    muscle_fixed input[8];
-    muscle_fixed output[8] = {0};
-    int i, j;
-    int best_block = -1;
-    muscle_fixed best_score = -MUSCLE_FIXED_ONE;
+    muscle_fixed row[CACHE_LSTM_HIDDEN];
+    struct cache_head *spare;
+    struct cache_model *m;
+    unsigned long learned;
+    unsigned int r, i;
+
+    if (READ_ONCE(learn))
+        muscle_wset_fork(&cache_wset);
+
+    rcu_read_lock();
+    m = rcu_dereference(cache_model);
+    if (muscle_wset_is_builtin(&cache_wset, m))
+        m = NULL;
+    learned = m ? READ_ONCE(m->learned) : 0;
+    /* Until the last flip's grace period ends, readers may be in the spare */
+    if (m && learned != m->published && poll_state_synchronize_rcu(m->flip_gp)) {
+        spare = rcu_dereference(m->out) == &m->head[0] ? &m->head[1] : &m->head[0];
+        for (r = 0; r < CACHE_LSTM_OUTPUT; r++) {
+            const s32 *w = m->master + r * CACHE_LEARN_ROW;
+
+            for (i = 0; i < CACHE_LSTM_HIDDEN; i++)
+                row[i] = READ_ONCE(w[i]) >> CACHE_LEARN_FRAC;
+            /* Cannot fail: 8 bits, and CACHE_LEARN_LIMIT keeps the scale in range */
+            muscle_quantize_row(row, CACHE_LSTM_HIDDEN, 8,
+                                (s8 *)spare->w.q + r * CACHE_LSTM_HIDDEN, &spare->w.scale[r]);
+            /* The head owns its bias copy, see muscle_qmat_init() */
+            ((muscle_fixed *)spare->w.bias)[r] = READ_ONCE(w[CACHE_LSTM_HIDDEN]) >>
+                                                  CACHE_LEARN_FRAC;
+        }
+        rcu_assign_pointer(m->out, spare);
+        m->flip_gp = get_state_synchronize_rcu();
+        m->published = learned;
+    }
+    rcu_read_unlock();
+
+    if (READ_ONCE(learn))
+        cache_publish_kick();
+}
 
-    spin_lock_irqsave(&cache_state.lock, flags);
+/* Runs from the ring drain for cpu, never concurrently with itself */
+static void cache_step(const struct cache_model *m, struct muscle_cache_state *s,
+                       struct cache_learn *l, u64 ctx, u64 pos)
+{
+    unsigned int idx = hash_64(ctx, ilog2(CACHE_STREAMS));
+    struct muscle_stream *st = &s->stream[idx];
+    muscle_fixed input[CACHE_LSTM_INPUT];
+    muscle_fixed output[CACHE_LSTM_OUTPUT];
+    u64 t0 = muscle_stat_clock();
+    bool learning = READ_ONCE(learn);
+    int slot;
 
-    /* Shift history */
-    for (i = 0; i < 7; i++)
-        cache_state.last_blocks[i] = cache_state.last_blocks[i+1];
-    cache_state.last_blocks[7] = block;
+    cache_blend_merged(s);
 
-    /* One-hot-ish encode last 8 blocks (mod 1024 for density) */
-    for (i = 0; i < 8; i++)
-        input[i] = muscle_float_to_fixed(1.0f / (1.0f + abs((int)(cache_state.last_blocks[i] & 1023) - 512)));
+    /* Integer delta/stride features of this context's recent positions */
+    muscle_stream_encode(st, ctx, pos, input);
+    /* A fresh stream's pending prediction was for the context it replaced */
+    if (learning)
+        cache_learn_score(&s->pend[idx], l,
+                          input[MUSCLE_STREAM_FRESH] ? 0 : st->delta[0]);
 
-    lstm_step(input);
+    /* One LSTM step on the shared fused gate kernel */
+    cache_cell_step(&m->lstm, input, s->h, s->c);
 
     /* Output layer */
-    for (i = 0; i < CACHE_LSTM_OUTPUT; i++) {
-        muscle_fixed sum = lstm_outb[i];
-        for (j = 0; j < CACHECACHE_LSTM_HIDDEN; j++)
-            sum += lstm_outw[i * CACHE_LSTM_HIDDEN + j] * cache_state.h[j];
-        output[i] = sum;
-        if (output[i] > best_score) {
-            best_score = output[i];
-            best_block = i;
+    cache_head_forward(rcu_dereference(m->out), s->h, output);
+    slot = muscle_stream_argmax(output, CACHE_LSTM_OUTPUT, READ_ONCE(ra_confidence));
+    muscle_stat_time(&cache_stats, MUSCLE_STAT_INFER_NS, t0);
+    muscle_stat_inc(&cache_stats, MUSCLE_STAT_INFER);
+    if (slot < 0)
+        muscle_stat_inc(&cache_stats, MUSCLE_STAT_ABSTAIN);
+
+    WRITE_ONCE(s->pred_ctx, ctx);
+    WRITE_ONCE(s->pred_slot, slot);
+    if (learning)
+        cache_learn_pend(&s->pend[idx], s->h, output);
+}
+
+/* Stride published for ctx on this CPU, or 0 if there is none */
+static s32 cache_pred_stride(u64 ctx)
+{
+    const struct muscle_cache_state *s = raw_cpu_ptr(&cache_state);
+    int slot = READ_ONCE(s->pred_slot);
+
+    if (slot < 0 || READ_ONCE(s->pred_ctx) != ctx)
+        return 0;
+    return muscle_stream_strides[slot];
+}
+
+static void cache_drain(struct muscle_evq *q, int cpu,
+                        const struct muscle_event *ev, unsigned int n)
+{
+    struct muscle_cache_state *s = per_cpu_ptr(&cache_state, cpu);
+    struct cache_learn *l = per_cpu_ptr(&cache_learn, cpu);
+    const struct cache_model *m;
+    unsigned int i;
+
+    /* One model for the whole batch; a concurrent swap lands on the next */
+    rcu_read_lock();
+    m = rcu_dereference(cache_model);
+    for (i = 0; m && i < n; i++)
+        cache_step(m, s, l, ev[i].b, ev[i].a);
+    rcu_read_unlock();
+
+    if (READ_ONCE(l->head) - READ_ONCE(l->tail) >= CACHE_LEARN_BATCH)
+        queue_work_on(cpu, system_wq, &l->work);
+}
+
+/*
+ * Public API — called from block layer.  Only queues block for this
+ * CPU's predictor; the return value comes from the slot it last
+ * published, i.e. the one made from the history before block.
+ * Captured like muscle_cache_readahead(), with context 0.
+ */
+int __muscle_cache_predict(u64 block)
+{
+    struct muscle_event ev = { .a = block };
+    s32 stride = 0;
+
+    if (likely(rcu_access_pointer(cache_model))) {
+        muscle_stat_inc(&cache_stats, MUSCLE_STAT_CALLS);
+        if (muscle_throttled(&cache_throttle))
+            goto out;
+        muscle_evq_push(&cache_evq, &ev);
+        stride = cache_pred_stride(0);
+    }
+out:
+    ev.c = (s64)stride;
+    muscle_trace_event(MUSCLE_TRACE_CACHE, &ev);
+    if (!stride)
+        return -1;
+    return (int)(block + stride);
+}
+
+/*
+ * Track a new range, booking the previous one as wasted unless
+ * cache_ra_hit() saw it used.  Only a page-cache miss gets here, so a
+ * miss is never counted as the range serving a read.
+ */
+static void cache_ra_issue(const struct address_space *mapping, pgoff_t start, pgoff_t end)
+{
+    struct cache_ra_last *st = get_cpu_ptr(&cache_ra_last);
+
+    if (st->mapping && !st->hit) {
+        muscle_stat_inc(&cache_stats, MUSCLE_STAT_MISSES);
+        muscle_stat_add(&cache_stats, MUSCLE_STAT_WASTED_BYTES,
+                        (u64)(st->end - st->start) << PAGE_SHIFT);
+        muscle_stat_add(&cache_stats, MUSCLE_STAT_SAVED_NS,
+                        -(u64)(st->end - st->start) * READ_ONCE(ra_waste_ns));
+    }
+    st->mapping = mapping;
+    st->start = start;
+    st->end = end;
+    st->hit = false;
+    muscle_stat_inc(&cache_stats, MUSCLE_STAT_ISSUED);
+    put_cpu_ptr(&cache_ra_last);
+}
+
+/* A read reached the marker on the first page of this CPU's range */
+static void cache_ra_hit(const struct address_space *mapping, pgoff_t index)
+{
+    struct cache_ra_last *st = get_cpu_ptr(&cache_ra_last);
+
+    if (st->mapping == mapping && index >= st->start && index < st->end &&
+        !st->hit) {
+        st->hit = true;
+        muscle_stat_inc(&cache_stats, MUSCLE_STAT_HITS);
+        muscle_stat_add(&cache_stats, MUSCLE_STAT_SAVED_NS,
+                        (u64)READ_ONCE(ra_hit_us) * NSEC_PER_USEC);
+    }
+    put_cpu_ptr(&cache_ra_last);
+}
+
+/*
+ * Called from page_cache_sync_ra() for a read of ractl's index.  Queues
+ * the access for this CPU's predictor and, if it last published a
+ * confident slot, reads the predicted window ahead on the same mapping.
+ * May sleep; the I/O itself is asynchronous.
+ *
+ * Captured as a = index, b = context, c = predicted stride (0 for none),
+ * d = pages read ahead from index + c, e = window.
+ */
+void __muscle_cache_readahead(struct readahead_control *ractl)
+{
+    struct address_space *mapping = ractl->mapping;
+    pgoff_t index = readahead_index(ractl), start = 0, end = 0, last;
+    unsigned int window = clamp_t(unsigned int, READ_ONCE(ra_window), 1, CACHE_RA_MAX_PAGES);
+    struct inode *host = mapping->host;
+    u64 ctx = ((u64)host->i_sb->s_dev << 32) ^ host->i_ino;
+    struct muscle_event ev = { .a = index, .b = ctx, .e = window };
+    loff_t isize;
+    s32 off;
+
+    if (unlikely(!rcu_access_pointer(cache_model))) {
+        muscle_trace_event(MUSCLE_TRACE_CACHE, &ev);
+        return;
+    }
+
+    muscle_stat_inc(&cache_stats, MUSCLE_STAT_CALLS);
+    if (muscle_throttled(&cache_throttle)) {
+        muscle_trace_event(MUSCLE_TRACE_CACHE, &ev);
+        return;
+    }
+    muscle_evq_push(&cache_evq, &ev);
+
+    off = cache_pred_stride(ctx);
+    isize = i_size_read(host);
+    if (off && (off < 0 || off >= window) && isize > 0) {
+        last = (isize - 1) >> PAGE_SHIFT;
+        if (off > 0 || index >= (pgoff_t)-off) {
+            start = index + off;
+            end = start <= last ? min_t(pgoff_t, start + window, last + 1) : start;
         }
     }
 
-    spin_unlock_irqrestore(&cache_state.lock, flags);
+    trace_muscle_cache_readahead(ctx, index, off, end - start);
+    ev.c = (s64)off;
+    ev.d = end - start;
+    muscle_trace_event(MUSCLE_TRACE_CACHE, &ev);
+    if (end > start) {
+        DEFINE_READAHEAD(rac, ractl->file, ractl->ra, mapping, start);
 
-    /* Prefetch predicted block */
-    if (best_block >= 0) {
-        u64 pred = block + best_block - 3; /* center around current */
-        prefetch_range((void *)(unsigned long)pred << 12, PAGE_SIZE * 8);
-        pr_debug("MuscleCache: predicted next block %llu (score %.2f)\n",
-                 pred, muscle_fixed_to_float(best_score));
-        return (int)(pred);
+        /* A lookahead of the whole range puts PG_readahead on its first page */
+        cache_ra_issue(mapping, start, end);
+        page_cache_ra_unbounded(&rac, end - start, end - start);
     }
+}
 
-    return -1;
+/*
+ * Called from page_cache_async_ra() when a read reaches a PG_readahead
+ * folio at ractl's index: if it is the marker on this CPU's range, the
+ * range served a read without a miss.  The range is per CPU, so a reader
+ * that migrated in between goes unscored.
+ */
+void __muscle_cache_ra_marker(struct readahead_control *ractl)
+{
+    if (likely(rcu_access_pointer(cache_model)))
+        cache_ra_hit(ractl->mapping, readahead_index(ractl));
 }
 
+/* Kept for existing scripts; debugfs muscle/cache/ has the full set */
+static int cache_ra_stats_get(char *buf, const struct kernel_param *kp)
+{
+    return sysfs_emit(buf, "issued %llu hits %llu misses %llu low_conf %llu\n",
+                      muscle_stat_read(&cache_stats, MUSCLE_STAT_ISSUED),
+                      muscle_stat_read(&cache_stats, MUSCLE_STAT_HITS),
+                      muscle_stat_read(&cache_stats, MUSCLE_STAT_MISSES),
+                      muscle_stat_read(&cache_stats, MUSCLE_STAT_ABSTAIN));
+}
+
+static const struct kernel_param_ops cache_ra_stats_ops = {
+    .get = cache_ra_stats_get,
+};
+module_param_cb(ra_stats, &cache_ra_stats_ops, NULL, 0444);
+MODULE_PARM_DESC(ra_stats, "Readahead ranges issued, hit, missed, skipped");
+
+static void cache_release(void *model)
+{
+    struct cache_model *m = model;
+
+    kfree(m->master);
+    cache_head_free(&m->head[1]);
+    cache_head_free(&m->head[0]);
+    cache_cell_free(&m->lstm);
+    kfree(m);
+}
+
+static void *cache_build(const muscle_fixed *const *t)
+{
+    struct cache_model *m;
+    int i, r, ret;
+
+    m = kzalloc(sizeof(*m), GFP_KERNEL);
+    if (!m)
+        return ERR_PTR(-ENOMEM);
+    /* Forget bias +1 */
+    ret = cache_cell_init(&m->lstm, &t[CACHE_WI], &t[CACHE_RI], &t[CACHE_BI],
+                          MUSCLE_FIXED_ONE);
+    if (ret)
+        goto err;
+    for (i = 0; i < ARRAY_SIZE(m->head); i++) {
+        ret = cache_head_init(&m->head[i], t[CACHE_OUTW], t[CACHE_OUTB]);
+        if (ret)
+            goto err;
+    }
+    RCU_INIT_POINTER(m->out, &m->head[0]);
+    m->flip_gp = get_state_synchronize_rcu();
+
+    /* Learning starts from the loaded head, in case learn is set later */
+    m->master = kmalloc_array(CACHE_LSTM_OUTPUT * CACHE_LEARN_ROW, sizeof(s32), GFP_KERNEL);
+    if (!m->master) {
+        ret = -ENOMEM;
+        goto err;
+    }
+    for (r = 0; r < CACHE_LSTM_OUTPUT; r++) {
+        s32 *row = m->master + r * CACHE_LEARN_ROW;
+
+        for (i = 0; i < CACHE_LSTM_HIDDEN; i++)
+            row[i] = clamp(t[CACHE_OUTW][r * CACHE_LSTM_HIDDEN + i],
+                           -16 * MUSCLE_FIXED_ONE, 16 * MUSCLE_FIXED_ONE) << CACHE_LEARN_FRAC;
+        row[CACHE_LSTM_HIDDEN] = clamp(t[CACHE_OUTB][r], -16 * MUSCLE_FIXED_ONE,
+                       16 * MUSCLE_FIXED_ONE) << CACHE_LEARN_FRAC;
+    }
+    return m;
+
+err:
+    cache_release(m);
+    return ERR_PTR(ret);
+}
+
+static struct muscle_wset cache_wset = {
+    .name      = "cache",
+    .tables    = cache_tables,
+    .nr_tables = CACHE_TABLES,
+    .build     = cache_build,
+    .release   = cache_release,
+    .model     = (void __rcu **)&cache_model,
+};
+
 static int __init muscle_cache_init(void)
 {
-    spin_lock_init(&cache_state.lock);
-    memset(&cache_state, 0, sizeof(cache_state));
-    pr_info("MuscleCache: LSTM prefetch predictor initialized (64 hidden)\n");
+    int ret, cpu;
+
+    muscle_switch_ready(&muscle_cache_key_switch);
+    for_each_possible_cpu(cpu) {
+        struct muscle_cache_state *s = per_cpu_ptr(&cache_state, cpu);
+        int i;
+
+        s->pred_slot = -1;
+        for (i = 0; i < CACHE_STREAMS; i++)
+            s->pend[i].top = -1;
+        INIT_WORK(&per_cpu_ptr(&cache_learn, cpu)->work, cache_learn_fn);
+    }
+
+    ret = muscle_evq_init(&cache_evq, "cache", cache_drain);
+    if (ret) {
+        pr_err("MuscleCache: failed to set up event rings (%d)\n", ret);
+        return ret;
+    }
+    ret = muscle_wset_register(&cache_wset);
+    if (ret) {
+        pr_err("MuscleCache: failed to build weights (%d)\n", ret);
+        return ret;
+    }
+
+    muscle_stats_register(&cache_stats, &cache_evq);
+    muscle_throttle_register(&cache_throttle);
+    WRITE_ONCE(learn_ready, true);
+    if (learn)
+        cache_learn_start();
+    seqcount_init(&cache_merged.seq);
+    if (merge_interval_ms)
+        schedule_delayed_work(&cache_merge_work, msecs_to_jiffies(merge_interval_ms));
+    WRITE_ONCE(merge_ready, true);
+    pr_info("MuscleCache: LSTM readahead predictor initialized (64 hidden, per-CPU state, %s)\n",
+            muscle_lstm_impl_name());
     return 0;
 }
 
@@ -0,0 +1,656 @@
+/*
+ * muscle-bench: run the muscles' forward passes and hooks in userspace.
+ *
+ *   muscle-bench [-t 1,2,4] [-n iters] [-r reps] [-c pattern[,pattern]]
+ *                [--lstm-impl name] [--blob muscle=file]
+ *                [--block-trace file] [--syscall-trace file] [--pages file]
+ *                [--capture file]... [--trace mask [--trace-dir dir]]
+ *                [--stats] [--csv] [--baseline file [--tolerance pct]] [-l] [-v]
+ *
+ * The kernel sources are built unmodified against shim/, with every
+ * thread playing one CPU.  For each case and thread count, every thread
+ * runs the case n times per repetition between two barriers.  ns/op is
+ * thread CPU time per operation, averaged over the threads, so time-slicing
+ * on a small host does not inflate it; Mops/s is all operations over the
+ * wall time from the first thread starting to the last one finishing.  cycles/op and misses/op come from user-only
+ * perf counters and print "-" where the PMU is not available.  Each figure
+ * is the median of the repetitions.
+ *
+ * With --baseline, ns/op is compared with an earlier --csv run and the
+ * exit status is 3 if any case got slower by more than the tolerance.
+ * With --trace, the hooks capture as they would with that trace_mask,
+ * which prices capture; --trace-dir also keeps what they wrote.
+ * --stats turns stats_timing on, which prices it too, and prints the
+ * debugfs muscle/ files to stderr at the end.
+ */
+#include <fnmatch.h>
+#include <getopt.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define BENCH_MAX_THREADS   NR_CPUS
+#define BENCH_MAX_REPS      64
+#define BENCH_MAX_BLOBS     16
+#define BENCH_MAX_RESULTS   256
+#define BENCH_PAGES_MAX     16384
+
+static struct {
+    unsigned int threads[BENCH_MAX_THREADS];
+    unsigned int nr_threads;
+    unsigned long iters;
+    unsigned int reps;
+    const char *filter;
+    bool csv;
+    const char *baseline;
+    double tolerance;
+} opt = {
+    .iters     = 20000,
+    .reps      = 5,
+    .tolerance = 10.0,
+};
+
+struct bench_sample {
+    double ns;                  /* CPU ns per op, mean over threads */
+    double cycles, misses;      /* per op, NAN without counters */
+    double mops;
+};
+
+struct bench_result {
+    char name[64];
+    unsigned int threads;
+    struct bench_sample s;
+};
+
+static struct bench_result bench_results[BENCH_MAX_RESULTS];
+static unsigned int bench_nr_results;
+
+/* Per-thread slots of one run */
+struct bench_run {
+    const struct bench_case *c;
+    unsigned int nr_threads;
+    pthread_barrier_t barrier;
+    int err;
+    struct {
+        double cpu_ns, start, end, cycles, misses;
+    } rep[BENCH_MAX_THREADS][BENCH_MAX_REPS];
+};
+
+/* User-only cycles and cache-miss counters for the calling thread */
+struct bench_pmu {
+    int fd[2];
+};
+
+static int bench_perf_open(u64 config, int group)
+{
+    struct perf_event_attr attr = {
+        .type           = PERF_TYPE_HARDWARE,
+        .size           = sizeof(attr),
+        .config         = config,
+        .disabled       = group < 0,
+        .exclude_kernel = 1,
+        .exclude_hv     = 1,
+    };
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void bench_pmu_open(struct bench_pmu *pmu)
+{
+    pmu->fd[0] = bench_perf_open(PERF_COUNT_HW_CPU_CYCLES, -1);
+    pmu->fd[1] = pmu->fd[0] < 0 ? -1 :
+                 bench_perf_open(PERF_COUNT_HW_CACHE_MISSES, pmu->fd[0]);
+}
+
+static void bench_pmu_close(struct bench_pmu *pmu)
+{
+    if (pmu->fd[1] >= 0)
+        close(pmu->fd[1]);
+    if (pmu->fd[0] >= 0)
+        close(pmu->fd[0]);
+}
+
+static void bench_pmu_start(struct bench_pmu *pmu)
+{
+    if (pmu->fd[0] < 0)
+        return;
+    ioctl(pmu->fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(pmu->fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static double bench_pmu_read(int fd)
+{
+    u64 v;
+
+    return fd >= 0 && read(fd, &v, sizeof(v)) == sizeof(v) ? (double)v : NAN;
+}
+
+static void bench_pmu_stop(struct bench_pmu *pmu, double *cycles, double *misses)
+{
+    if (pmu->fd[0] >= 0)
+        ioctl(pmu->fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    *cycles = bench_pmu_read(pmu->fd[0]);
+    *misses = bench_pmu_read(pmu->fd[1]);
+}
+
+static double bench_clock(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+struct bench_arg {
+    struct bench_run *run;
+    struct bench_thread t;
+};
+
+static void *bench_thread_fn(void *p)
+{
+    struct bench_arg *arg = p;
+    struct bench_run *run = arg->run;
+    struct bench_thread *t = &arg->t;
+    const struct bench_case *c = run->c;
+    struct bench_pmu pmu;
+    unsigned int r;
+    double c0;
+    int err = 0;
+
+    shim_cpu = t->cpu;
+    shim_current()->cpu = t->cpu;
+    if (c->setup)
+        err = c->setup(t);
+    if (err)
+        __atomic_store_n(&run->err, err, __ATOMIC_RELAXED);
+    bench_pmu_open(&pmu);
+
+    pthread_barrier_wait(&run->barrier);
+    if (!__atomic_load_n(&run->err, __ATOMIC_RELAXED)) {
+        /* Warm the caches, the branch predictors and the rings */
+        c->run(t, opt.iters / 10 + 1);
+
+        for (r = 0; r < opt.reps; r++) {
+            typeof(run->rep[0][0]) *s = &run->rep[t->cpu][r];
+
+            pthread_barrier_wait(&run->barrier);
+            bench_pmu_start(&pmu);
+            s->start = bench_clock(CLOCK_MONOTONIC);
+            c0 = bench_clock(CLOCK_THREAD_CPUTIME_ID);
+            c->run(t, opt.iters);
+            s->cpu_ns = bench_clock(CLOCK_THREAD_CPUTIME_ID) - c0;
+            s->end = bench_clock(CLOCK_MONOTONIC);
+            bench_pmu_stop(&pmu, &s->cycles, &s->misses);
+        }
+    }
+
+    bench_pmu_close(&pmu);
+    pthread_barrier_wait(&run->barrier);
+    if (c->teardown)
+        c->teardown(t);
+    return NULL;
+}
+
+static int bench_cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return isnan(x) ? !isnan(y) : isnan(y) ? -1 : (x > y) - (x < y);
+}
+
+static double bench_median(double *v, unsigned int n)
+{
+    qsort(v, n, sizeof(*v), bench_cmp_double);
+    if (isnan(v[0]))
+        return NAN;
+    while (n && isnan(v[n - 1]))
+        n--;
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static int bench_run_case(const struct bench_case *c, unsigned int nr_threads,
+                          struct bench_sample *out)
+{
+    static struct bench_run run;
+    struct bench_arg arg[BENCH_MAX_THREADS];
+    pthread_t tid[BENCH_MAX_THREADS];
+    double ns[BENCH_MAX_REPS], cyc[BENCH_MAX_REPS], miss[BENCH_MAX_REPS];
+    double mops[BENCH_MAX_REPS];
+    unsigned int i, r;
+
+    memset(&run, 0, sizeof(run));
+    run.c = c;
+    run.nr_threads = nr_threads;
+    pthread_barrier_init(&run.barrier, NULL, nr_threads);
+
+    for (i = 0; i < nr_threads; i++) {
+        arg[i].run = &run;
+        arg[i].t = (struct bench_thread) {
+            .cpu        = i,
+            .nr_threads = nr_threads,
+            /* Threads start spread over the inputs, not in lockstep */
+            .blk_pos    = bench_in.nr_blk * i / nr_threads,
+            .sys_pos    = bench_in.nr_sys * i / nr_threads,
+            .page_pos   = bench_in.nr_pages * i / nr_threads,
+            .seed       = 0x9e3779b97f4a7c15ULL * (i + 1),
+        };
+        pthread_create(&tid[i], NULL, bench_thread_fn, &arg[i]);
+    }
+    for (i = 0; i < nr_threads; i++)
+        pthread_join(tid[i], NULL);
+    pthread_barrier_destroy(&run.barrier);
+    if (run.err)
+        return run.err;
+
+    for (r = 0; r < opt.reps; r++) {
+        double cpu = 0, start = INFINITY, end = 0, wall, cycles = 0, misses = 0;
+
+        /* From the first thread leaving the barrier to the last one done */
+        for (i = 0; i < nr_threads; i++) {
+            cpu += run.rep[i][r].cpu_ns;
+            start = min(start, run.rep[i][r].start);
+            end = max(end, run.rep[i][r].end);
+            cycles += run.rep[i][r].cycles;
+            misses += run.rep[i][r].misses;
+        }
+        wall = end - start;
+        ns[r] = cpu / nr_threads / opt.iters;
+        cyc[r] = cycles / nr_threads / opt.iters;
+        miss[r] = misses / nr_threads / opt.iters;
+        mops[r] = wall > 0 ? nr_threads * opt.iters * 1e3 / wall : 0;
+    }
+    out->ns = bench_median(ns, opt.reps);
+    out->cycles = bench_median(cyc, opt.reps);
+    out->misses = bench_median(miss, opt.reps);
+    out->mops = bench_median(mops, opt.reps);
+    return 0;
+}
+
+static bool bench_selected(const char *name)
+{
+    char pat[256], *p, *tok;
+
+    if (!opt.filter)
+        return true;
+    snprintf(pat, sizeof(pat), "%s", opt.filter);
+    for (p = pat; (tok = strsep(&p, ","));) {
+        if (!fnmatch(tok, name, 0))
+            return true;
+        /* A bare muscle name selects all of its cases */
+        if (!strchr(tok, '.') && !strncmp(name, tok, strlen(tok)) &&
+            name[strlen(tok)] == '.')
+            return true;
+    }
+    return false;
+}
+
+static void bench_print_num(double v, const char *fmt, int width)
+{
+    if (isnan(v))
+        printf(opt.csv ? "" : "%*s", width, "-");
+    else
+        printf(fmt, width, v);
+}
+
+static void bench_print(const char *name, unsigned int threads,
+                        const struct bench_sample *s)
+{
+    if (opt.csv) {
+        printf("%s,%u,", name, threads);
+        bench_print_num(s->ns, "%.*f", 2);
+        putchar(',');
+        bench_print_num(s->cycles, "%.*f", 1);
+        putchar(',');
+        bench_print_num(s->misses, "%.*f", 3);
+        printf(",%.3f\n", s->mops);
+    } else {
+        printf("%-24s %3u ", name, threads);
+        bench_print_num(s->ns, " %*.1f", 10);
+        bench_print_num(s->cycles, " %*.0f", 10);
+        bench_print_num(s->misses, " %*.2f", 9);
+        printf(" %9.3f\n", s->mops);
+    }
+    fflush(stdout);
+}
+
+/* Compare against an earlier --csv run; returns the number of regressions */
+static int bench_check_baseline(const char *path)
+{
+    char line[256], name[64];
+    unsigned int threads, i;
+    int bad = 0;
+    double ns;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "muscle-bench: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%63[^,],%u,%lf", name, &threads, &ns) != 3)
+            continue;
+        for (i = 0; i < bench_nr_results; i++) {
+            const struct bench_result *r = &bench_results[i];
+
+            if (strcmp(r->name, name) || r->threads != threads || isnan(r->s.ns))
+                continue;
+            if (r->s.ns > ns * (1 + opt.tolerance / 100)) {
+                fprintf(stderr, "muscle-bench: %s/%u regressed: %.1f ns/op, baseline %.1f (+%.0f%%)\n",
+                        name, threads, r->s.ns, ns, (r->s.ns / ns - 1) * 100);
+                bad++;
+            }
+        }
+    }
+    fclose(f);
+    return bad;
+}
+
+static int bench_parse_threads(const char *s)
+{
+    char buf[256], *p, *tok;
+    unsigned long v;
+    char *end;
+
+    snprintf(buf, sizeof(buf), "%s", s);
+    opt.nr_threads = 0;
+    for (p = buf; (tok = strsep(&p, ","));) {
+        v = strtoul(tok, &end, 10);
+        if (*end || !v || v > BENCH_MAX_THREADS || opt.nr_threads == BENCH_MAX_THREADS)
+            return -EINVAL;
+        opt.threads[opt.nr_threads++] = v;
+    }
+    return opt.nr_threads ? 0 : -EINVAL;
+}
+
+static void bench_list(void)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < bench_nr_muscles; i++) {
+        const struct bench_muscle *m = bench_muscles[i];
+
+        for (j = 0; j < m->nr_cases; j++) {
+            char name[64];
+
+            snprintf(name, sizeof(name), "%s.%s", m->name, m->cases[j].name);
+            printf("%-24s %s\n", name, m->cases[j].desc);
+        }
+    }
+}
+
+static void bench_usage(FILE *f)
+{
+    fprintf(f,
+        "usage: muscle-bench [options]\n"
+        "  -t, --threads LIST       thread counts to run, e.g. 1,2,4 (default 1 and all CPUs)\n"
+        "  -n, --iters N            operations per thread per repetition (default %lu)\n"
+        "  -r, --reps N             repetitions, the median is reported (default %u)\n"
+        "  -c, --case PATTERNS      comma-separated globs over muscle.case\n"
+        "  -l, --list               list the cases\n"
+        "      --lstm-impl NAME     LSTM gate kernel (available: %s)\n"
+        "      --blob MUSCLE=FILE   load a weight blob (tools/muscle/mkblob.py)\n"
+        "      --block-trace FILE   replay blkparse queue events\n"
+        "      --syscall-trace FILE replay \"pid nr arg1 arg2 [uid]\" lines\n"
+        "      --pages FILE         compress FILE's pages instead of synthetic ones\n"
+        "      --capture FILE       take block requests and syscalls from a capture,\n"
+        "                           one file per CPU (tools/muscle/capture.sh)\n"
+        "      --trace MASK         run with hook capture on, as trace_mask\n"
+        "      --trace-dir DIR      write the captured records to DIR/cpuN\n"
+        "      --stats              time passes (stats_timing=1) and print the\n"
+        "                           debugfs counters to stderr at the end\n"
+        "      --csv                machine-readable output\n"
+        "      --baseline FILE      fail if ns/op regressed against a --csv run\n"
+        "      --tolerance PCT      allowed regression (default %.0f)\n"
+        "  -v, --verbose            show kernel log output (twice for more)\n",
+        opt.iters, opt.reps, bench_lstm_impls(), opt.tolerance);
+}
+
+enum {
+    OPT_LSTM = 256,
+    OPT_BLOB,
+    OPT_BLOCK,
+    OPT_SYSCALL,
+    OPT_PAGES,
+    OPT_CAPTURE,
+    OPT_TRACE,
+    OPT_TRACE_DIR,
+    OPT_STATS,
+    OPT_CSV,
+    OPT_BASELINE,
+    OPT_TOLERANCE,
+};
+
+static const struct option bench_options[] = {
+    { "threads",       required_argument, NULL, 't' },
+    { "iters",         required_argument, NULL, 'n' },
+    { "reps",          required_argument, NULL, 'r' },
+    { "case",          required_argument, NULL, 'c' },
+    { "list",          no_argument,       NULL, 'l' },
+    { "verbose",       no_argument,       NULL, 'v' },
+    { "help",          no_argument,       NULL, 'h' },
+    { "lstm-impl",     required_argument, NULL, OPT_LSTM },
+    { "blob",          required_argument, NULL, OPT_BLOB },
+    { "block-trace",   required_argument, NULL, OPT_BLOCK },
+    { "syscall-trace", required_argument, NULL, OPT_SYSCALL },
+    { "pages",         required_argument, NULL, OPT_PAGES },
+    { "capture",       required_argument, NULL, OPT_CAPTURE },
+    { "trace",         required_argument, NULL, OPT_TRACE },
+    { "trace-dir",     required_argument, NULL, OPT_TRACE_DIR },
+    { "stats",         no_argument,       NULL, OPT_STATS },
+    { "csv",           no_argument,       NULL, OPT_CSV },
+    { "baseline",      required_argument, NULL, OPT_BASELINE },
+    { "tolerance",     required_argument, NULL, OPT_TOLERANCE },
+    { }
+};
+
+static void bench_die(const char *what, const char *arg, int err)
+{
+    fprintf(stderr, "muscle-bench: %s %s: %s\n", what, arg, strerror(-err));
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    const char *blobs[BENCH_MAX_BLOBS], *lstm_impl = NULL, *bad = NULL;
+    char *captures[NR_CPUS];
+    unsigned int nr_blobs = 0, nr_captures = 0, trace = 0, i, j, k, max_threads = 0;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    bool list = false, stats = false;
+    int ch, ret;
+
+    while ((ch = getopt_long(argc, argv, "t:n:r:c:lvh", bench_options, NULL)) != -1) {
+        switch (ch) {
+        case 't':
+            if (bench_parse_threads(optarg))
+                bench_die("bad thread list", optarg, -EINVAL);
+            break;
+        case 'n':
+            opt.iters = strtoul(optarg, NULL, 0);
+            if (!opt.iters)
+                bench_die("bad iteration count", optarg, -EINVAL);
+            break;
+        case 'r':
+            opt.reps = strtoul(optarg, NULL, 0);
+            if (!opt.reps || opt.reps > BENCH_MAX_REPS)
+                bench_die("bad repetition count", optarg, -EINVAL);
+            break;
+        case 'c':
+            opt.filter = optarg;
+            break;
+        case 'l':
+            list = true;
+            break;
+        case 'v':
+            shim_verbose++;
+            break;
+        case 'h':
+            bench_usage(stdout);
+            return 0;
+        case OPT_LSTM:
+            lstm_impl = optarg;
+            break;
+        case OPT_BLOB:
+            if (nr_blobs == BENCH_MAX_BLOBS || !strchr(optarg, '='))
+                bench_die("bad blob", optarg, -EINVAL);
+            blobs[nr_blobs++] = optarg;
+            break;
+        case OPT_BLOCK:
+            ret = bench_input_block(optarg);
+            if (ret)
+                bench_die("block trace", optarg, ret);
+            break;
+        case OPT_SYSCALL:
+            ret = bench_input_syscall(optarg);
+            if (ret)
+                bench_die("syscall trace", optarg, ret);
+            break;
+        case OPT_PAGES:
+            ret = bench_input_pages(optarg, BENCH_PAGES_MAX);
+            if (ret)
+                bench_die("pages", optarg, ret);
+            break;
+        case OPT_CAPTURE:
+            if (nr_captures == NR_CPUS)
+                bench_die("too many capture files at", optarg, -E2BIG);
+            captures[nr_captures++] = optarg;
+            break;
+        case OPT_TRACE:
+            trace = strtoul(optarg, NULL, 0);
+            if (!trace || trace >= BIT(MUSCLE_TRACE_TYPES))
+                bench_die("bad trace mask", optarg, -EINVAL);
+            break;
+        case OPT_TRACE_DIR:
+            shim_relay_dir = optarg;
+            break;
+        case OPT_STATS:
+            stats = true;
+            break;
+        case OPT_CSV:
+            opt.csv = true;
+            break;
+        case OPT_BASELINE:
+            opt.baseline = optarg;
+            break;
+        case OPT_TOLERANCE:
+            opt.tolerance = strtod(optarg, NULL);
+            break;
+        default:
+            bench_usage(stderr);
+            return 2;
+        }
+    }
+    if (list) {
+        bench_list();
+        return 0;
+    }
+    if (!opt.nr_threads) {
+        opt.threads[opt.nr_threads++] = 1;
+        if (ncpus > 1)
+            opt.threads[opt.nr_threads++] = min_t(long, ncpus, BENCH_MAX_THREADS);
+    }
+    for (i = 0; i < opt.nr_threads; i++)
+        max_threads = max(max_threads, opt.threads[i]);
+
+    if (nr_captures) {
+        ret = bench_input_capture(captures, nr_captures);
+        if (ret)
+            bench_die("capture", captures[0], ret);
+    }
+
+    /* Boot: one CPU per thread, then the initcalls in kernel order */
+    nr_cpu_ids = max_threads;
+    bench_input_synthetic(1);
+    bench_sine_fill(2);
+    ret = shim_run_initcalls();
+    if (ret)
+        fprintf(stderr, "muscle-bench: some initcalls failed (%d), continuing\n", ret);
+
+    if (lstm_impl) {
+        ret = bench_lstm_select(lstm_impl);
+        if (ret)
+            bench_die("LSTM implementation", lstm_impl, ret);
+    }
+    ret = bench_lstm_check(4, &bad);
+    if (ret == -EILSEQ) {
+        fprintf(stderr, "muscle-bench: LSTM gate kernel %s disagrees with generic\n", bad);
+        exit(1);
+    }
+    if (ret)
+        bench_die("checking", "LSTM gate kernels", ret);
+    for (i = 0; i < nr_blobs; i++) {
+        ret = bench_load_blob(blobs[i]);
+        if (ret)
+            bench_die("loading", blobs[i], ret);
+    }
+    for (i = 0; i < bench_nr_muscles; i++) {
+        const struct bench_muscle *m = bench_muscles[i];
+
+        ret = m->wset ? bench_wset_random(m->wset, 3 + i) : 0;
+        if (!ret && m->init)
+            ret = m->init();
+        if (ret)
+            bench_die("setting up", m->name, ret);
+    }
+    if (trace) {
+        ret = bench_trace_set(trace);
+        if (ret)
+            bench_die("starting capture in", shim_relay_dir ?: "memory", ret);
+    }
+    if (stats)
+        bench_stats_timing(true);
+
+    if (!opt.csv) {
+        printf("# lstm %s, %zu block requests on %u devices, %zu syscalls, %zu pages\n",
+               muscle_lstm_impl_name(), bench_in.nr_blk, bench_in.nr_dev,
+               bench_in.nr_sys, bench_in.nr_pages);
+        printf("%-24s %3s %10s %10s %9s %9s\n", "case", "thr", "ns/op", "cycles/op",
+               "miss/op", "Mops/s");
+    } else {
+        printf("case,threads,ns_op,cycles_op,misses_op,mops\n");
+    }
+
+    for (i = 0; i < bench_nr_muscles; i++) {
+        const struct bench_muscle *m = bench_muscles[i];
+
+        for (j = 0; j < m->nr_cases; j++) {
+            const struct bench_case *c = &m->cases[j];
+            char name[64];
+
+            snprintf(name, sizeof(name), "%s.%s", m->name, c->name);
+            if (!bench_selected(name))
+                continue;
+            for (k = 0; k < opt.nr_threads; k++) {
+                struct bench_result *r = &bench_results[bench_nr_results];
+
+                ret = bench_run_case(c, opt.threads[k], &r->s);
+                if (ret) {
+                    fprintf(stderr, "muscle-bench: %s: setup failed (%d)\n", name, ret);
+                    continue;
+                }
+                bench_print(name, opt.threads[k], &r->s);
+                if (bench_nr_results < BENCH_MAX_RESULTS - 1) {
+                    snprintf(r->name, sizeof(r->name), "%s", name);
+                    r->threads = opt.threads[k];
+                    bench_nr_results++;
+                }
+            }
+        }
+    }
+
+    if (trace)
+        bench_trace_set(0);
+    if (stats)
+        shim_debugfs_dump(stderr);
+    if (shim_verbose)
+        fprintf(stderr, "# kills %ld, readahead pages %ld\n",
+                atomic_long_read(&shim_kills), atomic_long_read(&shim_ra_pages));
+    if (opt.baseline && bench_check_baseline(opt.baseline))
+        return 3;
+    return 0;
+}
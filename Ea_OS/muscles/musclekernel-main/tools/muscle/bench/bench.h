@@ -0,0 +1,169 @@
+#ifndef _MUSCLE_BENCH_H
+#define _MUSCLE_BENCH_H
+
+#include <linux/muscle.h>
+
+/*
+ * Benchmark inputs, shared read-only by every thread.  Block requests are
+ * replayed from blkparse output, syscalls from a bpftrace log, pages from
+ * a memory dump (see bench_input.c); anything not given is synthesised.
+ */
+struct bench_blk {
+    u32 dev;                    /* dense device index, < bench_in.nr_dev */
+    blk_opf_t opf;              /* REQ_OP_* | REQ_FUA / REQ_PREFLUSH */
+    u64 sector;
+    u32 sectors;
+};
+
+struct bench_sys {
+    u32 pid;
+    u32 uid;
+    u64 nr;
+    u64 arg1, arg2;
+};
+
+struct bench_input {
+    struct bench_blk *blk;
+    size_t nr_blk;
+    unsigned int nr_dev;
+    struct bench_sys *sys;
+    size_t nr_sys;
+    struct page *pages;
+    size_t nr_pages;
+};
+
+extern struct bench_input bench_in;
+
+#define BENCH_MAX_DEVS  64
+
+int bench_input_block(const char *path);
+int bench_input_syscall(const char *path);
+int bench_input_pages(const char *path, size_t max_pages);
+int bench_input_capture(char *const *paths, unsigned int n);
+void bench_input_synthetic(u64 seed);
+
+/*
+ * Captured hook records (lib/muscle/muscle_trace.c).  One file per CPU,
+ * each a run of sub-buffers that start with a MUSCLE_TRACE_HDR record;
+ * bench_capture_next() merges the files by timestamp and skips headers.
+ */
+struct bench_capture {
+    FILE *f[NR_CPUS];
+    struct muscle_trace_rec cur[NR_CPUS];   /* each file's next record */
+    struct muscle_trace_rec rec;            /* the one last returned */
+    u64 dropped[NR_CPUS];       /* per file, from its last header */
+    unsigned int nr;
+    u64 records, first_ts, last_ts;
+    int err;                    /* set if a file is not a capture */
+};
+
+int bench_capture_open(struct bench_capture *c, char *const *paths, unsigned int n);
+const struct muscle_trace_rec *bench_capture_next(struct bench_capture *c);
+u64 bench_capture_dropped(const struct bench_capture *c);
+void bench_capture_close(struct bench_capture *c);
+
+/* One harness thread; it runs as CPU cpu for the whole case */
+struct bench_thread {
+    int cpu;
+    unsigned int nr_threads;
+    size_t blk_pos, sys_pos, page_pos;
+    u64 seed;
+    void *priv;                 /* the case's per-thread state */
+};
+
+/*
+ * A case times run(), which must do exactly n operations (inferences,
+ * hook calls, pages).  setup() and teardown() are per thread and untimed.
+ */
+struct bench_case {
+    const char *name;
+    const char *desc;
+    int (*setup)(struct bench_thread *t);
+    void (*teardown)(struct bench_thread *t);
+    void (*run)(struct bench_thread *t, unsigned long n);
+};
+
+/*
+ * replay() scores one captured record of type trace, in capture order
+ * and running as the CPU it was captured on; report() prints the totals.
+ * Both are optional.
+ */
+struct bench_muscle {
+    const char *name;
+    struct muscle_wset *wset;   /* NULL if the weights are fixed at build */
+    int (*init)(void);          /* once, after the initcalls and inputs */
+    const struct bench_case *cases;
+    unsigned int nr_cases;
+    enum muscle_trace_type trace;
+    void (*replay)(const struct muscle_trace_rec *rec);
+    void (*report)(void);
+    void (*learn)(void);        /* turn online learning on, for --learn */
+};
+
+extern const struct bench_muscle bench_cache, bench_io, bench_security,
+                                 bench_sched, bench_sine, bench_zmuscle;
+extern const struct bench_muscle *const bench_muscles[];
+extern const unsigned int bench_nr_muscles;
+
+/* bench_lib.c */
+u64 bench_rand(u64 *state);
+int bench_lstm_select(const char *name);
+const char *bench_lstm_impls(void);
+int bench_lstm_check(u64 seed, const char **impl);
+int bench_wset_random(struct muscle_wset *ws, u64 seed);
+int bench_wset_load(struct muscle_wset *ws, const char *path);
+int bench_load_blob(const char *spec);
+void bench_sine_fill(u64 seed);
+int bench_trace_set(unsigned int mask);
+void bench_stats_timing(bool on);
+
+/* Percentage, 0 for an empty denominator */
+static inline double bench_pct(unsigned long n, unsigned long d)
+{
+    return d ? 100.0 * n / d : 0;
+}
+
+static inline const struct bench_blk *bench_next_blk(struct bench_thread *t)
+{
+    const struct bench_blk *b = &bench_in.blk[t->blk_pos];
+
+    if (++t->blk_pos == bench_in.nr_blk)
+        t->blk_pos = 0;
+    return b;
+}
+
+static inline const struct bench_sys *bench_next_sys(struct bench_thread *t)
+{
+    const struct bench_sys *s = &bench_in.sys[t->sys_pos];
+
+    if (++t->sys_pos == bench_in.nr_sys)
+        t->sys_pos = 0;
+    return s;
+}
+
+static inline struct page *bench_next_page(struct bench_thread *t)
+{
+    struct page *p = &bench_in.pages[t->page_pos];
+
+    if (++t->page_pos == bench_in.nr_pages)
+        t->page_pos = 0;
+    return p;
+}
+
+/*
+ * Hook cases play their CPU's workqueue too.  A ring kicks its drain
+ * once MUSCLE_RING_BATCH events are queued, so polling at that rate keeps
+ * the rings from overflowing; what is left runs at the end of run().
+ */
+static inline void bench_poll_work(struct bench_thread *t, unsigned long i)
+{
+    if (!((i + 1) & (MUSCLE_RING_BATCH - 1)))
+        shim_run_work(t->cpu, false);
+}
+
+static inline void bench_flush_work(struct bench_thread *t)
+{
+    shim_run_work(t->cpu, true);
+}
+
+#endif /* _MUSCLE_BENCH_H */
@@ -0,0 +1,288 @@
+/*
+ * MuscleCache: the LSTM step alone, and the readahead hook end to end
+ * (event push, this CPU's ring drain, the readahead decision).
+ *
+ * Replay steps the loaded model on each captured access as the drain
+ * would, but without the ring's lag, and scores the window it would have
+ * read ahead against the context's next access; the live decisions in
+ * the capture are scored the same way.  With --learn the replayed model
+ * also trains as it goes, the learner running inline once a batch is
+ * queued and the head flipping every learn_publish_ms of capture time.
+ */
+#include "../../../mm/muscle_cache.c"
+
+#include "bench.h"
+
+/* One file per replayed device, large enough that no window is clipped */
+struct cache_bench_dev {
+    struct super_block sb;
+    struct inode inode;
+    struct address_space mapping;
+};
+
+static struct cache_bench_dev *cache_bench_devs;
+
+static int cache_bench_init(void)
+{
+    unsigned int i;
+
+    cache_bench_devs = kcalloc(BENCH_MAX_DEVS, sizeof(*cache_bench_devs), GFP_KERNEL);
+    if (!cache_bench_devs)
+        return -ENOMEM;
+    for (i = 0; i < BENCH_MAX_DEVS; i++) {
+        struct cache_bench_dev *d = &cache_bench_devs[i];
+
+        d->sb.s_dev = i + 1;
+        d->inode.i_sb = &d->sb;
+        d->inode.i_ino = 2;
+        d->inode.i_size = 1LL << 50;
+        d->mapping.host = &d->inode;
+    }
+    return 0;
+}
+
+static inline pgoff_t cache_bench_index(const struct bench_blk *b)
+{
+    return b->sector >> (PAGE_SHIFT - SECTOR_SHIFT);
+}
+
+static void cache_bench_step(struct bench_thread *t, unsigned long n)
+{
+    struct muscle_cache_state *s = this_cpu_ptr(&cache_state);
+    struct cache_learn *l = this_cpu_ptr(&cache_learn);
+    const struct cache_model *m = rcu_dereference(cache_model);
+
+    while (n--) {
+        const struct bench_blk *b = bench_next_blk(t);
+
+        cache_step(m, s, l, b->dev, cache_bench_index(b));
+    }
+}
+
+/* Run the learner where cache_drain() would queue it */
+static void cache_bench_learn_poll(void)
+{
+    struct cache_learn *l = this_cpu_ptr(&cache_learn);
+
+    if (l->head - l->tail >= CACHE_LEARN_BATCH)
+        cache_learn_fn(&l->work);
+}
+
+/* As writing learn, so the built-in model is forked before training */
+static int cache_bench_learn_setup(struct bench_thread *t)
+{
+    return learn_set("1", &__param_learn);
+}
+
+static void cache_bench_learn_teardown(struct bench_thread *t)
+{
+    struct cache_learn *l = this_cpu_ptr(&cache_learn);
+
+    WRITE_ONCE(learn, false);
+    l->tail = l->head;
+}
+
+/* The step with samples scored and trained on; flips are left out */
+static void cache_bench_learn(struct bench_thread *t, unsigned long n)
+{
+    struct muscle_cache_state *s = this_cpu_ptr(&cache_state);
+    struct cache_learn *l = this_cpu_ptr(&cache_learn);
+    const struct cache_model *m = rcu_dereference(cache_model);
+
+    while (n--) {
+        const struct bench_blk *b = bench_next_blk(t);
+
+        cache_step(m, s, l, b->dev, cache_bench_index(b));
+        cache_bench_learn_poll();
+    }
+}
+
+static void cache_bench_hook(struct bench_thread *t, unsigned long n)
+{
+    struct file_ra_state ra = {};
+    unsigned long i;
+
+    for (i = 0; i < n; i++) {
+        const struct bench_blk *b = bench_next_blk(t);
+        struct readahead_control rac = {
+            .mapping = &cache_bench_devs[b->dev].mapping,
+            .ra      = &ra,
+            ._index  = cache_bench_index(b),
+        };
+
+        muscle_cache_readahead(&rac);
+        bench_poll_work(t, i);
+    }
+    bench_flush_work(t);
+}
+
+/* Per-context replay state; colliding contexts just evict each other */
+#define CACHE_REPLAY_CTX_BITS   12
+
+/* A window read ahead, tracked until the next one replaces it */
+struct cache_replay_win {
+    pgoff_t start, end;
+    unsigned long used;         /* accesses that landed in it */
+    bool hit;
+};
+
+struct cache_replay_ctx {
+    u64 ctx;
+    pgoff_t last;
+    bool valid;
+    struct cache_replay_win win[2];  /* replayed, live */
+};
+
+struct cache_replay_score {
+    unsigned long predicted, issued, hits, wasted;
+};
+
+static struct {
+    struct cache_replay_ctx ctx[1 << CACHE_REPLAY_CTX_BITS];
+    struct cache_replay_score score[2];
+    unsigned long accesses, follow, seq;
+    unsigned long publish_at;
+    bool model;
+} cache_replay;
+
+static void cache_bench_learn_on(void)
+{
+    learn_set("1", &__param_learn);
+}
+
+/*
+ * The window read ahead for a stride: for muscle_cache_readahead() as it
+ * computes it, skipping what the kernel's own readahead covers; for
+ * muscle_cache_predict() (window 0) the one predicted block.
+ */
+static struct cache_replay_win cache_replay_window(pgoff_t index, s32 off, u32 window)
+{
+    struct cache_replay_win w = {};
+
+    if (!off || (window && off > 0 && off < window) || (off < 0 && index < (pgoff_t)-off))
+        return w;
+    w.start = index + off;
+    w.end = w.start + (window ?: 1);
+    return w;
+}
+
+/*
+ * Score an access against the window in flight.  Any access in it counts
+ * as served, an upper bound on the kernel's hits, which only a read of
+ * the marker on the window's first page records.
+ */
+static void cache_replay_access(struct cache_replay_score *sc,
+                                struct cache_replay_win *w, pgoff_t index)
+{
+    if (index < w->start || index >= w->end)
+        return;
+    if (!w->hit) {
+        w->hit = true;
+        sc->hits++;
+    }
+    w->used++;
+}
+
+/* ...and only let a non-empty window replace it; what it never served is waste */
+static void cache_replay_issue(struct cache_replay_score *sc, struct cache_replay_win *w,
+                               struct cache_replay_win next, s32 off)
+{
+    if (off)
+        sc->predicted++;
+    if (next.end == next.start)
+        return;
+    sc->issued++;
+    sc->wasted += w->end - w->start - min_t(unsigned long, w->used, w->end - w->start);
+    *w = next;
+}
+
+static void cache_bench_replay(const struct muscle_trace_rec *rec)
+{
+    const struct muscle_event *ev = &rec->ev;
+    struct cache_replay_ctx *c = &cache_replay.ctx[hash_64(ev->b, CACHE_REPLAY_CTX_BITS)];
+    const struct cache_model *m = rcu_dereference(cache_model);
+    struct cache_replay_win live;
+    pgoff_t index = ev->a;
+    s32 off;
+    int i;
+
+    cache_replay.accesses++;
+    if (c->valid && c->ctx == ev->b) {
+        cache_replay.follow++;
+        /* The kernel's own readahead already covers a short forward step */
+        if (index > c->last && index - c->last < max_t(u32, ev->e, 1))
+            cache_replay.seq++;
+        for (i = 0; i < 2; i++)
+            cache_replay_access(&cache_replay.score[i], &c->win[i], index);
+    } else {
+        *c = (struct cache_replay_ctx) { .ctx = ev->b, .valid = true };
+    }
+    c->last = index;
+
+    if (m) {
+        cache_replay.model = true;
+        off = cache_pred_stride(ev->b);
+        cache_step(m, this_cpu_ptr(&cache_state), this_cpu_ptr(&cache_learn), ev->b, index);
+        if (READ_ONCE(learn)) {
+            cache_bench_learn_poll();
+            if (time_after_eq(jiffies, cache_replay.publish_at)) {
+                cache_publish_fn(&cache_publish_work.work);
+                cache_replay.publish_at = jiffies + msecs_to_jiffies(READ_ONCE(learn_publish_ms));
+            }
+        }
+        cache_replay_issue(&cache_replay.score[0], &c->win[0],
+                           cache_replay_window(index, off, ev->e), off);
+    }
+    /* Live: the window actually issued, clipped to the file as recorded */
+    live = cache_replay_window(index, (s32)ev->c, ev->e);
+    if (ev->e)
+        live.end = live.start + ev->d;
+    cache_replay_issue(&cache_replay.score[1], &c->win[1], live, (s32)ev->c);
+}
+
+static void cache_bench_report(void)
+{
+    static const char *const who[] = { "replay", "live" };
+    unsigned int i;
+
+    if (!cache_replay.accesses)
+        return;
+    printf("cache: %lu accesses, %lu followed within a context, %.1f%% covered by sequential readahead\n",
+           cache_replay.accesses, cache_replay.follow,
+           bench_pct(cache_replay.seq, cache_replay.follow));
+    for (i = 0; i < 2; i++) {
+        const struct cache_replay_score *sc = &cache_replay.score[i];
+
+        if (!i && !cache_replay.model) {
+            printf("  %-6s  no model loaded (--blob cache=FILE)\n", who[i]);
+            continue;
+        }
+        printf("  %-6s  predicted %5.1f%%  issued %lu  hit %lu (%.1f%%)  wasted %lu pages\n",
+               who[i], bench_pct(sc->predicted, cache_replay.accesses), sc->issued, sc->hits,
+               bench_pct(sc->hits, sc->issued), sc->wasted);
+    }
+    if (READ_ONCE(learn))
+        printf("  learned from %llu samples, %llu dropped\n",
+               muscle_stat_read(&cache_stats, MUSCLE_STAT_LEARN),
+               muscle_stat_read(&cache_stats, MUSCLE_STAT_LEARN_DROPPED));
+}
+
+static const struct bench_case cache_bench_cases[] = {
+    { .name = "step", .desc = "LSTM step + output head", .run = cache_bench_step },
+    { .name = "hook", .desc = "muscle_cache_readahead() + ring drain", .run = cache_bench_hook },
+    { .name = "learn", .desc = "LSTM step + output head, training inline",
+      .setup = cache_bench_learn_setup, .teardown = cache_bench_learn_teardown,
+      .run = cache_bench_learn },
+};
+
+const struct bench_muscle bench_cache = {
+    .name     = "cache",
+    .wset     = &cache_wset,
+    .init     = cache_bench_init,
+    .cases    = cache_bench_cases,
+    .nr_cases = ARRAY_SIZE(cache_bench_cases),
+    .trace    = MUSCLE_TRACE_CACHE,
+    .replay   = cache_bench_replay,
+    .report   = cache_bench_report,
+    .learn    = cache_bench_learn_on,
+};
@@ -0,0 +1,171 @@
+/*
+ * zmuscle: single-page compression and decompression on caller memory,
+ * and batched compression into a scatterlist through the per-CPU arenas.
+ * Every case counts pages, so ns/op is per 4 KB page.
+ */
+#include "../../../lib/muscle/muscle_compress.c"
+
+#include "bench.h"
+
+#define ZM_BENCH_BATCH  16
+
+struct zm_bench {
+    void *wrkmem;
+    u8 dst[2 * PAGE_SIZE];
+    struct page *pages[ZM_BENCH_BATCH];
+    struct scatterlist sg[ZM_BENCH_BATCH];
+    unsigned int lens[ZM_BENCH_BATCH];
+    u8 *sgbuf;
+};
+
+/* Every input page compressed once, for the decompression case */
+static u8 **zm_bench_frames;
+static size_t *zm_bench_frame_len;
+
+static void zm_bench_fail(const char *what, size_t page, int err)
+{
+    fprintf(stderr, "muscle-bench: zmuscle: %s of page %zu: %s\n", what, page,
+            err ? strerror(-err) : "data differs");
+    exit(1);
+}
+
+/* Also round-trips every page, so a timed case never runs on a broken codec */
+static int zm_bench_init(void)
+{
+    void *wrkmem = kmalloc(MUSCLE_COMPRESS_WRKMEM, GFP_KERNEL);
+    u8 buf[2 * PAGE_SIZE], page[PAGE_SIZE];
+    size_t i, len;
+    int ret = -ENOMEM;
+
+    zm_bench_frames = kcalloc(bench_in.nr_pages, sizeof(*zm_bench_frames), GFP_KERNEL);
+    zm_bench_frame_len = kcalloc(bench_in.nr_pages, sizeof(*zm_bench_frame_len), GFP_KERNEL);
+    if (!wrkmem || !zm_bench_frames || !zm_bench_frame_len)
+        goto out;
+
+    for (i = 0; i < bench_in.nr_pages; i++) {
+        len = sizeof(buf);
+        ret = muscle_compress(buf, &len, &bench_in.pages[i], PAGE_SIZE, wrkmem);
+        if (ret)
+            goto out;
+        ret = -ENOMEM;
+        zm_bench_frames[i] = kmemdup(buf, len, GFP_KERNEL);
+        if (!zm_bench_frames[i])
+            goto out;
+        zm_bench_frame_len[i] = len;
+
+        len = sizeof(page);
+        ret = muscle_decompress(page, &len, buf, zm_bench_frame_len[i]);
+        if (ret)
+            zm_bench_fail("decompression", i, ret);
+        if (len != PAGE_SIZE || memcmp(page, &bench_in.pages[i], PAGE_SIZE))
+            zm_bench_fail("round trip", i, 0);
+    }
+    ret = 0;
+out:
+    kfree(wrkmem);
+    return ret;
+}
+
+static int zm_bench_setup(struct bench_thread *t)
+{
+    struct zm_bench *z = kzalloc(sizeof(*z), GFP_KERNEL);
+    unsigned int i;
+
+    if (!z)
+        return -ENOMEM;
+    t->priv = z;
+    z->wrkmem = kmalloc(MUSCLE_COMPRESS_WRKMEM, GFP_KERNEL);
+    z->sgbuf = kmalloc(ZM_BENCH_BATCH * PAGE_SIZE, GFP_KERNEL);
+    if (!z->wrkmem || !z->sgbuf)
+        return -ENOMEM;
+
+    /* As many page-sized chunks as pages: incompressible input still fits */
+    sg_init_table(z->sg, ZM_BENCH_BATCH);
+    for (i = 0; i < ZM_BENCH_BATCH; i++)
+        sg_set_buf(&z->sg[i], z->sgbuf + i * PAGE_SIZE, PAGE_SIZE);
+    return 0;
+}
+
+static void zm_bench_teardown(struct bench_thread *t)
+{
+    struct zm_bench *z = t->priv;
+
+    if (z) {
+        kfree(z->wrkmem);
+        kfree(z->sgbuf);
+        kfree(z);
+    }
+}
+
+static void zm_bench_compress(struct bench_thread *t, unsigned long n)
+{
+    struct zm_bench *z = t->priv;
+    size_t len;
+
+    while (n--) {
+        len = sizeof(z->dst);
+        muscle_compress(z->dst, &len, bench_next_page(t), PAGE_SIZE, z->wrkmem);
+    }
+}
+
+static void zm_bench_decompress(struct bench_thread *t, unsigned long n)
+{
+    struct zm_bench *z = t->priv;
+    size_t i, len;
+    int ret;
+
+    while (n--) {
+        i = t->page_pos;
+        bench_next_page(t);
+        len = PAGE_SIZE;
+        ret = muscle_decompress(z->dst, &len, zm_bench_frames[i], zm_bench_frame_len[i]);
+        if (unlikely(ret || len != PAGE_SIZE))
+            zm_bench_fail("decompression", i, ret);
+    }
+}
+
+static void zm_bench_pages(struct bench_thread *t, unsigned long n)
+{
+    struct zm_bench *z = t->priv;
+    unsigned long i;
+    unsigned int j, nr;
+
+    for (i = 0; i < n; i += nr) {
+        nr = min_t(unsigned long, n - i, ZM_BENCH_BATCH);
+        for (j = 0; j < nr; j++)
+            z->pages[j] = bench_next_page(t);
+        muscle_compress_pages(z->pages, nr, z->sg, ZM_BENCH_BATCH, z->lens);
+    }
+}
+
+static const struct bench_case zm_bench_cases[] = {
+    {
+        .name     = "compress",
+        .desc     = "muscle_compress(), one page",
+        .setup    = zm_bench_setup,
+        .teardown = zm_bench_teardown,
+        .run      = zm_bench_compress,
+    },
+    {
+        .name     = "decompress",
+        .desc     = "muscle_decompress(), one page",
+        .setup    = zm_bench_setup,
+        .teardown = zm_bench_teardown,
+        .run      = zm_bench_decompress,
+    },
+    {
+        .name     = "pages",
+        .desc     = "muscle_compress_pages(), batches of 16",
+        .setup    = zm_bench_setup,
+        .teardown = zm_bench_teardown,
+        .run      = zm_bench_pages,
+    },
+};
+
+const struct bench_muscle bench_zmuscle = {
+    .name     = "zmuscle",
+    .wset     = &zm_wset,
+    .init     = zm_bench_init,
+    .cases    = zm_bench_cases,
+    .nr_cases = ARRAY_SIZE(zm_bench_cases),
+};
@@ -0,0 +1,496 @@
+/*
+ * Benchmark inputs.
+ *
+ * Block traces are blkparse output restricted to queue events, one
+ * request per line as "maj,min RWBS sector sectors":
+ *
+ *   blkparse -i sda -a queue -f "%D %d %S %n\n" > sda.trace
+ *
+ * Syscall traces are "pid nr arg1 arg2 [uid]" per line:
+ *
+ *   bpftrace -e 'tracepoint:raw_syscalls:sys_enter {
+ *       printf("%d %d %lu %lu %d\n", pid, args->id, args->args[0],
+ *              args->args[1], uid); }' > sys.trace
+ *
+ * Page inputs are any file (a core dump, a swap image), cut into pages.
+ * Lines that do not parse are skipped, so raw tool output with headers
+ * and summaries can be fed in as is.
+ *
+ * Captures are the per-CPU files of tools/muscle/capture.sh; their io
+ * and security records stand in for both traces above.
+ */
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+struct bench_input bench_in;
+
+#define BENCH_SYNTH_BLK     65536
+#define BENCH_SYNTH_SYS     65536
+#define BENCH_SYNTH_PAGES   256
+
+static void *bench_grow(void *p, size_t *cap, size_t n, size_t size)
+{
+    void *q;
+
+    if (n < *cap)
+        return p;
+    *cap = *cap ? 2 * *cap : 4096;
+    q = realloc(p, *cap * size);
+    if (!q) {
+        perror("bench: input");
+        exit(1);
+    }
+    return q;
+}
+
+/*
+ * blkparse RWBS: an optional F (preflush), the op (R, W, D or DE,
+ * F for a bare flush, N for anything else), then F (FUA), A, S, M.
+ */
+static int bench_rwbs(const char *s, blk_opf_t *opf)
+{
+    blk_opf_t f = 0;
+
+    if (s[0] == 'F' && s[1] && strchr("RWDFN", s[1])) {
+        f |= REQ_PREFLUSH;
+        s++;
+    }
+    switch (*s++) {
+    case 'R':
+        f |= REQ_OP_READ;
+        break;
+    case 'W':
+        f |= REQ_OP_WRITE;
+        break;
+    case 'D':
+        if (*s == 'E') {
+            f |= REQ_OP_SECURE_ERASE;
+            s++;
+        } else {
+            f |= REQ_OP_DISCARD;
+        }
+        break;
+    case 'F':
+        f |= REQ_OP_FLUSH;
+        break;
+    case 'N':
+        f |= REQ_OP_DRV_IN;
+        break;
+    default:
+        return -EINVAL;
+    }
+    for (; *s; s++) {
+        if (*s == 'F')
+            f |= REQ_FUA;
+        else if (*s == 'S')
+            f |= REQ_SYNC;
+        else if (*s == 'M')
+            f |= REQ_META;
+    }
+    *opf = f;
+    return 0;
+}
+
+int bench_input_block(const char *path)
+{
+    unsigned int devs[BENCH_MAX_DEVS], maj, min, sectors, i;
+    struct bench_blk *blk = NULL;
+    size_t n = 0, cap = 0;
+    unsigned long long sector;
+    char line[256], rwbs[16];
+    blk_opf_t opf;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (!f)
+        return -errno;
+    bench_in.nr_dev = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%u,%u %15s %llu %u", &maj, &min, rwbs, &sector, &sectors) != 5 ||
+            bench_rwbs(rwbs, &opf))
+            continue;
+
+        for (i = 0; i < bench_in.nr_dev && devs[i] != (maj << 20 | min); i++)
+            ;
+        if (i == bench_in.nr_dev) {
+            if (i == BENCH_MAX_DEVS)
+                continue;
+            devs[bench_in.nr_dev++] = maj << 20 | min;
+        }
+
+        blk = bench_grow(blk, &cap, n, sizeof(*blk));
+        blk[n++] = (struct bench_blk) {
+            .dev     = i,
+            .opf     = opf,
+            .sector  = sector,
+            .sectors = sectors,
+        };
+    }
+    fclose(f);
+    if (!n) {
+        free(blk);
+        return -ENODATA;
+    }
+    bench_in.blk = blk;
+    bench_in.nr_blk = n;
+    return 0;
+}
+
+int bench_input_syscall(const char *path)
+{
+    struct bench_sys *sys = NULL;
+    unsigned long long nr, a1, a2;
+    unsigned int pid, uid;
+    size_t n = 0, cap = 0;
+    char line[256];
+    FILE *f;
+    int got;
+
+    f = fopen(path, "r");
+    if (!f)
+        return -errno;
+    while (fgets(line, sizeof(line), f)) {
+        uid = 0;
+        got = sscanf(line, "%u %llu %llu %llu %u", &pid, &nr, &a1, &a2, &uid);
+        if (got < 4)
+            continue;
+
+        sys = bench_grow(sys, &cap, n, sizeof(*sys));
+        sys[n++] = (struct bench_sys) {
+            .pid  = pid,
+            .uid  = uid,
+            .nr   = nr,
+            .arg1 = a1,
+            .arg2 = a2,
+        };
+    }
+    fclose(f);
+    if (!n) {
+        free(sys);
+        return -ENODATA;
+    }
+    bench_in.sys = sys;
+    bench_in.nr_sys = n;
+    return 0;
+}
+
+int bench_input_pages(const char *path, size_t max_pages)
+{
+    struct page *pages;
+    size_t n = 0;
+    ssize_t got;
+    int fd;
+
+    pages = aligned_alloc(PAGE_SIZE, max_pages * PAGE_SIZE);
+    if (!pages)
+        return -ENOMEM;
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        free(pages);
+        return -errno;
+    }
+    /* Whole pages only, as a swap device would see them */
+    while (n < max_pages && (got = pread(fd, &pages[n], PAGE_SIZE, n * PAGE_SIZE)) ==
+           (ssize_t)PAGE_SIZE)
+        n++;
+    close(fd);
+    if (!n) {
+        free(pages);
+        return -ENODATA;
+    }
+    bench_in.pages = pages;
+    bench_in.nr_pages = n;
+    return 0;
+}
+
+/*
+ * A few devices, each interleaving sequential runs (mostly reads, some
+ * sync writes), fixed strides and random seeks, as a mixed workload
+ * would queue them.
+ */
+static void bench_synth_block(u64 *seed)
+{
+    u64 pos[4] = { 0, 1 << 20, 1 << 24, 1 << 28 };
+    unsigned int len = 0, dev = 0;
+    size_t i;
+
+    bench_in.blk = kcalloc(BENCH_SYNTH_BLK, sizeof(*bench_in.blk), GFP_KERNEL);
+    bench_in.nr_blk = BENCH_SYNTH_BLK;
+    bench_in.nr_dev = ARRAY_SIZE(pos);
+    for (i = 0; i < BENCH_SYNTH_BLK; i++) {
+        struct bench_blk *b = &bench_in.blk[i];
+        u64 r = bench_rand(seed);
+
+        if (!len) {
+            dev = r % bench_in.nr_dev;
+            len = 4 + (r >> 8) % 60;
+            if ((r >> 16) % 8 == 0)
+                pos[dev] = (r >> 20) % (1ULL << 30);
+        }
+        len--;
+
+        b->dev = dev;
+        b->sectors = 8 << ((r >> 32) % 4);
+        b->sector = pos[dev];
+        switch ((r >> 40) % 16) {
+        case 0 ... 10:
+            b->opf = REQ_OP_READ;
+            break;
+        case 11 ... 13:
+            b->opf = REQ_OP_WRITE;
+            break;
+        case 14:
+            b->opf = REQ_OP_WRITE | REQ_FUA | REQ_SYNC;
+            break;
+        default:
+            b->opf = REQ_OP_FLUSH | REQ_PREFLUSH;
+            b->sectors = 0;
+            break;
+        }
+        /* The last device strides instead of streaming */
+        pos[dev] += b->sectors + (dev == 3 ? 64 : 0);
+    }
+}
+
+/* Tasks stuck in short syscall loops, with the odd rare call mixed in */
+static void bench_synth_syscall(u64 *seed)
+{
+    static const u16 loops[][4] = {
+        { 0, 1, 3, 257 },       /* read write close openat */
+        { 7, 0, 1, 7 },         /* poll read write poll */
+        { 232, 0, 44, 45 },     /* epoll_wait read sendto recvfrom */
+        { 9, 11, 12, 10 },      /* mmap munmap brk mprotect */
+    };
+    size_t i;
+
+    bench_in.sys = kcalloc(BENCH_SYNTH_SYS, sizeof(*bench_in.sys), GFP_KERNEL);
+    bench_in.nr_sys = BENCH_SYNTH_SYS;
+    for (i = 0; i < BENCH_SYNTH_SYS; i++) {
+        struct bench_sys *s = &bench_in.sys[i];
+        u64 r = bench_rand(seed);
+        unsigned int task = (i / 16) % 64;
+
+        s->pid = 2000 + task;
+        s->uid = task < 48 ? 1000 : 0;
+        s->nr = (r % 64) ? loops[task % ARRAY_SIZE(loops)][i % 4] : (r >> 8) % 335;
+        s->arg1 = (r >> 16) % 1024;
+        s->arg2 = (r >> 24) % 65536;
+    }
+}
+
+/* Zero, same-filled, text, pointer array, counters and random pages */
+static void bench_synth_pages(u64 *seed)
+{
+    static const char text[] = "the quick brown fox jumps over the lazy dog; ";
+    size_t i, j;
+
+    bench_in.pages = aligned_alloc(PAGE_SIZE, BENCH_SYNTH_PAGES * PAGE_SIZE);
+    bench_in.nr_pages = BENCH_SYNTH_PAGES;
+    for (i = 0; i < BENCH_SYNTH_PAGES; i++) {
+        u8 *d = bench_in.pages[i].data;
+        u64 *w = (u64 *)d;
+        u32 *c = (u32 *)d;
+        u64 base = 0xffff888000000000ULL + (bench_rand(seed) & 0xfffff000);
+
+        switch (i % 6) {
+        case 0:
+            memset(d, 0, PAGE_SIZE);
+            break;
+        case 1:
+            for (j = 0; j < PAGE_SIZE / 8; j++)
+                w[j] = 0xdeadbeefcafef00dULL;
+            break;
+        case 2:
+            for (j = 0; j < PAGE_SIZE; j++)
+                d[j] = text[(j + i) % (sizeof(text) - 1)];
+            break;
+        case 3:
+            for (j = 0; j < PAGE_SIZE / 8; j++)
+                w[j] = base + 64 * (bench_rand(seed) % 512);
+            break;
+        case 4:
+            for (j = 0; j < PAGE_SIZE / 4; j++)
+                c[j] = 100000 + 3 * j + bench_rand(seed) % 4;
+            break;
+        default:
+            for (j = 0; j < PAGE_SIZE / 8; j++)
+                w[j] = bench_rand(seed);
+            break;
+        }
+    }
+}
+
+/*
+ * Advance file i to its next hook record, folding in any sub-buffer
+ * headers on the way.  A file is closed at its end or at the first
+ * header that is not ours.
+ */
+static void bench_capture_fill(struct bench_capture *c, unsigned int i)
+{
+    struct muscle_trace_rec *r = &c->cur[i];
+
+    while (fread(r, sizeof(*r), 1, c->f[i]) == 1) {
+        if (r->type != MUSCLE_TRACE_HDR)
+            return;
+        if (r->hdr.magic != MUSCLE_TRACE_MAGIC || r->hdr.version != MUSCLE_TRACE_VERSION ||
+            r->hdr.size != sizeof(*r)) {
+            c->err = -EPROTO;
+            break;
+        }
+        c->dropped[i] = r->hdr.dropped;
+    }
+    fclose(c->f[i]);
+    c->f[i] = NULL;
+}
+
+int bench_capture_open(struct bench_capture *c, char *const *paths, unsigned int n)
+{
+    struct muscle_trace_rec hdr;
+    unsigned int i;
+
+    if (n > NR_CPUS)
+        return -E2BIG;
+    memset(c, 0, sizeof(*c));
+    c->nr = n;
+    for (i = 0; i < n; i++) {
+        c->f[i] = fopen(paths[i], "r");
+        if (!c->f[i]) {
+            c->err = -errno;
+            break;
+        }
+        /* Every sub-buffer, so every non-empty capture, opens with a header */
+        if (fread(&hdr, sizeof(hdr), 1, c->f[i]) != 1) {
+            fclose(c->f[i]);
+            c->f[i] = NULL;
+            continue;
+        }
+        if (hdr.type != MUSCLE_TRACE_HDR) {
+            c->err = -EPROTO;
+            break;
+        }
+        rewind(c->f[i]);
+        bench_capture_fill(c, i);
+    }
+    if (c->err) {
+        bench_capture_close(c);
+        return c->err;
+    }
+    return 0;
+}
+
+/* The earliest pending record over all files, NULL once all are done */
+const struct muscle_trace_rec *bench_capture_next(struct bench_capture *c)
+{
+    unsigned int i, best = c->nr;
+
+    for (i = 0; i < c->nr; i++)
+        if (c->f[i] && (best == c->nr || c->cur[i].ts < c->cur[best].ts))
+            best = i;
+    if (best == c->nr)
+        return NULL;
+
+    c->rec = c->cur[best];
+    bench_capture_fill(c, best);
+    if (!c->records++)
+        c->first_ts = c->rec.ts;
+    c->last_ts = c->rec.ts;
+    return &c->rec;
+}
+
+u64 bench_capture_dropped(const struct bench_capture *c)
+{
+    u64 sum = 0;
+    unsigned int i;
+
+    for (i = 0; i < c->nr; i++)
+        sum += c->dropped[i];
+    return sum;
+}
+
+void bench_capture_close(struct bench_capture *c)
+{
+    unsigned int i;
+
+    for (i = 0; i < c->nr; i++)
+        if (c->f[i])
+            fclose(c->f[i]);
+    memset(c->f, 0, sizeof(c->f));
+}
+
+/* Block requests and syscalls, in capture order; queue ids map to devices */
+int bench_input_capture(char *const *paths, unsigned int n)
+{
+    static struct bench_capture c;
+    const struct muscle_trace_rec *r;
+    struct bench_blk *blk = NULL;
+    struct bench_sys *sys = NULL;
+    size_t nb = 0, ns = 0, cap_b = 0, cap_s = 0;
+    u64 devs[BENCH_MAX_DEVS];
+    unsigned int nr_dev = 0, i;
+    int ret;
+
+    ret = bench_capture_open(&c, paths, n);
+    if (ret)
+        return ret;
+    while ((r = bench_capture_next(&c))) {
+        switch (r->type) {
+        case MUSCLE_TRACE_IO:
+            for (i = 0; i < nr_dev && devs[i] != r->ev.c; i++)
+                ;
+            if (i == nr_dev) {
+                if (i == BENCH_MAX_DEVS)
+                    continue;
+                devs[nr_dev++] = r->ev.c;
+            }
+            blk = bench_grow(blk, &cap_b, nb, sizeof(*blk));
+            blk[nb++] = (struct bench_blk) {
+                .dev     = i,
+                .opf     = (__force blk_opf_t)r->ev.d,
+                .sector  = r->ev.a,
+                .sectors = r->ev.e,
+            };
+            break;
+        case MUSCLE_TRACE_SECURITY:
+            sys = bench_grow(sys, &cap_s, ns, sizeof(*sys));
+            sys[ns++] = (struct bench_sys) {
+                .pid  = r->ev.d,
+                .uid  = r->ev.e,
+                .nr   = r->ev.a,
+                .arg1 = r->ev.b,
+                .arg2 = r->ev.c,
+            };
+            break;
+        }
+    }
+    ret = c.err;
+    bench_capture_close(&c);
+    if (ret) {
+        free(blk);
+        free(sys);
+        return ret;
+    }
+    if (!nb && !ns)
+        return -ENODATA;
+    if (nb) {
+        bench_in.blk = blk;
+        bench_in.nr_blk = nb;
+        bench_in.nr_dev = nr_dev;
+    }
+    if (ns) {
+        bench_in.sys = sys;
+        bench_in.nr_sys = ns;
+    }
+    return 0;
+}
+
+void bench_input_synthetic(u64 seed)
+{
+    if (!bench_in.nr_blk)
+        bench_synth_block(&seed);
+    if (!bench_in.nr_sys)
+        bench_synth_syscall(&seed);
+    if (!bench_in.nr_pages)
+        bench_synth_pages(&seed);
+}
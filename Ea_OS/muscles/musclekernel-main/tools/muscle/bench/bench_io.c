@@ -0,0 +1,200 @@
+/*
+ * MuscleIO: classify + LSTM step on a private predictor, and the
+ * insertion hook end to end, where threads replaying the same device
+ * contend on its predictor lock.
+ *
+ * Replay keeps one predictor per captured queue, steps it on every
+ * request as if the drain always kept up, and scores the class it
+ * predicts and the hint it implies against the queue's next request.
+ * The hints the live kernel returned are scored alongside.
+ */
+#include "../../../block/muscle_io.c"
+
+#include "bench.h"
+
+static struct request_queue io_bench_queues[BENCH_MAX_DEVS];
+
+static int io_bench_init(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < BENCH_MAX_DEVS; i++)
+        io_bench_queues[i].id = i;
+    return 0;
+}
+
+static int io_bench_step_setup(struct bench_thread *t)
+{
+    struct muscle_io_state *s = kzalloc(sizeof(*s), GFP_KERNEL);
+
+    if (!s)
+        return -ENOMEM;
+    s->pred = -1;
+    t->priv = s;
+    return 0;
+}
+
+static void io_bench_teardown(struct bench_thread *t)
+{
+    kfree(t->priv);
+}
+
+static void io_bench_step(struct bench_thread *t, unsigned long n)
+{
+    const struct io_model *m = rcu_dereference(io_model);
+    struct muscle_io_state *s = t->priv;
+
+    while (n--) {
+        const struct bench_blk *b = bench_next_blk(t);
+        int cls = io_classify(s, b->sector, b->sectors, b->opf);
+
+        s->pred = io_lstm_step(m, s, b->dev, cls, b->sector);
+    }
+}
+
+static void io_bench_hook(struct bench_thread *t, unsigned long n)
+{
+    struct request rq = {};
+    unsigned long i;
+
+    for (i = 0; i < n; i++) {
+        const struct bench_blk *b = bench_next_blk(t);
+
+        rq.q = &io_bench_queues[b->dev];
+        rq.cmd_flags = b->opf;
+        rq.__sector = b->sector;
+        rq.__data_len = b->sectors << SECTOR_SHIFT;
+        muscle_io_predict(rq.q, &rq);
+        bench_poll_work(t, i);
+    }
+    bench_flush_work(t);
+}
+
+struct io_replay_hint {
+    unsigned long given, right;
+};
+
+struct io_replay_queue {
+    u64 id;
+    struct muscle_io_state s;
+    int last_cls;
+    enum req_op last_op;
+    enum muscle_io_hint hint[2];        /* replayed, live; for the next request */
+};
+
+static struct {
+    struct io_replay_queue q[BENCH_MAX_DEVS];
+    unsigned int nr_q;
+    unsigned long requests, predicted, class_right, repeat_right;
+    struct io_replay_hint merge[2], dispatch[2];
+    bool model;
+} io_replay;
+
+static struct io_replay_queue *io_replay_queue(u64 id)
+{
+    struct io_replay_queue *rq;
+    unsigned int i;
+
+    for (i = 0; i < io_replay.nr_q; i++)
+        if (io_replay.q[i].id == id)
+            return &io_replay.q[i];
+    if (io_replay.nr_q == BENCH_MAX_DEVS)
+        return NULL;
+    rq = &io_replay.q[io_replay.nr_q++];
+    rq->id = id;
+    rq->s.pred = -1;
+    rq->last_cls = -1;
+    return rq;
+}
+
+/* A merge hint pays off if rq continues in the same direction */
+static void io_replay_judge(unsigned int who, enum muscle_io_hint hint,
+                            enum req_op op, int cls)
+{
+    bool seq = cls == IO_CLASS_READ_SEQ || cls == IO_CLASS_WRITE_SEQ;
+
+    if (hint == MUSCLE_IO_HINT_MERGE) {
+        io_replay.merge[who].given++;
+        io_replay.merge[who].right += seq && io_hint(cls, op) == MUSCLE_IO_HINT_MERGE;
+    } else if (hint == MUSCLE_IO_HINT_DISPATCH) {
+        io_replay.dispatch[who].given++;
+        io_replay.dispatch[who].right += !seq;
+    }
+}
+
+static void io_bench_replay(const struct muscle_trace_rec *rec)
+{
+    const struct muscle_event *ev = &rec->ev;
+    const struct io_model *m = rcu_dereference(io_model);
+    struct io_replay_queue *q = io_replay_queue(ev->c);
+    enum req_op op = ev->d & REQ_OP_MASK;
+    int cls, i;
+
+    if (!q)
+        return;
+    cls = io_classify(&q->s, ev->a, ev->e, ev->d);
+    io_replay.requests++;
+    io_replay.repeat_right += cls == q->last_cls;
+    if (q->s.pred >= 0) {
+        io_replay.predicted++;
+        io_replay.class_right += cls == q->s.pred;
+    }
+    for (i = 0; i < 2; i++)
+        if (q->last_cls >= 0)
+            io_replay_judge(i, q->hint[i], q->last_op, cls);
+
+    if (m) {
+        io_replay.model = true;
+        q->s.pred = io_lstm_step(m, &q->s, ev->c, cls, ev->a);
+        q->hint[0] = io_hint(q->s.pred, op);
+    }
+    q->hint[1] = ev->b;
+    q->last_cls = cls;
+    q->last_op = op;
+}
+
+static void io_bench_report(void)
+{
+    static const char *const who[] = { "replay", "live" };
+    unsigned int i;
+
+    if (!io_replay.requests)
+        return;
+    printf("io: %lu requests on %u queues, repeating the last class is right %.1f%%\n",
+           io_replay.requests, io_replay.nr_q,
+           bench_pct(io_replay.repeat_right, io_replay.requests));
+    if (io_replay.model)
+        printf("  replay  class predicted %.1f%%, right %.1f%% of those\n",
+               bench_pct(io_replay.predicted, io_replay.requests),
+               bench_pct(io_replay.class_right, io_replay.predicted));
+    else
+        printf("  replay  no model loaded (--blob io=FILE)\n");
+    for (i = !io_replay.model; i < 2; i++)
+        printf("  %-6s  merge %lu (%.1f%% right)  dispatch %lu (%.1f%% right)\n", who[i],
+               io_replay.merge[i].given,
+               bench_pct(io_replay.merge[i].right, io_replay.merge[i].given),
+               io_replay.dispatch[i].given,
+               bench_pct(io_replay.dispatch[i].right, io_replay.dispatch[i].given));
+}
+
+static const struct bench_case io_bench_cases[] = {
+    {
+        .name     = "step",
+        .desc     = "classify + LSTM step + output head",
+        .setup    = io_bench_step_setup,
+        .teardown = io_bench_teardown,
+        .run      = io_bench_step,
+    },
+    { .name = "hook", .desc = "muscle_io_predict() + ring drain", .run = io_bench_hook },
+};
+
+const struct bench_muscle bench_io = {
+    .name     = "io",
+    .wset     = &io_wset,
+    .init     = io_bench_init,
+    .cases    = io_bench_cases,
+    .nr_cases = ARRAY_SIZE(io_bench_cases),
+    .trace    = MUSCLE_TRACE_IO,
+    .replay   = io_bench_replay,
+    .report   = io_bench_report,
+};
@@ -0,0 +1,227 @@
+/*
+ * Shared library internals the harness needs to reach: the gate kernel
+ * selection in muscle_lstm.c, blob loading in muscle_weights.c, the
+ * capture switch in muscle_trace.c and the timing switch in
+ * muscle_stats.c.
+ */
+#include "../../../lib/muscle/muscle_lstm.c"
+#include "../../../lib/muscle/muscle_weights.c"
+#include "../../../lib/muscle/muscle_trace.c"
+#include "../../../lib/muscle/muscle_stats.c"
+
+#include "bench.h"
+
+const struct bench_muscle *const bench_muscles[] = {
+    &bench_cache,
+    &bench_io,
+    &bench_security,
+    &bench_sched,
+    &bench_sine,
+    &bench_zmuscle,
+};
+const unsigned int bench_nr_muscles = ARRAY_SIZE(bench_muscles);
+
+/* xorshift64*, good enough for weights and synthetic streams */
+u64 bench_rand(u64 *state)
+{
+    u64 x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* Force a gate kernel instead of the boot-time pick */
+int bench_lstm_select(const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(muscle_gate_impls); i++) {
+        const struct muscle_gate_impl *impl = muscle_gate_impls[i];
+
+        if (strcmp(impl->name, name))
+            continue;
+        if (impl->usable && !impl->usable())
+            return -ENODEV;
+        muscle_gate_impl = impl;
+        return 0;
+    }
+    return -ENOENT;
+}
+
+const char *bench_lstm_impls(void)
+{
+    static char buf[128];
+    unsigned int i;
+    int len = 0;
+
+    for (i = 0; i < ARRAY_SIZE(muscle_gate_impls); i++) {
+        const struct muscle_gate_impl *impl = muscle_gate_impls[i];
+
+        if (!impl->usable || impl->usable())
+            len += snprintf(buf + len, sizeof(buf) - len, "%s%s", len ? " " : "",
+                            impl->name);
+    }
+    return buf;
+}
+
+/* Uniform Q12 in ±scale */
+static muscle_fixed bench_weight(u64 *state, muscle_fixed scale)
+{
+    return (muscle_fixed)(bench_rand(state) % (2 * scale + 1)) - scale;
+}
+
+/*
+ * Every usable gate kernel must match the generic one bit for bit.  Random
+ * layers of a few shapes, odd column counts included, are packed once and
+ * fed random activations; *impl names the first kernel that differs.
+ */
+int bench_lstm_check(u64 seed, const char **impl)
+{
+    static const unsigned int shape[][2] = { { 3, 5 }, { 7, 16 }, { 16, 64 } };
+    static muscle_fixed w[MUSCLE_GATES][MUSCLE_LSTM_MAX_HIDDEN * MUSCLE_LSTM_MAX_COLS];
+    static muscle_fixed r[MUSCLE_GATES][MUSCLE_LSTM_MAX_HIDDEN * MUSCLE_LSTM_MAX_HIDDEN];
+    static muscle_fixed b[MUSCLE_GATES][MUSCLE_LSTM_MAX_HIDDEN];
+    muscle_fixed ref[MUSCLE_LSTM_MAX_HIDDEN * MUSCLE_GATES];
+    muscle_fixed out[MUSCLE_LSTM_MAX_HIDDEN * MUSCLE_GATES];
+    s16 xh[MUSCLE_LSTM_MAX_COLS] __aligned(16);
+    unsigned int s, i, j, g, round;
+    int ret;
+
+    for (s = 0; s < ARRAY_SIZE(shape); s++) {
+        struct muscle_lstm_weights lw = { .input = shape[s][0], .hidden = shape[s][1] };
+        struct muscle_lstm lstm;
+
+        for (g = 0; g < MUSCLE_GATES; g++) {
+            for (j = 0; j < lw.hidden * lw.input; j++)
+                w[g][j] = bench_weight(&seed, MUSCLE_FIXED_ONE);
+            for (j = 0; j < lw.hidden * lw.hidden; j++)
+                r[g][j] = bench_weight(&seed, MUSCLE_FIXED_ONE);
+            for (j = 0; j < lw.hidden; j++)
+                b[g][j] = bench_weight(&seed, MUSCLE_FIXED_ONE);
+            lw.w[g] = w[g];
+            lw.r[g] = r[g];
+            lw.b[g] = b[g];
+        }
+        ret = muscle_lstm_pack(&lstm, &lw);
+        if (ret)
+            return ret;
+
+        for (round = 0; round < 16; round++) {
+            memset(xh, 0, sizeof(xh));
+            for (j = 0; j < lw.input + lw.hidden; j++)
+                xh[j] = muscle_act16(bench_weight(&seed, 4 * MUSCLE_FIXED_ONE));
+            muscle_gates_scalar.gates(&lstm, xh, ref);
+
+            for (i = 0; i < ARRAY_SIZE(muscle_gate_impls); i++) {
+                const struct muscle_gate_impl *k = muscle_gate_impls[i];
+
+                if (k == &muscle_gates_scalar || (k->usable && !k->usable()))
+                    continue;
+                k->gates(&lstm, xh, out);
+                if (memcmp(ref, out, lw.hidden * MUSCLE_GATES * sizeof(*out))) {
+                    muscle_lstm_free(&lstm);
+                    *impl = k->name;
+                    return -EILSEQ;
+                }
+            }
+        }
+        muscle_lstm_free(&lstm);
+    }
+    return 0;
+}
+
+/*
+ * Give a muscle without complete built-in tables a random model of the
+ * right shape; forward-pass cost does not depend on the values.  A muscle
+ * that already has a model keeps it.
+ */
+int bench_wset_random(struct muscle_wset *ws, u64 seed)
+{
+    const muscle_fixed *t[MUSCLE_WSET_MAX_TABLES] = {};
+    muscle_fixed *buf;
+    unsigned int i, j;
+    int ret = 0;
+    void *m;
+
+    if (rcu_access_pointer(*ws->model))
+        return 0;
+
+    for (i = 0; i < ws->nr_tables; i++) {
+        buf = kmalloc_array(ws->tables[i].count, sizeof(*buf), GFP_KERNEL);
+        if (!buf) {
+            ret = -ENOMEM;
+            goto out;
+        }
+        for (j = 0; j < ws->tables[i].count; j++)
+            buf[j] = bench_weight(&seed, MUSCLE_FIXED_ONE / 4);
+        t[i] = buf;
+    }
+
+    m = ws->build(t);
+    if (IS_ERR(m)) {
+        ret = PTR_ERR(m);
+        goto out;
+    }
+    mutex_lock(&ws->lock);
+    muscle_wset_publish(ws, m, 0);
+    mutex_unlock(&ws->lock);
+out:
+    for (i = 0; i < ws->nr_tables; i++)
+        kfree(t[i]);
+    return ret;
+}
+
+int bench_wset_load(struct muscle_wset *ws, const char *path)
+{
+    return muscle_wset_load(ws, path);
+}
+
+/* "muscle=path": load a blob into that muscle's weight set */
+int bench_load_blob(const char *spec)
+{
+    const char *path = strchr(spec, '=');
+    unsigned int i;
+
+    if (!path)
+        return -EINVAL;
+    for (i = 0; i < bench_nr_muscles; i++) {
+        const struct bench_muscle *m = bench_muscles[i];
+
+        if (m->wset && strlen(m->name) == (size_t)(path - spec) &&
+            !strncmp(m->name, spec, path - spec))
+            return bench_wset_load(m->wset, path + 1);
+    }
+    return -ENOENT;
+}
+
+/* As a write to trace_mask; writers then go through the shim's relay */
+int bench_trace_set(unsigned int mask)
+{
+    char buf[16];
+
+    snprintf(buf, sizeof(buf), "%u", mask);
+    return trace_mask_set(buf, NULL);
+}
+
+/* As a write to stats_timing */
+void bench_stats_timing(bool on)
+{
+    stats_timing_set(on ? "1" : "0", &__param_stats_timing);
+}
+
+/*
+ * The sine regressor's table is not in the tree; bench_sine.c points
+ * muscle_core.c at this one, which must be filled before the initcalls.
+ */
+muscle_fixed bench_sine_weights[ARRAY_SIZE(muscle_sine_weights)];
+
+void bench_sine_fill(u64 seed)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(bench_sine_weights); i++)
+        bench_sine_weights[i] = bench_weight(&seed, MUSCLE_FIXED_ONE / 4);
+}
@@ -0,0 +1,305 @@
+/*
+ * MuscleScheduler: the DQN forward pass, the batched per-node pass, the
+ * tick hook over a populated CFS timeline (direct and batched mode), and
+ * the wakeup migration head.
+ *
+ * Replay re-scores each captured tick state with the built-in DQN and
+ * compares its pick with the live one and with CFS, which would have run
+ * candidate 0.  With --learn the live ticks are recorded as experience
+ * and the trainer runs inline every SCHED_TRAIN_PERIOD of capture time,
+ * so the replayed net is the one online learning would have had.
+ */
+#include "../../../kernel/muscle_scheduler.c"
+
+#include "bench.h"
+
+#define SCHED_BENCH_STATES  64
+#define SCHED_BENCH_TASKS   8
+
+struct sched_bench {
+    muscle_fixed state[SCHED_BENCH_STATES][SCHED_STATES];
+    struct sched_node sn;
+    struct sched_slot slot[SCHED_BATCH];
+    struct task_struct task[SCHED_BENCH_TASKS];
+};
+
+/* Normalised remaining vruntime and wait, as the tick builds them */
+static void sched_bench_state(u64 *seed, muscle_fixed state[SCHED_STATES])
+{
+    int i;
+
+    for (i = 0; i < SCHED_STATES; i++)
+        state[i] = bench_rand(seed) % (4 * MUSCLE_FIXED_ONE);
+}
+
+/* Queue the tasks on this CPU's timeline in vruntime order */
+static void sched_bench_fill_rq(struct sched_bench *b, int cpu)
+{
+    struct rq *rq = cpu_rq(cpu);
+    struct rb_node *parent = NULL;
+    int i;
+
+    /* Where CFS starts a queue, so the state must survive the u64 wrap */
+    rq->cfs.min_vruntime = (u64)(-(1LL << 20));
+
+    /* A right spine: rb_next() walks it in order, like a real timeline */
+    for (i = 0; i < SCHED_BENCH_TASKS; i++) {
+        struct task_struct *p = &b->task[i];
+        struct rb_node *node = &p->se.run_node;
+
+        p->pid = 1000 + cpu * SCHED_BENCH_TASKS + i;
+        p->cpu = cpu;
+        p->cpus_ptr = cpu_online_mask;
+        p->se.vruntime = rq->cfs.min_vruntime + 1000000ULL * (i + 1);
+        p->se.exec_start = local_clock();
+        p->se.on_rq = 1;
+        node->__rb_parent_color = (unsigned long)parent;
+        node->rb_left = node->rb_right = NULL;
+        if (parent)
+            parent->rb_right = node;
+        parent = node;
+    }
+    rq->cfs.tasks_timeline.rb_root.rb_node = &b->task[0].se.run_node;
+    rq->cfs.tasks_timeline.rb_leftmost = &b->task[0].se.run_node;
+    rq->cfs.nr_running = SCHED_BENCH_TASKS;
+    rq->nr_running = SCHED_BENCH_TASKS;
+    rq->curr = &b->task[0];
+}
+
+static int sched_bench_setup(struct bench_thread *t)
+{
+    struct sched_bench *b = kzalloc(sizeof(*b), GFP_KERNEL);
+    int i;
+
+    if (!b)
+        return -ENOMEM;
+    for (i = 0; i < SCHED_BENCH_STATES; i++)
+        sched_bench_state(&t->seed, b->state[i]);
+    for (i = 0; i < SCHED_BATCH; i++) {
+        b->sn.slot[i] = &b->slot[i];
+        b->sn.n[i] = SCHED_ACTIONS;
+    }
+    sched_bench_fill_rq(b, t->cpu);
+    t->priv = b;
+    return 0;
+}
+
+static int sched_bench_direct_setup(struct bench_thread *t)
+{
+    WRITE_ONCE(sched_batch, false);
+    return sched_bench_setup(t);
+}
+
+static int sched_bench_batched_setup(struct bench_thread *t)
+{
+    WRITE_ONCE(sched_batch, true);
+    return sched_bench_setup(t);
+}
+
+static int sched_bench_suggest_setup(struct bench_thread *t)
+{
+    WRITE_ONCE(sched_balance, true);
+    return sched_bench_setup(t);
+}
+
+static void sched_bench_teardown(struct bench_thread *t)
+{
+    struct rq *rq = cpu_rq(t->cpu);
+
+    rq->cfs.tasks_timeline = (struct rb_root_cached){};
+    rq->cfs.nr_running = rq->nr_running = 0;
+    rq->curr = NULL;
+    kfree(t->priv);
+}
+
+/* Learning on and the trainer idle: prices the recording in the tick */
+static int sched_bench_learn_setup(struct bench_thread *t)
+{
+    WRITE_ONCE(sched_learn, true);
+    return sched_bench_direct_setup(t);
+}
+
+static void sched_bench_learn_teardown(struct bench_thread *t)
+{
+    WRITE_ONCE(sched_learn, false);
+    sched_bench_teardown(t);
+}
+
+static void sched_bench_forward(struct bench_thread *t, unsigned long n)
+{
+    struct sched_bench *b = t->priv;
+    muscle_fixed q[SCHED_ACTIONS];
+    unsigned long i;
+
+    for (i = 0; i < n; i++)
+        sched_forward(rcu_dereference(sched_net), b->state[i % SCHED_BENCH_STATES], q);
+}
+
+/* n states, in node-sized batches of SCHED_BATCH */
+static void sched_bench_batch(struct bench_thread *t, unsigned long n)
+{
+    struct sched_bench *b = t->priv;
+    struct sched_node *sn = &b->sn;
+    unsigned long i;
+    int j, nb;
+
+    for (i = 0; i < n; i += nb) {
+        nb = min_t(unsigned long, n - i, SCHED_BATCH);
+        for (j = 0; j < nb; j++) {
+            memcpy(sn->x[j], b->state[(i + j) % SCHED_BENCH_STATES], sizeof(sn->x[j]));
+            sn->gen[j] = i + j;
+        }
+        sched_batch_run(sn, nb);
+    }
+}
+
+static void sched_bench_tick(struct bench_thread *t, unsigned long n)
+{
+    struct sched_bench *b = t->priv;
+    struct rq *rq = cpu_rq(t->cpu);
+    unsigned long i;
+
+    for (i = 0; i < n; i++) {
+        /* Run one task per tick so vruntimes and waits keep moving */
+        b->task[i % SCHED_BENCH_TASKS].se.vruntime += 250000;
+        rq->cfs.min_vruntime += 250000 / SCHED_BENCH_TASKS;
+        b->task[i % SCHED_BENCH_TASKS].se.exec_start = local_clock();
+        muscle_scheduler_tick(rq);
+        bench_poll_work(t, i);
+    }
+    bench_flush_work(t);
+}
+
+static void sched_bench_suggest(struct bench_thread *t, unsigned long n)
+{
+    struct sched_bench *b = t->priv;
+    unsigned long i;
+
+    for (i = 0; i < n; i++) {
+        struct task_struct *p = &b->task[i % SCHED_BENCH_TASKS];
+
+        muscle_sched_suggest_cpu(p, t->cpu);
+    }
+}
+
+static struct {
+    unsigned long ticks, agree, override[2];
+    s64 wait[3];                /* summed wait feature: replay, live, CFS pick */
+    unsigned long train_at;
+} sched_replay;
+
+static void sched_bench_learn_on(void)
+{
+    sched_learn_set("1", &__param_sched_learn);
+}
+
+static void sched_bench_replay(const struct muscle_trace_rec *rec)
+{
+    muscle_fixed state[SCHED_STATES], q[SCHED_ACTIONS];
+    int n = min_t(int, rec->sched.n, SCHED_ACTIONS), live = rec->sched.action;
+    int i, action;
+
+    if (!n)
+        return;
+    for (i = 0; i < SCHED_STATES; i++)
+        state[i] = rec->sched.state[i];
+    action = sched_forward(rcu_dereference(sched_net), state, q);
+    if (action >= n)
+        action = -1;
+    if (live >= n)
+        live = -1;
+    if (READ_ONCE(sched_learn)) {
+        /* Whether the live pick switched tasks is not captured; assume overrides did */
+        sched_learn_record(state, n, max(live, 0), live > 0);
+        if (!sched_replay.train_at)
+            sched_replay.train_at = jiffies + SCHED_TRAIN_PERIOD;
+        if (time_after_eq(jiffies, sched_replay.train_at)) {
+            sched_train_fn(&sched_train_work.work);
+            sched_replay.train_at = jiffies + SCHED_TRAIN_PERIOD;
+        }
+    }
+
+    sched_replay.ticks++;
+    sched_replay.agree += action == live;
+    sched_replay.override[0] += action > 0;
+    sched_replay.override[1] += live > 0;
+    sched_replay.wait[0] += state[SCHED_ACTIONS + max(action, 0)];
+    sched_replay.wait[1] += state[SCHED_ACTIONS + max(live, 0)];
+    sched_replay.wait[2] += state[SCHED_ACTIONS];
+}
+
+static void sched_bench_report(void)
+{
+    unsigned long n = sched_replay.ticks;
+
+    if (!n)
+        return;
+    printf("sched: %lu ticks, replay agrees with live %.1f%%\n", n,
+           bench_pct(sched_replay.agree, n));
+    printf("  replay  overrides CFS %5.1f%%  mean wait %.3f\n",
+           bench_pct(sched_replay.override[0], n),
+           muscle_fixed_to_float(sched_replay.wait[0] / (s64)n));
+    printf("  live    overrides CFS %5.1f%%  mean wait %.3f\n",
+           bench_pct(sched_replay.override[1], n),
+           muscle_fixed_to_float(sched_replay.wait[1] / (s64)n));
+    printf("  cfs                          mean wait %.3f\n",
+           muscle_fixed_to_float(sched_replay.wait[2] / (s64)n));
+    if (READ_ONCE(sched_learn))
+        printf("  learned from %llu samples\n", muscle_stat_read(&sched_stats, MUSCLE_STAT_LEARN));
+}
+
+static const struct bench_case sched_bench_cases[] = {
+    {
+        .name     = "forward",
+        .desc     = "DQN forward + argmax",
+        .setup    = sched_bench_setup,
+        .teardown = sched_bench_teardown,
+        .run      = sched_bench_forward,
+    },
+    {
+        .name     = "batch",
+        .desc     = "per-node batch of 16, per state",
+        .setup    = sched_bench_setup,
+        .teardown = sched_bench_teardown,
+        .run      = sched_bench_batch,
+    },
+    {
+        .name     = "tick",
+        .desc     = "muscle_scheduler_tick(), direct",
+        .setup    = sched_bench_direct_setup,
+        .teardown = sched_bench_teardown,
+        .run      = sched_bench_tick,
+    },
+    {
+        .name     = "tick-batched",
+        .desc     = "muscle_scheduler_tick(), batched + worker",
+        .setup    = sched_bench_batched_setup,
+        .teardown = sched_bench_teardown,
+        .run      = sched_bench_tick,
+    },
+    {
+        .name     = "tick-learn",
+        .desc     = "muscle_scheduler_tick(), direct, recording experience",
+        .setup    = sched_bench_learn_setup,
+        .teardown = sched_bench_learn_teardown,
+        .run      = sched_bench_tick,
+    },
+    {
+        .name     = "suggest",
+        .desc     = "muscle_sched_suggest_cpu()",
+        .setup    = sched_bench_suggest_setup,
+        .teardown = sched_bench_teardown,
+        .run      = sched_bench_suggest,
+    },
+};
+
+const struct bench_muscle bench_sched = {
+    .name     = "sched",
+    .wset     = &sched_wset,
+    .cases    = sched_bench_cases,
+    .nr_cases = ARRAY_SIZE(sched_bench_cases),
+    .trace    = MUSCLE_TRACE_SCHED,
+    .replay   = sched_bench_replay,
+    .report   = sched_bench_report,
+    .learn    = sched_bench_learn_on,
+};
@@ -0,0 +1,131 @@
+/*
+ * MuscleSecurity: one-at-a-time scoring, windowed scoring (batched
+ * encoder/decoder over SEC_WINDOW_MAX syscalls), and the syscall-entry
+ * hook end to end with sampling and verdict caching as configured.
+ *
+ * Replay scores every captured syscall, as with sec_sample=1 and no
+ * verdict cache hits, pooling statistics on the capture's own clock.
+ * Each anomaly it reports is a false positive if the capture was clean.
+ */
+#include "../../../kernel/muscle_security.c"
+
+#include "bench.h"
+
+static void sec_bench_event(const struct bench_sys *s, struct muscle_event *ev)
+{
+    *ev = (struct muscle_event) {
+        .a = s->nr,
+        .b = s->arg1,
+        .c = s->arg2,
+        .d = s->pid,
+        .e = s->uid,
+    };
+}
+
+static void sec_bench_score(struct bench_thread *t, unsigned long n)
+{
+    const struct sec_model *m = rcu_dereference(sec_model);
+    struct sec_stats *st = this_cpu_ptr(&sec_stats);
+    struct muscle_event ev;
+
+    while (n--) {
+        sec_bench_event(bench_next_sys(t), &ev);
+        sec_score(m, st, &ev);
+    }
+}
+
+static void sec_bench_window(struct bench_thread *t, unsigned long n)
+{
+    const struct sec_model *m = rcu_dereference(sec_model);
+    struct sec_stats *st = this_cpu_ptr(&sec_stats);
+    struct muscle_event ev;
+
+    while (n--) {
+        sec_bench_event(bench_next_sys(t), &ev);
+        sec_window_add(m, st, &ev, SEC_WINDOW_MAX, t->cpu);
+    }
+}
+
+static void sec_bench_hook(struct bench_thread *t, unsigned long n)
+{
+    unsigned long i;
+
+    for (i = 0; i < n; i++) {
+        const struct bench_sys *s = bench_next_sys(t);
+
+        shim_set_task(s->pid, s->uid);
+        muscle_security_check(s->nr, s->arg1, s->arg2);
+        bench_poll_work(t, i);
+    }
+    bench_flush_work(t);
+}
+
+/* As writes to enable; the shim's keys are a load and a branch, not a NOP */
+static int sec_bench_off_setup(struct bench_thread *t)
+{
+    return muscle_switch_ops.set("0", &__param_enable);
+}
+
+static void sec_bench_off_teardown(struct bench_thread *t)
+{
+    muscle_switch_ops.set("1", &__param_enable);
+}
+
+static struct {
+    unsigned long syscalls, flagged;
+    u64 next_publish;
+    bool model;
+} sec_replay;
+
+static void sec_bench_replay(const struct muscle_trace_rec *rec)
+{
+    long kills = atomic_long_read(&shim_kills);
+
+    sec_replay.syscalls++;
+    if (!rcu_access_pointer(sec_model))
+        return;
+    sec_replay.model = true;
+    if (rec->ts >= sec_replay.next_publish) {
+        if (sec_replay.next_publish)
+            sec_stats_fn(NULL);
+        sec_replay.next_publish = rec->ts + max(sec_publish_ms, 10U) * NSEC_PER_MSEC;
+    }
+    sec_drain(&sec_evq, rec->cpu, &rec->ev, 1);
+    sec_replay.flagged += atomic_long_read(&shim_kills) != kills;
+}
+
+static void sec_bench_report(void)
+{
+    if (!sec_replay.syscalls)
+        return;
+    if (!sec_replay.model) {
+        printf("security: %lu syscalls, no model loaded (--blob security=FILE)\n",
+               sec_replay.syscalls);
+        return;
+    }
+    printf("security: %lu syscalls scored, %lu flagged (%.3f%%)\n", sec_replay.syscalls,
+           sec_replay.flagged, bench_pct(sec_replay.flagged, sec_replay.syscalls));
+}
+
+static const struct bench_case sec_bench_cases[] = {
+    { .name = "score", .desc = "autoencoder forward + loss", .run = sec_bench_score },
+    { .name = "window", .desc = "batched window of 16, per syscall", .run = sec_bench_window },
+    { .name = "hook", .desc = "muscle_security_check() + ring drain", .run = sec_bench_hook },
+    {
+        .name     = "hook-off",
+        .desc     = "muscle_security_check() with enable=0",
+        .setup    = sec_bench_off_setup,
+        .teardown = sec_bench_off_teardown,
+        .run      = sec_bench_hook,
+    },
+};
+
+const struct bench_muscle bench_security = {
+    .name     = "security",
+    .wset     = &sec_wset,
+    .cases    = sec_bench_cases,
+    .nr_cases = ARRAY_SIZE(sec_bench_cases),
+    .trace    = MUSCLE_TRACE_SECURITY,
+    .replay   = sec_bench_replay,
+    .report   = sec_bench_report,
+};
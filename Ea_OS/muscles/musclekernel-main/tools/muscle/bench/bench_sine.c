@@ -0,0 +1,32 @@
+/*
+ * MuscleSine: the 1→40→40→1 integer forward pass, which is also what
+ * the cpufreq governor's load predictor runs per decision.
+ *
+ * muscle_sine_weights has no definition in the tree; run the regressor
+ * on random weights of the same shape (see bench_sine_fill()).
+ */
+#define muscle_sine_weights bench_sine_weights
+#include "../../../kernel/muscle_core.c"
+
+#include "bench.h"
+
+static void sine_bench_forward(struct bench_thread *t, unsigned long n)
+{
+    muscle_fixed x = 0;
+
+    while (n--) {
+        muscle_sine_forward(x);
+        x = (x + 97) & (8 * MUSCLE_FIXED_ONE - 1);
+    }
+}
+
+static const struct bench_case sine_bench_cases[] = {
+    { .name = "forward", .desc = "3-layer MLP forward", .run = sine_bench_forward },
+};
+
+const struct bench_muscle bench_sine = {
+    .name     = "sine",
+    .wset     = &sine_wset,
+    .cases    = sine_bench_cases,
+    .nr_cases = ARRAY_SIZE(sine_bench_cases),
+};
@@ -0,0 +1,169 @@
+/*
+ * muscle-replay: score weight sets against captured hook inputs.
+ *
+ *   muscle-replay [--blob muscle=file]... [--lstm-impl name] [--learn]
+ *                 [-m muscle[,muscle]] [-v] FILE...
+ *
+ * FILEs are the per-CPU capture files of tools/muscle/capture.sh (or of
+ * muscle-bench --trace-dir).  Records are merged into one stream by
+ * timestamp and fed, one at a time and as the CPU that captured them,
+ * to each selected muscle's replay callback; jiffies follows the
+ * capture's clock.  local_clock() is only roughly in step across CPUs,
+ * so the order between CPUs is approximate; within a CPU it is exact.
+ *
+ * Muscles run the model they would at boot plus any --blob; none gets
+ * random weights, so a muscle without a model only has its live
+ * decisions scored.
+ */
+#include <getopt.h>
+
+#include "bench.h"
+
+#define REPLAY_MAX_BLOBS    16
+
+static void replay_usage(FILE *f)
+{
+    fprintf(f,
+        "usage: muscle-replay [options] FILE...\n"
+        "  -m, --muscles LIST       comma-separated muscles to score (default all)\n"
+        "      --blob MUSCLE=FILE   load a weight blob (tools/muscle/mkblob.py)\n"
+        "      --lstm-impl NAME     LSTM gate kernel (available: %s)\n"
+        "      --learn              let the models train online as they replay\n"
+        "  -v, --verbose            show kernel log output (twice for more)\n",
+        bench_lstm_impls());
+}
+
+enum {
+    OPT_LSTM = 256,
+    OPT_BLOB,
+    OPT_LEARN,
+};
+
+static const struct option replay_options[] = {
+    { "muscles",   required_argument, NULL, 'm' },
+    { "verbose",   no_argument,       NULL, 'v' },
+    { "help",      no_argument,       NULL, 'h' },
+    { "lstm-impl", required_argument, NULL, OPT_LSTM },
+    { "blob",      required_argument, NULL, OPT_BLOB },
+    { "learn",     no_argument,       NULL, OPT_LEARN },
+    { }
+};
+
+static void replay_die(const char *what, const char *arg, int err)
+{
+    fprintf(stderr, "muscle-replay: %s %s: %s\n", what, arg, strerror(-err));
+    exit(1);
+}
+
+static bool replay_selected(const char *list, const char *name)
+{
+    size_t len = strlen(name);
+    const char *p;
+
+    if (!list)
+        return true;
+    for (p = list; (p = strstr(p, name)); p += len)
+        if ((p == list || p[-1] == ',') && (!p[len] || p[len] == ','))
+            return true;
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    const char *blobs[REPLAY_MAX_BLOBS], *lstm_impl = NULL, *muscles = NULL;
+    static struct bench_capture cap;
+    const struct muscle_trace_rec *rec;
+    unsigned int nr_blobs = 0, i;
+    unsigned long sel = 0;
+    bool learn = false;
+    int ch, ret;
+
+    while ((ch = getopt_long(argc, argv, "m:vh", replay_options, NULL)) != -1) {
+        switch (ch) {
+        case 'm':
+            muscles = optarg;
+            break;
+        case 'v':
+            shim_verbose++;
+            break;
+        case 'h':
+            replay_usage(stdout);
+            return 0;
+        case OPT_LSTM:
+            lstm_impl = optarg;
+            break;
+        case OPT_BLOB:
+            if (nr_blobs == REPLAY_MAX_BLOBS || !strchr(optarg, '='))
+                replay_die("bad blob", optarg, -EINVAL);
+            blobs[nr_blobs++] = optarg;
+            break;
+        case OPT_LEARN:
+            learn = true;
+            break;
+        default:
+            replay_usage(stderr);
+            return 2;
+        }
+    }
+    if (optind == argc) {
+        replay_usage(stderr);
+        return 2;
+    }
+
+    /* Boot with every CPU a capture can name */
+    nr_cpu_ids = NR_CPUS;
+    bench_sine_fill(2);
+    ret = shim_run_initcalls();
+    if (ret)
+        fprintf(stderr, "muscle-replay: some initcalls failed (%d), continuing\n", ret);
+    if (lstm_impl) {
+        ret = bench_lstm_select(lstm_impl);
+        if (ret)
+            replay_die("LSTM implementation", lstm_impl, ret);
+    }
+    for (i = 0; i < nr_blobs; i++) {
+        ret = bench_load_blob(blobs[i]);
+        if (ret)
+            replay_die("loading", blobs[i], ret);
+    }
+    for (i = 0; i < bench_nr_muscles; i++) {
+        const struct bench_muscle *m = bench_muscles[i];
+
+        if (!m->replay || !replay_selected(muscles, m->name))
+            continue;
+        ret = m->init ? m->init() : 0;
+        if (ret)
+            replay_die("setting up", m->name, ret);
+        if (learn && m->learn)
+            m->learn();
+        sel |= BIT(i);
+    }
+    if (!sel)
+        replay_die("no muscle to replay in", muscles, -ENOENT);
+
+    ret = bench_capture_open(&cap, argv + optind, argc - optind);
+    if (ret)
+        replay_die("opening capture", argv[optind], ret);
+    while ((rec = bench_capture_next(&cap))) {
+        shim_cpu = rec->cpu % nr_cpu_ids;
+        shim_current()->cpu = shim_cpu;
+        shim_current()->pid = rec->pid;
+        jiffies = rec->ts / (NSEC_PER_SEC / HZ);
+        for (i = 0; i < bench_nr_muscles; i++)
+            if ((sel & BIT(i)) && bench_muscles[i]->trace == rec->type)
+                bench_muscles[i]->replay(rec);
+    }
+    ret = cap.err;
+    bench_capture_close(&cap);
+    if (ret)
+        replay_die("reading", "capture", ret);
+
+    printf("# %llu records from %u files over %.3f s, %llu dropped at capture\n",
+           (unsigned long long)cap.records, cap.nr,
+           (cap.last_ts - cap.first_ts) / 1e9,
+           (unsigned long long)bench_capture_dropped(&cap));
+    for (i = 0; i < bench_nr_muscles; i++)
+        if ((sel & BIT(i)) && bench_muscles[i]->report)
+            bench_muscles[i]->report();
+    return 0;
+}
@@ -0,0 +1 @@
+#include <arm_neon.h>
@@ -0,0 +1,22 @@
+#ifndef _SHIM_TRACEPOINT_H
+#define _SHIM_TRACEPOINT_H
+
+#include "../../kernel.h"
+
+/*
+ * A disabled tracepoint is a patched-out branch in the kernel; here every
+ * TRACE_EVENT() becomes an empty inline so the call sites still compile
+ * against the real prototypes and cost nothing.
+ */
+#define TP_PROTO(...)           __VA_ARGS__
+#define TP_ARGS(...)            __VA_ARGS__
+
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print)          \
+    static inline void trace_##name(proto) { }                          \
+    static inline bool trace_##name##_enabled(void) { return false; }
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(template, name, proto, args)                       \
+    static inline void trace_##name(proto) { }                          \
+    static inline bool trace_##name##_enabled(void) { return false; }
+
+#endif /* _SHIM_TRACEPOINT_H */
@@ -0,0 +1,59 @@
+#ifndef _SHIM_SCHED_SCHED_H
+#define _SHIM_SCHED_SCHED_H
+
+#include "../../kernel.h"
+
+/*
+ * The slice of kernel/sched/sched.h the scheduler muscle touches.  Each
+ * harness CPU has one runqueue whose CFS timeline the benchmark fills
+ * with tasks; group scheduling is not modelled (every entity is a task).
+ */
+struct cfs_rq {
+    unsigned int nr_running;
+    u64 min_vruntime;
+    struct rb_root_cached tasks_timeline;
+};
+
+struct rq {
+    raw_spinlock_t __lock;
+    unsigned int nr_running;
+    int cpu;
+    struct task_struct *curr;
+    struct cfs_rq cfs;
+    u64 clock_task;
+};
+
+struct rq_flags {
+    unsigned long flags;
+};
+
+struct sched_domain {
+    struct cpumask span;
+};
+
+DECLARE_PER_CPU(struct rq, runqueues);
+DECLARE_PER_CPU(struct sched_domain __rcu *, sd_llc);
+
+#define cpu_rq(cpu)             (&per_cpu(runqueues, (cpu)))
+#define this_rq()               this_cpu_ptr(&runqueues)
+#define cpu_of(rq)              ((rq)->cpu)
+#define rq_lock(rq, rf)         do { (void)(rf); raw_spin_lock(&(rq)->__lock); } while (0)
+#define rq_unlock(rq, rf)       do { (void)(rf); raw_spin_unlock(&(rq)->__lock); } while (0)
+#define update_rq_clock(rq)     ((rq)->clock_task = local_clock())
+#define rq_clock_task(rq)       ((rq)->clock_task)
+#define sched_domain_span(sd)   ((const struct cpumask *)&(sd)->span)
+#define entity_is_task(se)      (!(se)->my_q)
+#define task_of(se)             container_of(se, struct task_struct, se)
+
+/* One LLC spanning every CPU, like the single shim NUMA node */
+#define cpus_share_cache(a, b)  ((void)(a), (void)(b), true)
+#define available_idle_cpu(cpu) (!READ_ONCE(cpu_rq(cpu)->nr_running))
+
+static inline struct sched_entity *__pick_first_entity(struct cfs_rq *cfs_rq)
+{
+    struct rb_node *left = cfs_rq->tasks_timeline.rb_leftmost;
+
+    return left ? rb_entry(left, struct sched_entity, run_node) : NULL;
+}
+
+#endif /* _SHIM_SCHED_SCHED_H */
@@ -0,0 +1 @@
+/* Tracepoints are compiled out in the harness, see <linux/tracepoint.h> */
@@ -0,0 +1,1324 @@
+/*
+ * Userspace stand-ins for the kernel APIs the muscles use, just enough to
+ * build and run them unmodified in tools/muscle/bench.  Every <linux/...>
+ * and <asm/...> header under shim/include forwards here.
+ *
+ * The semantics that matter for timing are kept: per-CPU data lives in
+ * separate per-CPU copies (a thread "is" a CPU, see shim_cpu), locks and
+ * seqcounts are real, and work items queue up until the owning thread
+ * runs them with shim_run_work().  RCU read sections are free, which is
+ * what they cost in a non-preemptible kernel too; nothing here frees a
+ * model under a running reader.
+ */
+#ifndef _SHIM_KERNEL_H
+#define _SHIM_KERNEL_H
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+/* Types */
+typedef int8_t s8;
+typedef uint8_t u8;
+typedef int16_t s16;
+typedef uint16_t u16;
+typedef int32_t s32;
+typedef uint32_t u32;
+typedef long long s64;
+typedef unsigned long long u64;
+typedef u16 __le16;
+typedef u32 __le32;
+typedef u64 __le64;
+typedef unsigned int gfp_t;
+typedef u64 sector_t;
+typedef unsigned long pgoff_t;
+typedef s64 ktime_t;
+typedef u32 blk_opf_t;
+
+#define S8_MAX          INT8_MAX
+#define S8_MIN          INT8_MIN
+#define S16_MAX         INT16_MAX
+#define S16_MIN         INT16_MIN
+#define S32_MAX         INT32_MAX
+#define S32_MIN         INT32_MIN
+#define S64_MAX         INT64_MAX
+#define S64_MIN         INT64_MIN
+#define U8_MAX          UINT8_MAX
+#define U16_MAX         UINT16_MAX
+#define U32_MAX         UINT32_MAX
+#define U64_MAX         UINT64_MAX
+
+/* Compiler */
+#define __init
+#define __exit
+#define __read_mostly
+#define __user
+#define __rcu
+#define __percpu
+#define __force
+#define __iomem
+#define __packed                __attribute__((packed))
+#define __aligned(x)            __attribute__((aligned(x)))
+#define __maybe_unused          __attribute__((unused))
+#define __always_unused         __attribute__((unused))
+#define __used                  __attribute__((used))
+#define noinline                __attribute__((noinline))
+#undef __always_inline
+#define __always_inline         inline __attribute__((always_inline))
+#define fallthrough             __attribute__((fallthrough))
+#define likely(x)               __builtin_expect(!!(x), 1)
+#define unlikely(x)             __builtin_expect(!!(x), 0)
+#define unreachable()           __builtin_unreachable()
+#define barrier()               __asm__ __volatile__("" ::: "memory")
+
+#define L1_CACHE_BYTES          64
+#define SMP_CACHE_BYTES         L1_CACHE_BYTES
+#define ____cacheline_aligned   __aligned(SMP_CACHE_BYTES)
+#define ____cacheline_aligned_in_smp ____cacheline_aligned
+
+#define READ_ONCE(x)            (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v)        (*(volatile __typeof__(x) *)&(x) = (v))
+#define data_race(x)            (x)
+
+/* Hide a pointer from the optimizer's idea of which object it points into */
+#define RELOC_HIDE(ptr, off)                                            \
+    ({                                                                  \
+        unsigned long __p;                                              \
+        __asm__("" : "=r"(__p) : "0"(ptr));                             \
+        (__typeof__(ptr))(__p + (off));                                 \
+    })
+
+/* Opaque to every muscle that only passes them through */
+struct path;
+struct rq;
+
+/* Helpers */
+#define ARRAY_SIZE(a)           (sizeof(a) / sizeof((a)[0]))
+#define container_of(p, t, m)   ((t *)((char *)(p) - offsetof(t, m)))
+#define BIT(n)                  (1UL << (n))
+#define BITS_PER_LONG           64
+#define ALIGN(x, a)             (((x) + ((a) - 1)) & ~((__typeof__(x))(a) - 1))
+#define IS_ALIGNED(x, a)        (((x) & ((__typeof__(x))(a) - 1)) == 0)
+#define DIV_ROUND_UP(n, d)      (((n) + (d) - 1) / (d))
+#define BUILD_BUG_ON(c)         _Static_assert(!(c), #c)
+#define static_assert(e, ...)   _Static_assert(e, #e)
+#define struct_size(p, m, n)    (sizeof(*(p)) + sizeof((p)->m[0]) * (n))
+#define array_size(a, b)        ((size_t)(a) * (size_t)(b))
+#define IS_ENABLED(x)           0
+
+#define min(a, b)                                                       \
+    ({ __typeof__(a) __a = (a); __typeof__(b) __b = (b); __a < __b ? __a : __b; })
+#define max(a, b)                                                       \
+    ({ __typeof__(a) __a = (a); __typeof__(b) __b = (b); __a > __b ? __a : __b; })
+#define min_t(t, a, b)          min((t)(a), (t)(b))
+#define max_t(t, a, b)          max((t)(a), (t)(b))
+#define clamp(v, lo, hi)        min(max(v, lo), hi)
+#define clamp_t(t, v, lo, hi)   min_t(t, max_t(t, v, lo), hi)
+#undef abs
+#define abs(x)                                                          \
+    ({ __typeof__(x) __x = (x); __x < 0 ? -__x : __x; })
+#define swap(a, b)                                                      \
+    do { __typeof__(a) __t = (a); (a) = (b); (b) = __t; } while (0)
+
+/* Errors */
+#define MAX_ERRNO       4095
+
+static inline void *ERR_PTR(long err)
+{
+    return (void *)err;
+}
+
+static inline long PTR_ERR(const void *p)
+{
+    return (long)p;
+}
+
+static inline bool IS_ERR(const void *p)
+{
+    return (unsigned long)p >= (unsigned long)-MAX_ERRNO;
+}
+
+static inline bool IS_ERR_OR_NULL(const void *p)
+{
+    return !p || IS_ERR(p);
+}
+
+/* printk */
+extern int shim_verbose;
+
+#define pr_fmt(fmt) fmt
+#define shim_printk(lvl, fmt, ...)                                      \
+    do {                                                                \
+        if (shim_verbose >= (lvl))                                      \
+            fprintf(stderr, fmt, ##__VA_ARGS__);                        \
+    } while (0)
+#define pr_emerg(fmt, ...)      shim_printk(0, fmt, ##__VA_ARGS__)
+#define pr_alert(fmt, ...)      shim_printk(1, fmt, ##__VA_ARGS__)
+#define pr_err(fmt, ...)        shim_printk(0, fmt, ##__VA_ARGS__)
+#define pr_warn(fmt, ...)       shim_printk(1, fmt, ##__VA_ARGS__)
+#define pr_info(fmt, ...)       shim_printk(2, fmt, ##__VA_ARGS__)
+#define pr_debug(fmt, ...)      shim_printk(3, fmt, ##__VA_ARGS__)
+#define printk(fmt, ...)        shim_printk(2, fmt, ##__VA_ARGS__)
+#define pr_alert_ratelimited(fmt, ...)  pr_alert(fmt, ##__VA_ARGS__)
+
+#define WARN_ON(c)                                                      \
+    ({                                                                  \
+        bool __c = !!(c);                                               \
+        if (unlikely(__c))                                              \
+            fprintf(stderr, "WARNING: %s:%d: %s\n", __FILE__, __LINE__, #c); \
+        __c;                                                            \
+    })
+#define WARN_ON_ONCE(c)                                                 \
+    ({                                                                  \
+        static bool __warned;                                           \
+        bool __c = !!(c);                                               \
+        if (unlikely(__c) && !__warned) {                               \
+            __warned = true;                                            \
+            fprintf(stderr, "WARNING: %s:%d: %s\n", __FILE__, __LINE__, #c); \
+        }                                                               \
+        __c;                                                            \
+    })
+#define BUG_ON(c)               do { if (unlikely(c)) abort(); } while (0)
+
+/*
+ * Initcalls run in kernel level order from shim_run_initcalls(), which
+ * the harness calls once on CPU 0 before any benchmark.
+ */
+typedef int (*initcall_t)(void);
+
+#define __shim_initcall(fn, lvl)                                        \
+    static initcall_t __initcall_##fn __used                            \
+        __attribute__((section("shim_initcall" #lvl))) = fn
+#define core_initcall(fn)       __shim_initcall(fn, 1)
+#define postcore_initcall(fn)   __shim_initcall(fn, 2)
+#define arch_initcall(fn)       __shim_initcall(fn, 3)
+#define subsys_initcall(fn)     __shim_initcall(fn, 4)
+#define fs_initcall(fn)         __shim_initcall(fn, 5)
+#define device_initcall(fn)     __shim_initcall(fn, 6)
+#define module_init(fn)         __shim_initcall(fn, 6)
+#define late_initcall(fn)       __shim_initcall(fn, 7)
+#define module_exit(fn)         static void (*__exitcall_##fn)(void) __used = fn
+
+#define THIS_MODULE             ((void *)0)
+#define MODULE_LICENSE(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_ALIAS(x)
+#define EXPORT_SYMBOL(x)
+#define EXPORT_SYMBOL_GPL(x)
+
+int shim_run_initcalls(void);
+
+/* Module parameters: the harness sets the variables directly */
+struct kernel_param;
+
+struct kernel_param_ops {
+    int (*set)(const char *val, const struct kernel_param *kp);
+    int (*get)(char *buf, const struct kernel_param *kp);
+};
+
+struct kernel_param {
+    const char *name;
+    const struct kernel_param_ops *ops;
+    void *arg;
+};
+
+#define module_param(name, type, perm)
+#define module_param_named(name, value, type, perm)
+#define module_param_cb(_name, _ops, _arg, perm)                        \
+    static const struct kernel_param __param_##_name __used = {         \
+        .name = #_name, .ops = _ops, .arg = _arg,                       \
+    }
+#define MODULE_PARM_DESC(name, desc)
+
+int param_set_uint(const char *val, const struct kernel_param *kp);
+int param_get_uint(char *buf, const struct kernel_param *kp);
+int param_set_int(const char *val, const struct kernel_param *kp);
+int param_get_int(char *buf, const struct kernel_param *kp);
+int param_set_bool(const char *val, const struct kernel_param *kp);
+int param_get_bool(char *buf, const struct kernel_param *kp);
+
+int sysfs_emit(char *buf, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int sysfs_emit_at(char *buf, int at, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/* Atomics, bitops and barriers */
+#define smp_mb()                __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_rmb()               __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb()               __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_mb__before_atomic() smp_mb()
+#define smp_mb__after_atomic()  smp_mb()
+#define smp_load_acquire(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#if defined(__x86_64__)
+#define cpu_relax()             __builtin_ia32_pause()
+#else
+#define cpu_relax()             __asm__ __volatile__("yield" ::: "memory")
+#endif
+
+typedef struct { int counter; } atomic_t;
+typedef struct { long counter; } atomic_long_t;
+typedef struct { s64 counter; } atomic64_t;
+
+#define ATOMIC_INIT(i)          { (i) }
+#define ATOMIC_LONG_INIT(i)     { (i) }
+#define ATOMIC64_INIT(i)        { (i) }
+
+#define __shim_atomic_ops(pfx, T, V)                                    \
+static inline V pfx##_read(const T *v)                                  \
+{ return __atomic_load_n(&v->counter, __ATOMIC_RELAXED); }              \
+static inline void pfx##_set(T *v, V i)                                 \
+{ __atomic_store_n(&v->counter, i, __ATOMIC_RELAXED); }                 \
+static inline void pfx##_add(V i, T *v)                                 \
+{ __atomic_fetch_add(&v->counter, i, __ATOMIC_RELAXED); }               \
+static inline void pfx##_sub(V i, T *v)                                 \
+{ __atomic_fetch_sub(&v->counter, i, __ATOMIC_RELAXED); }               \
+static inline void pfx##_inc(T *v) { pfx##_add(1, v); }                 \
+static inline void pfx##_dec(T *v) { pfx##_sub(1, v); }                 \
+static inline V pfx##_add_return(V i, T *v)                             \
+{ return __atomic_add_fetch(&v->counter, i, __ATOMIC_SEQ_CST); }        \
+static inline V pfx##_inc_return(T *v) { return pfx##_add_return(1, v); } \
+static inline V pfx##_dec_return(T *v) { return pfx##_add_return(-1, v); } \
+static inline V pfx##_xchg(T *v, V i)                                   \
+{ return __atomic_exchange_n(&v->counter, i, __ATOMIC_SEQ_CST); }       \
+static inline V pfx##_cmpxchg(T *v, V old, V new)                       \
+{                                                                       \
+    __atomic_compare_exchange_n(&v->counter, &old, new, false,          \
+                                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);    \
+    return old;                                                         \
+}
+
+__shim_atomic_ops(atomic, atomic_t, int)
+__shim_atomic_ops(atomic_long, atomic_long_t, long)
+__shim_atomic_ops(atomic64, atomic64_t, s64)
+
+#define cmpxchg(p, o, n)                                                \
+    ({                                                                  \
+        __typeof__(*(p)) __o = (o);                                     \
+        __atomic_compare_exchange_n(p, &__o, n, false,                  \
+                                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED); \
+        __o;                                                            \
+    })
+#define xchg(p, v)              __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+
+static inline void set_bit(long nr, volatile unsigned long *addr)
+{
+    __atomic_fetch_or(&addr[nr / BITS_PER_LONG], 1UL << (nr % BITS_PER_LONG),
+                      __ATOMIC_RELAXED);
+}
+
+static inline void clear_bit(long nr, volatile unsigned long *addr)
+{
+    __atomic_fetch_and(&addr[nr / BITS_PER_LONG], ~(1UL << (nr % BITS_PER_LONG)),
+                       __ATOMIC_RELAXED);
+}
+
+static inline bool test_bit(long nr, const volatile unsigned long *addr)
+{
+    return (__atomic_load_n(&addr[nr / BITS_PER_LONG], __ATOMIC_RELAXED) >>
+            (nr % BITS_PER_LONG)) & 1;
+}
+
+static inline bool test_and_set_bit(long nr, volatile unsigned long *addr)
+{
+    unsigned long m = 1UL << (nr % BITS_PER_LONG);
+
+    return __atomic_fetch_or(&addr[nr / BITS_PER_LONG], m, __ATOMIC_SEQ_CST) & m;
+}
+
+static inline bool test_and_clear_bit(long nr, volatile unsigned long *addr)
+{
+    unsigned long m = 1UL << (nr % BITS_PER_LONG);
+
+    return __atomic_fetch_and(&addr[nr / BITS_PER_LONG], ~m, __ATOMIC_SEQ_CST) & m;
+}
+
+static inline int fls(unsigned int x)
+{
+    return x ? 32 - __builtin_clz(x) : 0;
+}
+
+static inline int fls64(u64 x)
+{
+    return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+#define __ffs(x)                __builtin_ctzl(x)
+#define ilog2(n)                ((int)(63 - __builtin_clzll((u64)(n))))
+#define is_power_of_2(n)        ((n) != 0 && (((n) & ((n) - 1)) == 0))
+#define roundup_pow_of_two(n)   (1UL << fls64((u64)(n) - 1))
+
+/* Hashing, as in <linux/hash.h> */
+#define GOLDEN_RATIO_32         0x61C88647
+#define GOLDEN_RATIO_64         0x61C8864680B583EBull
+
+static inline u32 hash_32(u32 val, unsigned int bits)
+{
+    return (val * GOLDEN_RATIO_32) >> (32 - bits);
+}
+
+static inline u32 hash_64(u64 val, unsigned int bits)
+{
+    return (u32)((val * GOLDEN_RATIO_64) >> (64 - bits));
+}
+
+static inline u32 hash_ptr(const void *ptr, unsigned int bits)
+{
+    return hash_64((unsigned long)ptr, bits);
+}
+
+/* 64-bit division */
+static inline u64 div_u64(u64 n, u32 d) { return n / d; }
+static inline s64 div_s64(s64 n, s32 d) { return n / d; }
+static inline u64 div64_u64(u64 n, u64 d) { return n / d; }
+static inline s64 div64_s64(s64 n, s64 d) { return n / d; }
+static inline u64 div_u64_rem(u64 n, u32 d, u32 *rem) { *rem = n % d; return n / d; }
+static inline u64 mul_u64_u64_shr(u64 a, u64 b, unsigned int shift)
+{
+    return (u64)(((unsigned __int128)a * b) >> shift);
+}
+#define do_div(n, base)                                                 \
+    ({ u32 __rem = (u32)((n) % (base)); (n) /= (base); __rem; })
+
+/* Bitwise integer square root, as lib/math/int_sqrt.c */
+static inline unsigned long int_sqrt(unsigned long x)
+{
+    unsigned long b, m, y = 0;
+
+    if (x <= 1)
+        return x;
+    m = 1UL << ((63 - __builtin_clzl(x)) & ~1UL);
+    while (m) {
+        b = y + m;
+        y >>= 1;
+        if (x >= b) {
+            x -= b;
+            y += m;
+        }
+        m >>= 2;
+    }
+    return y;
+}
+#define int_sqrt64(x)           ((u32)int_sqrt(x))
+
+/* Unaligned little-endian access (<asm/unaligned.h>), x86/arm64 hosts */
+#define le16_to_cpu(x)          ((u16)(x))
+#define le32_to_cpu(x)          ((u32)(x))
+#define le64_to_cpu(x)          ((u64)(x))
+#define cpu_to_le16(x)          ((__le16)(x))
+#define cpu_to_le32(x)          ((__le32)(x))
+#define cpu_to_le64(x)          ((__le64)(x))
+
+static inline u16 get_unaligned_le16(const void *p) { u16 v; memcpy(&v, p, 2); return v; }
+static inline u32 get_unaligned_le32(const void *p) { u32 v; memcpy(&v, p, 4); return v; }
+static inline u64 get_unaligned_le64(const void *p) { u64 v; memcpy(&v, p, 8); return v; }
+static inline void put_unaligned_le16(u16 v, void *p) { memcpy(p, &v, 2); }
+static inline void put_unaligned_le32(u32 v, void *p) { memcpy(p, &v, 4); }
+static inline void put_unaligned_le64(u64 v, void *p) { memcpy(p, &v, 8); }
+
+u32 crc32_le(u32 crc, const void *p, size_t len);
+
+/* CPUs: each harness thread runs as one CPU */
+#define NR_CPUS                 64
+
+struct cpumask {
+    unsigned long bits[NR_CPUS / BITS_PER_LONG];
+};
+
+extern __thread int shim_cpu;
+extern unsigned int nr_cpu_ids;
+extern struct cpumask __cpu_online_mask;
+extern unsigned int nr_node_ids;
+
+#define cpu_online_mask         ((const struct cpumask *)&__cpu_online_mask)
+#define cpu_possible_mask       cpu_online_mask
+#define smp_processor_id()      shim_cpu
+#define raw_smp_processor_id()  shim_cpu
+#define get_cpu()               shim_cpu
+#define put_cpu()               do { } while (0)
+#define preempt_disable()       barrier()
+#define preempt_enable()        barrier()
+#define local_irq_save(f)       do { (f) = 0; barrier(); } while (0)
+#define local_irq_restore(f)    do { (void)(f); barrier(); } while (0)
+#define local_irq_disable()     barrier()
+#define local_irq_enable()      barrier()
+#define local_bh_disable()      barrier()
+#define local_bh_enable()       barrier()
+#define irqs_disabled()         false
+#define in_task()               true
+#define in_interrupt()          false
+#define in_hardirq()            false
+#define might_sleep()           do { } while (0)
+#define cond_resched()          do { } while (0)
+
+static inline int cpumask_next_and(int n, const struct cpumask *a,
+                                   const struct cpumask *b)
+{
+    for (n++; n < (int)nr_cpu_ids; n++)
+        if (test_bit(n, a->bits) && test_bit(n, b->bits))
+            return n;
+    return nr_cpu_ids;
+}
+
+#define cpumask_test_cpu(c, m)  test_bit(c, (m)->bits)
+#define cpumask_any_and(a, b)   cpumask_next_and(-1, a, b)
+#define cpu_online(c)           ((unsigned int)(c) < nr_cpu_ids)
+#define num_online_cpus()       nr_cpu_ids
+#define num_possible_cpus()     nr_cpu_ids
+#define for_each_possible_cpu(c) for ((c) = 0; (c) < (int)nr_cpu_ids; (c)++)
+#define for_each_online_cpu(c)  for_each_possible_cpu(c)
+#define for_each_cpu(c, m)      for_each_cpu_and(c, m, m)
+#define for_each_cpu_and(c, a, b)                                       \
+    for ((c) = -1; ((c) = cpumask_next_and(c, a, b)) < (int)nr_cpu_ids;)
+
+/* One NUMA node holding every CPU */
+#define cpu_to_node(cpu)        ((void)(cpu), 0)
+#define numa_node_id()          0
+#define cpumask_of_node(node)   ((void)(node), cpu_online_mask)
+#define for_each_node(n)        for ((n) = 0; (n) < (int)nr_node_ids; (n)++)
+#define for_each_online_node(n) for_each_node(n)
+
+/*
+ * Per-CPU variables.  Static ones are placed in the shim_percpu section,
+ * which is copied once per CPU at startup; like the kernel, a per-CPU
+ * address plus shim_percpu_offset[cpu] gives that CPU's copy, and
+ * dynamic ones (alloc_percpu()) come from the same per-CPU units.
+ */
+extern unsigned long shim_percpu_offset[NR_CPUS];
+
+#define __shim_pcpu             __attribute__((section("shim_percpu")))
+#define DEFINE_PER_CPU(type, name)              __shim_pcpu __typeof__(type) name
+#define DEFINE_PER_CPU_ALIGNED(type, name)                              \
+    __shim_pcpu ____cacheline_aligned __typeof__(type) name
+#define DEFINE_PER_CPU_SHARED_ALIGNED(type, name)                       \
+    DEFINE_PER_CPU_ALIGNED(type, name)
+#define DEFINE_PER_CPU_READ_MOSTLY(type, name)  DEFINE_PER_CPU(type, name)
+#define DECLARE_PER_CPU(type, name)             extern __typeof__(type) name
+
+#define per_cpu_ptr(ptr, cpu)   RELOC_HIDE(ptr, shim_percpu_offset[cpu])
+#define per_cpu(var, cpu)       (*per_cpu_ptr(&(var), cpu))
+#define this_cpu_ptr(ptr)       per_cpu_ptr(ptr, shim_cpu)
+#define raw_cpu_ptr(ptr)        this_cpu_ptr(ptr)
+#define get_cpu_ptr(ptr)        this_cpu_ptr(ptr)
+#define put_cpu_ptr(ptr)        do { (void)(ptr); } while (0)
+
+#define this_cpu_read(pcp)      (*this_cpu_ptr(&(pcp)))
+#define this_cpu_write(pcp, v)  ((void)(*this_cpu_ptr(&(pcp)) = (v)))
+#define this_cpu_add(pcp, v)    ((void)(*this_cpu_ptr(&(pcp)) += (v)))
+#define this_cpu_sub(pcp, v)    ((void)(*this_cpu_ptr(&(pcp)) -= (v)))
+#define this_cpu_inc(pcp)       this_cpu_add(pcp, 1)
+#define this_cpu_dec(pcp)       this_cpu_sub(pcp, 1)
+#define this_cpu_inc_return(pcp) (++*this_cpu_ptr(&(pcp)))
+#define __this_cpu_read(pcp)    this_cpu_read(pcp)
+#define __this_cpu_write(pcp, v) this_cpu_write(pcp, v)
+#define __this_cpu_add(pcp, v)  this_cpu_add(pcp, v)
+#define __this_cpu_inc(pcp)     this_cpu_inc(pcp)
+#define __this_cpu_dec(pcp)     this_cpu_dec(pcp)
+#define raw_cpu_read(pcp)       this_cpu_read(pcp)
+#define raw_cpu_inc(pcp)        this_cpu_inc(pcp)
+
+void *__alloc_percpu(size_t size, size_t align);
+#define alloc_percpu(type)      ((type *)__alloc_percpu(sizeof(type), __alignof__(type)))
+#define free_percpu(p)          do { (void)(p); } while (0)
+
+/* Time */
+#define HZ                      1000
+#define NSEC_PER_USEC           1000ULL
+#define NSEC_PER_MSEC           1000000ULL
+#define NSEC_PER_SEC            1000000000ULL
+#define USEC_PER_SEC            1000000ULL
+#define TICK_NSEC               (NSEC_PER_SEC / HZ)
+
+/* Ticks from the monotonic clock, advanced by shim_update_jiffies() */
+extern volatile unsigned long jiffies;
+#define jiffies_64              ((u64)jiffies)
+
+u64 ktime_get_ns(void);
+void shim_update_jiffies(void);
+
+#define local_clock()           ktime_get_ns()
+#define sched_clock()           ktime_get_ns()
+#define ktime_get()             ((ktime_t)ktime_get_ns())
+#define ktime_to_ns(t)          ((s64)(t))
+#define msecs_to_jiffies(m)     ((unsigned long)(m) * HZ / 1000)
+#define usecs_to_jiffies(u)     DIV_ROUND_UP((unsigned long)(u) * HZ, 1000000)
+#define jiffies_to_msecs(j)     ((unsigned int)((j) * 1000 / HZ))
+#define time_after(a, b)        ((long)((b) - (a)) < 0)
+#define time_before(a, b)       time_after(b, a)
+#define time_after_eq(a, b)     ((long)((a) - (b)) >= 0)
+#define time_before_eq(a, b)    time_after_eq(b, a)
+
+/* Locks */
+typedef struct { int locked; } raw_spinlock_t;
+typedef struct { raw_spinlock_t rlock; } spinlock_t;
+
+#define __RAW_SPIN_LOCK_UNLOCKED(n)     { 0 }
+#define __SPIN_LOCK_UNLOCKED(n)         { { 0 } }
+#define DEFINE_RAW_SPINLOCK(n)          raw_spinlock_t n = __RAW_SPIN_LOCK_UNLOCKED(n)
+#define DEFINE_SPINLOCK(n)              spinlock_t n = __SPIN_LOCK_UNLOCKED(n)
+
+static inline void raw_spin_lock_init(raw_spinlock_t *l)
+{
+    l->locked = 0;
+}
+
+static inline bool raw_spin_trylock(raw_spinlock_t *l)
+{
+    return !__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+/* Yield while spinning: harness threads may outnumber host CPUs */
+static inline void raw_spin_lock(raw_spinlock_t *l)
+{
+    while (!raw_spin_trylock(l))
+        while (__atomic_load_n(&l->locked, __ATOMIC_RELAXED))
+            sched_yield();
+}
+
+static inline void raw_spin_unlock(raw_spinlock_t *l)
+{
+    __atomic_store_n(&l->locked, 0, __ATOMIC_RELEASE);
+}
+
+#define raw_spin_lock_irq(l)            raw_spin_lock(l)
+#define raw_spin_unlock_irq(l)          raw_spin_unlock(l)
+#define raw_spin_lock_irqsave(l, f)     do { (f) = 0; raw_spin_lock(l); } while (0)
+#define raw_spin_unlock_irqrestore(l, f) do { (void)(f); raw_spin_unlock(l); } while (0)
+
+#define spin_lock_init(l)               raw_spin_lock_init(&(l)->rlock)
+#define spin_lock(l)                    raw_spin_lock(&(l)->rlock)
+#define spin_unlock(l)                  raw_spin_unlock(&(l)->rlock)
+#define spin_trylock(l)                 raw_spin_trylock(&(l)->rlock)
+#define spin_lock_bh(l)                 spin_lock(l)
+#define spin_unlock_bh(l)               spin_unlock(l)
+#define spin_lock_irq(l)                spin_lock(l)
+#define spin_unlock_irq(l)              spin_unlock(l)
+#define spin_lock_irqsave(l, f)         raw_spin_lock_irqsave(&(l)->rlock, f)
+#define spin_unlock_irqrestore(l, f)    raw_spin_unlock_irqrestore(&(l)->rlock, f)
+#define spin_trylock_irqsave(l, f)      ({ (f) = 0; spin_trylock(l); })
+
+struct mutex {
+    pthread_mutex_t m;
+};
+
+#define DEFINE_MUTEX(n)         struct mutex n = { PTHREAD_MUTEX_INITIALIZER }
+#define mutex_init(l)           pthread_mutex_init(&(l)->m, NULL)
+#define mutex_destroy(l)        pthread_mutex_destroy(&(l)->m)
+#define mutex_lock(l)           pthread_mutex_lock(&(l)->m)
+#define mutex_unlock(l)         pthread_mutex_unlock(&(l)->m)
+#define mutex_trylock(l)        (pthread_mutex_trylock(&(l)->m) == 0)
+
+#define lockdep_assert_held(l)  do { (void)(l); } while (0)
+#define lockdep_is_held(l)      ((void)(l), 1)
+
+/* Without PREEMPT_RT a local lock only pins the task, as a thread is here */
+typedef struct { int unused; } local_lock_t;
+
+#define INIT_LOCAL_LOCK(l)      { 0 }
+#define local_lock(l)           do { (void)(l); } while (0)
+#define local_unlock(l)         do { (void)(l); } while (0)
+#define local_lock_irqsave(l, f) do { (void)(l); (f) = 0; } while (0)
+#define local_unlock_irqrestore(l, f) do { (void)(l); (void)(f); } while (0)
+
+typedef struct { unsigned int sequence; } seqcount_t;
+
+#define SEQCNT_ZERO(n)          { 0 }
+#define seqcount_init(s)        ((s)->sequence = 0)
+
+static inline unsigned int raw_read_seqcount(const seqcount_t *s)
+{
+    return __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE);
+}
+
+static inline unsigned int read_seqcount_begin(const seqcount_t *s)
+{
+    unsigned int seq;
+
+    while ((seq = raw_read_seqcount(s)) & 1)
+        sched_yield();
+    return seq;
+}
+
+static inline bool read_seqcount_retry(const seqcount_t *s, unsigned int start)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&s->sequence, __ATOMIC_RELAXED) != start;
+}
+
+static inline void raw_write_seqcount_begin(seqcount_t *s)
+{
+    __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void raw_write_seqcount_end(seqcount_t *s)
+{
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+}
+
+#define write_seqcount_begin(s) raw_write_seqcount_begin(s)
+#define write_seqcount_end(s)   raw_write_seqcount_end(s)
+
+/* RCU: readers are free, and the harness never frees under a reader */
+struct rcu_head {
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+};
+
+#define rcu_read_lock()                 barrier()
+#define rcu_read_unlock()               barrier()
+#define rcu_read_lock_bh()              barrier()
+#define rcu_read_unlock_bh()            barrier()
+#define RCU_INITIALIZER(v)              (v)
+#define rcu_access_pointer(p)           READ_ONCE(p)
+#define rcu_dereference(p)              __atomic_load_n(&(p), __ATOMIC_CONSUME)
+#define rcu_dereference_protected(p, c) (p)
+#define rcu_dereference_raw(p)          rcu_dereference(p)
+#define rcu_assign_pointer(p, v)        __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define RCU_INIT_POINTER(p, v)          WRITE_ONCE(p, v)
+#define rcu_replace_pointer(p, v, c)                                    \
+    ({ __typeof__(p) __old = (p); rcu_assign_pointer(p, v); __old; })
+#define synchronize_rcu()               smp_mb()
+#define get_state_synchronize_rcu()     0UL
+#define poll_state_synchronize_rcu(c)   ((void)(c), true)
+#define call_rcu(head, fn)              (fn)(head)
+#define kfree_rcu(p, field)             kfree(p)
+
+/* Random numbers: a per-thread xorshift, reproducible run to run */
+u32 get_random_u32(void);
+
+static inline u32 get_random_u32_below(u32 ceil)
+{
+    return (u32)(((u64)get_random_u32() * ceil) >> 32);
+}
+
+/* Memory */
+#define GFP_KERNEL              0x01u
+#define GFP_ATOMIC              0x02u
+#define GFP_NOWAIT              0x04u
+#define __GFP_NOWARN            0x08u
+#define __GFP_ZERO              0x10u
+#define __GFP_NORETRY           0x20u
+
+#define PAGE_SHIFT              12
+#define PAGE_SIZE               (1UL << PAGE_SHIFT)
+#define PAGE_MASK               (~(PAGE_SIZE - 1))
+
+/* Cacheline aligned like the slab caches the muscles allocate from */
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+    void *p = aligned_alloc(SMP_CACHE_BYTES, ALIGN(size ? size : 1, SMP_CACHE_BYTES));
+
+    if (p && (flags & __GFP_ZERO))
+        memset(p, 0, size);
+    return p;
+}
+
+static inline void kfree(const void *p)
+{
+    free((void *)p);
+}
+
+#define kzalloc(s, f)                   kmalloc(s, (f) | __GFP_ZERO)
+#define kmalloc_node(s, f, n)           kmalloc(s, f)
+#define kzalloc_node(s, f, n)           kzalloc(s, f)
+#define kmalloc_array(n, s, f)          kmalloc(array_size(n, s), f)
+#define kcalloc(n, s, f)                kzalloc(array_size(n, s), f)
+#define kvmalloc(s, f)                  kmalloc(s, f)
+#define kvzalloc(s, f)                  kzalloc(s, f)
+#define kvmalloc_array(n, s, f)         kmalloc_array(n, s, f)
+#define kvcalloc(n, s, f)               kcalloc(n, s, f)
+#define kvfree(p)                       kfree(p)
+#define vmalloc(s)                      kmalloc(s, GFP_KERNEL)
+#define vzalloc(s)                      kzalloc(s, GFP_KERNEL)
+#define vfree(p)                        kfree(p)
+
+/* Naturally aligned, as the buddy allocator hands them out */
+static inline unsigned long __get_free_pages(gfp_t flags, unsigned int order)
+{
+    void *p = aligned_alloc(PAGE_SIZE << order, PAGE_SIZE << order);
+
+    if (p && (flags & __GFP_ZERO))
+        memset(p, 0, PAGE_SIZE << order);
+    return (unsigned long)p;
+}
+
+static inline void free_pages(unsigned long addr, unsigned int order)
+{
+    free((void *)addr);
+}
+
+static inline void *kmemdup(const void *src, size_t len, gfp_t flags)
+{
+    void *p = kmalloc(len, flags);
+
+    if (p)
+        memcpy(p, src, len);
+    return p;
+}
+
+static inline char *kstrdup(const char *s, gfp_t flags)
+{
+    return s ? kmemdup(s, strlen(s) + 1, flags) : NULL;
+}
+
+/* Strings and sorting */
+char *strim(char *s);
+int kstrtou64(const char *s, unsigned int base, u64 *res);
+int kstrtouint(const char *s, unsigned int base, unsigned int *res);
+int kstrtoint(const char *s, unsigned int base, int *res);
+int kstrtobool(const char *s, bool *res);
+#define sort(base, num, size, cmp, swp) qsort(base, num, size, cmp)
+
+/* Workqueues: per-CPU pending lists, run by shim_run_work() */
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct work_struct {
+    work_func_t func;
+    struct work_struct *next;
+    unsigned long expires;
+    int pending;
+};
+
+struct delayed_work {
+    struct work_struct work;
+    int cpu;
+};
+
+struct workqueue_struct {
+    const char *name;
+    unsigned int flags;
+};
+
+#define WQ_UNBOUND              0x02u
+#define WQ_FREEZABLE            0x04u
+#define WQ_MEM_RECLAIM          0x08u
+#define WQ_HIGHPRI              0x10u
+#define WQ_CPU_INTENSIVE        0x20u
+
+extern struct workqueue_struct *system_wq;
+extern struct workqueue_struct *system_highpri_wq;
+extern struct workqueue_struct *system_unbound_wq;
+
+/* Workers have no priority here; attrs only carry what was asked for */
+struct workqueue_attrs {
+    int nice;
+};
+
+#define MAX_NICE                19
+#define alloc_workqueue_attrs()         ((struct workqueue_attrs *)kzalloc(sizeof(struct workqueue_attrs), GFP_KERNEL))
+#define free_workqueue_attrs(a)         kfree(a)
+#define apply_workqueue_attrs(wq, a)    ((void)(wq), (void)(a), 0)
+
+#define __WORK_INITIALIZER(n, f)        { .func = (f) }
+#define __DELAYED_WORK_INITIALIZER(n, f, fl) { .work = __WORK_INITIALIZER((n).work, f) }
+#define DECLARE_WORK(n, f)              struct work_struct n = __WORK_INITIALIZER(n, f)
+#define DECLARE_DELAYED_WORK(n, f)      struct delayed_work n = __DELAYED_WORK_INITIALIZER(n, f, 0)
+#define DECLARE_DEFERRABLE_WORK(n, f)   DECLARE_DELAYED_WORK(n, f)
+#define INIT_WORK(w, f)                 (*(w) = (struct work_struct){ .func = (f) })
+#define INIT_DELAYED_WORK(w, f)         (*(w) = (struct delayed_work){ .work = { .func = (f) } })
+#define to_delayed_work(w)              container_of(w, struct delayed_work, work)
+#define work_pending(w)                 __atomic_load_n(&(w)->pending, __ATOMIC_ACQUIRE)
+#define delayed_work_pending(dw)        work_pending(&(dw)->work)
+
+struct workqueue_struct *alloc_workqueue(const char *fmt, unsigned int flags,
+                                         int max_active, ...);
+void destroy_workqueue(struct workqueue_struct *wq);
+bool queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
+                           struct delayed_work *dw, unsigned long delay);
+bool mod_delayed_work_on(int cpu, struct workqueue_struct *wq,
+                         struct delayed_work *dw, unsigned long delay);
+bool cancel_work_sync(struct work_struct *work);
+bool cancel_delayed_work_sync(struct delayed_work *dw);
+unsigned int shim_run_work(int cpu, bool all);
+
+#define queue_work_on(cpu, wq, w)                                       \
+    queue_delayed_work_on(cpu, wq, to_delayed_work(w), 0)
+#define queue_work(wq, w)               queue_work_on(shim_cpu, wq, w)
+#define queue_work_node(node, wq, w)    queue_work(wq, w)
+#define schedule_work(w)                queue_work(system_wq, w)
+#define schedule_work_on(cpu, w)        queue_work_on(cpu, system_wq, w)
+#define queue_delayed_work(wq, dw, d)   queue_delayed_work_on(shim_cpu, wq, dw, d)
+#define mod_delayed_work(wq, dw, d)     mod_delayed_work_on(shim_cpu, wq, dw, d)
+#define schedule_delayed_work(dw, d)    queue_delayed_work(system_wq, dw, d)
+#define schedule_delayed_work_on(c, dw, d) queue_delayed_work_on(c, system_wq, dw, d)
+#define cancel_delayed_work(dw)         cancel_delayed_work_sync(dw)
+#define flush_work(w)                   ((void)(w), false)
+
+/* irq_work runs right away: the shim has no hard irq context to defer from */
+struct irq_work {
+    void (*func)(struct irq_work *work);
+};
+
+#define init_irq_work(w, f)             ((w)->func = (f))
+#define irq_work_queue(w)               ({ (w)->func(w); true; })
+#define irq_work_queue_on(w, cpu)       irq_work_queue(w)
+#define irq_work_sync(w)                do { (void)(w); } while (0)
+
+/* Static keys: a plain flag, which costs a load instead of a NOP */
+struct static_key {
+    int enabled;
+};
+struct static_key_true {
+    struct static_key key;
+};
+struct static_key_false {
+    struct static_key key;
+};
+
+#define STATIC_KEY_TRUE_INIT    { .key = { 1 } }
+#define STATIC_KEY_FALSE_INIT   { .key = { 0 } }
+#define DEFINE_STATIC_KEY_TRUE(n)       struct static_key_true n = STATIC_KEY_TRUE_INIT
+#define DEFINE_STATIC_KEY_FALSE(n)      struct static_key_false n = STATIC_KEY_FALSE_INIT
+#define DECLARE_STATIC_KEY_TRUE(n)      extern struct static_key_true n
+#define DECLARE_STATIC_KEY_FALSE(n)     extern struct static_key_false n
+#define static_key_enabled(k)           (READ_ONCE((k)->key.enabled) > 0)
+#define static_branch_likely(k)         likely(static_key_enabled(k))
+#define static_branch_unlikely(k)       unlikely(static_key_enabled(k))
+#define static_branch_enable(k)         WRITE_ONCE((k)->key.enabled, 1)
+#define static_branch_disable(k)        WRITE_ONCE((k)->key.enabled, 0)
+#define static_branch_inc(k)            __atomic_fetch_add(&(k)->key.enabled, 1, __ATOMIC_SEQ_CST)
+#define static_branch_dec(k)            __atomic_fetch_sub(&(k)->key.enabled, 1, __ATOMIC_SEQ_CST)
+#define static_branch_enable_cpuslocked(k)  static_branch_enable(k)
+#define static_branch_disable_cpuslocked(k) static_branch_disable(k)
+
+/* kobjects, sysfs and firmware: enough for lib/muscle/muscle_weights.c */
+struct kobject {
+    const char *name;
+};
+
+struct attribute {
+    const char *name;
+    unsigned short mode;
+};
+
+struct attribute_group {
+    const char *name;
+    struct attribute **attrs;
+};
+
+struct kobj_attribute {
+    struct attribute attr;
+    ssize_t (*show)(struct kobject *kobj, struct kobj_attribute *attr, char *buf);
+    ssize_t (*store)(struct kobject *kobj, struct kobj_attribute *attr,
+                     const char *buf, size_t count);
+};
+
+struct sysfs_ops {
+    int unused;
+};
+
+struct kobj_type {
+    void (*release)(struct kobject *kobj);
+    const struct sysfs_ops *sysfs_ops;
+    const struct attribute_group **default_groups;
+};
+
+#define __ATTR(n, m, s, st)     { .attr = { .name = #n, .mode = m }, .show = s, .store = st }
+#define __ATTR_RO(n)            __ATTR(n, 0444, n##_show, NULL)
+#define __ATTR_WO(n)            __ATTR(n, 0200, NULL, n##_store)
+#define __ATTR_RW(n)            __ATTR(n, 0644, n##_show, n##_store)
+#define ATTRIBUTE_GROUPS(n)                                             \
+    static const struct attribute_group n##_group = { .attrs = n##_attrs }; \
+    static const struct attribute_group *n##_groups[] = { &n##_group, NULL }
+
+extern const struct sysfs_ops kobj_sysfs_ops;
+extern struct kobject *kernel_kobj;
+
+struct kobject *kobject_create_and_add(const char *name, struct kobject *parent);
+int kobject_init_and_add(struct kobject *kobj, const struct kobj_type *ktype,
+                         struct kobject *parent, const char *fmt, ...);
+void kobject_put(struct kobject *kobj);
+
+#define NAME_MAX                255
+
+struct device;
+struct firmware {
+    size_t size;
+    const u8 *data;
+};
+
+/* Firmware names are host paths, so the harness can load real blobs */
+int request_firmware(const struct firmware **fw, const char *name, struct device *dev);
+void release_firmware(const struct firmware *fw);
+
+/*
+ * debugfs and relay.  There is no reader: each finished sub-buffer counts
+ * as consumed right away, so capture costs what the producer side costs.
+ * If shim_relay_dir is set when a channel opens, finished sub-buffers are
+ * also appended to <dir>/<base>N, as a reader of the debugfs files gets them.
+ */
+extern const char *shim_relay_dir;
+
+typedef unsigned short umode_t;
+
+struct dentry {
+    char name[32];
+    struct dentry *parent;
+    void *data;
+    const struct file_operations *fops;
+    struct dentry *next;                /* in creation order */
+};
+
+/* seq_file output goes straight to the FILE shim_debugfs_dump() was given */
+struct seq_file {
+    FILE *f;
+    void *private;
+};
+
+#define seq_printf(m, fmt, ...)         fprintf((m)->f, fmt, ##__VA_ARGS__)
+#define seq_puts(m, s)                  fputs(s, (m)->f)
+#define seq_putc(m, c)                  fputc(c, (m)->f)
+
+/* Only what the shim can act on: a show routine or a u64 setter */
+struct file_operations {
+    int (*shim_show)(struct seq_file *m, void *v);
+    int (*shim_set)(void *data, u64 val);
+};
+
+#define DEFINE_SHOW_ATTRIBUTE(__name)                                   \
+    static const struct file_operations __name##_fops = {               \
+        .shim_show = __name##_show,                                     \
+    }
+#define DEFINE_DEBUGFS_ATTRIBUTE(__fops, __get, __set, __fmt)           \
+    static const struct file_operations __fops = {                      \
+        .shim_set = __set,                                              \
+    }
+
+extern const struct file_operations relay_file_operations;
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent);
+struct dentry *debugfs_create_file(const char *name, umode_t mode, struct dentry *parent,
+                                   void *data, const struct file_operations *fops);
+#define debugfs_create_file_unsafe      debugfs_create_file
+void debugfs_remove(struct dentry *d);
+
+/* Print every readable file, as "== muscle/<dir>/<file>" and its contents */
+void shim_debugfs_dump(FILE *f);
+/* Write val to the setter at path ("muscle/cache/reset"); -ENOENT if none */
+int shim_debugfs_write(const char *path, u64 val);
+
+struct rchan;
+
+struct rchan_buf {
+    void *start;                        /* n_subbufs × subbuf_size */
+    void *data;                         /* current sub-buffer */
+    size_t offset;
+    size_t subbufs_produced;
+    size_t subbufs_consumed;
+    struct rchan *chan;
+    unsigned int cpu;
+    FILE *dump;
+};
+
+struct rchan_callbacks {
+    int (*subbuf_start)(struct rchan_buf *buf, void *subbuf, void *prev_subbuf,
+                        size_t prev_padding);
+    struct dentry *(*create_buf_file)(const char *filename, struct dentry *parent,
+                                      umode_t mode, struct rchan_buf *buf, int *is_global);
+    int (*remove_buf_file)(struct dentry *dentry);
+};
+
+struct rchan {
+    size_t subbuf_size;
+    size_t n_subbufs;
+    const struct rchan_callbacks *cb;
+    struct rchan_buf *buf[NR_CPUS];
+};
+
+struct rchan *relay_open(const char *base_filename, struct dentry *parent,
+                         size_t subbuf_size, size_t n_subbufs,
+                         const struct rchan_callbacks *cb, void *private_data);
+void relay_close(struct rchan *chan);
+void relay_flush(struct rchan *chan);
+size_t relay_switch_subbuf(struct rchan_buf *buf, size_t length);
+
+static inline int relay_buf_full(struct rchan_buf *buf)
+{
+    return buf->subbufs_produced - buf->subbufs_consumed == buf->chan->n_subbufs;
+}
+
+static inline void subbuf_start_reserve(struct rchan_buf *buf, size_t length)
+{
+    buf->offset = length;
+}
+
+static inline void __relay_write(struct rchan *chan, const void *data, size_t length)
+{
+    struct rchan_buf *buf = chan->buf[smp_processor_id()];
+
+    if (unlikely(buf->offset + length > chan->subbuf_size))
+        length = relay_switch_subbuf(buf, length);
+    memcpy(buf->data + buf->offset, data, length);
+    buf->offset += length;
+}
+#define relay_write(chan, data, length) __relay_write(chan, data, length)
+
+/* Tasks, credentials, pids, cgroups */
+typedef struct { uid_t val; } kuid_t;
+
+struct cred {
+    kuid_t uid;
+};
+
+struct rb_node {
+    unsigned long __rb_parent_color;
+    struct rb_node *rb_right;
+    struct rb_node *rb_left;
+};
+
+struct rb_root {
+    struct rb_node *rb_node;
+};
+
+struct rb_root_cached {
+    struct rb_root rb_root;
+    struct rb_node *rb_leftmost;
+};
+
+#define rb_parent(r)            ((struct rb_node *)((r)->__rb_parent_color & ~3UL))
+#define rb_entry(p, t, m)       container_of(p, t, m)
+#define RB_EMPTY_NODE(n)        ((n)->__rb_parent_color == (unsigned long)(n))
+
+struct rb_node *rb_next(const struct rb_node *node);
+
+struct cfs_rq;
+
+struct sched_entity {
+    struct rb_node run_node;
+    u64 vruntime;
+    u64 exec_start;
+    u64 sum_exec_runtime;
+    u64 prev_sum_exec_runtime;
+    unsigned int on_rq;
+    struct cfs_rq *my_q;            /* NULL for a task */
+};
+
+struct task_struct {
+    pid_t pid;
+    pid_t tgid;
+    int cpu;
+    const struct cpumask *cpus_ptr;
+    const struct cred *cred;
+    u64 start_boottime;
+    struct sched_entity se;
+};
+
+/* Each harness thread runs as its own task */
+struct task_struct *shim_current(void);
+void shim_set_task(pid_t pid, uid_t uid);
+#define current                 shim_current()
+#define current_uid()           (current->cred->uid)
+#define task_cpu(p)             ((p)->cpu)
+#define task_pid_nr(p)          ((p)->pid)
+
+struct user_namespace {
+    int unused;
+};
+extern struct user_namespace init_user_ns;
+#define from_kuid(ns, uid)      ((void)(ns), (uid).val)
+
+struct pid;
+struct pid_namespace {
+    int unused;
+};
+extern struct pid_namespace init_pid_ns;
+
+/*
+ * Kills are only counted: the verdict, not its delivery, is measured.
+ * Every pid is live and was started at boot, like the tasks the harness
+ * runs as, so a lookup always finds the task an event came from.
+ */
+extern atomic_long_t shim_kills;
+struct task_struct *shim_find_task(pid_t nr);
+#define find_task_by_pid_ns(nr, ns) ((void)(ns), shim_find_task(nr))
+#define task_pid(p)             ((struct pid *)(unsigned long)(p)->pid)
+#define kill_pid(pid, sig, priv) ({ (void)(pid); atomic_long_inc(&shim_kills); 0; })
+#define SIGKILL                 9
+
+struct cgroup {
+    u64 id;
+};
+extern struct cgroup shim_root_cgroup;
+#define task_dfl_cgroup(t)      ((void)(t), &shim_root_cgroup)
+#define cgroup_id(cg)           ((cg)->id)
+
+/* Block layer */
+struct request_queue {
+    unsigned int id;
+};
+
+struct request {
+    struct request_queue *q;
+    blk_opf_t cmd_flags;
+    sector_t __sector;
+    unsigned int __data_len;
+};
+
+enum req_op {
+    REQ_OP_READ             = 0,
+    REQ_OP_WRITE            = 1,
+    REQ_OP_FLUSH            = 2,
+    REQ_OP_DISCARD          = 3,
+    REQ_OP_SECURE_ERASE     = 5,
+    REQ_OP_ZONE_APPEND      = 7,
+    REQ_OP_WRITE_ZEROES     = 9,
+    REQ_OP_ZONE_OPEN        = 10,
+    REQ_OP_ZONE_CLOSE       = 11,
+    REQ_OP_ZONE_FINISH      = 12,
+    REQ_OP_ZONE_RESET       = 15,
+    REQ_OP_ZONE_RESET_ALL   = 17,
+    REQ_OP_DRV_IN           = 34,
+    REQ_OP_DRV_OUT          = 35,
+};
+
+#define REQ_OP_BITS             8
+#define REQ_OP_MASK             ((1u << REQ_OP_BITS) - 1)
+#define REQ_SYNC                (1u << 11)
+#define REQ_META                (1u << 12)
+#define REQ_FUA                 (1u << 17)
+#define REQ_PREFLUSH            (1u << 18)
+#define SECTOR_SHIFT            9
+
+#define req_op(rq)              ((enum req_op)((rq)->cmd_flags & REQ_OP_MASK))
+#define blk_rq_pos(rq)          ((rq)->__sector)
+#define blk_rq_bytes(rq)        ((rq)->__data_len)
+#define blk_rq_sectors(rq)      ((rq)->__data_len >> SECTOR_SHIFT)
+
+static inline bool op_is_zone_mgmt(enum req_op op)
+{
+    switch (op & REQ_OP_MASK) {
+    case REQ_OP_ZONE_RESET:
+    case REQ_OP_ZONE_OPEN:
+    case REQ_OP_ZONE_CLOSE:
+    case REQ_OP_ZONE_FINISH:
+    case REQ_OP_ZONE_RESET_ALL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* A flat xarray, enough for small ids such as request_queue ids */
+#define SHIM_XA_SIZE            1024
+
+struct xarray {
+    void *slot[SHIM_XA_SIZE];
+};
+
+#define DEFINE_XARRAY(n)        struct xarray n
+#define xa_mk_err(e)            ((void *)(((unsigned long)(e) << 2) | 2UL))
+#define xa_is_err(p)                                                    \
+    ((((unsigned long)(p) & 3) == 2) && ((unsigned long)(p) >= (unsigned long)xa_mk_err(-MAX_ERRNO)))
+#define xa_load(xa, i)                                                  \
+    ((i) < SHIM_XA_SIZE ? __atomic_load_n(&(xa)->slot[i], __ATOMIC_ACQUIRE) : NULL)
+#define xa_erase(xa, i)                                                 \
+    ((i) < SHIM_XA_SIZE ? xchg(&(xa)->slot[i], NULL) : NULL)
+#define xa_cmpxchg(xa, i, old, new, gfp)                                \
+    ((i) < SHIM_XA_SIZE ? cmpxchg(&(xa)->slot[i], old, new) : xa_mk_err(-ENOMEM))
+
+/* Page cache and readahead */
+struct page {
+    u8 data[PAGE_SIZE];
+} __aligned(PAGE_SIZE);
+
+#define page_address(p)         ((void *)(p)->data)
+#define kmap_local_page(p)      page_address(p)
+#define kunmap_local(a)         do { (void)(a); } while (0)
+
+struct super_block {
+    dev_t s_dev;
+};
+
+struct inode {
+    struct super_block *i_sb;
+    unsigned long i_ino;
+    loff_t i_size;
+};
+
+struct address_space {
+    struct inode *host;
+};
+
+struct file_ra_state {
+    pgoff_t start;
+    unsigned int size;
+};
+
+struct file;
+
+struct readahead_control {
+    struct file *file;
+    struct address_space *mapping;
+    struct file_ra_state *ra;
+    pgoff_t _index;
+    unsigned int _nr_pages;
+};
+
+#define DEFINE_READAHEAD(n, f, r, m, i)                                 \
+    struct readahead_control n = { .file = f, .mapping = m, .ra = r, ._index = i }
+#define readahead_index(rac)    ((rac)->_index)
+#define i_size_read(inode)      READ_ONCE((inode)->i_size)
+
+/* Readahead is counted, not issued */
+extern atomic_long_t shim_ra_pages;
+#define page_cache_ra_unbounded(rac, nr, lookahead)                     \
+    ((void)(rac), (void)(lookahead), atomic_long_add(nr, &shim_ra_pages))
+
+/* Scatterlists over plain buffers; iteration still stops at page edges */
+struct scatterlist {
+    void *buf;
+    unsigned int length;
+};
+
+#define SG_MITER_ATOMIC         (1 << 0)
+#define SG_MITER_TO_SG          (1 << 1)
+#define SG_MITER_FROM_SG        (1 << 2)
+
+struct sg_mapping_iter {
+    void *addr;
+    size_t length;
+    size_t consumed;
+    /* private */
+    struct scatterlist *__sg;
+    unsigned int __nents;
+    size_t __offset;
+};
+
+#define sg_init_table(sg, n)    memset(sg, 0, (n) * sizeof(struct scatterlist))
+#define sg_set_buf(sg, b, len)  ((sg)->buf = (void *)(b), (sg)->length = (len))
+
+void sg_miter_start(struct sg_mapping_iter *mi, struct scatterlist *sgl,
+                    unsigned int nents, unsigned int flags);
+bool sg_miter_next(struct sg_mapping_iter *mi);
+void sg_miter_stop(struct sg_mapping_iter *mi);
+
+/* x86 and arm64 SIMD sections: userspace may always use the vector units */
+#define kernel_fpu_begin()      do { } while (0)
+#define kernel_fpu_end()        do { } while (0)
+#define kernel_neon_begin()     do { } while (0)
+#define kernel_neon_end()       do { } while (0)
+#define may_use_simd()          true
+#define irq_fpu_usable()        true
+
+#define X86_FEATURE_XMM4_1      "sse4.1"
+#define X86_FEATURE_AVX2        "avx2"
+#define X86_FEATURE_AVX_VNNI    "avxvnni"
+#define boot_cpu_has(f)         __builtin_cpu_supports(f)
+#define XFEATURE_MASK_SSE       (1ULL << 1)
+#define XFEATURE_MASK_YMM       (1ULL << 2)
+/* __builtin_cpu_supports() already checks that the OS saves the state */
+#define cpu_has_xfeatures(mask, name) ((void)(mask), (void)(name), 1)
+
+#endif /* _SHIM_KERNEL_H */
@@ -0,0 +1,786 @@
+/*
+ * Runtime half of the kernel shim: per-CPU areas, workqueues, initcalls
+ * and the handful of library routines the muscles call.  See kernel.h.
+ */
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kernel.h"
+#include "include/sched/sched.h"
+
+int shim_verbose;
+
+__thread int shim_cpu;
+static __thread u64 shim_rand_state;
+
+u32 get_random_u32(void)
+{
+    u64 x = shim_rand_state ?: 0x9E3779B97F4A7C15ULL + shim_cpu;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    shim_rand_state = x;
+    return (x * 0x2545F4914F6CDD1DULL) >> 32;
+}
+unsigned int nr_cpu_ids = 1;
+unsigned int nr_node_ids = 1;
+struct cpumask __cpu_online_mask;
+
+/* Per-CPU areas */
+#define SHIM_PCPU_UNIT  (8UL << 20)
+
+extern char __start_shim_percpu[] __attribute__((weak));
+extern char __stop_shim_percpu[] __attribute__((weak));
+
+unsigned long shim_percpu_offset[NR_CPUS];
+static char *shim_pcpu_base;
+static size_t shim_pcpu_used;
+static pthread_mutex_t shim_pcpu_lock = PTHREAD_MUTEX_INITIALIZER;
+
+DEFINE_PER_CPU(struct rq, runqueues);
+DEFINE_PER_CPU(struct sched_domain *, sd_llc);
+
+/*
+ * Reserve every possible CPU's unit up front, before any initcall can
+ * touch a per-CPU variable, and seed each with the static template.
+ */
+__attribute__((constructor(101)))
+static void shim_percpu_setup(void)
+{
+    size_t tmpl = __stop_shim_percpu - __start_shim_percpu;
+    int cpu;
+
+    shim_pcpu_base = mmap(NULL, NR_CPUS * SHIM_PCPU_UNIT, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (shim_pcpu_base == MAP_FAILED) {
+        perror("shim: per-CPU areas");
+        exit(1);
+    }
+    for (cpu = 0; cpu < NR_CPUS; cpu++) {
+        char *unit = shim_pcpu_base + cpu * SHIM_PCPU_UNIT;
+
+        memcpy(unit, __start_shim_percpu, tmpl);
+        shim_percpu_offset[cpu] = unit - __start_shim_percpu;
+    }
+    shim_pcpu_used = ALIGN(tmpl, SMP_CACHE_BYTES);
+}
+
+void *__alloc_percpu(size_t size, size_t align)
+{
+    size_t off;
+
+    pthread_mutex_lock(&shim_pcpu_lock);
+    off = ALIGN(shim_pcpu_used, max_t(size_t, align, SMP_CACHE_BYTES));
+    if (off + size > SHIM_PCPU_UNIT) {
+        pthread_mutex_unlock(&shim_pcpu_lock);
+        return NULL;
+    }
+    shim_pcpu_used = off + size;
+    pthread_mutex_unlock(&shim_pcpu_lock);
+
+    /* Fresh units are zero-filled, as alloc_percpu() memory is */
+    return __start_shim_percpu + off;
+}
+
+/* Tasks */
+static __thread struct cred shim_cred;
+static __thread struct task_struct shim_task;
+static __thread bool shim_task_ready;
+
+struct task_struct *shim_current(void)
+{
+    if (unlikely(!shim_task_ready)) {
+        shim_task.pid = shim_task.tgid = getpid() + shim_cpu;
+        shim_task.cpu = shim_cpu;
+        shim_task.cpus_ptr = cpu_online_mask;
+        shim_cred.uid.val = getuid();
+        shim_task.cred = &shim_cred;
+        shim_task_ready = true;
+    }
+    return &shim_task;
+}
+
+void shim_set_task(pid_t pid, uid_t uid)
+{
+    struct task_struct *p = shim_current();
+
+    p->pid = p->tgid = pid;
+    shim_cred.uid.val = uid;
+}
+
+struct task_struct *shim_find_task(pid_t nr)
+{
+    static __thread struct task_struct found;
+
+    found.pid = found.tgid = nr;
+    return &found;
+}
+
+struct user_namespace init_user_ns;
+struct pid_namespace init_pid_ns;
+struct cgroup shim_root_cgroup = { .id = 1 };
+atomic_long_t shim_kills;
+atomic_long_t shim_ra_pages;
+
+/* Time */
+volatile unsigned long jiffies;
+
+u64 ktime_get_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+void shim_update_jiffies(void)
+{
+    unsigned long now = ktime_get_ns() / TICK_NSEC;
+
+    if (now != jiffies)
+        jiffies = now;
+}
+
+/*
+ * Workqueues.  Work queued "on" a CPU sits on that CPU's list until the
+ * harness thread playing the CPU calls shim_run_work(); like the real
+ * thing, PENDING is cleared just before the function runs, so it may
+ * queue itself again.
+ */
+struct shim_worklist {
+    raw_spinlock_t lock;
+    struct work_struct *head;
+    int nr;
+} ____cacheline_aligned;
+
+static struct shim_worklist shim_work[NR_CPUS];
+
+static struct workqueue_struct shim_system_wq = { .name = "events" };
+static struct workqueue_struct shim_highpri_wq = { .name = "events_highpri" };
+static struct workqueue_struct shim_unbound_wq = { .name = "events_unbound" };
+struct workqueue_struct *system_wq = &shim_system_wq;
+struct workqueue_struct *system_highpri_wq = &shim_highpri_wq;
+struct workqueue_struct *system_unbound_wq = &shim_unbound_wq;
+
+struct workqueue_struct *alloc_workqueue(const char *fmt, unsigned int flags,
+                                         int max_active, ...)
+{
+    struct workqueue_struct *wq = kzalloc(sizeof(*wq), GFP_KERNEL);
+
+    if (wq) {
+        wq->name = fmt;
+        wq->flags = flags;
+    }
+    return wq;
+}
+
+void destroy_workqueue(struct workqueue_struct *wq)
+{
+    kfree(wq);
+}
+
+static void shim_work_add(int cpu, struct work_struct *w, unsigned long delay)
+{
+    struct shim_worklist *wl = &shim_work[cpu < 0 ? shim_cpu : cpu];
+
+    raw_spin_lock(&wl->lock);
+    w->expires = jiffies + delay;
+    w->next = wl->head;
+    wl->head = w;
+    __atomic_store_n(&wl->nr, wl->nr + 1, __ATOMIC_RELEASE);
+    raw_spin_unlock(&wl->lock);
+}
+
+bool queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
+                           struct delayed_work *dw, unsigned long delay)
+{
+    if (__atomic_exchange_n(&dw->work.pending, 1, __ATOMIC_ACQ_REL))
+        return false;
+    dw->cpu = cpu;
+    shim_work_add(cpu, &dw->work, delay);
+    return true;
+}
+
+bool mod_delayed_work_on(int cpu, struct workqueue_struct *wq,
+                         struct delayed_work *dw, unsigned long delay)
+{
+    struct shim_worklist *wl = &shim_work[dw->cpu];
+
+    if (!queue_delayed_work_on(cpu, wq, dw, delay)) {
+        /* Already queued: only pull the deadline in, never move CPUs */
+        raw_spin_lock(&wl->lock);
+        if (work_pending(&dw->work))
+            dw->work.expires = jiffies + delay;
+        raw_spin_unlock(&wl->lock);
+    }
+    return true;
+}
+
+static bool shim_work_unlink(struct work_struct *w)
+{
+    int cpu;
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct shim_worklist *wl = &shim_work[cpu];
+        struct work_struct **pp;
+
+        raw_spin_lock(&wl->lock);
+        for (pp = &wl->head; *pp; pp = &(*pp)->next) {
+            if (*pp == w) {
+                *pp = w->next;
+                wl->nr--;
+                __atomic_store_n(&w->pending, 0, __ATOMIC_RELEASE);
+                raw_spin_unlock(&wl->lock);
+                return true;
+            }
+        }
+        raw_spin_unlock(&wl->lock);
+    }
+    return false;
+}
+
+bool cancel_work_sync(struct work_struct *work)
+{
+    return shim_work_unlink(work);
+}
+
+bool cancel_delayed_work_sync(struct delayed_work *dw)
+{
+    return shim_work_unlink(&dw->work);
+}
+
+/*
+ * Run cpu's due work (every queued item if all), in queueing order.
+ * Returns the number of items run.
+ */
+unsigned int shim_run_work(int cpu, bool all)
+{
+    struct shim_worklist *wl = &shim_work[cpu];
+    struct work_struct *run = NULL, **pp, *w;
+    unsigned int n = 0;
+
+    if (!__atomic_load_n(&wl->nr, __ATOMIC_ACQUIRE))
+        return 0;
+    shim_update_jiffies();
+
+    raw_spin_lock(&wl->lock);
+    pp = &wl->head;
+    while ((w = *pp)) {
+        if (all || time_after_eq(jiffies, w->expires)) {
+            *pp = w->next;
+            wl->nr--;
+            /* The list is LIFO; reversing here restores queueing order */
+            w->next = run;
+            run = w;
+        } else {
+            pp = &w->next;
+        }
+    }
+    raw_spin_unlock(&wl->lock);
+
+    while ((w = run)) {
+        run = w->next;
+        __atomic_store_n(&w->pending, 0, __ATOMIC_RELEASE);
+        smp_mb();
+        w->func(w);
+        n++;
+    }
+    return n;
+}
+
+/* Initcalls, in level order */
+#define SHIM_INITCALL_LEVEL(lvl)                                        \
+    extern initcall_t __start_shim_initcall##lvl[] __attribute__((weak)); \
+    extern initcall_t __stop_shim_initcall##lvl[] __attribute__((weak))
+
+SHIM_INITCALL_LEVEL(1);
+SHIM_INITCALL_LEVEL(2);
+SHIM_INITCALL_LEVEL(3);
+SHIM_INITCALL_LEVEL(4);
+SHIM_INITCALL_LEVEL(5);
+SHIM_INITCALL_LEVEL(6);
+SHIM_INITCALL_LEVEL(7);
+
+int shim_run_initcalls(void)
+{
+    static struct {
+        initcall_t *start, *stop;
+    } levels[] = {
+        { __start_shim_initcall1, __stop_shim_initcall1 },
+        { __start_shim_initcall2, __stop_shim_initcall2 },
+        { __start_shim_initcall3, __stop_shim_initcall3 },
+        { __start_shim_initcall4, __stop_shim_initcall4 },
+        { __start_shim_initcall5, __stop_shim_initcall5 },
+        { __start_shim_initcall6, __stop_shim_initcall6 },
+        { __start_shim_initcall7, __stop_shim_initcall7 },
+    };
+    static struct sched_domain llc;
+    unsigned int i, cpu;
+    initcall_t *fn;
+    int ret, err = 0;
+
+    for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+        struct rq *rq = cpu_rq(cpu);
+
+        set_bit(cpu, __cpu_online_mask.bits);
+        raw_spin_lock_init(&rq->__lock);
+        rq->cpu = cpu;
+        per_cpu(sd_llc, cpu) = &llc;
+    }
+    llc.span = __cpu_online_mask;
+
+    shim_update_jiffies();
+    for (i = 0; i < ARRAY_SIZE(levels); i++) {
+        for (fn = levels[i].start; fn && fn < levels[i].stop; fn++) {
+            ret = (*fn)();
+            if (ret) {
+                fprintf(stderr, "shim: initcall %p returned %d\n", (void *)*fn, ret);
+                err = err ? err : ret;
+            }
+        }
+    }
+    return err;
+}
+
+/* Module parameters */
+int param_set_uint(const char *val, const struct kernel_param *kp)
+{
+    return kstrtouint(val, 0, kp->arg);
+}
+
+int param_get_uint(char *buf, const struct kernel_param *kp)
+{
+    return sysfs_emit(buf, "%u\n", *(unsigned int *)kp->arg);
+}
+
+int param_set_int(const char *val, const struct kernel_param *kp)
+{
+    return kstrtoint(val, 0, kp->arg);
+}
+
+int param_get_int(char *buf, const struct kernel_param *kp)
+{
+    return sysfs_emit(buf, "%d\n", *(int *)kp->arg);
+}
+
+int param_set_bool(const char *val, const struct kernel_param *kp)
+{
+    return kstrtobool(val, kp->arg);
+}
+
+int param_get_bool(char *buf, const struct kernel_param *kp)
+{
+    return sysfs_emit(buf, "%c\n", *(bool *)kp->arg ? 'Y' : 'N');
+}
+
+int sysfs_emit(char *buf, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, PAGE_SIZE, fmt, ap);
+    va_end(ap);
+    return min_t(int, n, PAGE_SIZE - 1);
+}
+
+int sysfs_emit_at(char *buf, int at, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf + at, PAGE_SIZE - at, fmt, ap);
+    va_end(ap);
+    return min_t(int, n, PAGE_SIZE - at - 1);
+}
+
+/* Strings */
+char *strim(char *s)
+{
+    size_t n = strlen(s);
+
+    while (n && isspace((unsigned char)s[n - 1]))
+        s[--n] = '\0';
+    while (isspace((unsigned char)*s))
+        s++;
+    return s;
+}
+
+int kstrtou64(const char *s, unsigned int base, u64 *res)
+{
+    char *end;
+
+    errno = 0;
+    if (*s == '-')
+        return -EINVAL;
+    *res = strtoull(s, &end, base);
+    if (errno)
+        return -ERANGE;
+    if (end == s || (*end && !(*end == '\n' && !end[1])))
+        return -EINVAL;
+    return 0;
+}
+
+int kstrtouint(const char *s, unsigned int base, unsigned int *res)
+{
+    u64 v;
+    int ret = kstrtou64(s, base, &v);
+
+    if (ret)
+        return ret;
+    if (v > UINT_MAX)
+        return -ERANGE;
+    *res = v;
+    return 0;
+}
+
+int kstrtoint(const char *s, unsigned int base, int *res)
+{
+    char *end;
+    long v;
+
+    errno = 0;
+    v = strtol(s, &end, base);
+    if (errno || v < INT_MIN || v > INT_MAX)
+        return -ERANGE;
+    if (end == s || (*end && !(*end == '\n' && !end[1])))
+        return -EINVAL;
+    *res = v;
+    return 0;
+}
+
+int kstrtobool(const char *s, bool *res)
+{
+    switch (s[0]) {
+    case 'y': case 'Y': case '1':
+        *res = true;
+        return 0;
+    case 'n': case 'N': case '0':
+        *res = false;
+        return 0;
+    case 'o': case 'O':
+        if (s[1] == 'n' || s[1] == 'N') {
+            *res = true;
+            return 0;
+        }
+        if (s[1] == 'f' || s[1] == 'F') {
+            *res = false;
+            return 0;
+        }
+        break;
+    }
+    return -EINVAL;
+}
+
+/* crc32_le(), bitwise: blobs are loaded once, speed does not matter */
+u32 crc32_le(u32 crc, const void *p, size_t len)
+{
+    const u8 *b = p;
+    int i;
+
+    while (len--) {
+        crc ^= *b++;
+        for (i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return crc;
+}
+
+/* debugfs and relay */
+const struct file_operations relay_file_operations;
+const char *shim_relay_dir;
+
+static struct dentry *shim_debugfs, **shim_debugfs_tail = &shim_debugfs;
+
+struct dentry *debugfs_create_file(const char *name, umode_t mode, struct dentry *parent,
+                                   void *data, const struct file_operations *fops)
+{
+    struct dentry *d = kzalloc(sizeof(*d), GFP_KERNEL);
+
+    if (!d)
+        return ERR_PTR(-ENOMEM);
+    snprintf(d->name, sizeof(d->name), "%s", name);
+    d->parent = IS_ERR(parent) ? NULL : parent;
+    d->data = data;
+    d->fops = fops;
+    *shim_debugfs_tail = d;
+    shim_debugfs_tail = &d->next;
+    return d;
+}
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent)
+{
+    return debugfs_create_file(name, 0755, parent, NULL, NULL);
+}
+
+/* Files only; relay is the one caller */
+void debugfs_remove(struct dentry *d)
+{
+    struct dentry **p;
+
+    if (IS_ERR_OR_NULL(d))
+        return;
+    for (p = &shim_debugfs; *p; p = &(*p)->next) {
+        if (*p == d) {
+            *p = d->next;
+            if (shim_debugfs_tail == &d->next)
+                shim_debugfs_tail = p;
+            break;
+        }
+    }
+    kfree(d);
+}
+
+static int shim_debugfs_path(const struct dentry *d, char *buf, size_t len)
+{
+    int n = d->parent ? shim_debugfs_path(d->parent, buf, len) : 0;
+
+    return n + snprintf(buf + n, len - n, "%s%s", n ? "/" : "", d->name);
+}
+
+void shim_debugfs_dump(FILE *f)
+{
+    struct seq_file m = { .f = f };
+    const struct dentry *d;
+    char path[256];
+
+    for (d = shim_debugfs; d; d = d->next) {
+        if (!d->fops || !d->fops->shim_show)
+            continue;
+        shim_debugfs_path(d, path, sizeof(path));
+        fprintf(f, "== %s\n", path);
+        m.private = d->data;
+        d->fops->shim_show(&m, NULL);
+    }
+}
+
+int shim_debugfs_write(const char *path, u64 val)
+{
+    const struct dentry *d;
+    char buf[256];
+
+    for (d = shim_debugfs; d; d = d->next) {
+        if (!d->fops || !d->fops->shim_set)
+            continue;
+        shim_debugfs_path(d, buf, sizeof(buf));
+        if (!strcmp(buf, path))
+            return d->fops->shim_set(d->data, val);
+    }
+    return -ENOENT;
+}
+
+/* A sub-buffer is read as soon as it is full: the next one is always free */
+size_t relay_switch_subbuf(struct rchan_buf *buf, size_t length)
+{
+    struct rchan *chan = buf->chan;
+    void *prev = buf->data, *next;
+    size_t padding = 0;
+
+    if (buf->offset <= chan->subbuf_size) {
+        padding = chan->subbuf_size - buf->offset;
+        if (buf->dump)
+            fwrite(buf->data, 1, buf->offset, buf->dump);
+        buf->subbufs_produced++;
+        buf->subbufs_consumed = buf->subbufs_produced;
+    }
+    next = buf->start + (buf->subbufs_produced % chan->n_subbufs) * chan->subbuf_size;
+    buf->offset = 0;
+    if (!chan->cb->subbuf_start(buf, next, prev, padding)) {
+        buf->offset = chan->subbuf_size + 1;
+        return 0;
+    }
+    buf->data = next;
+    if (unlikely(buf->offset + length > chan->subbuf_size)) {
+        buf->offset = chan->subbuf_size + 1;
+        return 0;
+    }
+    return length;
+}
+
+struct rchan *relay_open(const char *base_filename, struct dentry *parent,
+                         size_t subbuf_size, size_t n_subbufs,
+                         const struct rchan_callbacks *cb, void *private_data)
+{
+    struct rchan *chan = kzalloc(sizeof(*chan), GFP_KERNEL);
+    unsigned int cpu;
+
+    if (!chan)
+        return NULL;
+    chan->subbuf_size = subbuf_size;
+    chan->n_subbufs = n_subbufs;
+    chan->cb = cb;
+    for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+        struct rchan_buf *buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+
+        if (!buf || !(buf->start = kmalloc(subbuf_size * n_subbufs, GFP_KERNEL))) {
+            kfree(buf);
+            relay_close(chan);
+            return NULL;
+        }
+        buf->chan = chan;
+        buf->cpu = cpu;
+        buf->data = buf->start;
+        chan->buf[cpu] = buf;
+        if (shim_relay_dir) {
+            char path[PATH_MAX];
+
+            snprintf(path, sizeof(path), "%s/%s%u", shim_relay_dir, base_filename, cpu);
+            buf->dump = fopen(path, "w");
+            if (!buf->dump)
+                pr_warn("shim: relay: %s: %s\n", path, strerror(errno));
+        }
+        /* As relay does for the first sub-buffer */
+        cb->subbuf_start(buf, buf->data, NULL, 0);
+    }
+    return chan;
+}
+
+void relay_flush(struct rchan *chan)
+{
+    unsigned int cpu;
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++)
+        if (chan->buf[cpu]) {
+            relay_switch_subbuf(chan->buf[cpu], 0);
+            if (chan->buf[cpu]->dump)
+                fflush(chan->buf[cpu]->dump);
+        }
+}
+
+void relay_close(struct rchan *chan)
+{
+    unsigned int cpu;
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (chan->buf[cpu]) {
+            if (chan->buf[cpu]->dump)
+                fclose(chan->buf[cpu]->dump);
+            kfree(chan->buf[cpu]->start);
+        }
+        kfree(chan->buf[cpu]);
+    }
+    kfree(chan);
+}
+
+/* kobjects and firmware */
+const struct sysfs_ops kobj_sysfs_ops;
+static struct kobject shim_kernel_kobj = { .name = "kernel" };
+struct kobject *kernel_kobj = &shim_kernel_kobj;
+
+struct kobject *kobject_create_and_add(const char *name, struct kobject *parent)
+{
+    struct kobject *kobj = kzalloc(sizeof(*kobj), GFP_KERNEL);
+
+    if (kobj)
+        kobj->name = name;
+    return kobj;
+}
+
+int kobject_init_and_add(struct kobject *kobj, const struct kobj_type *ktype,
+                         struct kobject *parent, const char *fmt, ...)
+{
+    return 0;
+}
+
+void kobject_put(struct kobject *kobj)
+{
+}
+
+int request_firmware(const struct firmware **fw, const char *name, struct device *dev)
+{
+    struct firmware *f;
+    struct stat st;
+    ssize_t n;
+    int fd;
+
+    fd = open(name, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+    f = kzalloc(sizeof(*f), GFP_KERNEL);
+    if (!f || fstat(fd, &st) || !(f->data = kmalloc(st.st_size, GFP_KERNEL)))
+        goto fail;
+    n = read(fd, (void *)f->data, st.st_size);
+    if (n != st.st_size)
+        goto fail;
+    f->size = n;
+    close(fd);
+    *fw = f;
+    return 0;
+fail:
+    close(fd);
+    if (f)
+        kfree(f->data);
+    kfree(f);
+    return -EIO;
+}
+
+void release_firmware(const struct firmware *fw)
+{
+    if (fw) {
+        kfree(fw->data);
+        kfree(fw);
+    }
+}
+
+/* rb_next(), as in lib/rbtree.c */
+struct rb_node *rb_next(const struct rb_node *node)
+{
+    struct rb_node *parent;
+
+    if (RB_EMPTY_NODE(node))
+        return NULL;
+
+    if (node->rb_right) {
+        node = node->rb_right;
+        while (node->rb_left)
+            node = node->rb_left;
+        return (struct rb_node *)node;
+    }
+    while ((parent = rb_parent(node)) && node == parent->rb_right)
+        node = parent;
+    return parent;
+}
+
+/* Scatterlist iteration: chunks never cross a page of the entry's buffer */
+void sg_miter_start(struct sg_mapping_iter *mi, struct scatterlist *sgl,
+                    unsigned int nents, unsigned int flags)
+{
+    memset(mi, 0, sizeof(*mi));
+    mi->__sg = sgl;
+    mi->__nents = nents;
+}
+
+bool sg_miter_next(struct sg_mapping_iter *mi)
+{
+    sg_miter_stop(mi);
+
+    while (mi->__nents && mi->__offset >= mi->__sg->length) {
+        mi->__sg++;
+        mi->__nents--;
+        mi->__offset = 0;
+    }
+    if (!mi->__nents)
+        return false;
+
+    mi->addr = (u8 *)mi->__sg->buf + mi->__offset;
+    mi->length = min_t(size_t, mi->__sg->length - mi->__offset,
+                       PAGE_SIZE - ((unsigned long)mi->addr & ~PAGE_MASK));
+    mi->consumed = mi->length;
+    return true;
+}
+
+void sg_miter_stop(struct sg_mapping_iter *mi)
+{
+    if (mi->addr) {
+        mi->__offset += mi->consumed;
+        mi->addr = NULL;
+        mi->length = 0;
+        mi->consumed = 0;
+    }
+}
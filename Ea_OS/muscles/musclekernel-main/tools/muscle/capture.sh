@@ -0,0 +1,62 @@
+#!/bin/sh
+# Capture the muscle hooks' inputs for muscle-replay.
+#
+#   tools/muscle/capture.sh [-m mask] [-d seconds] OUTDIR
+#
+# Sets trace_mask (1 cache, 2 io, 4 security, 8 sched; default all) for
+# the given time, or until interrupted, and drains the per-CPU relay
+# files under debugfs into OUTDIR/cpuN (overwritten) once a second so
+# the buffers do not fill.  Records lost anyway are counted in trace_dropped and in the
+# capture's own headers.  Then, for example:
+#
+#   make -C tools/muscle/bench muscle-replay
+#   tools/muscle/bench/muscle-replay --blob cache=cache-7.bin OUTDIR/cpu*
+#
+# Run as root with debugfs mounted.
+
+set -eu
+
+MASK=15
+SECS=10
+TRACE=/sys/kernel/debug/muscle/trace
+
+while getopts m:d: opt; do
+	case $opt in
+	m) MASK=$OPTARG ;;
+	d) SECS=$OPTARG ;;
+	*) echo "usage: $0 [-m mask] [-d seconds] OUTDIR" >&2; exit 2 ;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -eq 1 ] || { echo "usage: $0 [-m mask] [-d seconds] OUTDIR" >&2; exit 2; }
+OUT=$1
+
+PARAMS=$(dirname "$(ls /sys/module/*/parameters/trace_mask 2>/dev/null | head -n 1)")
+[ -f "$PARAMS/trace_mask" ] || { echo "$0: no trace_mask parameter (CONFIG_RELAY?)" >&2; exit 1; }
+
+mkdir -p "$OUT"
+drain() {
+	for f in "$TRACE"/cpu*; do
+		[ -e "$f" ] && cat "$f" >> "$OUT/$(basename "$f")"
+	done
+	return 0
+}
+
+stop() {
+	echo 0 > "$PARAMS/trace_mask"
+	drain
+	echo "dropped $(cat "$PARAMS/trace_dropped") records" >&2
+}
+trap 'stop; exit 130' INT TERM
+
+echo "$MASK" > "$PARAMS/trace_mask"
+# The channel, and with it $TRACE, exists from the first non-zero mask on
+for f in "$TRACE"/cpu*; do
+	: > "$OUT/$(basename "$f")"
+done
+for _ in $(seq "$SECS"); do
+	sleep 1
+	drain
+done
+trap - INT TERM
+stop
@@ -0,0 +1,32 @@
+#!/usr/bin/env python3
+"""Generate the Q12 sigmoid/tanh lookup tables in lib/muscle/tables/.
+
+Tables sample [0, 8] in steps of 1/32 (MUSCLE_LUT_SHIFT = 7 in Q12); the
+kernel mirrors negative inputs and interpolates linearly between entries.
+"""
+
+import math
+import os
+
+FIXED_ONE = 1 << 12
+LUT_SHIFT = 7
+LUT_SIZE = (8 * FIXED_ONE >> LUT_SHIFT) + 1
+
+OUT = os.path.join(os.path.dirname(__file__), "..", "..", "lib", "muscle", "tables")
+
+
+def emit(name, fn):
+    vals = [int(round(fn((i << LUT_SHIFT) / FIXED_ONE) * FIXED_ONE)) for i in range(LUT_SIZE)]
+    with open(os.path.join(OUT, name), "w") as f:
+        for i in range(0, len(vals), 10):
+            f.write(",".join("0x%04x" % v for v in vals[i:i + 10]) + ",\n")
+
+
+def main():
+    os.makedirs(OUT, exist_ok=True)
+    emit("sigmoid_lut.hex", lambda x: 1.0 / (1.0 + math.exp(-x)))
+    emit("tanh_lut.hex", math.tanh)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""Pack muscle .hex weight tables into a versioned blob for hot-swapping.
+
+The layout is the one lib/muscle/muscle_weights.c validates (struct
+muscle_blob_hdr in include/linux/muscle.h): a header, a table directory,
+then little-endian Q12 tables.  Unlike quantize.py, table sizes must match
+exactly; the kernel would reject anything else.
+
+  tools/muscle/mkblob.py cache --dir trained/ --gen 7 -o cache-7.bin
+  tools/muscle/mkblob.py --check cache-7.bin
+
+Install the blob under /lib/firmware/muscle/ and load it with
+  echo muscle/cache-7.bin > /sys/kernel/muscle/cache/load
+or roll back with
+  echo builtin > /sys/kernel/muscle/cache/load
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+import zlib
+
+MAGIC = 0x5753554D
+VERSION = 1
+NAME_LEN = 16
+HDR = struct.Struct("<IHHII%ds" % NAME_LEN)
+ENT = struct.Struct("<%dsII" % NAME_LEN)
+
+ROOT = os.path.normpath(os.path.join(os.path.dirname(__file__), "..", ".."))
+
+STREAM_FEATURES = 8
+STREAM_VOCAB = 16
+
+# muscle: (hex file prefix, default dir, [(table, count)]), in the order
+# the muscle registers them
+MUSCLES = {
+    "cache": ("cache", "mm/weights",
+              [(g, 64 * STREAM_FEATURES) for g in ("wi", "wf", "wg", "wo")] +
+              [(g, 64 * 64) for g in ("ri", "rf", "rg", "ro")] +
+              [(g, 64) for g in ("bi", "bf", "bg", "bo")] +
+              [("outw", STREAM_VOCAB * 64), ("outb", STREAM_VOCAB)]),
+    "io": ("io", "block/weights",
+           [(g, 48 * (10 + STREAM_FEATURES)) for g in ("wi", "wf", "wg", "wo")] +
+           [(g, 48) for g in ("bi", "bf", "bg", "bo")] +
+           [("outw", 10 * 48), ("outb", 10)]),
+    "security": ("sec", "kernel/weights",
+                 [("enc_w", 16 * 7), ("enc_b", 16), ("dec_w", 7 * 16), ("dec_b", 7)]),
+    "sched": ("sched", "kernel/weights",
+              [("w1", 32 * 10), ("b1", 32), ("w2", 5 * 32), ("b2", 5)]),
+    # No sine_*.hex ships; pass the trained tables with --dir
+    "sine": ("sine", "kernel/weights",
+             [("l1_w", 40), ("l1_b", 40), ("l2_w", 40 * 40), ("l2_b", 40),
+              ("out_w", 40), ("out_b", 1)]),
+    "zmuscle": ("zmuscle", "lib/muscle/weights", [("w", 3 * 5), ("b", 3)]),
+}
+
+
+def read_hex(path, count):
+    text = open(path).read()
+    junk = re.sub(r"0x[0-9a-fA-F]+|[\s,]", "", text)
+    if junk:
+        raise ValueError("%s: non-numeric text" % path)
+    vals = [int(t, 16) & 0xFFFFFFFF for t in re.findall(r"0x[0-9a-fA-F]+", text)]
+    if len(vals) != count:
+        raise ValueError("%s: %d entries, expected %d" % (path, len(vals), count))
+    return vals
+
+
+def pack(muscle, wdir, gen):
+    prefix, _, tables = MUSCLES[muscle]
+    off = HDR.size + ENT.size * len(tables)
+    entries, payload = b"", b""
+    for name, count in tables:
+        vals = read_hex(os.path.join(wdir, "%s_%s.hex" % (prefix, name)), count)
+        entries += ENT.pack(name.encode(), count, off + len(payload))
+        payload += struct.pack("<%dI" % count, *vals)
+    body = entries + payload
+    crc = zlib.crc32(body) & 0xFFFFFFFF
+    return HDR.pack(MAGIC, VERSION, len(tables), gen, crc, muscle.encode()) + body
+
+
+def check(blob):
+    magic, ver, nr, gen, crc, muscle = HDR.unpack_from(blob)
+    muscle = muscle.rstrip(b"\0").decode()
+    if magic != MAGIC or ver != VERSION:
+        raise ValueError("bad magic or version")
+    if zlib.crc32(blob[HDR.size:]) & 0xFFFFFFFF != crc:
+        raise ValueError("crc mismatch")
+    if muscle not in MUSCLES:
+        raise ValueError("unknown muscle %r" % muscle)
+    want = dict(MUSCLES[muscle][2])
+    print("%s generation %d, %d tables" % (muscle, gen, nr))
+    for i in range(nr):
+        name, count, off = ENT.unpack_from(blob, HDR.size + i * ENT.size)
+        name = name.rstrip(b"\0").decode()
+        ok = want.get(name) == count and off % 4 == 0 and off + 4 * count <= len(blob)
+        print("  %-6s %6d @ 0x%06x %s" % (name, count, off, "ok" if ok else "BAD"))
+        if not ok:
+            raise ValueError("table %s does not match the kernel layout" % name)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("muscle", nargs="?", choices=sorted(MUSCLES))
+    ap.add_argument("--dir", help="directory with the .hex tables (default: in-tree)")
+    ap.add_argument("--gen", type=int, default=1, help="generation to stamp (>= 1)")
+    ap.add_argument("-o", "--output", help="blob to write")
+    ap.add_argument("--check", metavar="BLOB", help="validate and list an existing blob")
+    args = ap.parse_args()
+
+    try:
+        if args.check:
+            check(open(args.check, "rb").read())
+            return 0
+        if not args.muscle or not args.output:
+            ap.error("muscle and -o are required")
+        if args.gen < 1:
+            ap.error("generation 0 is reserved for the built-in set")
+        wdir = args.dir or os.path.join(ROOT, MUSCLES[args.muscle][1])
+        blob = pack(args.muscle, wdir, args.gen)
+        with open(args.output, "wb") as f:
+            f.write(blob)
+        check(blob)
+    except (OSError, ValueError) as e:
+        print("mkblob: %s" % e, file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,213 @@
+#!/usr/bin/env python3
+"""Quantize muscle .hex weight tables and report the accuracy cost.
+
+Mirrors lib/muscle/muscle_quant.c bit for bit: symmetric per-row int8 or
+int16 quantization with a Q16 scale, s16-saturated Q12 activations and
+integer accumulation.  For every muscle whose tables are present, random
+Q12 inputs are pushed through the exact s32 fixed-point layers and through
+the quantized ones, and the difference is reported.
+
+  tools/muscle/quantize.py                     # report for the whole tree
+  tools/muscle/quantize.py --emit out/         # also write *.q8.hex etc.
+  tools/muscle/quantize.py --max-err 0.05      # fail on regression
+"""
+
+import argparse
+import os
+import random
+import re
+import sys
+
+FIXED_SHIFT = 12
+FIXED_ONE = 1 << FIXED_SHIFT
+QSCALE_SHIFT = 16
+S16_MIN, S16_MAX = -(1 << 15), (1 << 15) - 1
+
+ROOT = os.path.normpath(os.path.join(os.path.dirname(__file__), "..", ".."))
+
+
+def s32(v):
+    v &= 0xFFFFFFFF
+    return v - (1 << 32) if v & 0x80000000 else v
+
+
+def tdiv(a, b):
+    """C integer division (truncates toward zero)."""
+    q = abs(a) // abs(b)
+    return q if (a >= 0) == (b >= 0) else -q
+
+
+def load_hex(path, count):
+    """Parse a .hex initializer the way the C compiler sees it."""
+    if not os.path.exists(path):
+        return None, "missing"
+    text = open(path).read()
+    vals = [s32(int(t, 16)) for t in re.findall(r"0x[0-9a-fA-F]+", text)]
+    junk = re.sub(r"0x[0-9a-fA-F]+|[\s,]", "", text)
+    note = []
+    if junk:
+        note.append("non-numeric text")
+    if len(vals) < count:
+        note.append("short by %d (zero-filled)" % (count - len(vals)))
+        vals += [0] * (count - len(vals))
+    elif len(vals) > count:
+        note.append("%d excess values dropped" % (len(vals) - count))
+        vals = vals[:count]
+    return vals, ", ".join(note) or "ok"
+
+
+def quantize_row(row, bits):
+    qmax = 127 if bits == 8 else S16_MAX
+    maxabs = max((abs(v) for v in row), default=0)
+    scale = tdiv((maxabs << QSCALE_SHIFT) + qmax - 1, qmax) or 1
+    if scale > 0x7FFFFFFF:
+        raise ValueError("row magnitude out of range")
+    q = []
+    for v in row:
+        v <<= QSCALE_SHIFT
+        r = tdiv(v + (-(scale // 2) if v < 0 else scale // 2), scale)
+        q.append(max(-qmax, min(qmax, r)))
+    return q, scale
+
+
+def act16(x):
+    return max(S16_MIN, min(S16_MAX, x))
+
+
+def gemv_ref(w, b, x, rows, cols):
+    return [(b[r] if b else 0) + (sum(w[r * cols + c] * x[c] for c in range(cols)) >> FIXED_SHIFT)
+            for r in range(rows)]
+
+
+def gemv_q(qm, b, x):
+    rows, cols, q, scales = qm
+    x16 = [act16(v) for v in x]
+    out = []
+    for r in range(rows):
+        acc = sum(q[r * cols + c] * x16[c] for c in range(cols))
+        out.append((b[r] if b else 0) + ((acc * scales[r]) >> (QSCALE_SHIFT + FIXED_SHIFT)))
+    return out
+
+
+def qmat(w, rows, cols, bits):
+    q, scales = [], []
+    for r in range(rows):
+        qr, sc = quantize_row(w[r * cols:(r + 1) * cols], bits)
+        q += qr
+        scales.append(sc)
+    return rows, cols, q, scales
+
+
+# (muscle, weight dir, [(layer, weight table, bias table, rows, cols, bits)])
+LAYERS = [
+    ("sched", "kernel/weights", [
+        ("l1", "sched_w1", "sched_b1", 32, 10, 16),
+        ("l2", "sched_w2", "sched_b2", 5, 32, 16),
+    ]),
+    ("security", "kernel/weights", [
+        ("enc", "sec_enc_w", "sec_enc_b", 16, 7, 16),
+        ("dec", "sec_dec_w", "sec_dec_b", 7, 16, 16),
+    ]),
+    ("cache", "mm/weights", [
+        ("out", "cache_outw", "cache_outb", 16, 64, 8),
+    ]),
+    ("io", "block/weights", [
+        ("out", "io_outw", "io_outb", 10, 48, 8),
+    ]),
+]
+
+# LSTM gate rows quantize [W | R] together, int8 (muscle_lstm_pack())
+LSTMS = [
+    ("cache-lstm", "mm/weights", "cache", 8, 64, True),
+    ("io-lstm", "block/weights", "io", 18, 48, False),
+]
+
+
+def report_layer(name, w, b, rows, cols, bits, samples, rng, emit):
+    qm = qmat(w, rows, cols, bits)
+    max_err = sum_err = 0
+    agree = 0
+    for _ in range(samples):
+        x = [rng.randint(-FIXED_ONE, FIXED_ONE) for _ in range(cols)]
+        ref = gemv_ref(w, b, x, rows, cols)
+        got = gemv_q(qm, b, x)
+        errs = [abs(r - g) for r, g in zip(ref, got)]
+        max_err = max(max_err, max(errs))
+        sum_err += sum(errs) / len(errs)
+        agree += ref.index(max(ref)) == got.index(max(got))
+    if emit:
+        write_hex(os.path.join(emit, "%s.q%d.hex" % (name, bits)), qm[2])
+        write_hex(os.path.join(emit, "%s.scale.hex" % name), qm[3])
+    return {
+        "bytes": (rows * cols * 4, rows * cols * bits // 8 + rows * 4),
+        "max": max_err / FIXED_ONE,
+        "mean": sum_err / samples / FIXED_ONE,
+        "argmax": 100.0 * agree / samples,
+    }
+
+
+def write_hex(path, vals):
+    with open(path, "w") as f:
+        for i in range(0, len(vals), 10):
+            f.write(",".join("0x%x" % (v & 0xFFFFFFFF) for v in vals[i:i + 10]) + ",\n")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("--root", default=ROOT, help="musclekernel tree")
+    ap.add_argument("--samples", type=int, default=200)
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--emit", metavar="DIR", help="write quantized tables")
+    ap.add_argument("--max-err", type=float, help="fail if any mean error exceeds this (float units)")
+    args = ap.parse_args()
+
+    rng = random.Random(args.seed)
+    if args.emit:
+        os.makedirs(args.emit, exist_ok=True)
+
+    rows = []
+    for muscle, wdir, layers in LAYERS:
+        for layer, wt, bt, r, c, bits in layers:
+            w, wnote = load_hex(os.path.join(args.root, wdir, wt + ".hex"), r * c)
+            b, bnote = load_hex(os.path.join(args.root, wdir, bt + ".hex"), r)
+            if w is None or b is None:
+                missing = [t for t, v in ((wt, w), (bt, b)) if v is None]
+                rows.append((muscle, layer, bits, None, "skipped: %s missing" % "/".join(missing)))
+                continue
+            res = report_layer(wt, w, b, r, c, bits, args.samples, rng, args.emit)
+            rows.append((muscle, layer, bits, res, "%s: %s" % (wt, wnote)))
+
+    for muscle, wdir, prefix, inp, hid, recurrent in LSTMS:
+        for gate in "ifgo":
+            w, wnote = load_hex(os.path.join(args.root, wdir, "%s_w%s.hex" % (prefix, gate)), hid * inp)
+            rr, rnote = (load_hex(os.path.join(args.root, wdir, "%s_r%s.hex" % (prefix, gate)), hid * hid)
+                         if recurrent else ([0] * hid * hid, "ok"))
+            if w is None or rr is None:
+                missing = [t for t, v in (("w", w), ("r", rr)) if v is None]
+                rows.append((muscle, "gate " + gate, 8, None, "skipped: %s_%s%s missing" %
+                             (prefix, "/".join(missing), gate)))
+                continue
+            n = inp + (hid if recurrent else 0)
+            cat = []
+            for u in range(hid):
+                cat += w[u * inp:(u + 1) * inp] + (rr[u * hid:(u + 1) * hid] if recurrent else [])
+            res = report_layer("%s_%s" % (prefix, gate), cat, None, hid, n, 8, args.samples, rng, args.emit)
+            rows.append((muscle, "gate " + gate, 8, res, "w: %s, r: %s" % (wnote, rnote)))
+
+    print("%-11s %-7s %4s %9s %9s %10s %10s %7s  %s" %
+          ("muscle", "layer", "bits", "s32 B", "quant B", "mean err", "max err", "argmax", "source"))
+    failed = False
+    for muscle, layer, bits, res, note in rows:
+        if res is None:
+            print("%-11s %-7s %4d %50s  %s" % (muscle, layer, bits, "-", note))
+            continue
+        print("%-11s %-7s %4d %9d %9d %10.5f %10.5f %6.1f%%  %s" %
+              (muscle, layer, bits, res["bytes"][0], res["bytes"][1],
+               res["mean"], res["max"], res["argmax"], note))
+        if args.max_err is not None and res["mean"] > args.max_err:
+            failed = True
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
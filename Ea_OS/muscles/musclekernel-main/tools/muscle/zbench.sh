@@ -0,0 +1,79 @@
+#!/bin/sh
+# Compare zmuscle against other zram compressors on real memory dumps.
+#
+#   tools/muscle/zbench.sh [-a "zmuscle lz4 zstd"] [-r 3] DUMP...
+#
+# Each DUMP (a core file, a /proc/<pid>/mem extract, a swap image...) is
+# written to a fresh /dev/zram0 once per algorithm and read back with
+# O_DIRECT, so every page goes through the compressor and decompressor
+# exactly once per run.  Ratio comes from mm_stat (orig / compr data
+# size); throughput is wall clock over the dump size and includes the
+# block layer, so compare the algorithms with each other, not with
+# in-memory benchmarks.  Run as root with zram loaded and zram0 free.
+
+set -eu
+
+ALGS="zmuscle lz4 zstd"
+RUNS=3
+DEV=zram0
+SYS=/sys/block/$DEV
+
+while getopts a:r: opt; do
+	case $opt in
+	a) ALGS=$OPTARG ;;
+	r) RUNS=$OPTARG ;;
+	*) echo "usage: $0 [-a algs] [-r runs] DUMP..." >&2; exit 2 ;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -gt 0 ] || { echo "usage: $0 [-a algs] [-r runs] DUMP..." >&2; exit 2; }
+[ -d $SYS ] || modprobe zram num_devices=1
+
+now() { date +%s%N; }
+
+# Bytes and nanoseconds to GB/s with two decimals
+gbps() { echo "$1 $2" | awk '{ printf "%.2f", $2 ? $1 / $2 : 0 }'; }
+
+zram_setup() {
+	echo 1 > $SYS/reset
+	echo "$1" > $SYS/comp_algorithm
+	echo "$2" > $SYS/disksize
+}
+
+printf "%-24s %-8s %7s %10s %10s\n" dump alg ratio "comp GB/s" "dec GB/s"
+for dump in "$@"; do
+	size=$(stat -c %s "$dump")
+	# Whole pages only: zram is a block device
+	pages=$((size / 4096))
+	bytes=$((pages * 4096))
+	[ $pages -gt 0 ] || { echo "$dump: smaller than a page, skipped" >&2; continue; }
+
+	for alg in $ALGS; do
+		if ! grep -qw "$alg" $SYS/comp_algorithm 2>/dev/null &&
+		   ! grep -q "^name *: $alg\$" /proc/crypto; then
+			printf "%-24s %-8s %s\n" "$(basename "$dump")" "$alg" unavailable
+			continue
+		fi
+		ct=0 dt=0 ratio=0
+		for _ in $(seq "$RUNS"); do
+			zram_setup "$alg" $bytes
+			# Page-cache the dump first so the read side is not measured
+			cat "$dump" > /dev/null
+
+			t0=$(now)
+			dd if="$dump" of=/dev/$DEV bs=1M count=$bytes iflag=count_bytes \
+			   oflag=direct status=none
+			t1=$(now)
+			dd if=/dev/$DEV of=/dev/null bs=1M iflag=direct status=none
+			t2=$(now)
+
+			ct=$((ct + t1 - t0))
+			dt=$((dt + t2 - t1))
+			# mm_stat: orig_data_size compr_data_size ...
+			ratio=$(awk '{ printf "%.3f", $2 ? $1 / $2 : 0 }' $SYS/mm_stat)
+		done
+		printf "%-24s %-8s %7s %10s %10s\n" "$(basename "$dump")" "$alg" "$ratio" \
+		       "$(gbps $((bytes * RUNS)) $ct)" "$(gbps $((bytes * RUNS)) $dt)"
+	done
+done
+echo 1 > $SYS/reset